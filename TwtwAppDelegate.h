@@ -44,6 +44,10 @@
 
 - (IBAction)undo:(id)sender;
 
+- (IBAction)importSound:(id)sender;
+
+- (IBAction)toggleSilenceCompression:(id)sender;
+
 - (IBAction)zoomNormalSizeAction:(id)sender;
 - (IBAction)zoom2xAction:(id)sender;
 - (IBAction)zoom1_5xAction:(id)sender;
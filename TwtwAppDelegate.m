@@ -32,6 +32,7 @@
 #import "twtw-document.h"
 #import "twtw-editing.h"
 #import "twtw-cloud.h"
+#import "twtw-audioconv.h"
 
 #include <oggz/oggz.h>
 #include "skeleton.h"
@@ -43,6 +44,10 @@ static void twtwDocChanged(gint notifID, void *userData)
 }
 
 
+// user defaults key for the "Compress Silence in Recordings" menu item
+static NSString * const kTwtwCompressSilenceDefaultsKey = @"TwtwCompressSilence";
+
+
 
 @implementation TwtwAppDelegate
 
@@ -173,6 +178,8 @@ static void twtwDocChanged(gint notifID, void *userData)
     
     twtw_add_active_document_notif_callback (twtwDocChanged, self);
     
+    twtw_speex_set_silence_compression ([[NSUserDefaults standardUserDefaults] boolForKey:kTwtwCompressSilenceDefaultsKey]);
+    
     // create the initial document
     twtw_active_document ();
     
@@ -319,6 +326,28 @@ static void twtwDocChanged(gint notifID, void *userData)
     }
 }
 
+- (IBAction)importSound:(id)sender
+{
+    [_canvasView importSoundAction:sender];
+}
+
+- (IBAction)toggleSilenceCompression:(id)sender
+{
+    // applies to the next recording (and to sounds encoded when the document is saved)
+    BOOL enabled = !twtw_speex_silence_compression ();
+    
+    twtw_speex_set_silence_compression (enabled);
+    [[NSUserDefaults standardUserDefaults] setBool:enabled forKey:kTwtwCompressSilenceDefaultsKey];
+}
+
+- (BOOL)validateMenuItem:(NSMenuItem *)item
+{
+    if ([item action] == @selector(toggleSilenceCompression:)) {
+        [item setState:(twtw_speex_silence_compression ()) ? NSOnState : NSOffState];
+    }
+    return YES;
+}
+
 - (IBAction)zoomNormalSizeAction:(id)sender
 {
     NSSize canvasSize = NSMakeSize(TWTW_CANONICAL_CANVAS_WIDTH, round(TWTW_CANONICAL_CANVAS_WIDTH * 9.0 / 16.0));
@@ -42,6 +42,9 @@ typedef struct twtwCanvasElementInfo_Cocoa {
     
     NSRect envelopeRect;
     
+    NSRect timeMarkersRect;
+    double timeMarkerH;  // height of one marker, i.e. one second of sound
+    
     NSRect closeRect;
 } TwtwCanvasElementInfo;
 
@@ -61,6 +64,7 @@ typedef struct twtwCanvasElementInfo_Cocoa {
     
     double _currentAudioTime;
     int _audioState;
+    struct _TwtwSpeexEncoder *_speexEncoder;  // encodes the sound while it's being recorded
     
     TwtwCanvasElementInfo _elemInfo;
     
@@ -74,6 +78,12 @@ typedef struct twtwCanvasElementInfo_Cocoa {
 
 - (BOOL)audioIsBusy;
 
+// asks for a WAV file and makes it the current page's sound (converted to the app's sound format)
+- (void)importSoundAction:(id)sender;
+
+// jumps to the given position in the page's sound; starts playback if nothing is playing
+- (void)seekAudioToTime:(double)timeInSecs;
+
 - (CGImageRef)copyActivePageAsCGImage;
 
 @end
@@ -29,14 +29,13 @@
 #import "twtw-graphicscache.h"
 #import "twtw-graphicscache-priv.h"
 #import "twtw-audio.h"
+#import "twtw-audioconv.h"
 #import "twtw-filesystem.h"
 
 
-// private function for notifying page about new audio recording
-extern void twtw_page_ui_did_record_pcm_with_file_size (TwtwPage *page, gint fileSize);
-
 // implemented in twtw-document.c
 void twtw_set_default_color_index (gint index);
+void twtw_notify_about_doc_change (const gint notifID);
 
 
 
@@ -157,14 +156,26 @@ static void twtwDocChanged(gint notifID, void *userData)
     
     if (status == TWTW_AUDIOSTATUS_REC) {
         TwtwPage *page = twtw_active_document_page ();
-        const char *audioPath = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
+        short *pcm = NULL;
+        size_t pcmSize = 0;
+        TwtwSpeexPacketStore *speexPackets = NULL;
         
-        gboolean isFile = FALSE;
-        size_t audioFileSize = twtw_filesys_get_file_size_utf8 (audioPath, strlen(audioPath), &isFile);
-    
-        twtw_page_ui_did_record_pcm_with_file_size (page, audioFileSize);
-
-        NSLog(@"did record new audio; data size is %i bytes", (int)audioFileSize);
+        // the encoder has been keeping up with the recording, so there's not much left to do here
+        twtw_audio_pcm_set_record_data_func (NULL, NULL);
+        if (_speexEncoder) {
+            twtw_speex_encoder_finish (_speexEncoder, &speexPackets);
+            _speexEncoder = NULL;
+        }
+        
+        if (0 == twtw_audio_pcm_take_recorded_buffer (&pcm, &pcmSize)) {
+            size_t speexDataSize = (speexPackets) ? twtw_speex_packet_store_get_data_size (speexPackets) : 0;
+            twtw_page_set_pcm_sound_copy_with_speex_packets (page, pcm, pcmSize, speexPackets);
+            g_free(pcm);
+            
+            NSLog(@"did record new audio; data size is %i bytes (%i bytes encoded)", (int)pcmSize, (int)speexDataSize);
+        } else {
+            twtw_speex_packet_store_destroy (speexPackets);
+        }
     }
     
     _currentAudioTime = 0;
@@ -198,52 +209,114 @@ static void twtwDocChanged(gint notifID, void *userData)
 
     TwtwPage *page = twtw_active_document_page ();
     gint pageIndex = twtw_active_document_page_index ();
-    const char *path = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
-    NSAssert(path && strlen(path) > 0, @"path is null");
 
     // make a copy of previous audio and push it on the undo stack
-    char *copiedAudioPath = NULL;
-    twtw_filesys_make_uniquely_named_copy_of_file_at_path (path, strlen(path), &copiedAudioPath, NULL);
-    TwtwAction undoAction = { TWTW_ACTION_SET_PCM_SOUND, pageIndex, NULL,  copiedAudioPath, NULL };
+    TwtwPCMSound *prevSound = twtw_page_copy_pcm_sound (page);
+    TwtwAction undoAction = { TWTW_ACTION_SET_PCM_SOUND, pageIndex, NULL,  prevSound, (TwtwActionDestructorFuncPtr)twtw_destroy_pcm_sound };
     twtw_undo_push_action (&undoAction);
     
     
-    NSLog(@"starting audio recording, temp path is:\n    %s", path);
+    NSLog(@"starting audio recording into memory");
     
     TwtwAudioCallbacks callbacks;
     callbacks.audioCompletedFunc = myAudioCompletedCallback;
     callbacks.audioInProgressFunc = myAudioInProgressCallback;
         
     int secsToRecord = 20;
+    
+    _speexEncoder = twtw_speex_encoder_create ();
+    if (_speexEncoder)
+        twtw_audio_pcm_set_record_data_func ((TwtwAudioPCMDataFunc)twtw_speex_encoder_write, _speexEncoder);
         
-    if (0 == twtw_audio_pcm_record_to_path_utf8 (path, strlen(path), secsToRecord, callbacks, self))
+    if (0 == twtw_audio_pcm_record_to_buffer (secsToRecord, callbacks, self)) {
         _audioState = TWTW_AUDIOSTATUS_REC;
+    } else {
+        twtw_audio_pcm_set_record_data_func (NULL, NULL);
+        if (_speexEncoder) {
+            twtw_speex_encoder_finish (_speexEncoder, NULL);
+            _speexEncoder = NULL;
+        }
+    }
 }
 
-- (void)playAction:(id)sender
+- (void)_startPlaybackAtTime:(double)startTime
 {
-    if (_audioState == TWTW_AUDIOSTATUS_PLAY) {
-        twtw_audio_pcm_stop ();
-        _audioState = 0;
-        return;
-    } else if (_audioState != 0) {
+    TwtwPage *page = twtw_active_document_page ();
+    short *pcm = NULL;
+    size_t pcmSize = 0;
+
+    TwtwAudioCallbacks callbacks;
+    callbacks.audioCompletedFunc = myAudioCompletedCallback;
+    callbacks.audioInProgressFunc = myAudioInProgressCallback;
+    
+    // a sound loaded from a file is decoded while it plays; the decoder seeks by starting at the nearest packet
+    TwtwSpeexDecoder *decoder = twtw_page_create_speex_decoder (page);
+    if (decoder) {
+        double duration = (double)twtw_speex_decoder_get_length (decoder) / TWTW_PCM_SAMPLERATE;
+        
+        if (0 == twtw_audio_pcm_play_from_seekable_source ((TwtwAudioPCMReadFunc)twtw_speex_decoder_read,
+                                                           (TwtwAudioPCMSeekFunc)twtw_speex_decoder_seek,
+                                                           (TwtwAudioPCMSourceDestroyFunc)twtw_speex_decoder_destroy,
+                                                           decoder, duration, startTime, callbacks, self)) {
+            _audioState = TWTW_AUDIOSTATUS_PLAY;
+            _currentAudioTime = startTime;
+            return;
+        }
+    }
+    
+    if (0 == twtw_page_get_pcm_sound_buffer (page, &pcm, &pcmSize) && pcm) {
+        if (0 == twtw_audio_pcm_play_buffer (pcm, pcmSize, callbacks, self)) {
+            _audioState = TWTW_AUDIOSTATUS_PLAY;
+            if (startTime > 0.0 && 0 == twtw_audio_pcm_seek (startTime))
+                _currentAudioTime = startTime;
+        }
         return;
     }
 
-    TwtwPage *page = twtw_active_document_page ();
+    // sound is too long to be kept in memory
+    if (twtw_page_get_sound_duration_in_seconds (page) < 1 || 0 != twtw_page_write_pcm_sound_to_temp_file (page))
+        return;
+    
     const char *path = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
 
     if ( !path || strlen(path) < 1)
         return;
-
-    TwtwAudioCallbacks callbacks;
-    callbacks.audioCompletedFunc = myAudioCompletedCallback;
-    callbacks.audioInProgressFunc = myAudioInProgressCallback;
     
     if (0 == twtw_audio_pcm_play_from_path_utf8 (path, strlen(path), callbacks, self)) {
         _audioState = TWTW_AUDIOSTATUS_PLAY;
+        if (startTime > 0.0 && 0 == twtw_audio_pcm_seek (startTime))
+            _currentAudioTime = startTime;
         
-        NSLog(@"now playing PCM sound, temp path is:\n    %s", __func__, path);
+        NSLog(@"now playing PCM sound, temp path is:\n    %s", path);
+    }
+}
+
+- (void)playAction:(id)sender
+{
+    if (_audioState == TWTW_AUDIOSTATUS_PLAY) {
+        twtw_audio_pcm_stop ();
+        _audioState = 0;
+        return;
+    } else if (_audioState != 0) {
+        return;
+    }
+    
+    [self _startPlaybackAtTime:0.0];
+}
+
+- (void)seekAudioToTime:(double)timeInSecs
+{
+    timeInSecs = MAX(0.0, timeInSecs);
+    
+    if (_audioState == TWTW_AUDIOSTATUS_PLAY) {
+        if (0 == twtw_audio_pcm_seek (timeInSecs)) {
+            _currentAudioTime = timeInSecs;
+            [self setNeedsDisplay:YES];
+        }
+    }
+    else if (_audioState == 0) {
+        if (timeInSecs < twtw_page_get_sound_duration_in_seconds (twtw_active_document_page ()))
+            [self _startPlaybackAtTime:timeInSecs];
     }
 }
 
@@ -253,6 +326,53 @@ static void twtwDocChanged(gint notifID, void *userData)
 }
 
 
+- (void)importSoundAction:(id)sender
+{
+    if (_audioState != 0) {
+        NSLog(@"can't import sound while audio is busy");
+        return;
+    }
+    
+    NSOpenPanel *oPanel = [NSOpenPanel openPanel];
+    [oPanel setAllowsMultipleSelection:NO];
+    
+    NSTextField *infoView = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 400, 36)];
+    [infoView setDrawsBackground:NO];
+    [infoView setBordered:NO];
+    [infoView setBezeled:NO];
+    [infoView setFont:[NSFont systemFontOfSize:11.0]];
+    [infoView setStringValue:@"Choose a WAV file to be used as the sound for this page.\n(The sound will be converted to 20:20's internal format.)"];
+    
+    [oPanel setAccessoryView:[infoView autorelease]];
+    
+    int result = [oPanel runModalForDirectory:nil file:nil types:[NSArray arrayWithObjects:@"wav", @"wave", nil]];
+    
+    if (result != NSOKButton || [[oPanel filenames] count] < 1)
+        return;
+    
+    NSString *file = [[oPanel filenames] objectAtIndex:0];
+    const char *utf8Path = [file UTF8String];
+    
+    TwtwPage *page = twtw_active_document_page ();
+    gint pageIndex = twtw_active_document_page_index ();
+    
+    // make a copy of previous audio and push it on the undo stack
+    TwtwPCMSound *prevSound = twtw_page_copy_pcm_sound (page);
+    TwtwAction undoAction = { TWTW_ACTION_SET_PCM_SOUND, pageIndex, NULL,  prevSound, (TwtwActionDestructorFuncPtr)twtw_destroy_pcm_sound };
+    twtw_undo_push_action (&undoAction);
+    
+    gint err = twtw_page_import_wav_sound_utf8 (page, utf8Path, strlen(utf8Path));
+    if (err != 0) {
+        NSLog(@"** sound import failed (error %i): %@", err, file);
+    }
+    
+    twtw_notify_about_doc_change (TWTW_NOTIF_DOCUMENT_PAGE_MODIFIED);
+    
+    [self setNeedsDisplay:YES];
+    [self _notifyOfUpdate];
+}
+
+
 #pragma mark --- image loading (camera) ---
 
 - (void)_loadImageAsBGPhotoForCurrentPageFromPath:(NSString *)path
@@ -316,7 +436,7 @@ static void twtwDocChanged(gint notifID, void *userData)
     TwtwPage *page = twtw_active_document_page ();
     gint pageIndex = twtw_active_document_page_index ();
     
-    TwtwYUVImage *prevValue = twtw_yuv_image_copy (twtw_page_get_yuv_photo (page));
+    TwtwYUVImage *prevValue = twtw_page_copy_yuv_photo (page);
     TwtwAction undoAction = { TWTW_ACTION_SET_BG_PHOTO, pageIndex, NULL,  prevValue, (TwtwActionDestructorFuncPtr)twtw_yuv_image_destroy };
     twtw_undo_push_action (&undoAction);
     
@@ -458,6 +578,16 @@ static int colorIDFromPointInPencilsBox(int x, int y)
         [self sendDocumentAction:self];
         return;
     }
+    else if (NSMouseInRect(pos, _elemInfo.timeMarkersRect, NO) && _elemInfo.timeMarkerH > 0.0) {
+        // scrub through the sound while the mouse is down; markers go from the bottom up, one per second
+        while (event && [event type] != NSLeftMouseUp) {
+            [self seekAudioToTime:(pos.y - _elemInfo.timeMarkersRect.origin.y) / _elemInfo.timeMarkerH];
+            
+            event = [[self window] nextEventMatchingMask:(NSLeftMouseDraggedMask | NSLeftMouseUpMask)];
+            pos = [self convertPoint:[event locationInWindow] fromView:nil];
+        }
+        return;
+    }
     
     // not on a button, so start drawing a curve.
     // view origin is bottom-left, so must flip Y for curves.
@@ -626,42 +756,31 @@ static void drawPageThumbnail(CGContextRef ctx, TwtwPageThumb *thumb, NSRect out
 }
 
 
-static CGContextRef createCGContextFromTwtwYUVImage(TwtwYUVImage *yuvImage, uint8_t **outBitmapData)
+static void drawBackgroundPhotoFromPage(CGContextRef ctx, TwtwPage *page, int w, int h)
 {
-    g_return_val_if_fail(yuvImage, NULL);
-    g_return_val_if_fail(yuvImage->buffer, NULL);
+    // the page keeps the converted photo cached, so this is cheap when flipping between pages.
+    // CG only supports 32-bit pixels, not 24, so the display photo is requested with alpha
+    size_t rowBytes = 0;
+    const unsigned char *pixels = twtw_page_get_display_photo (page, w, h, TRUE, &rowBytes);
 
-    const int w = yuvImage->w;
-    const int h = yuvImage->h;
-    const size_t rowBytes = w * 4;
-    uint8_t *bitmapData = malloc(rowBytes * h);
+    if ( !pixels) return;
 
-    twtw_yuv_image_convert_to_rgb_for_display (yuvImage, bitmapData, rowBytes, TRUE, 1, 1);
-    
+    ///printf("%s: should draw YUV photo: %p (page %p); size %i * %i\n", __func__, pixels, page, w, h);
+
+    // the image is only used within this function, so it can refer to the page's pixels without copying
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, pixels, rowBytes * h, NULL);
     CGColorSpaceRef cspace = CGColorSpaceCreateWithName(kCGColorSpaceGenericRGB);
-    CGContextRef context = CGBitmapContextCreate(bitmapData, w, h,
-                                                 8,  // bits per component
-                                                 rowBytes,
-                                                 cspace,
-                                                 kCGImageAlphaNoneSkipLast);  // CG only supports 32-bit pixels, not 24
+    CGImageRef cgImage = CGImageCreate(w, h,
+                                       8,  // bits per component
+                                       32,  // bits per pixel
+                                       rowBytes,
+                                       cspace,
+                                       kCGImageAlphaNoneSkipLast,
+                                       provider, NULL, false, kCGRenderingIntentDefault);
     CGColorSpaceRelease(cspace);
+    CGDataProviderRelease(provider);
     
-    *outBitmapData = bitmapData;
-    return context;
-}
-
-static void drawBackgroundPhotoFromPage(CGContextRef ctx, TwtwPage *page, int w, int h)
-{
-    TwtwYUVImage *image = twtw_page_get_yuv_photo (page);
-
-    if ( !image) return;
-    
-    uint8_t *bitmapData = NULL;
-    CGContextRef bgImageCtx = createCGContextFromTwtwYUVImage(image, &bitmapData);
-
-    ///printf("%s: should draw YUV photo: %p (page %p); size %i * %i -- image size %i * %i\n", __func__, image, page, w, h, image->w, image->h);
-
-    CGImageRef cgImage = CGBitmapContextCreateImage(bgImageCtx);
+    if ( !cgImage) return;
     
     CGContextSaveGState(ctx);
     CGContextTranslateCTM(ctx, 0, h - 1);
@@ -674,8 +793,6 @@ static void drawBackgroundPhotoFromPage(CGContextRef ctx, TwtwPage *page, int w,
     CGContextRestoreGState(ctx);
     
     CGImageRelease(cgImage);
-    CGContextRelease(bgImageCtx);
-    free(bitmapData);
 }
 
 static void drawActivePageInCache(double zoomFactor)
@@ -716,6 +833,21 @@ static void drawActivePageInCache(double zoomFactor)
     }
 }
 
+- (void)_regenDirtyThumbs
+{
+    // e.g. after a document was opened, all thumbs need to be rendered; do them in parallel
+    if (twtw_book_regen_dirty_thumbs (twtw_active_document(), 0, NULL, NULL) > 0)
+        [self setNeedsDisplay:YES];
+}
+
+// thumbnails are rendered when drawing pauses rather than inside drawRect:, so strokes don't wait for them.
+// each request pushes the regen back, so continuous drawing renders the thumbs only once
+- (void)_scheduleThumbRegen
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(_regenDirtyThumbs) object:nil];
+    [self performSelector:@selector(_regenDirtyThumbs) withObject:nil afterDelay:0.3];
+}
+
 - (CGImageRef)copyActivePageAsCGImage
 {
     TwtwCacheSurface *surf = twtw_shared_canvas_cache_surface();
@@ -849,6 +981,11 @@ static void drawActivePageInCache(double zoomFactor)
     
     // -- two stacks of papers --
     int currentPage = twtw_active_document_page_index();
+    
+    // thumbs that are out of date are drawn as they are and rendered later (see _scheduleThumbRegen)
+    gboolean thumbIsDirty = FALSE;
+    BOOL needsThumbRegen = NO;
+    
     imSize = [_im_leaf size];
     int i;
     double y = 1;
@@ -860,9 +997,10 @@ static void drawActivePageInCache(double zoomFactor)
                     ];
                     
         TwtwPage *page = twtw_book_get_page (twtw_active_document(), i);
-        TwtwPageThumb *thumb = twtw_page_get_thumb (page);
+        TwtwPageThumb *thumb = twtw_page_peek_thumb (page, &thumbIsDirty);
         drawPageThumbnail(cgCtx, thumb, NSMakeRect(x, y,
                                                    imSize.width - 24, imSize.height));
+        if (thumbIsDirty) needsThumbRegen = YES;
 
         y += 3;
     }
@@ -878,14 +1016,18 @@ static void drawActivePageInCache(double zoomFactor)
                     ];
                     
         TwtwPage *page = twtw_book_get_page (twtw_active_document(), 20 - (i - currentPage));
-        TwtwPageThumb *thumb = twtw_page_get_thumb (page);
+        TwtwPageThumb *thumb = twtw_page_peek_thumb (page, &thumbIsDirty);
         drawPageThumbnail(cgCtx, thumb, NSMakeRect(x, y,
                                                    imSize.width - 24, imSize.height));
+        if (thumbIsDirty) needsThumbRegen = YES;
 
         y += 3;
     }
     _elemInfo.rightPaperStackRect = NSMakeRect(x, 1, imSize.width, imSize.height + y - 2);
     
+    if (needsThumbRegen)
+        [self _scheduleThumbRegen];
+    
     x += imSize.width - 17;
     
     imSize = [_im_envelope size];
@@ -906,6 +1048,9 @@ static void drawActivePageInCache(double zoomFactor)
                                    bounds.size.height - 40 - 24);
                                    
     double d = (markerRect.size.height / 20.0);
+    
+    _elemInfo.timeMarkersRect = NSMakeRect(markerRect.origin.x, markerRect.origin.y, d, markerRect.size.height);
+    _elemInfo.timeMarkerH = d;
 
     int pos = (_audioState != 0) ? ceil(_currentAudioTime) : 0;
     int soundDuration = twtw_page_get_sound_duration_in_seconds (twtw_active_document_page());
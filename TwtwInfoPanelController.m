@@ -120,7 +120,7 @@ static void twtwDocChanged(gint notifID, void *userData)
     TwtwPage *page = twtw_active_document_page ();
     gint pageIndex = twtw_active_document_page_index ();
     
-    TwtwYUVImage *prevValue = twtw_yuv_image_copy (twtw_page_get_yuv_photo (page));
+    TwtwYUVImage *prevValue = twtw_page_copy_yuv_photo (page);
     
     TwtwAction undoAction = { TWTW_ACTION_SET_BG_PHOTO, pageIndex, NULL,  prevValue, (TwtwActionDestructorFuncPtr)twtw_yuv_image_destroy };
     twtw_undo_push_action (&undoAction);
@@ -135,11 +135,9 @@ static void twtwDocChanged(gint notifID, void *userData)
     TwtwPage *page = twtw_active_document_page ();
     gint pageIndex = twtw_active_document_page_index ();
     
-    const char *currAudioPath = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
-    char *copiedAudioPath = NULL;
-    twtw_filesys_make_uniquely_named_copy_of_file_at_path (currAudioPath, strlen(currAudioPath), &copiedAudioPath, NULL);
+    TwtwPCMSound *prevValue = twtw_page_copy_pcm_sound (page);
     
-    TwtwAction undoAction = { TWTW_ACTION_SET_PCM_SOUND, pageIndex, NULL,  copiedAudioPath, NULL };
+    TwtwAction undoAction = { TWTW_ACTION_SET_PCM_SOUND, pageIndex, NULL,  prevValue, (TwtwActionDestructorFuncPtr)twtw_destroy_pcm_sound };
     twtw_undo_push_action (&undoAction);
     
     twtw_page_clear_audio (page);
@@ -213,7 +211,7 @@ static void twtwDocChanged(gint notifID, void *userData)
     
     [_fileSizeField setStringValue:@"(Not yet computed)"];
     
-    [_clearPhotoButton setEnabled:(twtw_page_get_yuv_photo(page)) ? YES : NO];
+    [_clearPhotoButton setEnabled:(twtw_page_has_photo(page)) ? YES : NO];
     [_clearVectorsButton setEnabled:(twtw_page_get_curves_count(page) > 0) ? YES : NO];
     [_clearAudioButton setEnabled:(twtw_page_get_sound_duration_in_seconds(page) > 0) ? YES : NO];
     
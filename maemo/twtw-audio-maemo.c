@@ -374,6 +374,51 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
     return 0;
 }
 
+// the gstreamer pipelines here only work on files, so the UI records and plays through the page's temp file
+int twtw_audio_pcm_record_to_buffer (int seconds, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    return -1;
+}
+
+int twtw_audio_pcm_take_recorded_buffer (short **outPCMBuffer, size_t *outPCMBufferSize)
+{
+    return -1;
+}
+
+int twtw_audio_pcm_play_buffer (const short *pcmBuffer, size_t pcmBufferSize, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    return -1;
+}
+
+int twtw_audio_pcm_set_record_data_func (TwtwAudioPCMDataFunc func, void *userData)
+{
+    return -1;
+}
+
+// (appsrc isn't available in the device's gstreamer either)
+int twtw_audio_pcm_play_from_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                     double durationInSecs, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if (destroyFunc)
+        destroyFunc(source);
+    return -1;
+}
+
+int twtw_audio_pcm_play_from_seekable_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSeekFunc seekFunc,
+                                              TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                              double durationInSecs, double startTimeInSecs,
+                                              TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if (destroyFunc)
+        destroyFunc(source);
+    return -1;
+}
+
+int twtw_audio_pcm_seek (double timeInSecs)
+{
+    return -1;
+}
+
 void twtw_audio_pcm_stop ()
 {
     stopPipeline();
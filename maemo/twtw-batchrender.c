@@ -0,0 +1,128 @@
+/*
+ *  twtw-batchrender.c
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    command-line tool for rendering page previews from a list of books:
+
+        twtw-batchrender [-w width] [-j threads] [-f ppm|png] -o outdir book1.twtw book2.twtw ...
+*/
+
+#include "twtw-pagerender.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgnomevfs/gnome-vfs.h>
+
+
+static void printUsage(const char *argv0)
+{
+    printf("usage: %s [-w width] [-j threads] [-f ppm|png] -o outdir book ...\n", argv0);
+    printf("  -w   width of rendered images in pixels (default 640)\n");
+    printf("  -j   number of worker threads (default: number of CPUs)\n");
+    printf("  -f   output file format (default ppm)\n");
+}
+
+static void batchProgress(gint booksDone, gint booksTotal, const char *bookPath, gint result, gint pagesRendered, void *cbData)
+{
+    if (result == 0)
+        printf("[%i/%i] %s: %i pages\n", booksDone, booksTotal, bookPath, pagesRendered);
+    else
+        printf("[%i/%i] %s: failed (error %i)\n", booksDone, booksTotal, bookPath, result);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    gint width = 640;
+    gint threadCount = 0;
+    gint fileFormat = TWTW_IMAGEFILE_PPM;
+    const char *outDirPath = NULL;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-')
+            break;
+
+        if (0 == strcmp(arg, "-h")) {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+
+        if (0 == strcmp(arg, "-w"))
+            width = atoi(value);
+        else if (0 == strcmp(arg, "-j"))
+            threadCount = atoi(value);
+        else if (0 == strcmp(arg, "-o"))
+            outDirPath = value;
+        else if (0 == strcmp(arg, "-f")) {
+            if (0 == strcmp(value, "png"))
+                fileFormat = TWTW_IMAGEFILE_PNG;
+            else if (0 == strcmp(value, "ppm"))
+                fileFormat = TWTW_IMAGEFILE_PPM;
+            else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    const gint bookCount = argc - i;
+    if ( !outDirPath || bookCount < 1 || width < 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // the Maemo filesystem implementation uses gnome-vfs
+    gnome_vfs_init();
+
+    TwtwBatchRenderStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    gint failed = twtw_batch_render_books_utf8 ((const char **)(argv + i), bookCount,
+                                                outDirPath, width, fileFormat, threadCount,
+                                                batchProgress, NULL,
+                                                &stats);
+
+    printf("\nrendered %i pages from %i books (%i failed) using %i threads\n",
+                    stats.pagesRendered, stats.booksTotal, stats.booksFailed, stats.threadCount);
+    printf("wall time %.3f s -- load %.3f s, render %.3f s, write %.3f s (summed over threads)\n",
+                    stats.wallSecs, stats.loadSecs, stats.renderSecs, stats.writeSecs);
+    if (stats.pagesRendered > 0 && stats.wallSecs > 0.0)
+        printf("%.1f pages/s\n", stats.pagesRendered / stats.wallSecs);
+
+    gnome_vfs_shutdown();
+
+    return (failed == 0) ? 0 : 2;
+}
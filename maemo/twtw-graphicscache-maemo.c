@@ -102,6 +102,17 @@ void twtw_cache_surface_destroy(TwtwCacheSurface *surf)
     g_free(surf);
 }
 
+void twtw_cache_surface_swap_contents (TwtwCacheSurface *surf1, TwtwCacheSurface *surf2)
+{
+    g_return_if_fail(surf1);
+    g_return_if_fail(surf2);
+    g_return_if_fail(surf1->activeCairoCtx == NULL && surf2->activeCairoCtx == NULL);
+    
+    TwtwCacheSurface temp = *surf1;
+    *surf1 = *surf2;
+    *surf2 = temp;
+}
+
 
 gint twtw_cache_surface_get_width (TwtwCacheSurface *surf)
 {
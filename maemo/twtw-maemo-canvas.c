@@ -62,6 +62,8 @@ static GdkRectangle g_canvasUserRect = { 0, 0, 0, 0 };
 
 
 static void drawCurveList(cairo_t *cr, TwtwCurveList *curve, gint mode);
+static void destroyPrefetchSurfaces();
+static void schedulePrefetch();
 
 
 struct twtwCanvasElementInfo {
@@ -165,6 +167,7 @@ void twtw_canvas_did_acquire_drawable(gint w, gint h, GdkDrawable *drawable)
     twtw_set_size_and_parent_for_shared_canvas_cache_surface (w, h, drawable);
 
     g_bgCacheIsDirty = TRUE;
+    destroyPrefetchSurfaces();
     
     memset(&g_uiElementInfo, 0, sizeof(g_uiElementInfo));    
 }
@@ -357,6 +360,8 @@ void twtw_canvas_mouseup(GtkWidget *widget, gint x, gint y)
     g_editingMinY = g_editingMaxY = INT_MIN;
 
     gtk_widget_queue_draw_area (widget, g_canvasX, g_canvasY, g_canvasW, g_canvasH);
+    
+    schedulePrefetch();
 }
 
 
@@ -467,53 +472,32 @@ static void drawCurveList(cairo_t *cr, TwtwCurveList *curve, gint mode)
 }
 
 
-static GdkPixbuf *createGdkPixbufFromTwtwYUVImage(TwtwYUVImage *yuvImage)
-{
-    g_return_val_if_fail(yuvImage, NULL);
-    g_return_val_if_fail(yuvImage->buffer, NULL);
-
-    const int w = yuvImage->w;
-    const int h = yuvImage->h;
-    
-    GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB,  FALSE /*has alpha*/,  8 /*bits per sample*/,
-                                        w, h);
-    if ( !pixbuf) return NULL;
-    
-    const size_t dstRowBytes = gdk_pixbuf_get_rowstride (pixbuf);
-    unsigned char *dstBuf = gdk_pixbuf_get_pixels (pixbuf);
-
-    twtw_yuv_image_convert_to_rgb_for_display (yuvImage, dstBuf, dstRowBytes, FALSE, 1, 1);
-    
-    return pixbuf;
-}
-
-
 static void drawBackgroundPhotoFromPage(cairo_t *cr, TwtwPage *page, int w, int h)
 {
-    TwtwYUVImage *image = twtw_page_get_yuv_photo (page);
+    // the page keeps the converted photo cached, so this is cheap when flipping between pages
+    size_t rowBytes = 0;
+    const unsigned char *pixels = twtw_page_get_display_photo (page, w, h, FALSE, &rowBytes);
 
-    //printf("%s: should draw YUV photo: %p (page %p)\n", __func__, image, page);
+    //printf("%s: should draw YUV photo: %p (page %p)\n", __func__, pixels, page);
     
-    if ( !image) return;
+    if ( !pixels) return;
     
-    GdkPixbuf *pixbuf = createGdkPixbufFromTwtwYUVImage(image);
-    GdkPixbuf *upscaledPixbuf = gdk_pixbuf_scale_simple(pixbuf, w, h, GDK_INTERP_BILINEAR);
+    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data ((guchar *)pixels, GDK_COLORSPACE_RGB,  FALSE /*has alpha*/,  8 /*bits per sample*/,
+                                                  w, h, rowBytes,
+                                                  NULL, NULL);  // pixels are owned by the page
+    if ( !pixbuf) return;
 
     cairo_save(cr);
-    gdk_cairo_set_source_pixbuf (cr, upscaledPixbuf, 0, 0);
+    gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
     cairo_paint(cr);
     cairo_restore(cr);
     
-    gdk_pixbuf_unref(upscaledPixbuf);
     gdk_pixbuf_unref(pixbuf);
 }
 
 
-static void drawEntireActivePageInCache()
+static void drawPageInCache(TwtwCacheSurface *surf, TwtwPage *page)
 {
-    TwtwPage *page = twtw_active_document_page ();
-    TwtwCacheSurface *surf = twtw_shared_canvas_cache_surface();
-    
     int w = twtw_cache_surface_get_width(surf);
     int h = twtw_cache_surface_get_height(surf);
     
@@ -534,6 +518,198 @@ static void drawEntireActivePageInCache()
     }
 }
 
+// the page that the shared canvas cache currently holds (valid when g_bgCacheIsDirty is not set)
+static TwtwPage *g_cachedPage = NULL;
+static gint g_cachedPageIndex = -1;
+
+static void drawEntireActivePageInCache()
+{
+    TwtwPage *page = twtw_active_document_page ();
+
+    drawPageInCache(twtw_shared_canvas_cache_surface(), page);
+    
+    g_cachedPage = page;
+    g_cachedPageIndex = twtw_active_document_page_index ();
+}
+
+
+// ----- page prefetch -----
+
+/*
+  rendering a heavy page (photo + hundreds of curves) takes a noticeable time on device,
+  so the previous and next pages are rendered into spare cache surfaces when the main loop is idle.
+  on page change, a prefetched surface is swapped in as the canvas cache, and the page that was
+  displayed goes into the slot that was freed up (so flipping back and forth is instant too).
+*/
+
+#define PREFETCH_SLOT_COUNT  2
+
+typedef struct {
+    TwtwCacheSurface *surf;
+    TwtwPage *page;     // NULL if the surface doesn't contain anything useful
+    gint pageIndex;
+} TwtwPrefetchSlot;
+
+static TwtwPrefetchSlot g_prefetchSlots[PREFETCH_SLOT_COUNT];
+static guint g_prefetchIdleID = 0;
+
+
+static void invalidatePrefetchedPages()
+{
+    int i;
+    for (i = 0; i < PREFETCH_SLOT_COUNT; i++) {
+        g_prefetchSlots[i].page = NULL;
+        g_prefetchSlots[i].pageIndex = -1;
+    }
+}
+
+static void destroyPrefetchSurfaces()
+{
+    int i;
+    for (i = 0; i < PREFETCH_SLOT_COUNT; i++) {
+        twtw_cache_surface_destroy(g_prefetchSlots[i].surf);
+        g_prefetchSlots[i].surf = NULL;
+    }
+    invalidatePrefetchedPages();
+}
+
+static gboolean isPrefetchWantedForPageIndex(gint index)
+{
+    const gint activeIndex = twtw_active_document_page_index ();
+    
+    return (index == activeIndex - 1 || index == activeIndex + 1) ? TRUE : FALSE;
+}
+
+static TwtwPrefetchSlot *findPrefetchSlotForPage(TwtwPage *page, gint index)
+{
+    int i;
+    for (i = 0; i < PREFETCH_SLOT_COUNT; i++) {
+        if (g_prefetchSlots[i].page == page && g_prefetchSlots[i].pageIndex == index && g_prefetchSlots[i].surf)
+            return g_prefetchSlots + i;
+    }
+    return NULL;
+}
+
+// returns a slot whose content is not needed for the current neighbour pages
+static TwtwPrefetchSlot *findReusablePrefetchSlot()
+{
+    int i;
+    for (i = 0; i < PREFETCH_SLOT_COUNT; i++) {
+        if ( !g_prefetchSlots[i].page || !isPrefetchWantedForPageIndex(g_prefetchSlots[i].pageIndex))
+            return g_prefetchSlots + i;
+    }
+    return NULL;
+}
+
+static gboolean prefetchIdleFunc(gpointer data)
+{
+    TwtwCacheSurface *canvasSurf = twtw_shared_canvas_cache_surface();
+    TwtwBook *book = twtw_active_document ();
+    const gint activeIndex = twtw_active_document_page_index ();
+    const gint pageCount = twtw_book_get_page_count (book);
+    const gint wantedIndexes[PREFETCH_SLOT_COUNT] = { activeIndex + 1, activeIndex - 1 };
+    int i;
+    
+    // don't compete with drawing, and wait until the canvas has been drawn (the cache surface is created lazily)
+    if (g_editedCL || g_bgCacheIsDirty || twtw_cache_surface_get_width(canvasSurf) < 1) {
+        g_prefetchIdleID = 0;
+        return FALSE;
+    }
+    
+    // render one page per idle callback so that input events get processed in between.
+    // the wanted pages are re-evaluated every time, so stale work is dropped when the user jumps far
+    for (i = 0; i < PREFETCH_SLOT_COUNT; i++) {
+        const gint index = wantedIndexes[i];
+        if (index < 0 || index >= pageCount)
+            continue;
+            
+        TwtwPage *page = twtw_book_get_page (book, index);
+        if (findPrefetchSlotForPage(page, index))
+            continue;
+            
+        TwtwPrefetchSlot *slot = findReusablePrefetchSlot();
+        if ( !slot)
+            break;
+        
+        if (slot->surf && (twtw_cache_surface_get_width(slot->surf) != twtw_cache_surface_get_width(canvasSurf) ||
+                           twtw_cache_surface_get_height(slot->surf) != twtw_cache_surface_get_height(canvasSurf))) {
+            twtw_cache_surface_destroy(slot->surf);
+            slot->surf = NULL;
+        }
+        if ( !slot->surf) {
+            slot->surf = twtw_cache_surface_create_similar (canvasSurf, -1, -1);
+            if ( !slot->surf) break;
+        }
+        
+        ///double t0 = twtw_absolute_time_get_current();
+        drawPageInCache(slot->surf, page);
+        slot->page = page;
+        slot->pageIndex = index;
+        ///printf("%s: prefetched page %i in %.3f s\n", __func__, index, twtw_absolute_time_get_current() - t0);
+        
+        return TRUE;
+    }
+    
+    g_prefetchIdleID = 0;
+    return FALSE;
+}
+
+static void schedulePrefetch()
+{
+    if ( !g_prefetchIdleID) {
+        g_prefetchIdleID = g_idle_add(prefetchIdleFunc, NULL);
+    }
+}
+
+// returns TRUE if the active page was found in a prefetch slot and is now in the canvas cache
+static gboolean swapInPrefetchedActivePage()
+{
+    TwtwPage *page = twtw_active_document_page ();
+    const gint index = twtw_active_document_page_index ();
+    TwtwPrefetchSlot *slot = findPrefetchSlotForPage(page, index);
+    
+    if ( !slot)
+        return FALSE;
+        
+    TwtwCacheSurface *canvasSurf = twtw_shared_canvas_cache_surface();
+    if (twtw_cache_surface_get_width(slot->surf) != twtw_cache_surface_get_width(canvasSurf) ||
+        twtw_cache_surface_get_height(slot->surf) != twtw_cache_surface_get_height(canvasSurf))
+        return FALSE;
+        
+    twtw_cache_surface_swap_contents (canvasSurf, slot->surf);
+    
+    // the slot now has the page that was displayed until now
+    if ( !g_bgCacheIsDirty && g_cachedPage) {
+        slot->page = g_cachedPage;
+        slot->pageIndex = g_cachedPageIndex;
+    } else {
+        slot->page = NULL;
+        slot->pageIndex = -1;
+    }
+    
+    g_cachedPage = page;
+    g_cachedPageIndex = index;
+    g_bgCacheIsDirty = FALSE;
+    return TRUE;
+}
+
+
+void twtw_canvas_document_did_change(GtkWidget *widget, gint notifID)
+{
+    if (notifID == TWTW_NOTIF_DOCUMENT_PAGE_INDEX_CHANGED && swapInPrefetchedActivePage()) {
+        gtk_widget_queue_draw_area (widget, g_canvasX, g_canvasY, g_canvasW, g_canvasH);
+        g_bottomUICacheIsDirty = TRUE;
+    } else {
+        // page content may have changed anywhere in the document (e.g. undo on another page)
+        if (notifID != TWTW_NOTIF_DOCUMENT_PAGE_INDEX_CHANGED)
+            invalidatePrefetchedPages();
+            
+        twtw_canvas_queue_full_redraw(widget);
+    }
+    
+    schedulePrefetch();
+}
+
 
 static void drawUIElement(cairo_t *cr, double canvasW, double canvasH, const char *elementName,
                                        double x, double y, gboolean flipY, double *outW, double *outH)
@@ -818,6 +994,8 @@ void twtw_canvas_draw(cairo_t *cr, gint x, gint y, gint w, gint h)
         drawEntireActivePageInCache();
         g_bgCacheIsDirty = FALSE;
         //printf("did render bg cache for canvas\n");
+        
+        schedulePrefetch();
     }
     
     // this call will refresh the element positions
@@ -30,6 +30,7 @@
 #include "twtw-maemo.h"
 #include "twtw-document.h"
 #include "twtw-audio.h"
+#include "twtw-audioconv.h"
 #include "twtw-camera.h"
 #include "twtw-filesystem.h"
 
@@ -67,7 +68,8 @@ typedef enum {
   MENU_FILE_OPEN = 1,
   MENU_FILE_SAVE = 2,
   MENU_FILE_QUIT = 3,
-  MENU_PAGE_CLEAR = 4
+  MENU_PAGE_CLEAR = 4,
+  MENU_COMPRESS_SILENCE = 5
 } MenuActionCode;
 
 
@@ -267,7 +269,7 @@ static void twtwDocChanged(gint notifID, TwtwMaemoAppData *appdata)
         twtw_set_active_document_page_index (0);  // go to first page
     }
 
-    twtw_canvas_queue_full_redraw(appdata->drawingArea);
+    twtw_canvas_document_did_change(appdata->drawingArea, notifID);
     
     if (appdata) {
         TwtwPage *page = twtw_active_document_page ();
@@ -364,7 +366,7 @@ static void playButtonClicked(GtkButton *button, TwtwMaemoAppData *appdata)
     TwtwPage *page = twtw_active_document_page ();
     gint soundLen = twtw_page_get_sound_duration_in_seconds (page);
 
-    if (soundLen > 0) {
+    if (soundLen > 0 && 0 == twtw_page_write_pcm_sound_to_temp_file (page)) {
         soundPath = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
     }
     
@@ -396,7 +398,7 @@ static void cameraFinishedCallback(int status, TwtwYUVImage *yuvImage, TwtwMaemo
     // a new photo was taken, so apply it on this document page
     
     TwtwPage *page = twtw_active_document_page ();
-    twtw_page_copy_yuv_photo(page, yuvImage);
+    twtw_page_set_yuv_photo_copy(page, yuvImage);
 
     printf("%s: %i, image %p, appdata %p, docpage %p\n", __func__, status, yuvImage, appdata, page);
         
@@ -464,6 +466,10 @@ static void menuItemActivated(GtkMenuItem *mi, gpointer data)
     case MENU_PAGE_CLEAR:
       clearPageAction(mi, menuData->appdata);
       break;
+    case MENU_COMPRESS_SILENCE:
+      // recordings are encoded when the document is saved, so this applies to the next save
+      twtw_speex_set_silence_compression (gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(mi)));
+      break;
     default:
       g_warning("unknown menu action code %i\n", aCode);
     }
@@ -490,11 +496,14 @@ static void buildMenu(HildonProgram *program, TwtwMaemoAppData *appdata)
   GtkMenuItem* miSep, *miSep2;
   GtkMenuItem* miQuit;
   GtkMenuItem *miClear;
+  GtkMenuItem *miSilence;
 
   miOpen = buildMenuItem("Open");
   miSave = buildMenuItem("Save");
   miQuit = buildMenuItem("Quit");
   miClear = buildMenuItem("Clear This Page");
+  miSilence = GTK_MENU_ITEM(gtk_check_menu_item_new_with_label("Compress Silence in Recordings"));
+  gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(miSilence), twtw_speex_silence_compression());
   miSep = g_object_new(GTK_TYPE_SEPARATOR_MENU_ITEM, NULL);
   miSep2 = g_object_new(GTK_TYPE_SEPARATOR_MENU_ITEM, NULL);
 
@@ -505,6 +514,7 @@ static void buildMenu(HildonProgram *program, TwtwMaemoAppData *appdata)
     "child", miSep2,
     "child", miOpen,
     "child", miSave,
+    "child", miSilence,
     "child", miSep,
     "child", miQuit,
     NULL);
@@ -533,6 +543,11 @@ static void buildMenu(HildonProgram *program, TwtwMaemoAppData *appdata)
   mdata->itemCode = MENU_PAGE_CLEAR;
   g_signal_connect(G_OBJECT(miClear), "activate", G_CALLBACK(menuItemActivated), mdata);
 
+  mdata = g_malloc0(sizeof(MenuItemData));
+  mdata->appdata = appdata;
+  mdata->itemCode = MENU_COMPRESS_SILENCE;
+  g_signal_connect(G_OBJECT(miSilence), "toggled", G_CALLBACK(menuItemActivated), mdata);
+
   gtk_widget_show_all(GTK_WIDGET(menu));
 }
 
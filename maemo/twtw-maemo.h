@@ -87,6 +87,9 @@ void twtw_canvas_set_rect(gint x, gint y, gint w, gint h);
 void twtw_canvas_did_acquire_drawable(gint w, gint h, GdkDrawable *drawable);
 
 void twtw_canvas_queue_full_redraw(GtkWidget *widget);
+
+// called for document notifications; swaps in a prefetched page on page change if available
+void twtw_canvas_document_did_change(GtkWidget *widget, gint notifID);
 void twtw_canvas_queue_audio_status_redraw(GtkWidget *widget);
 
 void twtw_canvas_set_action_callbacks(GtkWidget *widget, TwtwCanvasActionCallbacks *callbacks, void *cbData);
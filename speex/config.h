@@ -155,10 +155,14 @@
    first (like Motorola and SPARC, unlike Intel and VAX). */
 /* #undef WORDS_BIGENDIAN */
 
-/* Enable SSE support */
-#if defined(__X86__) || (defined(__APPLE__) && defined(__MACOSX__) && !defined(__BIG_ENDIAN__))
+/* Enable SSE support. SSE and SSE2 are part of every x86-64 CPU, and a 32-bit x86 build
+   defines __SSE__ only when it's allowed to assume it (as on all Intel Macs) */
+#if defined(__SSE__) && defined(FLOATING_POINT)
 #define _USE_SSE 
 #endif
+#if defined(__SSE2__) && defined(FLOATING_POINT)
+#define _USE_SSE2 
+#endif
 
 /* Define to empty if `const' does not conform to ANSI C. */
 /* #undef const */
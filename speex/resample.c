@@ -337,7 +337,6 @@ static int resampler_basic_direct_single(SpeexResamplerState *st, spx_uint32_t c
    const int frac_advance = st->frac_advance;
    const spx_uint32_t den_rate = st->den_rate;
    spx_word32_t sum;
-   int j;
 
    while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
    {
@@ -346,6 +345,7 @@ static int resampler_basic_direct_single(SpeexResamplerState *st, spx_uint32_t c
 
 #ifndef OVERRIDE_INNER_PRODUCT_SINGLE
       float accum[4] = {0,0,0,0};
+      int j;
 
       for(j=0;j<N;j+=4) {
         accum[0] += sinc[j]*iptr[j];
@@ -388,7 +388,6 @@ static int resampler_basic_direct_double(SpeexResamplerState *st, spx_uint32_t c
    const int frac_advance = st->frac_advance;
    const spx_uint32_t den_rate = st->den_rate;
    double sum;
-   int j;
 
    while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
    {
@@ -397,6 +396,7 @@ static int resampler_basic_direct_double(SpeexResamplerState *st, spx_uint32_t c
 
 #ifndef OVERRIDE_INNER_PRODUCT_DOUBLE
       double accum[4] = {0,0,0,0};
+      int j;
 
       for(j=0;j<N;j+=4) {
         accum[0] += sinc[j]*iptr[j];
@@ -435,7 +435,6 @@ static int resampler_basic_interpolate_single(SpeexResamplerState *st, spx_uint3
    const int int_advance = st->int_advance;
    const int frac_advance = st->frac_advance;
    const spx_uint32_t den_rate = st->den_rate;
-   int j;
    spx_word32_t sum;
 
    while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
@@ -453,6 +452,7 @@ static int resampler_basic_interpolate_single(SpeexResamplerState *st, spx_uint3
 
 #ifndef OVERRIDE_INTERPOLATE_PRODUCT_SINGLE
       spx_word32_t accum[4] = {0,0,0,0};
+      int j;
 
       for(j=0;j<N;j++) {
         const spx_word16_t curr_in=iptr[j];
@@ -497,7 +497,6 @@ static int resampler_basic_interpolate_double(SpeexResamplerState *st, spx_uint3
    const int int_advance = st->int_advance;
    const int frac_advance = st->frac_advance;
    const spx_uint32_t den_rate = st->den_rate;
-   int j;
    spx_word32_t sum;
 
    while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
@@ -515,6 +514,7 @@ static int resampler_basic_interpolate_double(SpeexResamplerState *st, spx_uint3
 
 #ifndef OVERRIDE_INTERPOLATE_PRODUCT_DOUBLE
       double accum[4] = {0,0,0,0};
+      int j;
 
       for(j=0;j<N;j++) {
         const double curr_in=iptr[j];
@@ -77,10 +77,8 @@ void vq_nbest_sign(spx_word16_t *_in, const __m128 *codebook, int len, int entri
    int i,j,k,used;
    VARDECL(float *dist);
    VARDECL(__m128 *in);
-   __m128 half;
    used = 0;
    ALLOC(dist, entries, float);
-   half = _mm_set_ps1(.5f);
    ALLOC(in, len, __m128);
    for (i=0;i<len;i++)
       in[i] = _mm_set_ps1(_in[i]);
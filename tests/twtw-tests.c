@@ -0,0 +1,627 @@
+/*
+ *  twtw-tests.c
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    round-trip checks for the core codecs. built by "make check" in maemo/ (or any build of the core files):
+
+        twtw-tests
+
+    prints a line for each failed check and exits with 1 if there were any.
+*/
+
+#include "twtw-photo.h"
+#include "twtw-cpu.h"
+#include "twtw-audioconv.h"
+#include "twtw-audio.h"
+#include "twtw-document.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+static int g_checkCount = 0;
+static int g_failCount = 0;
+
+#define CHECK(cond_, ...)  do { \
+                               g_checkCount++; \
+                               if ( !(cond_)) { \
+                                   g_failCount++; \
+                                   printf("** %s:%i: check failed: %s -- ", __FILE__, __LINE__, #cond_); \
+                                   printf(__VA_ARGS__); \
+                                   printf("\n"); \
+                               } \
+                           } while (0)
+
+
+#ifdef __APPLE__
+#pragma mark --- photos ---
+#endif
+
+// deterministic pseudo-random numbers, so a failure can be reproduced
+static unsigned int g_randState = 1;
+
+static int nextRand ()
+{
+    g_randState = g_randState * 1103515245 + 12345;
+    return (g_randState >> 16) & 0x7fff;
+}
+
+static unsigned char clampToByte (int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+// smooth gradients with some noise in luma; noisy chroma would make the 4:2:0 subsampling error unbounded
+static TwtwYUVImage *createTestImage (int w, int h, int lumaNoise)
+{
+    TwtwYUVImage *image = g_malloc0(sizeof(TwtwYUVImage));
+    image->w = w;
+    image->h = h;
+    image->rowBytes = w * 2;
+    image->pixelFormat = TWTW_CAM_FOURCC;
+    image->buffer = g_malloc(image->rowBytes * h);
+
+    int x, y;
+    for (y = 0; y < h; y++) {
+        unsigned char *p = image->buffer + image->rowBytes * y;
+        for (x = 0; x < w; x += 2) {
+            const int n0 = (lumaNoise > 0) ? (nextRand() % (lumaNoise*2 + 1)) - lumaNoise : 0;
+            const int n1 = (lumaNoise > 0) ? (nextRand() % (lumaNoise*2 + 1)) - lumaNoise : 0;
+            const int luma = 16 + (200 * (x + y)) / (w + h);
+            // chroma gradients stay within the 5-bit range for the largest test sizes (the top step is 248)
+            p[0] = clampToByte(64 + x / 8);             // Cb
+            p[1] = clampToByte(luma + n0);
+            p[2] = clampToByte(192 - y / 4);            // Cr
+            p[3] = clampToByte(luma + n1);
+            p += 4;
+        }
+    }
+    return image;
+}
+
+// largest difference between the images in luma and chroma samples
+static void compareYUVImages (TwtwYUVImage *a, TwtwYUVImage *b, int *outLumaDiff, int *outChromaDiff)
+{
+    int lumaDiff = 0, chromaDiff = 0;
+    int x, y;
+    for (y = 0; y < a->h; y++) {
+        const unsigned char *pa = a->buffer + a->rowBytes * y;
+        const unsigned char *pb = b->buffer + b->rowBytes * y;
+        for (x = 0; x < a->w * 2; x++) {
+            const int d = abs((int)pa[x] - (int)pb[x]);
+            if (x & 1)
+                lumaDiff = MAX(lumaDiff, d);
+            else
+                chromaDiff = MAX(chromaDiff, d);
+        }
+    }
+    *outLumaDiff = lumaDiff;
+    *outChromaDiff = chromaDiff;
+}
+
+static TwtwYUVImage *serializeAndDecode (TwtwYUVImage *image, uint32_t *outFourCC)
+{
+    unsigned char *data = NULL;
+    size_t dataSize = 0;
+    uint32_t fourCC = 0;
+    twtw_yuv_image_serialize (image, &data, &dataSize, &fourCC);
+    if ( !data)
+        return NULL;
+
+    TwtwYUVImage *decoded = twtw_yuv_image_create_from_serialized (data, dataSize, image->w, image->h, fourCC, 0);
+    g_free(data);
+
+    if (outFourCC) *outFourCC = fourCC;
+    return decoded;
+}
+
+// luma is truncated to 6 bits, chroma is rounded to 5 bits.
+// chroma is also shared by each pair of rows and interpolated between them when decoding, which costs a little more on gradients
+#define DPCM_MAX_LUMA_ERROR    3
+#define DPCM_MAX_CHROMA_ERROR  6
+
+static void checkDPCMRoundTrip (int w, int h)
+{
+    TwtwYUVImage *image = createTestImage (w, h, 12);
+    uint32_t fourCC = 0;
+    TwtwYUVImage *decoded = serializeAndDecode (image, &fourCC);
+
+    CHECK(decoded != NULL, "%i * %i", w, h);
+    if ( !decoded) {
+        twtw_yuv_image_destroy (image);
+        return;
+    }
+    CHECK(fourCC == TWTW_CAM_COMPRESSED_DPCM_FOURCC, "%i * %i: fourCC 0x%x", w, h, (unsigned int)fourCC);
+    CHECK(decoded->w == w && decoded->h == h, "%i * %i: decoded size %i * %i", w, h, decoded->w, decoded->h);
+
+    int lumaDiff = 0, chromaDiff = 0;
+    compareYUVImages (image, decoded, &lumaDiff, &chromaDiff);
+    CHECK(lumaDiff <= DPCM_MAX_LUMA_ERROR, "%i * %i: luma error %i", w, h, lumaDiff);
+    CHECK(chromaDiff <= DPCM_MAX_CHROMA_ERROR, "%i * %i: chroma error %i", w, h, chromaDiff);
+
+    // the decoded samples are already quantized, so a second round trip must not change anything
+    TwtwYUVImage *decoded2 = serializeAndDecode (decoded, NULL);
+    CHECK(decoded2 != NULL, "%i * %i: second generation", w, h);
+    if (decoded2) {
+        compareYUVImages (decoded, decoded2, &lumaDiff, &chromaDiff);
+        CHECK(lumaDiff == 0 && chromaDiff == 0, "%i * %i: second generation differs by %i / %i", w, h, lumaDiff, chromaDiff);
+    }
+
+    twtw_yuv_image_destroy (decoded2);
+    twtw_yuv_image_destroy (decoded);
+    twtw_yuv_image_destroy (image);
+}
+
+static void testPhotoDPCM ()
+{
+    // the default size, plus sizes whose rows don't fill a SIMD vector and odd heights (the last row has no chroma of its own)
+    static const int sizes[][2] = { { TWTW_CAM_IMAGEWIDTH, TWTW_CAM_IMAGEHEIGHT },
+                                    { 2, 2 }, { 4, 3 }, { 34, 17 }, { 318, 199 }, { 2, TWTW_CAM_IMAGEHEIGHT }, { TWTW_CAM_IMAGEWIDTH, 2 } };
+    int i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        checkDPCMRoundTrip (sizes[i][0], sizes[i][1]);
+    }
+}
+
+// the serializer's row splitters have SIMD versions; the stream must be the same byte for byte without them.
+// a truncated stream must be rejected rather than decoded into a partial image
+static void testPhotoStreaming ()
+{
+    static const int sizes[][2] = { { TWTW_CAM_IMAGEWIDTH, TWTW_CAM_IMAGEHEIGHT }, { 34, 17 }, { 318, 199 } };
+    int i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const int w = sizes[i][0];
+        const int h = sizes[i][1];
+        TwtwYUVImage *image = createTestImage (w, h, 12);
+
+        unsigned char *data = NULL, *scalarData = NULL;
+        size_t dataSize = 0, scalarDataSize = 0;
+        uint32_t fourCC = 0, scalarFourCC = 0;
+        twtw_yuv_image_serialize (image, &data, &dataSize, &fourCC);
+
+        twtw_cpu_set_disabled_features (TWTW_CPU_SSE2 | TWTW_CPU_SSSE3 | TWTW_CPU_SSE41 | TWTW_CPU_NEON);
+        twtw_yuv_image_serialize (image, &scalarData, &scalarDataSize, &scalarFourCC);
+        twtw_cpu_set_disabled_features (0);
+
+        CHECK(data && scalarData, "%i * %i", w, h);
+        if (data && scalarData) {
+            CHECK(fourCC == scalarFourCC && dataSize == scalarDataSize && 0 == memcmp(data, scalarData, dataSize),
+                  "%i * %i: SIMD and scalar streams differ (%i / %i bytes)", w, h, (int)dataSize, (int)scalarDataSize);
+
+            TwtwYUVImage *truncated = twtw_yuv_image_create_from_serialized (data, dataSize / 2, w, h, fourCC, 0);
+            CHECK(truncated == NULL, "%i * %i: truncated stream was decoded", w, h);
+            twtw_yuv_image_destroy (truncated);
+        }
+
+        g_free(data);
+        g_free(scalarData);
+        twtw_yuv_image_destroy (image);
+    }
+}
+
+// photos larger than the default size are stored as 'twYt' tiles, including the smaller tiles at the right and bottom edges.
+// a view of any area must match the same area of the fully decoded photo
+static void checkTiledRoundTrip (int w, int h)
+{
+    TwtwYUVImage *image = createTestImage (w, h, 12);
+    unsigned char *data = NULL;
+    size_t dataSize = 0;
+    uint32_t fourCC = 0;
+    twtw_yuv_image_serialize (image, &data, &dataSize, &fourCC);
+
+    CHECK(data != NULL, "%i * %i", w, h);
+    CHECK(fourCC == TWTW_CAM_COMPRESSED_TILED_FOURCC, "%i * %i: fourCC 0x%x", w, h, (unsigned int)fourCC);
+
+    TwtwTiledYUVImage *tiled = (data) ? twtw_tiled_yuv_image_create_from_serialized (data, dataSize, w, h, fourCC, 0) : NULL;
+    TwtwYUVImage *decoded = (tiled) ? twtw_tiled_yuv_image_create_decoded (tiled) : NULL;
+    CHECK(tiled && decoded, "%i * %i", w, h);
+
+    if (decoded) {
+        int lumaDiff = 0, chromaDiff = 0;
+        compareYUVImages (image, decoded, &lumaDiff, &chromaDiff);
+        CHECK(lumaDiff <= DPCM_MAX_LUMA_ERROR, "%i * %i: luma error %i", w, h, lumaDiff);
+        CHECK(chromaDiff <= DPCM_MAX_CHROMA_ERROR, "%i * %i: chroma error %i", w, h, chromaDiff);
+
+        TwtwYUVImage *decoded2 = serializeAndDecode (decoded, NULL);
+        CHECK(decoded2 != NULL, "%i * %i: second generation", w, h);
+        if (decoded2) {
+            compareYUVImages (decoded, decoded2, &lumaDiff, &chromaDiff);
+            CHECK(lumaDiff == 0 && chromaDiff == 0, "%i * %i: second generation differs by %i / %i", w, h, lumaDiff, chromaDiff);
+        }
+        twtw_yuv_image_destroy (decoded2);
+
+        size_t storedSize = 0;
+        const unsigned char *stored = twtw_tiled_yuv_image_get_serialized_data (tiled, &storedSize, NULL, NULL);
+        CHECK(stored && storedSize == dataSize && 0 == memcmp(stored, data, dataSize), "%i * %i: serialized data not kept as is", w, h);
+
+        // at native size the conversion doesn't filter, so a view that crosses tile edges must be an exact crop of the full conversion
+        const size_t rowBytes = w * 3;
+        unsigned char *fullRGB = g_malloc(rowBytes * h);
+        twtw_yuv_image_convert_to_rgb_for_display_scaled (decoded, fullRGB, rowBytes, w, h, FALSE);
+
+        const int viewX = MIN(w - 2, TWTW_PHOTO_TILE_SIZE - 6);
+        const int viewY = MIN(h - 2, TWTW_PHOTO_TILE_SIZE - 5);
+        const int viewW = w - viewX;
+        const int viewH = h - viewY;
+        unsigned char *viewRGB = g_malloc(viewW * 3 * viewH);
+        twtw_tiled_yuv_image_convert_rect_to_rgb_for_display_scaled (tiled, viewX, viewY, viewW, viewH, viewRGB, viewW * 3, viewW, viewH, FALSE);
+
+        int y, rowsDiffering = 0;
+        for (y = 0; y < viewH; y++) {
+            if (0 != memcmp(viewRGB + viewW * 3 * y, fullRGB + rowBytes * (viewY + y) + viewX * 3, viewW * 3))
+                rowsDiffering++;
+        }
+        CHECK(rowsDiffering == 0, "%i * %i: view at %i, %i differs from the full image on %i rows", w, h, viewX, viewY, rowsDiffering);
+
+        g_free(viewRGB);
+        g_free(fullRGB);
+    }
+
+    twtw_yuv_image_destroy (decoded);
+    twtw_tiled_yuv_image_destroy (tiled);
+    g_free(data);
+    twtw_yuv_image_destroy (image);
+}
+
+static void testPhotoTiles ()
+{
+    // just above the default size; exact multiples of the tile size; one row or column past a multiple
+    // (a 1-pixel edge tile is avoided by widening the tiles); and narrow edge tiles in both directions
+    static const int sizes[][2] = { { TWTW_CAM_IMAGEWIDTH + 2, TWTW_CAM_IMAGEHEIGHT + 2 },
+                                    { 2*TWTW_PHOTO_TILE_SIZE, TWTW_PHOTO_TILE_SIZE },
+                                    { 2*TWTW_PHOTO_TILE_SIZE + 2, 2*TWTW_PHOTO_TILE_SIZE + 1 },
+                                    { TWTW_PHOTO_TILE_SIZE + 2, TWTW_PHOTO_TILE_SIZE + 1 },
+                                    { 3*TWTW_PHOTO_TILE_SIZE + 4, TWTW_PHOTO_TILE_SIZE + 3 } };
+    int i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        checkTiledRoundTrip (sizes[i][0], sizes[i][1]);
+    }
+}
+
+static void setLE32 (unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+// a 'twYt' stream whose tile size table doesn't fit the data must be rejected when it's opened. the table
+// follows the 8-byte header; sizes that would wrap a 32-bit offset around to a small value are included
+static void testPhotoTilesCorruptSizeTable ()
+{
+    const int w = 2*TWTW_PHOTO_TILE_SIZE + 2;
+    const int h = TWTW_PHOTO_TILE_SIZE + 2;
+    TwtwYUVImage *image = createTestImage (w, h, 12);
+    unsigned char *data = NULL;
+    size_t dataSize = 0;
+    uint32_t fourCC = 0;
+    twtw_yuv_image_serialize (image, &data, &dataSize, &fourCC);
+    CHECK(data && fourCC == TWTW_CAM_COMPRESSED_TILED_FOURCC, "%i * %i", w, h);
+
+    if (data && fourCC == TWTW_CAM_COMPRESSED_TILED_FOURCC) {
+        const int tileCount = (data[4] | (data[5] << 8)) * (data[6] | (data[7] << 8));  // columns * rows
+        const size_t tablePos = 8;
+        const size_t firstTilePos = tablePos + 4 * tileCount;
+        unsigned char *corrupt = g_malloc(dataSize);
+
+        const struct {
+            int tile;
+            uint32_t size;
+        } corruptions[] = { { 0, 0xffffffff },
+                            { 0, (uint32_t)(0x100000000ULL - firstTilePos) + 16 },  // wraps to offset 16
+                            { 1, 0xfffffff0 },
+                            { 0, (uint32_t)(dataSize - firstTilePos + 1) },         // one byte past the end
+                            { tileCount - 1, (uint32_t)dataSize } };
+        int i;
+        for (i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); i++) {
+            memcpy(corrupt, data, dataSize);
+            setLE32 (corrupt + tablePos + 4 * corruptions[i].tile, corruptions[i].size);
+
+            TwtwTiledYUVImage *tiled = twtw_tiled_yuv_image_create_from_serialized (corrupt, dataSize, w, h, fourCC, 0);
+            CHECK(tiled == NULL, "tile %i with size 0x%x was accepted", corruptions[i].tile, (unsigned int)corruptions[i].size);
+            twtw_tiled_yuv_image_destroy (tiled);
+        }
+        g_free(corrupt);
+    }
+
+    g_free(data);
+    twtw_yuv_image_destroy (image);
+}
+
+
+
+#ifdef __APPLE__
+#pragma mark --- documents ---
+#endif
+
+// a photo on several pages is written once and read back on each of them
+static void testDocumentSharedPhotos ()
+{
+    const int w = TWTW_CAM_IMAGEWIDTH;
+    const int h = TWTW_CAM_IMAGEHEIGHT;
+    TwtwYUVImage *image = createTestImage (w, h, 12);
+    TwtwYUVImage *otherImage = createTestImage (w, h, 30);
+
+    TwtwBook *book = twtw_book_create ();
+    twtw_page_set_yuv_photo_copy (twtw_book_get_page (book, 0), image);
+
+    char *singleData = NULL, *data = NULL;
+    size_t singleDataSize = 0, dataSize = 0;
+    twtw_book_write_to_data (book, &singleData, &singleDataSize);
+
+    twtw_page_set_yuv_photo_copy (twtw_book_get_page (book, 3), image);
+    twtw_page_set_yuv_photo_copy (twtw_book_get_page (book, 7), otherImage);
+    twtw_page_set_yuv_photo_copy (twtw_book_get_page (book, 19), image);
+    twtw_book_write_to_data (book, &data, &dataSize);
+    CHECK(singleData && data, "writing");
+
+    size_t otherDataSize = 0;
+    unsigned char *otherData = NULL;
+    uint32_t fourCC = 0;
+    twtw_yuv_image_serialize (otherImage, &otherData, &otherDataSize, &fourCC);
+    g_free(otherData);
+
+    // the repeats only add their headers
+    CHECK(dataSize < singleDataSize + otherDataSize + 1024, "%i bytes with repeated photos, %i + %i bytes for the photos", (int)dataSize, (int)singleDataSize, (int)otherDataSize);
+
+    TwtwBook *readBook = NULL;
+    CHECK(data && 0 == twtw_book_create_from_data (data, dataSize, &readBook) && readBook, "reading");
+    if (readBook) {
+        int i;
+        for (i = 0; i < 20; i++) {
+            TwtwYUVImage *written = twtw_page_copy_yuv_photo (twtw_book_get_page (book, i));
+            TwtwYUVImage *read = twtw_page_copy_yuv_photo (twtw_book_get_page (readBook, i));
+            CHECK((written == NULL) == (read == NULL), "page %i: photo %s", i, (read) ? "added" : "missing");
+            if (written && read) {
+                int lumaDiff = 0, chromaDiff = 0;
+                compareYUVImages (written, read, &lumaDiff, &chromaDiff);
+                CHECK(lumaDiff <= DPCM_MAX_LUMA_ERROR && chromaDiff <= DPCM_MAX_CHROMA_ERROR, "page %i: differs by %i / %i", i, lumaDiff, chromaDiff);
+            }
+            twtw_yuv_image_destroy (written);
+            twtw_yuv_image_destroy (read);
+        }
+        twtw_book_destroy (readBook);
+    }
+
+    g_free(singleData);
+    g_free(data);
+    twtw_book_destroy (book);
+    twtw_yuv_image_destroy (otherImage);
+    twtw_yuv_image_destroy (image);
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- audio ---
+#endif
+
+static void testSpeexPacketStore ()
+{
+    TwtwSpeexPacketStore *store = twtw_speex_packet_store_create ();
+    CHECK(twtw_speex_packet_store_get_count (store) == 0 && twtw_speex_packet_store_get_length (store) == 0, "empty store");
+    CHECK(twtw_speex_packet_store_find_packet (store, 0) == 0, "empty store");
+
+    // packets of varying size; every packet is 200 frames except the last, which ends at 1250
+    const int count = 7;
+    size_t dataSize = 0;
+    int i, n;
+    for (i = 0; i < count; i++) {
+        unsigned char data[64];
+        const int bytes = 10 + i * 7;
+        for (n = 0; n < bytes; n++)
+            data[n] = (unsigned char)(i * 31 + n);
+        const ogg_int64_t granulepos = (i < count - 1) ? (i + 1) * 200 : 1250;
+        twtw_speex_packet_store_append (store, data, bytes, granulepos, (i == count - 1));
+        dataSize += bytes;
+    }
+
+    CHECK(twtw_speex_packet_store_get_count (store) == count, "count %i", twtw_speex_packet_store_get_count (store));
+    CHECK(twtw_speex_packet_store_get_data_size (store) == dataSize, "data size %i", (int)twtw_speex_packet_store_get_data_size (store));
+    CHECK(twtw_speex_packet_store_get_length (store) == 1250, "length %i", (int)twtw_speex_packet_store_get_length (store));
+
+    TwtwSpeexPacketStore *copy = twtw_speex_packet_store_copy (store);
+    CHECK(twtw_speex_packet_store_get_count (copy) == count, "copy count %i", twtw_speex_packet_store_get_count (copy));
+
+    for (i = 0; i < count; i++) {
+        int bytes = 0, copyBytes = 0;
+        ogg_int64_t granulepos = 0, copyGranulepos = 0;
+        const unsigned char *data = twtw_speex_packet_store_get_packet (store, i, &bytes, &granulepos);
+        const unsigned char *copyData = twtw_speex_packet_store_get_packet (copy, i, &copyBytes, &copyGranulepos);
+
+        int dataMatches = (data != NULL && bytes == 10 + i * 7);
+        for (n = 0; dataMatches && n < bytes; n++)
+            dataMatches = (data[n] == (unsigned char)(i * 31 + n));
+        CHECK(dataMatches, "packet %i data", i);
+        CHECK(granulepos == ((i < count - 1) ? (i + 1) * 200 : 1250), "packet %i granulepos %i", i, (int)granulepos);
+
+        CHECK(copyData && copyData != data && copyBytes == bytes && copyGranulepos == granulepos && 0 == memcmp(copyData, data, bytes),
+              "packet %i differs in the copy", i);
+    }
+
+    // a packet contains the frames up to (but not including) its granulepos
+    static const int positions[][2] = { { 0, 0 }, { 199, 0 }, { 200, 1 }, { 201, 1 }, { 1199, 5 }, { 1200, 6 }, { 1249, 6 }, { 1250, 7 }, { 100000, 7 } };
+    for (i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        const int index = twtw_speex_packet_store_find_packet (store, positions[i][0]);
+        CHECK(index == positions[i][1], "position %i is in packet %i, expected %i", positions[i][0], index, positions[i][1]);
+    }
+
+    twtw_speex_packet_store_destroy (copy);
+    twtw_speex_packet_store_destroy (store);
+}
+
+// M_PI isn't defined in strict C99
+#define TEST_PI  3.14159265358979323846
+
+// a few seconds of a voice-like signal without pauses, so the encoder doesn't trim anything
+static short *createTestSound (int frames)
+{
+    short *pcm = g_malloc(frames * sizeof(short));
+    int i;
+    for (i = 0; i < frames; i++) {
+        const double t = (double)i / TWTW_PCM_SAMPLERATE;
+        const double pitch = 140.0 + 40.0 * sin(2.0 * TEST_PI * 0.7 * t);
+        const double env = 0.6 + 0.4 * sin(2.0 * TEST_PI * 3.0 * t);
+        const double v = env * (sin(2.0 * TEST_PI * pitch * t) + 0.5 * sin(2.0 * TEST_PI * 2.0 * pitch * t) + 0.25 * sin(2.0 * TEST_PI * 3.0 * pitch * t));
+        pcm[i] = (short)(v * 6000.0) + (short)(nextRand() % 201 - 100);
+    }
+    return pcm;
+}
+
+static double differenceEnergy (const short *a, const short *b, int frames)
+{
+    double sum = 0.0;
+    int i;
+    for (i = 0; i < frames; i++) {
+        const double d = (double)a[i] - (double)b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+// the decoder starts a packet early, so it has mostly caught up with the one-shot decode by the time the output begins
+#define MAX_SEEK_ERROR  8
+
+// the decoder's output must be lined up with the original sound, and after seeking the same frames must come out
+// as when decoding from the start
+static void testSpeexDecoderSeek ()
+{
+    const int frames = 3 * TWTW_PCM_SAMPLERATE + 123;
+    short *pcm = createTestSound (frames);
+
+    const int prevSilenceCompression = twtw_speex_silence_compression ();
+    twtw_speex_set_silence_compression (0);
+
+    // the encoder's output doesn't depend on how the data is written to it
+    TwtwSpeexPacketStore *packets = NULL, *chunkedPackets = NULL;
+    TwtwSpeexEncoder *enc = twtw_speex_encoder_create ();
+    twtw_speex_encoder_write (enc, pcm, frames);
+    twtw_speex_encoder_finish (enc, &packets);
+
+    enc = twtw_speex_encoder_create ();
+    int pos = 0;
+    while (pos < frames) {
+        const int n = MIN(frames - pos, 37 + (pos % 500));
+        twtw_speex_encoder_write (enc, pcm + pos, n);
+        pos += n;
+    }
+    twtw_speex_encoder_finish (enc, &chunkedPackets);
+
+    twtw_speex_set_silence_compression (prevSilenceCompression);
+
+    CHECK(packets && chunkedPackets, "encoding");
+    if ( !packets || !chunkedPackets) {
+        twtw_speex_packet_store_destroy (packets);
+        twtw_speex_packet_store_destroy (chunkedPackets);
+        g_free(pcm);
+        return;
+    }
+
+    int i, packetsMatch = (twtw_speex_packet_store_get_count (packets) == twtw_speex_packet_store_get_count (chunkedPackets));
+    for (i = 0; packetsMatch && i < twtw_speex_packet_store_get_count (packets); i++) {
+        int bytes = 0, chunkedBytes = 0;
+        ogg_int64_t granulepos = 0, chunkedGranulepos = 0;
+        const unsigned char *data = twtw_speex_packet_store_get_packet (packets, i, &bytes, &granulepos);
+        const unsigned char *chunkedData = twtw_speex_packet_store_get_packet (chunkedPackets, i, &chunkedBytes, &chunkedGranulepos);
+        packetsMatch = (bytes == chunkedBytes && granulepos == chunkedGranulepos && 0 == memcmp(data, chunkedData, bytes));
+    }
+    CHECK(packetsMatch, "chunked writes give different packets");
+    CHECK(twtw_speex_packet_store_get_length (packets) == frames, "encoded length %i, expected %i", (int)twtw_speex_packet_store_get_length (packets), frames);
+
+    // one-shot decode, read in blocks that don't line up with the packets
+    TwtwSpeexDecoder *dec = twtw_speex_decoder_create (packets);
+    CHECK(dec && twtw_speex_decoder_get_length (dec) == frames, "decoder length");
+
+    short *decoded = g_malloc0((frames + 1000) * sizeof(short));
+    int decodedFrames = 0, n;
+    while (decodedFrames < frames + 1000 && (n = twtw_speex_decoder_read (dec, decoded + decodedFrames, MIN(333, frames + 1000 - decodedFrames))) > 0)
+        decodedFrames += n;
+    CHECK(decodedFrames == frames, "decoded %i frames, expected %i", decodedFrames, frames);
+
+    // the codec delay is skipped: the output is closest to the original within a couple of frames (the codec doesn't keep
+    // the exact phase). the decoder's lookahead alone is 40 frames, so the search covers more than that
+    const int maxLag = 60;
+    int lag, bestLag = 0;
+    double bestDiff = -1.0;
+    for (lag = -maxLag; lag <= maxLag; lag++) {
+        const double diff = differenceEnergy (pcm + maxLag, decoded + maxLag + lag, frames - 2*maxLag);
+        if (bestDiff < 0.0 || diff < bestDiff) {
+            bestDiff = diff;
+            bestLag = lag;
+        }
+    }
+    CHECK(abs(bestLag) <= 2, "decoded sound is offset by %i frames", bestLag);
+
+    // seeking to the start is the same as a new decoder
+    short *seekBuf = g_malloc(1000 * sizeof(short));
+    twtw_speex_decoder_seek (dec, 0);
+    n = twtw_speex_decoder_read (dec, seekBuf, 1000);
+    CHECK(n == 1000 && 0 == memcmp(seekBuf, decoded, 1000 * sizeof(short)), "seek to 0 differs from the one-shot decode");
+
+    // speex frames are 160 frames, and packets are 10 speex frames; the last position is in the last packet
+    const int seekPositions[] = { 1, 159, 160, 1399, 1400, 1401, 1600, 5 * 1600 + 37, 12345, 20000, frames - 1 };
+    for (i = 0; i < sizeof(seekPositions) / sizeof(seekPositions[0]); i++) {
+        const int seekPos = seekPositions[i];
+        const int count = MIN(1000, frames - seekPos);
+        twtw_speex_decoder_seek (dec, seekPos);
+        CHECK(twtw_speex_decoder_get_position (dec) == seekPos, "position after seeking to %i", seekPos);
+
+        n = twtw_speex_decoder_read (dec, seekBuf, count);
+        CHECK(n == count, "read %i frames after seeking to %i, expected %i", n, seekPos, count);
+        CHECK(twtw_speex_decoder_get_position (dec) == seekPos + count, "position after reading from %i", seekPos);
+
+        int maxDiff = 0;
+        for (n = 0; n < count; n++)
+            maxDiff = MAX(maxDiff, abs((int)seekBuf[n] - (int)decoded[seekPos + n]));
+        CHECK(maxDiff <= MAX_SEEK_ERROR, "after seeking to %i, the output differs from the one-shot decode by %i", seekPos, maxDiff);
+    }
+
+    // seeking to the end leaves nothing to read
+    twtw_speex_decoder_seek (dec, frames);
+    CHECK(twtw_speex_decoder_read (dec, seekBuf, 100) == 0, "read after seeking to the end");
+
+    g_free(seekBuf);
+    g_free(decoded);
+    twtw_speex_decoder_destroy (dec);
+    twtw_speex_packet_store_destroy (chunkedPackets);
+    twtw_speex_packet_store_destroy (packets);
+    g_free(pcm);
+}
+
+
+int main (int argc, char **argv)
+{
+    testPhotoDPCM ();
+    testPhotoStreaming ();
+    testPhotoTiles ();
+    testPhotoTilesCorruptSizeTable ();
+    testDocumentSharedPhotos ();
+    testSpeexPacketStore ();
+    testSpeexDecoderSeek ();
+
+    printf("%i checks, %i failed\n", g_checkCount, g_failCount);
+    return (g_failCount > 0) ? 1 : 0;
+}
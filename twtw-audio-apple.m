@@ -52,6 +52,10 @@ typedef struct {
 	AudioFileID					recordFile;
 	AudioQueueRef				queue;
     
+    unsigned char *             recordBuffer;   // used instead of recordFile when recording into memory
+    size_t                      recordBufferSize;
+    size_t                      recordBufferCapacity;
+    
 	CFAbsoluteTime				queueStartTime;	
 	CFAbsoluteTime				queueStopTime;
 	SInt64						recordPacket; // current packet number in record file
@@ -63,13 +67,21 @@ typedef struct {
 typedef struct {
     AudioFileID                 playFile;
     AudioQueueRef               queue;
+    
+    // used instead of playFile when playing from memory or a streaming source
+    TwtwAudioPCMReadFunc        readFunc;
+    TwtwAudioPCMSeekFunc        seekFunc;
+    TwtwAudioPCMSourceDestroyFunc sourceDestroyFunc;
+    void *                      source;
 
 	AudioQueueBufferRef			buffers[kNumberPlayBuffers];
+    Boolean                     bufferIsIdle[kNumberPlayBuffers];  // not enqueued because the sound ran out
         
 	AudioStreamBasicDescription dataFormat;
     
 	CFAbsoluteTime				queueStartTime;
     CFAbsoluteTime				queueStopTime;
+    Float64                     duration;
     SInt64                      currentPacket;
     UInt32                      numPacketsToRead;
 } TwtwAQPlayer;
@@ -99,6 +111,14 @@ static TwtwPCMState g_pcmState = { 0, 0, NULL, NULL, NULL, NULL };
 
 static NSRecursiveLock *g_pcmStateLock = nil;
 
+// result of the last recording into memory, until it's taken by the client
+static unsigned char *g_recordedPCM = NULL;
+static size_t g_recordedPCMSize = 0;
+
+// receives the data as it's recorded
+static TwtwAudioPCMDataFunc g_recordDataFunc = NULL;
+static void *g_recordDataFuncUserData = NULL;
+
 
 #pragma mark --- init ---
 
@@ -208,7 +228,24 @@ static void aqRecord_InputBufferHandler(
             printf("    record packet: %i; record file: %p\n", (int)aqr->recordPacket, aqr->recordFile);
         }
         
-        if (inNumPackets > 0) {
+        if (inNumPackets > 0 && g_recordDataFunc) {
+            // one packet is one frame in our PCM format
+            g_recordDataFunc(g_recordDataFuncUserData, (const short *)inBuffer->mAudioData, inNumPackets);
+        }
+        
+        if (inNumPackets > 0 && !aqr->recordFile) {
+            // append to memory buffer (it's allocated for the whole recording duration, so this normally doesn't realloc)
+            size_t numBytes = inBuffer->mAudioDataByteSize;
+            if (aqr->recordBufferSize + numBytes > aqr->recordBufferCapacity) {
+                aqr->recordBufferCapacity = MAX(aqr->recordBufferCapacity * 2, aqr->recordBufferSize + numBytes);
+                aqr->recordBuffer = g_realloc(aqr->recordBuffer, aqr->recordBufferCapacity);
+            }
+            memcpy(aqr->recordBuffer + aqr->recordBufferSize, inBuffer->mAudioData, numBytes);
+            aqr->recordBufferSize += numBytes;
+            
+            aqr->recordPacket += inNumPackets;
+        }
+        else if (inNumPackets > 0) {
             // write packets to file
             err = AudioFileWritePackets(aqr->recordFile, FALSE, inBuffer->mAudioDataByteSize,
                                         inPacketDesc, aqr->recordPacket, &inNumPackets, inBuffer->mAudioData);
@@ -256,11 +293,20 @@ static void stopAQRecording()
         NSLog(@"** %s: AudioQueueStop failed (%i)", __func__, err);
     }
     
-    // a codec may update its cookie at the end of an encoding session, so reapply it to the file now
-    aqRecord_CopyEncoderCookieToFile(aqr->queue, aqr->recordFile);
+    if (aqr->recordFile) {
+        // a codec may update its cookie at the end of an encoding session, so reapply it to the file now
+        aqRecord_CopyEncoderCookieToFile(aqr->queue, aqr->recordFile);
+    }
     
     AudioQueueDispose(aqr->queue, TRUE);
-	AudioFileClose(aqr->recordFile);
+    
+    if (aqr->recordFile) {
+        AudioFileClose(aqr->recordFile);
+    } else {
+        g_free(g_recordedPCM);
+        g_recordedPCM = aqr->recordBuffer;
+        g_recordedPCMSize = aqr->recordBufferSize;
+    }
     
     free(g_pcmState.aqRecorder);
     g_pcmState.aqRecorder = NULL;
@@ -315,11 +361,9 @@ static NSString *printableOSStatusError(OSStatus error, const char *operation)
 
 
 
-int twtw_audio_pcm_record_to_path_utf8 (const char *path, size_t pathLen, int seconds, TwtwAudioCallbacks callbacks, void *cbData)
+// records into a file if path is given, otherwise into memory
+static int startAQRecording (const char *path, size_t pathLen, int seconds, TwtwAudioCallbacks callbacks, void *cbData)
 {
-    if ( !path || pathLen < 1 || seconds < 1)
-        return -1;
- 
     [g_pcmStateLock lock];
     BOOL stateIsOK = (g_pcmState.state == TwtwPCMIsIdle);
     [g_pcmStateLock unlock];
@@ -363,22 +407,26 @@ int twtw_audio_pcm_record_to_path_utf8 (const char *path, size_t pathLen, int se
         return err;
     }
 
-    CFURLRef url = CFURLCreateFromFileSystemRepresentation(NULL, (Byte *)path, pathLen, FALSE);
-    AudioFileTypeID audioFileType = kAudioFileWAVEType;
+    if (path) {
+        CFURLRef url = CFURLCreateFromFileSystemRepresentation(NULL, (Byte *)path, pathLen, FALSE);
+        AudioFileTypeID audioFileType = kAudioFileWAVEType;
+            
+        if ((err = AudioFileCreateWithURL(url, audioFileType, &recordFormat, kAudioFileFlags_EraseFile,
+                                          &aqr.recordFile)) != noErr) {
+            NSLog(@"** failed: %@", printableOSStatusError(err, "AudioFileCreateWithURL"));
+            return err;
+        }
         
-    if ((err = AudioFileCreateWithURL(url, audioFileType, &recordFormat, kAudioFileFlags_EraseFile,
-                                      &aqr.recordFile)) != noErr) {
-        NSLog(@"** failed: %@", printableOSStatusError(err, "AudioFileCreateWithURL"));
-        return err;
+        CFRelease(url);
+        url = NULL;
+        
+        // copy the cookie first to give the file object as much info as we can about the data going in
+        aqRecord_CopyEncoderCookieToFile(aqr.queue, aqr.recordFile);
+    } else {
+        aqr.recordBufferCapacity = (seconds + 1) * TWTW_PCM_SAMPLERATE * recordFormat.mBytesPerFrame;
+        aqr.recordBuffer = g_malloc(aqr.recordBufferCapacity);
     }
     
-    CFRelease(url);
-    url = NULL;
-    
-    
-    // copy the cookie first to give the file object as much info as we can about the data going in
-    aqRecord_CopyEncoderCookieToFile(aqr.queue, aqr.recordFile);
-    
 	// allocate and enqueue buffers
 	int bufferByteSize = aqRecord_ComputeRecordBufferSize(&recordFormat, aqr.queue, 0.5);	// enough bytes for half a second
     int i;
@@ -442,6 +490,43 @@ int twtw_audio_pcm_record_to_path_utf8 (const char *path, size_t pathLen, int se
     return 0;
 }
 
+int twtw_audio_pcm_record_to_path_utf8 (const char *path, size_t pathLen, int seconds, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if ( !path || pathLen < 1 || seconds < 1)
+        return -1;
+    
+    return startAQRecording (path, pathLen, seconds, callbacks, cbData);
+}
+
+int twtw_audio_pcm_record_to_buffer (int seconds, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if (seconds < 1)
+        return -1;
+    
+    return startAQRecording (NULL, 0, seconds, callbacks, cbData);
+}
+
+int twtw_audio_pcm_set_record_data_func (TwtwAudioPCMDataFunc func, void *userData)
+{
+    [g_pcmStateLock lock];
+    g_recordDataFunc = func;
+    g_recordDataFuncUserData = userData;
+    [g_pcmStateLock unlock];
+    return 0;
+}
+
+int twtw_audio_pcm_take_recorded_buffer (short **outPCMBuffer, size_t *outPCMBufferSize)
+{
+    if ( !outPCMBuffer || !outPCMBufferSize || !g_recordedPCM)
+        return -1;
+    
+    *outPCMBuffer = (short *)g_recordedPCM;
+    *outPCMBufferSize = g_recordedPCMSize;
+    g_recordedPCM = NULL;
+    g_recordedPCMSize = 0;
+    return 0;
+}
+
 
 #pragma mark --- playback ---
 
@@ -462,7 +547,10 @@ static void stopAQPlayback()
     }
     
     AudioQueueDispose(aqp->queue, TRUE);
-	AudioFileClose(aqp->playFile);
+    if (aqp->playFile)
+        AudioFileClose(aqp->playFile);
+    if (aqp->sourceDestroyFunc)
+        aqp->sourceDestroyFunc(aqp->source);
     
     free(g_pcmState.aqPlayer);
     
@@ -518,19 +606,38 @@ static void aqPlay_BufferHandler(void *userData, AudioQueueRef inAQ, AudioQueueB
         UInt32 numBytes = 0;
         UInt32 nPackets = aqp->numPacketsToRead;
         
-        OSStatus err = AudioFileReadPackets(aqp->playFile, FALSE, &numBytes, NULL, aqp->currentPacket, &nPackets,
-                                            inCompleteAQBuffer->mAudioData);
+        if (aqp->readFunc) {
+            // one packet is one frame in our PCM format
+            short *dst = (short *)inCompleteAQBuffer->mAudioData;
+            UInt32 framesRead = 0;
+            int n;
+            while (framesRead < nPackets && (n = aqp->readFunc(aqp->source, dst + framesRead, nPackets - framesRead)) > 0) {
+                framesRead += n;
+            }
+            nPackets = framesRead;
+            numBytes = nPackets * aqp->dataFormat.mBytesPerPacket;
+        }
+        else {
+            OSStatus err = AudioFileReadPackets(aqp->playFile, FALSE, &numBytes, NULL, aqp->currentPacket, &nPackets,
+                                                inCompleteAQBuffer->mAudioData);
 
-        if (err != noErr) {
-            NSLog(@"** %s failed: %@", __func__, printableOSStatusError(err, "AudioFileReadPackets"));
+            if (err != noErr) {
+                NSLog(@"** %s failed: %@", __func__, printableOSStatusError(err, "AudioFileReadPackets"));
+            }
+            //else NSLog(@"did read %i packets from audiofile", (int)nPackets);
+        }
+        
+        int i;
+        for (i = 0; i < kNumberPlayBuffers; i++) {
+            if (aqp->buffers[i] == inCompleteAQBuffer)
+                aqp->bufferIsIdle[i] = (nPackets > 0) ? FALSE : TRUE;
         }
-        //else NSLog(@"did read %i packets from audiofile", (int)nPackets);
         
         if (nPackets > 0) {
             inCompleteAQBuffer->mAudioDataByteSize = numBytes;
-
+            
             AudioQueueEnqueueBuffer(inAQ, inCompleteAQBuffer, 0, NULL);
-		
+            
             aqp->currentPacket += nPackets;            
         } else {
             shouldStop = YES;
@@ -580,14 +687,49 @@ static void calculateBytesForTime(AudioStreamBasicDescription *inDesc, UInt32 in
 }
 
 
-int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAudioCallbacks callbacks, void *cbData)
+// moves the read position of the file or source; called with g_pcmStateLock held.
+// the timer's start and stop times are set so that the elapsed time is reported from the new position
+static int setAQPlayerPosition(TwtwAQPlayer *aqp, double timeInSecs)
+{
+    timeInSecs = MAX(0.0, MIN(timeInSecs, aqp->duration));
+    
+    if (aqp->playFile) {
+        // packets in a PCM file are frames
+        UInt32 framesPerPacket = MAX(1, aqp->dataFormat.mFramesPerPacket);
+        aqp->currentPacket = (SInt64)(timeInSecs * aqp->dataFormat.mSampleRate) / framesPerPacket;
+    }
+    else {
+        if ( !aqp->seekFunc)
+            return -1;
+        
+        size_t frame = (size_t)(timeInSecs * aqp->dataFormat.mSampleRate);
+        if (0 != aqp->seekFunc(aqp->source, frame))
+            return -1;
+        
+        aqp->currentPacket = frame;
+    }
+    
+    double now = CFAbsoluteTimeGetCurrent();
+    aqp->queueStartTime = now - timeInSecs;
+    aqp->queueStopTime = aqp->queueStartTime + aqp->duration;
+    return 0;
+}
+
+
+// plays from a file if path is given, otherwise from the source (which is owned by the player after this call)
+static int startAQPlayback (const char *path, size_t pathLen,
+                            TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSeekFunc seekFunc, TwtwAudioPCMSourceDestroyFunc destroyFunc,
+                            void *source, double sourceDuration, double startTime,
+                            TwtwAudioCallbacks callbacks, void *cbData)
 {
     [g_pcmStateLock lock];
     BOOL stateIsOK = (g_pcmState.state == TwtwPCMIsIdle);
     [g_pcmStateLock unlock];
     
     if ( !stateIsOK) {
-        NSLog(@"** %s: can't start recording, system is not idle (state: %i)", __func__, g_pcmState.state);
+        NSLog(@"** %s: can't start playback, system is not idle (state: %i)", __func__, g_pcmState.state);
+        if (destroyFunc)
+            destroyFunc(source);
         return -1;
     }
     
@@ -596,7 +738,35 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
 
     TwtwAQPlayer aqp;
     memset(&aqp, 0, sizeof(aqp));
-    OSStatus err;
+    OSStatus err = noErr;
+    UInt32 size;
+    BOOL okToPlay = NO;
+    Float64 duration = 0;
+    UInt32 maxPacketSize = 0;
+    
+    if ( !path) {
+        // same format as the recorder uses
+        aqp.dataFormat.mChannelsPerFrame = 1;
+        aqp.dataFormat.mSampleRate = TWTW_PCM_SAMPLERATE;
+        aqp.dataFormat.mBitsPerChannel = TWTW_PCM_SAMPLEBITS;
+        aqp.dataFormat.mFormatID = kAudioFormatLinearPCM;
+        aqp.dataFormat.mFormatFlags = kLinearPCMFormatFlagIsSignedInteger | kLinearPCMFormatFlagIsPacked;
+    #ifndef TWTW_PCM_LITTLE_ENDIAN
+        aqp.dataFormat.mFormatFlags |= kLinearPCMFormatFlagIsBigEndian;
+    #endif
+        aqp.dataFormat.mBytesPerPacket = aqp.dataFormat.mBytesPerFrame =
+                (aqp.dataFormat.mBitsPerChannel / 8) * aqp.dataFormat.mChannelsPerFrame;
+        aqp.dataFormat.mFramesPerPacket = 1;
+        
+        aqp.readFunc = readFunc;
+        aqp.seekFunc = seekFunc;
+        aqp.sourceDestroyFunc = destroyFunc;
+        aqp.source = source;
+        
+        duration = sourceDuration;
+        maxPacketSize = aqp.dataFormat.mBytesPerPacket;
+        goto createQueue;
+    }
     
     CFURLRef sndFile = CFURLCreateFromFileSystemRepresentation (NULL, (const UInt8 *)path, pathLen, FALSE);
     
@@ -605,8 +775,6 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
         return -50;
     }
     
-    BOOL okToPlay = NO;
-    
     err = AudioFileOpenURL(sndFile, 0x1/*fsRdPerm*/, 0/*inFileTypeHint*/, &aqp.playFile);
     
     CFRelease(sndFile);
@@ -617,19 +785,22 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
         return err;
     }
     
-    UInt32 size = sizeof(aqp.dataFormat);
+    size = sizeof(aqp.dataFormat);
     if ((err = AudioFileGetProperty(aqp.playFile, kAudioFilePropertyDataFormat, &size, &aqp.dataFormat)) != noErr) {
         NSLog(@"** failed: %@", printableOSStatusError(err, "getDataFormat"));
         goto bail;
     }
     
-    Float64 duration = 0;
     size = sizeof(duration);
     if ((err = AudioFileGetProperty(aqp.playFile, kAudioFilePropertyEstimatedDuration, &size, &duration)) != noErr) {
         NSLog(@"** failed: %@", printableOSStatusError(err, "getDuration"));
         goto bail;
     }
     
+    size = sizeof(maxPacketSize);
+    AudioFileGetProperty(aqp.playFile, kAudioFilePropertyPacketSizeUpperBound, &size, &maxPacketSize);
+    
+createQueue:
     
     ///NSLog(@"%s: sample rate is %.2f; formatID %i, bitsPerCh %i; duration %.3f",
     ///        __func__, aqp.dataFormat.mSampleRate, aqp.dataFormat.mFormatID, aqp.dataFormat.mBitsPerChannel, duration);
@@ -644,16 +815,13 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
     }
 
     UInt32 bufferByteSize = 0;
-    UInt32 maxPacketSize = 0;
-    size = sizeof(maxPacketSize);
-    AudioFileGetProperty(aqp.playFile, kAudioFilePropertyPacketSizeUpperBound, &size, &maxPacketSize);
     
     // adjust buffer size to represent about a half second of audio based on this format
     calculateBytesForTime (&aqp.dataFormat, maxPacketSize, 0.5/*seconds*/, &bufferByteSize, &aqp.numPacketsToRead);
 
     // not all formats use a cookie
     size = sizeof(UInt32);
-    err = AudioFileGetPropertyInfo(aqp.playFile, kAudioFilePropertyMagicCookieData, &size, NULL);
+    err = (aqp.playFile) ? AudioFileGetPropertyInfo(aqp.playFile, kAudioFilePropertyMagicCookieData, &size, NULL) : -1;
     
     if (err == noErr && size) {
         char cookie[size];
@@ -665,7 +833,7 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
             NSLog(@"** setting audio queue cookie failed (%i)", err);
     }
 
-    err = AudioFileGetPropertyInfo(aqp.playFile, kAudioFilePropertyChannelLayout, &size, NULL);
+    err = (aqp.playFile) ? AudioFileGetPropertyInfo(aqp.playFile, kAudioFilePropertyChannelLayout, &size, NULL) : -1;
     if (err == noErr && size > 0) {
         AudioChannelLayout *acl = (AudioChannelLayout *)malloc(size);
         
@@ -680,9 +848,18 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
     g_pcmState.didComplete = NO;
     g_pcmState.aqPlayer = malloc(sizeof(TwtwAQPlayer));
     memcpy(g_pcmState.aqPlayer, &aqp, sizeof(TwtwAQPlayer));
-
+    g_pcmState.aqPlayer->duration = duration;
+    
     // prime the queue with some data before starting
     g_pcmState.aqPlayer->currentPacket = 0;
+    if (startTime > 0.0) {
+        if (0 == setAQPlayerPosition(g_pcmState.aqPlayer, startTime))
+            startTime = MIN(startTime, duration);
+        else {
+            NSLog(@"** %s: can't start playback at %.3f s, source is not seekable", __func__, startTime);
+            startTime = 0.0;
+        }
+    }
     int i;
     for (i = 0; i < kNumberPlayBuffers; i++) {
         AudioQueueAllocateBuffer(aqp.queue, bufferByteSize, &(g_pcmState.aqPlayer->buffers[i]));
@@ -713,7 +890,8 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
     
     
     g_pcmState.state = TwtwPCMIsPlaying;
-    g_pcmState.aqPlayer->queueStartTime = CFAbsoluteTimeGetCurrent();
+    
+    g_pcmState.aqPlayer->queueStartTime = CFAbsoluteTimeGetCurrent() - MAX(0.0, startTime);
     g_pcmState.aqPlayer->queueStopTime = g_pcmState.aqPlayer->queueStartTime + duration;
     
     err = AudioQueueStart(aqp.queue, NULL);
@@ -751,7 +929,10 @@ int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAu
 bail:
     if ( !okToPlay) {
         AudioQueueDispose(aqp.queue, TRUE);
-        AudioFileClose(aqp.playFile);
+        if (aqp.playFile)
+            AudioFileClose(aqp.playFile);
+        if (aqp.sourceDestroyFunc)
+            aqp.sourceDestroyFunc(aqp.source);
         
         if (g_pcmState.aqPlayer)
             free(g_pcmState.aqPlayer);
@@ -765,6 +946,114 @@ bail:
     }
 }
 
+int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if ( !path || pathLen < 1)
+        return -1;
+    
+    return startAQPlayback (path, pathLen, NULL, NULL, NULL, NULL, 0.0, 0.0, callbacks, cbData);
+}
+
+int twtw_audio_pcm_play_from_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                     double durationInSecs, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if ( !readFunc) {
+        if (destroyFunc)
+            destroyFunc(source);
+        return -1;
+    }
+    
+    return startAQPlayback (NULL, 0, readFunc, NULL, destroyFunc, source, durationInSecs, 0.0, callbacks, cbData);
+}
+
+int twtw_audio_pcm_play_from_seekable_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSeekFunc seekFunc,
+                                              TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                              double durationInSecs, double startTimeInSecs,
+                                              TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if ( !readFunc || !seekFunc) {
+        if (destroyFunc)
+            destroyFunc(source);
+        return -1;
+    }
+    
+    return startAQPlayback (NULL, 0, readFunc, seekFunc, destroyFunc, source, durationInSecs, startTimeInSecs, callbacks, cbData);
+}
+
+
+// source for twtw_audio_pcm_play_buffer
+typedef struct {
+    short *pcm;
+    size_t numFrames;
+    size_t pos;
+} TwtwPCMBufferSource;
+
+static int pcmBufferSource_Read (void *source, short *dst, int frames)
+{
+    TwtwPCMBufferSource *src = (TwtwPCMBufferSource *)source;
+    int n = MIN((size_t)frames, src->numFrames - src->pos);
+    
+    memcpy(dst, src->pcm + src->pos, n * sizeof(short));
+    src->pos += n;
+    return n;
+}
+
+static int pcmBufferSource_Seek (void *source, size_t frame)
+{
+    TwtwPCMBufferSource *src = (TwtwPCMBufferSource *)source;
+    src->pos = MIN(frame, src->numFrames);
+    return 0;
+}
+
+static void pcmBufferSource_Destroy (void *source)
+{
+    TwtwPCMBufferSource *src = (TwtwPCMBufferSource *)source;
+    g_free(src->pcm);
+    g_free(src);
+}
+
+int twtw_audio_pcm_play_buffer (const short *pcmBuffer, size_t pcmBufferSize, TwtwAudioCallbacks callbacks, void *cbData)
+{
+    if ( !pcmBuffer || pcmBufferSize < sizeof(short))
+        return -1;
+    
+    TwtwPCMBufferSource *src = g_malloc0(sizeof(TwtwPCMBufferSource));
+    src->numFrames = pcmBufferSize / sizeof(short);
+    src->pcm = g_malloc(src->numFrames * sizeof(short));
+    memcpy(src->pcm, pcmBuffer, src->numFrames * sizeof(short));
+    
+    double duration = (double)src->numFrames / TWTW_PCM_SAMPLERATE;
+    
+    return startAQPlayback (NULL, 0, pcmBufferSource_Read, pcmBufferSource_Seek, pcmBufferSource_Destroy, src, duration, 0.0, callbacks, cbData);
+}
+
+
+int twtw_audio_pcm_seek (double timeInSecs)
+{
+    [g_pcmStateLock lock];
+    
+    TwtwAQPlayer *aqp = (g_pcmState.state == TwtwPCMIsPlaying) ? g_pcmState.aqPlayer : NULL;
+    int result = (aqp) ? setAQPlayerPosition(aqp, timeInSecs) : -1;
+    
+    if (result == 0) {
+        g_pcmState.didComplete = NO;
+        
+        // throw away the audio that was queued from the old position. the queue calls the buffer handler
+        // for the flushed buffers, which refills them from the new position
+        AudioQueueReset(aqp->queue);
+        
+        // buffers that were left out when the sound ran out need to be restarted here
+        int i;
+        for (i = 0; i < kNumberPlayBuffers; i++) {
+            if (aqp->bufferIsIdle[i])
+                aqPlay_BufferHandler(NULL, aqp->queue, aqp->buffers[i]);
+        }
+    }
+    
+    [g_pcmStateLock unlock];
+    return result;
+}
+
 
 void twtw_audio_pcm_stop ()
 {
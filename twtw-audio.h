@@ -70,6 +70,46 @@ int twtw_audio_pcm_record_to_path_utf8 (const char *path, size_t pathLen, int se
 
 int twtw_audio_pcm_play_from_path_utf8 (const char *path, size_t pathLen, TwtwAudioCallbacks callbacks, void *cbData);
 
+// the same without files (not supported by all backends; these return -1 if so).
+// when recording into memory, the data is picked up with twtw_audio_pcm_take_recorded_buffer() in the audioCompletedFunc callback
+// and must be freed with g_free(). for playback, the PCM data is copied
+int twtw_audio_pcm_record_to_buffer (int seconds, TwtwAudioCallbacks callbacks, void *cbData);
+int twtw_audio_pcm_take_recorded_buffer (short **outPCMBuffer, size_t *outPCMBufferSize);
+
+int twtw_audio_pcm_play_buffer (const short *pcmBuffer, size_t pcmBufferSize, TwtwAudioCallbacks callbacks, void *cbData);
+
+// while recording, the PCM data is also passed to this function as it comes in (on the audio thread),
+// e.g. for encoding it in the background with twtw_speex_encoder_write(). set to NULL when the recording is done.
+// not supported by all backends (returns -1 if so)
+typedef void (*TwtwAudioPCMDataFunc) (void *userData, const short *pcm, int frames);
+
+int twtw_audio_pcm_set_record_data_func (TwtwAudioPCMDataFunc func, void *userData);
+
+// streaming playback: the backend fills its buffers by calling readFunc as it goes, so playback can start before
+// the whole sound is available (e.g. while it's being decoded with twtw_speex_decoder_read).
+// readFunc returns the number of frames written into dst, 0 at end of sound. the source is destroyed with destroyFunc
+// when playback ends, or immediately if it can't be started. not supported by all backends (returns -1 if so)
+typedef int (*TwtwAudioPCMReadFunc) (void *source, short *dst, int frames);
+typedef void (*TwtwAudioPCMSourceDestroyFunc) (void *source);
+
+int twtw_audio_pcm_play_from_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                     double durationInSecs, TwtwAudioCallbacks callbacks, void *cbData);
+
+// the same for a source that can be repositioned: playback starts at startTimeInSecs, and twtw_audio_pcm_seek() works.
+// seekFunc moves the source so that the next read starts at the given frame, and returns 0 on success.
+// it's called while the backend holds its lock, so it should be cheap (twtw_speex_decoder_seek only resets the decoder
+// to the packet before the frame; the decoding happens in the following reads)
+typedef int (*TwtwAudioPCMSeekFunc) (void *source, size_t frame);
+
+int twtw_audio_pcm_play_from_seekable_source (TwtwAudioPCMReadFunc readFunc, TwtwAudioPCMSeekFunc seekFunc,
+                                              TwtwAudioPCMSourceDestroyFunc destroyFunc, void *source,
+                                              double durationInSecs, double startTimeInSecs,
+                                              TwtwAudioCallbacks callbacks, void *cbData);
+
+// moves the position of the sound that's playing; works for files, buffers and seekable sources.
+// the progress callback reports time from the new position. returns -1 if nothing is playing or the source can't seek
+int twtw_audio_pcm_seek (double timeInSecs);
+
 void twtw_audio_pcm_stop ();
 
 
@@ -27,12 +27,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifndef __WIN32__
+#include <sys/time.h>
+#endif
 #include <speex/speex.h>
 #include <speex/speex_header.h>
 #include <speex/speex_stereo.h>
 #include <speex/speex_preprocess.h>
+#include <speex/speex_resampler.h>
 #include <oggz/oggz.h>
 
+#include "twtw-audio.h"
 #include "twtw-audio-wavfile.h"
 #include "twtw-byteorder.h"
 #include "twtw-filesystem.h"
@@ -42,6 +49,16 @@
 #define MAX_FRAME_SIZE 3200
 #define MAX_FRAME_BYTES 3200
 
+// PCM files are read in blocks of this many samples (one second)
+#define PCM_READ_BLOCK_SAMPLES 8000
+
+// WAV files are imported in blocks of this many source frames
+#define PCM_IMPORT_BLOCK_FRAMES 4096
+
+#if defined(WORDS_BIGENDIAN) && defined(__ALTIVEC__)
+ #include <altivec.h>
+#endif
+
 
 
 typedef struct _TwtwPCMInfo {
@@ -51,6 +68,54 @@ typedef struct _TwtwPCMInfo {
 } TwtwPCMInfo;
 
 
+typedef struct _TwtwSpeexPacket {
+    size_t offset;      // in TwtwSpeexPacketStore.data
+    int bytes;
+    ogg_int64_t granulepos;
+    int e_o_s;
+} TwtwSpeexPacket;
+
+struct _TwtwSpeexPacketStore {
+    TwtwSpeexPacket *packets;
+    int packetCount;
+    int packetCapacity;
+    unsigned char *data;
+    size_t dataSize;
+    size_t dataCapacity;
+    
+    ogg_int64_t trimmedStart;  // see trimSilentPackets()
+};
+
+struct _TwtwWaveformPeaks {
+    signed char *data;  // min, max pairs
+    size_t count;
+    size_t capacity;
+    int periodFrames;   // frames that have gone into the last pair
+};
+
+struct _TwtwPCMImport {
+    FILE *file;
+    TwtwPCMInfo pcmInfo;
+    long srcFramesLeft;
+    long srcFramesRead;
+    gboolean srcAtEOF;
+    
+    // NULL if the file is already at TWTW_PCM_SAMPLERATE
+    SpeexResamplerState *resampler;
+    int flushFramesLeft;    // zeros fed to the resampler after the end of the file to get the rest of its output
+    
+    size_t length;
+    size_t position;
+    
+    // source frames mixed to mono but not yet passed to the resampler
+    short mono[PCM_IMPORT_BLOCK_FRAMES];
+    int monoFill;
+    int monoPos;
+    
+    unsigned char raw[PCM_IMPORT_BLOCK_FRAMES * 2 * sizeof(short)];
+};
+
+
 typedef struct _TwtwSpeexState
 {
     gint mode;
@@ -59,6 +124,31 @@ typedef struct _TwtwSpeexState
     TwtwPCMInfo pcmInfo;
     int32_t fileDataLeft;
     
+    // when encoding from a file, the source converted to the format in twtw-audio.h
+    TwtwPCMImport *pcmImport;
+    
+    // when encoding from memory, the source PCM data (not owned by the state)
+    const unsigned char *pcmData;
+    size_t pcmDataSize;
+    size_t pcmDataRead;
+    
+    // when encoding from a file, the PCM is read in blocks and frames are handed out from the block
+    short *readBuf;
+    int readBufFill;
+    int readBufPos;
+    gboolean readAtEOF;
+    
+    // frame handed out when encoding from memory (the source can't be modified by the preprocessor)
+    short frameBuf[MAX_FRAME_SIZE];
+    
+    // when only collecting the speex data, nothing is decoded (pcmBytesWritten is still updated)
+    gboolean collectOnly;
+    
+    // when decoding to memory, the decoded PCM data
+    gboolean decodeToBuffer;
+    unsigned char *pcmOut;
+    size_t pcmOutCapacity;
+    
     SpeexHeader header;
 
     void *speexEncState;
@@ -73,127 +163,358 @@ typedef struct _TwtwSpeexState
     int packetsRead;
     int32_t pcmBytesWritten;
 
-    // when decoding, keep a copy of all decoded speex data so twtwpage can cache it.
-    // when encoding, this indicates that all the data is already available as speex encoded
-    unsigned char *speexData;
-    size_t speexDataSize;
-    size_t speexDataWritten;
+    // when encoding, this indicates that all the data is already available as speex encoded (not owned by the state)
+    const TwtwSpeexPacketStore *existingPackets;
+    
+    // when compressing silence, the first and last frames where the encoder's VAD found speech (-1 if none)
+    gboolean compressSilence;
+    long firstSpeechFrame;
+    long lastSpeechFrame;
+    int speechRun;
+    
+    // when encoding, the output of twtw_speex_encode_all_data().
+    // when decoding, a copy of all the packets read so twtwpage can cache them
+    gboolean isEncoded;
+    TwtwSpeexPacketStore *packets;
 } TwtwSpeexState;
 
 
 
-// this function is borrowed from speexenc.c
-static int readPCMSamples(FILE *fin, TwtwPCMInfo *pcmInfo, const int frame_size, short *input, char *buff, int32_t *size)
-{   
-   unsigned char in[MAX_FRAME_BYTES*2];
-   int i;
-   short *s;
-   int nb_read;
-   
-   const int lsb = 1;  // data is always LSB right now
-   const int channels = pcmInfo->numChannels;
-   const int rate = pcmInfo->sampleRate;
-   const int bits = pcmInfo->dataFormat;
-   g_return_val_if_fail(rate > 0, -1);
-   g_return_val_if_fail(bits > 0, -1);
-   g_return_val_if_fail(channels > 0, -1);
-
-   if (size && *size<=0) {
-      return 0;
-   }
-   
-   /*Read input audio*/
-   if (size)
-      *size -= bits/8*channels*frame_size;
-   if (buff)
-   {
-      for (i=0;i<12;i++)
-         in[i]=buff[i];
-      nb_read = fread(in+12,1,bits/8*channels*frame_size-12, fin) + 12;
-      if (size)
-         *size += 12;
-   } else {
-      nb_read = fread(in,1,bits/8*channels* frame_size, fin);
-   }
-   nb_read /= bits/8*channels;
-
-   /*fprintf (stderr, "%d\n", nb_read);*/
-   if (nb_read==0)
-      return 0;
-
-   s=(short*)in;
-   if(bits==8)
-   {
-      /* Convert 8->16 bits */
-      for(i=frame_size*channels-1;i>=0;i--)
-      {
-         s[i]=(in[i]<<8)^0x8000;
-      }
-   } else
-   {
-      /* convert to our endian format */
-      for(i=0;i<frame_size*channels;i++)
-      {
-         if(lsb) 
-            s[i]=_le_16(s[i]); 
-         else
-            s[i]=_be_16(s[i]);
-      }
-   }
+#ifdef __APPLE__
+#pragma mark --- packet store ---
+#endif
 
-   /* FIXME: This is probably redundent now */
-   /* copy to float input buffer */
-   for (i=0;i<frame_size*channels;i++)
-   {
-      input[i]=(short)s[i];
-   }
+TwtwSpeexPacketStore *twtw_speex_packet_store_create ()
+{
+    return g_malloc0(sizeof(TwtwSpeexPacketStore));
+}
 
-   for (i=nb_read*channels;i<frame_size*channels;i++)
-   {
-      input[i]=0;
-   }
+TwtwSpeexPacketStore *twtw_speex_packet_store_copy (const TwtwSpeexPacketStore *store)
+{
+    g_return_val_if_fail(store, NULL);
+    
+    TwtwSpeexPacketStore *copy = g_malloc0(sizeof(TwtwSpeexPacketStore));
+    if (store->packetCount > 0) {
+        copy->packetCount = copy->packetCapacity = store->packetCount;
+        copy->packets = g_malloc(store->packetCount * sizeof(TwtwSpeexPacket));
+        memcpy(copy->packets, store->packets, store->packetCount * sizeof(TwtwSpeexPacket));
+        
+        copy->dataSize = copy->dataCapacity = store->dataSize;
+        copy->data = g_malloc(MAX(store->dataSize, 1));
+        memcpy(copy->data, store->data, store->dataSize);
+    }
+    copy->trimmedStart = store->trimmedStart;
+    return copy;
+}
 
+void twtw_speex_packet_store_destroy (TwtwSpeexPacketStore *store)
+{
+    if ( !store) return;
+    
+    g_free(store->packets);
+    g_free(store->data);
+    g_free(store);
+}
 
-   return nb_read;
+void twtw_speex_packet_store_append (TwtwSpeexPacketStore *store, const unsigned char *data, int bytes, ogg_int64_t granulepos, int eos)
+{
+    g_return_if_fail(store);
+    g_return_if_fail(data || bytes < 1);
+    
+    bytes = MAX(bytes, 0);
+    
+    // both buffers grow geometrically, so appending a packet is amortized constant time
+    if (store->packetCount >= store->packetCapacity) {
+        store->packetCapacity = MAX(store->packetCapacity * 2, 64);
+        store->packets = g_realloc(store->packets, store->packetCapacity * sizeof(TwtwSpeexPacket));
+    }
+    if (store->dataSize + bytes > store->dataCapacity) {
+        store->dataCapacity = MAX(store->dataCapacity * 2, store->dataSize + bytes + 4096);
+        store->data = g_realloc(store->data, store->dataCapacity);
+    }
+    
+    TwtwSpeexPacket *packet = store->packets + store->packetCount;
+    packet->offset = store->dataSize;
+    packet->bytes = bytes;
+    packet->granulepos = granulepos;
+    packet->e_o_s = eos;
+    
+    if (bytes > 0)
+        memcpy(store->data + store->dataSize, data, bytes);
+    store->dataSize += bytes;
+    store->packetCount++;
 }
 
+int twtw_speex_packet_store_get_count (const TwtwSpeexPacketStore *store)
+{
+    g_return_val_if_fail(store, 0);
+    return store->packetCount;
+}
 
-#define TWTW_SPEEX_NUMFRAMES    10
-#define TWTW_SPEEX_MODEID       SPEEX_MODEID_NB
-#define TWTW_SPEEX_COMPLEXITY   3
-#define TWTW_SPEEX_QUALITY      1
-#define TWTW_SPEEX_RATE         8000
+size_t twtw_speex_packet_store_get_data_size (const TwtwSpeexPacketStore *store)
+{
+    g_return_val_if_fail(store, 0);
+    return store->dataSize;
+}
 
+const unsigned char *twtw_speex_packet_store_get_packet (const TwtwSpeexPacketStore *store, int index, int *outBytes, ogg_int64_t *outGranulepos)
+{
+    g_return_val_if_fail(store, NULL);
+    g_return_val_if_fail(index >= 0 && index < store->packetCount, NULL);
+    
+    const TwtwSpeexPacket *packet = store->packets + index;
+    if (outBytes) *outBytes = packet->bytes;
+    if (outGranulepos) *outGranulepos = packet->granulepos;
+    return store->data + packet->offset;
+}
 
-int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t srcPathLen,
-                                               TwtwSpeexStatePtr *outState)
+ogg_int64_t twtw_speex_packet_store_get_length (const TwtwSpeexPacketStore *store)
 {
-    g_return_val_if_fail(srcPath, TWTW_PARAMERR);
-    g_return_val_if_fail(outState, TWTW_PARAMERR);
+    g_return_val_if_fail(store, 0);
+    
+    if (store->packetCount < 1)
+        return 0;
+    return MAX(store->packets[store->packetCount - 1].granulepos, 0);
+}
 
-    spx_int32_t vbr_enabled=0;
-    //spx_int32_t vbr_max=0;
-    //int abr_enabled=0;
-    //spx_int32_t vad_enabled=0;
-    //spx_int32_t dtx_enabled=0;
+ogg_int64_t twtw_speex_packet_store_get_trimmed_start (const TwtwSpeexPacketStore *store)
+{
+    g_return_val_if_fail(store, 0);
     
-    // frames per packet
-    int nframes = TWTW_SPEEX_NUMFRAMES;
+    return store->trimmedStart;
+}
+
+// the encoder's delay (its lookahead plus the preprocessor's frame) is implied by the granulepos of the first packet,
+// since all packets but the last are full. a single packet doesn't tell, so the delay of our own encoder is assumed
+static long delayOfPackets (const TwtwSpeexPacketStore *store, long packetFrames, long defaultDelay)
+{
+    if (store->packetCount >= 2) {
+        long delay = packetFrames - (long)store->packets[0].granulepos;
+        if (delay >= 0 && delay < packetFrames)
+            return delay;
+    }
+    return defaultDelay;
+}
+
+// the length given by the granulepos, limited to what the packets decode to (older files may have too large values)
+static size_t decodedLengthOfPackets (const TwtwSpeexPacketStore *store, long packetFrames, long delay)
+{
+    ogg_int64_t decodableLength = (ogg_int64_t)store->packetCount * packetFrames - delay;
+    return MAX(0, MIN(twtw_speex_packet_store_get_length (store), decodableLength));
+}
+
+int twtw_speex_packet_store_find_packet (const TwtwSpeexPacketStore *store, ogg_int64_t samplePos)
+{
+    g_return_val_if_fail(store, 0);
     
-    SpeexPreprocessState *preprocess = NULL;
-    int denoise_enabled = TRUE;
-    int agc_enabled = TRUE;  // automatic gain control
+    // binary search for the first packet that ends after samplePos (granulepos is the position at the end of a packet)
+    int lo = 0;
+    int hi = store->packetCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (store->packets[mid].granulepos <= samplePos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- waveform overview ---
+#endif
+
+TwtwWaveformPeaks *twtw_waveform_peaks_create ()
+{
+    return g_malloc0(sizeof(TwtwWaveformPeaks));
+}
+
+TwtwWaveformPeaks *twtw_waveform_peaks_create_from_data (const signed char *data, size_t count)
+{
+    g_return_val_if_fail(data || count < 1, NULL);
+    
+    TwtwWaveformPeaks *peaks = g_malloc0(sizeof(TwtwWaveformPeaks));
+    if (count > 0) {
+        peaks->count = peaks->capacity = count;
+        peaks->data = g_malloc(count * 2);
+        memcpy(peaks->data, data, count * 2);
+        
+        // the length of the last period isn't stored; anything appended starts a new pair
+        peaks->periodFrames = TWTW_WAVEFORM_PEAK_FRAMES;
+    }
+    return peaks;
+}
+
+TwtwWaveformPeaks *twtw_waveform_peaks_copy (const TwtwWaveformPeaks *peaks)
+{
+    g_return_val_if_fail(peaks, NULL);
     
+    TwtwWaveformPeaks *copy = twtw_waveform_peaks_create_from_data (peaks->data, peaks->count);
+    copy->periodFrames = peaks->periodFrames;
+    return copy;
+}
+
+void twtw_waveform_peaks_destroy (TwtwWaveformPeaks *peaks)
+{
+    if ( !peaks) return;
     
-    const char *speex_version = NULL;
-    speex_lib_ctl(SPEEX_LIB_GET_VERSION_STRING, (void*)&speex_version);
+    g_free(peaks->data);
+    g_free(peaks);
+}
+
+void twtw_waveform_peaks_append_pcm (TwtwWaveformPeaks *peaks, const short *pcm, size_t frames)
+{
+    g_return_if_fail(peaks);
+    g_return_if_fail(pcm || frames < 1);
+    
+    size_t i = 0;
+    while (i < frames) {
+        if (peaks->count == 0 || peaks->periodFrames >= TWTW_WAVEFORM_PEAK_FRAMES) {
+            if (peaks->count >= peaks->capacity) {
+                peaks->capacity = MAX(peaks->capacity * 2, 256);
+                peaks->data = g_realloc(peaks->data, peaks->capacity * 2);
+            }
+            peaks->data[peaks->count * 2] = 127;
+            peaks->data[peaks->count * 2 + 1] = -128;
+            peaks->count++;
+            peaks->periodFrames = 0;
+        }
+        
+        size_t n = MIN(frames - i, (size_t)(TWTW_WAVEFORM_PEAK_FRAMES - peaks->periodFrames));
+        const short *src = pcm + i;
+        int lo = 32767;
+        int hi = -32768;
+        size_t j;
+        for (j = 0; j < n; j++) {
+            int v = _le_16_s (src[j]);  // PCM buffers are LSB (see twtw-audio.h)
+            lo = MIN(lo, v);
+            hi = MAX(hi, v);
+        }
+        
+        // 16-bit range is stored as 8 bits
+        signed char *pair = peaks->data + (peaks->count - 1) * 2;
+        pair[0] = MIN(pair[0], lo >> 8);
+        pair[1] = MAX(pair[1], hi >> 8);
+        
+        peaks->periodFrames += n;
+        i += n;
+    }
+}
+
+size_t twtw_waveform_peaks_get_count (const TwtwWaveformPeaks *peaks)
+{
+    g_return_val_if_fail(peaks, 0);
+    return peaks->count;
+}
+
+const signed char *twtw_waveform_peaks_get_data (const TwtwWaveformPeaks *peaks)
+{
+    g_return_val_if_fail(peaks, NULL);
+    return peaks->data;
+}
 
-    printf("going to encode using speex, version is: '%s'\n", speex_version);
 
-    FILE *file = twtw_open_readb_utf8(srcPath, srcPathLen);
+#ifdef __APPLE__
+#pragma mark --- PCM import ---
+#endif
+
+// converts between the LSB format of twtw-audio.h and host byte order; the conversion is the same both ways
+#if defined(WORDS_BIGENDIAN)
+
+static void convertPCMByteOrderLE (short *buf, size_t count)
+{
+    size_t i = 0;
+    
+#if defined(__ALTIVEC__)
+    const vector unsigned char swapPerm = (vector unsigned char){ 1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14 };
+    
+    for ( ; i < count && ((uintptr_t)(buf + i) & 15); i++) {
+        buf[i] = (short)_le_16((uint16_t)buf[i]);
+    }
+    for ( ; i + 8 <= count; i += 8) {
+        vector unsigned char v = vec_ld(0, (unsigned char *)(buf + i));
+        vec_st(vec_perm(v, v, swapPerm), 0, (unsigned char *)(buf + i));
+    }
+#endif
+
+    for ( ; i < count && ((uintptr_t)(buf + i) & 3); i++) {
+        buf[i] = (short)_le_16((uint16_t)buf[i]);
+    }
+    // two samples at a time
+    for ( ; i + 2 <= count; i += 2) {
+        uint32_t v = *((uint32_t *)(buf + i));
+        *((uint32_t *)(buf + i)) = ((v & 0x00ff00ffU) << 8) | ((v >> 8) & 0x00ff00ffU);
+    }
+    for ( ; i < count; i++) {
+        buf[i] = (short)_le_16((uint16_t)buf[i]);
+    }
+}
+
+#else
+ #define convertPCMByteOrderLE(buf_, count_)  // already in host order
+#endif
+
+
+// mixes the next block of the file to mono; returns FALSE at the end of the file
+static gboolean fillImportMonoBuffer (TwtwPCMImport *imp)
+{
+    const int numChannels = imp->pcmInfo.numChannels;
+    const int bytesPerSample = imp->pcmInfo.dataFormat / 8;
+    const int frameBytes = numChannels * bytesPerSample;
+    
+    long toRead = MIN(PCM_IMPORT_BLOCK_FRAMES, imp->srcFramesLeft);
+    long n = (toRead > 0 && !imp->srcAtEOF) ? fread(imp->raw, frameBytes, toRead, imp->file) : 0;
+    if (n < 1) {
+        imp->srcAtEOF = TRUE;
+        return FALSE;
+    }
+    imp->srcFramesLeft -= n;
+    imp->srcFramesRead += n;
+    
+    short *dst = imp->mono;
+    long i;
+    if (bytesPerSample == 2) {
+        const int16_t *src = (const int16_t *)imp->raw;
+        if (numChannels == 2) {
+            for (i = 0; i < n; i++)
+                dst[i] = (short)(((int)_le_16_s(src[i*2]) + (int)_le_16_s(src[i*2+1])) >> 1);
+        } else {
+            for (i = 0; i < n; i++)
+                dst[i] = _le_16_s(src[i]);
+        }
+    } else {
+        // 8-bit WAV data is unsigned
+        const unsigned char *src = imp->raw;
+        if (numChannels == 2) {
+            for (i = 0; i < n; i++)
+                dst[i] = (short)(((int)src[i*2] + (int)src[i*2+1] - 256) << 7);
+        } else {
+            for (i = 0; i < n; i++)
+                dst[i] = (short)(((int)src[i] - 128) << 8);
+        }
+    }
+    imp->monoFill = n;
+    imp->monoPos = 0;
+    
+    if (n < toRead) {
+        // the file is shorter than its header says, so the length is reduced to what the data that exists converts to
+        const long rate = imp->pcmInfo.sampleRate;
+        imp->srcAtEOF = TRUE;
+        imp->length = MIN(imp->length, (size_t)(((int64_t)imp->srcFramesRead * TWTW_PCM_SAMPLERATE + rate - 1) / rate));
+    }
+    return TRUE;
+}
+
+int twtw_pcm_import_open_wav_path_utf8 (const char *path, size_t pathLen, TwtwPCMImport **outImport)
+{
+    g_return_val_if_fail(path, TWTW_PARAMERR);
+    g_return_val_if_fail(outImport, TWTW_PARAMERR);
+    
+    FILE *file = twtw_open_readb_utf8(path, pathLen);
     if ( !file)
         return TWTW_FILEERR;
-
+    
     // check for WAV header
     int wavSampleRate = 0;
     int wavNumChannels = 0;
@@ -201,10 +522,9 @@ int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t src
     int32_t wavDataSize = 0;
     {
         char first_bytes[12];
-        fread(first_bytes, 1, 12, file);
-        if (strncmp(first_bytes, "RIFF", 4) == 0) {
+        if (fread(first_bytes, 1, 12, file) == 12 && strncmp(first_bytes, "RIFF", 4) == 0) {
             if (twtw_read_wav_header(file, &wavSampleRate, &wavNumChannels, &wavFormat, &wavDataSize) == -1) {
-                printf("*** error opening wav file (unknown header), path: %s\n", srcPath);
+                printf("*** error opening wav file (unknown header), path: %s\n", path);
                 fclose(file);
                 return TWTW_FILEERR;
             } else {
@@ -212,11 +532,219 @@ int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t src
             }
         } else {
             // assume file is RAW PCM -- TODO
-            printf("*** raw format unsupported (path: %s)\n", srcPath);
+            printf("*** raw format unsupported (path: %s)\n", path);
+            fclose(file);
+            return TWTW_FILEERR;
+        }
+    }
+    
+    // the header's size may not have been updated if recording was interrupted, so also check the file size
+    long dataPos = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long fileDataSize = ftell(file) - dataPos;
+    fseek(file, dataPos, SEEK_SET);
+    long dataSize = (wavDataSize >= 0) ? MIN((long)wavDataSize, fileDataSize) : fileDataSize;
+    
+    TwtwPCMImport *imp = g_malloc0(sizeof(TwtwPCMImport));
+    imp->file = file;
+    imp->pcmInfo.sampleRate = wavSampleRate;
+    imp->pcmInfo.numChannels = wavNumChannels;
+    imp->pcmInfo.dataFormat = wavFormat;
+    imp->srcFramesLeft = MAX(0, dataSize) / (wavNumChannels * (wavFormat / 8));
+    imp->length = ((int64_t)imp->srcFramesLeft * TWTW_PCM_SAMPLERATE + wavSampleRate - 1) / wavSampleRate;
+    
+    if (wavSampleRate != TWTW_PCM_SAMPLERATE) {
+        int err = 0;
+        imp->resampler = speex_resampler_init(1, wavSampleRate, TWTW_PCM_SAMPLERATE, SPEEX_RESAMPLER_QUALITY_VOIP, &err);
+        if ( !imp->resampler) {
+            printf("** %s: can't create resampler for rate %i (err %i)\n", __func__, wavSampleRate, err);
+            twtw_pcm_import_destroy (imp);
             return TWTW_FILEERR;
         }
+        // the output is lined up with the source by dropping the filter's delay at the start and feeding zeros at the end
+        speex_resampler_skip_zeros(imp->resampler);
+        imp->flushFramesLeft = speex_resampler_get_input_latency(imp->resampler) + wavSampleRate / TWTW_PCM_SAMPLERATE + 1;
+    }
+    
+    *outImport = imp;
+    return 0;
+}
+
+void twtw_pcm_import_destroy (TwtwPCMImport *imp)
+{
+    if ( !imp) return;
+    
+    if (imp->resampler)
+        speex_resampler_destroy(imp->resampler);
+    if (imp->file)
+        fclose(imp->file);
+    g_free(imp);
+}
+
+size_t twtw_pcm_import_get_length (TwtwPCMImport *imp)
+{
+    g_return_val_if_fail(imp, 0);
+    return imp->length;
+}
+
+// same as twtw_pcm_import_read() but output is in host byte order
+static int readImportFrames (TwtwPCMImport *imp, short *dst, int frames)
+{
+    int framesRead = 0;
+    while (framesRead < frames && imp->position < imp->length) {
+        spx_uint32_t outLen = MIN((size_t)(frames - framesRead), imp->length - imp->position);
+        spx_uint32_t inLen = 0;
+        
+        if (imp->monoPos >= imp->monoFill && !fillImportMonoBuffer(imp)) {
+            if (imp->resampler && imp->flushFramesLeft > 0) {
+                inLen = imp->flushFramesLeft;
+                speex_resampler_process_int(imp->resampler, 0, NULL, &inLen, dst + framesRead, &outLen);
+                imp->flushFramesLeft -= inLen;
+            } else {
+                // anything the length still calls for after the resampler's tail is a fraction of a source frame
+                memset(dst + framesRead, 0, outLen * sizeof(short));
+                inLen = outLen;
+            }
+        }
+        else if (imp->resampler) {
+            inLen = imp->monoFill - imp->monoPos;
+            speex_resampler_process_int(imp->resampler, 0, imp->mono + imp->monoPos, &inLen, dst + framesRead, &outLen);
+            imp->monoPos += inLen;
+        }
+        else {
+            outLen = MIN(outLen, (spx_uint32_t)(imp->monoFill - imp->monoPos));
+            memcpy(dst + framesRead, imp->mono + imp->monoPos, outLen * sizeof(short));
+            imp->monoPos += outLen;
+            inLen = outLen;
+        }
+        
+        if (inLen == 0 && outLen == 0)
+            break;
+        framesRead += outLen;
+        imp->position += outLen;
     }
+    return framesRead;
+}
+
+int twtw_pcm_import_read (TwtwPCMImport *imp, short *dst, int frames)
+{
+    g_return_val_if_fail(imp, -1);
+    g_return_val_if_fail(dst || frames < 1, -1);
+    
+    int framesRead = readImportFrames(imp, dst, frames);
+    
+    // output is LSB like the PCM format in twtw-audio.h
+    convertPCMByteOrderLE(dst, framesRead);
+    return framesRead;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- encoding ---
+#endif
+
+static void fillReadBuffer(TwtwSpeexState *state)
+{
+   if ( !state->readBuf) {
+      // one frame of extra space for zero-padding the last frame
+      state->readBuf = g_malloc((PCM_READ_BLOCK_SAMPLES + MAX_FRAME_SIZE) * sizeof(short));
+   }
+   
+   // move the unread samples to the start of the block
+   int left = state->readBufFill - state->readBufPos;
+   if (left > 0 && state->readBufPos > 0)
+      memmove(state->readBuf, state->readBuf + state->readBufPos, left * sizeof(short));
+   state->readBufFill = left;
+   state->readBufPos = 0;
+   
+   int toRead = PCM_READ_BLOCK_SAMPLES - left;
+   int n = readImportFrames(state->pcmImport, state->readBuf + left, toRead);
+   if (n < toRead)
+      state->readAtEOF = TRUE;
+   
+   state->readBufFill = left + n;
+}
+
+// returns a pointer to the next frame in *outFrame, and the number of samples read into it (0 at end of input).
+// the rest of the frame is zeroed. the frame can be modified (the preprocessor works in place)
+static int readFrame(TwtwSpeexState *state, short **outFrame)
+{
+   const int frame_size = state->frameSize;
+   int nb_read;
+   
+   if (state->pcmData) {
+      size_t bytesLeft = state->pcmDataSize - state->pcmDataRead;
+      nb_read = MIN(bytesLeft / 2, frame_size);
+      
+      memcpy(state->frameBuf, state->pcmData + state->pcmDataRead, nb_read * sizeof(short));
+      convertPCMByteOrderLE(state->frameBuf, nb_read);
+      memset(state->frameBuf + nb_read, 0, (frame_size - nb_read) * sizeof(short));
+      
+      state->pcmDataRead += nb_read * 2;
+      *outFrame = state->frameBuf;
+      return nb_read;
+   }
+   
+   if (state->readBufFill - state->readBufPos < frame_size && !state->readAtEOF)
+      fillReadBuffer(state);
+   
+   short *frame = state->readBuf + state->readBufPos;
+   nb_read = MIN(frame_size, state->readBufFill - state->readBufPos);
+   
+   if (nb_read < frame_size)
+      memset(frame + nb_read, 0, (frame_size - nb_read) * sizeof(short));
+   
+   state->readBufPos += nb_read;
+   *outFrame = frame;
+   return nb_read;
+}
 
+
+#define TWTW_SPEEX_NUMFRAMES    10
+#define TWTW_SPEEX_MODEID       SPEEX_MODEID_NB
+#define TWTW_SPEEX_COMPLEXITY   3
+#define TWTW_SPEEX_QUALITY      1
+#define TWTW_SPEEX_RATE         8000
+
+// packets of silence kept before the first and after the last speech when trimming
+#define TWTW_SPEEX_TRIM_MARGIN_PACKETS  1
+
+// consecutive frames that must be speech before they count for trimming (a click in the silence shouldn't)
+#define TWTW_SPEEX_MIN_SPEECH_FRAMES    3
+
+
+static gboolean g_compressSilence = FALSE;
+
+void twtw_speex_set_silence_compression (int enabled)
+{
+    g_compressSilence = enabled;
+}
+
+int twtw_speex_silence_compression ()
+{
+    return g_compressSilence;
+}
+
+static TwtwSpeexState *createEncodingState ()
+{
+    spx_int32_t vbr_enabled=0;
+    //spx_int32_t vbr_max=0;
+    //int abr_enabled=0;
+    spx_int32_t vad_enabled = g_compressSilence;
+    spx_int32_t dtx_enabled = g_compressSilence;
+    
+    // frames per packet
+    int nframes = TWTW_SPEEX_NUMFRAMES;
+    
+    SpeexPreprocessState *preprocess = NULL;
+    int denoise_enabled = TRUE;
+    int agc_enabled = TRUE;  // automatic gain control
+    
+    
+    const char *speex_version = NULL;
+    speex_lib_ctl(SPEEX_LIB_GET_VERSION_STRING, (void*)&speex_version);
+
+    printf("going to encode using speex, version is: '%s'\n", speex_version);
             
     SpeexHeader header;
     memset(&header, 0, sizeof(header));
@@ -241,6 +769,12 @@ int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t src
     speex_encoder_ctl(encState, SPEEX_SET_COMPLEXITY, &complexity);
     speex_encoder_ctl(encState, SPEEX_SET_QUALITY, &quality);
     speex_encoder_ctl(encState, SPEEX_SET_SAMPLING_RATE, &rate);
+    
+    // with VAD, frames without speech are encoded at a low rate; DTX then reduces a run of them to a few bits per frame
+    if (vad_enabled)
+        speex_encoder_ctl(encState, SPEEX_SET_VAD, &vad_enabled);
+    if (dtx_enabled)
+        speex_encoder_ctl(encState, SPEEX_SET_DTX, &dtx_enabled);
 
 
     int32_t frame_size = 0;
@@ -294,12 +828,6 @@ int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t src
 
 
     TwtwSpeexState *state = g_malloc0(sizeof(TwtwSpeexState));
-    state->file = file;
-    state->pcmInfo.sampleRate = wavSampleRate;
-    state->pcmInfo.numChannels = wavNumChannels;
-    state->pcmInfo.dataFormat = wavFormat;
-    state->fileDataLeft = wavDataSize;
-    
     state->speexEncState = encState;
     state->header = header;
     state->speexBits = bits;
@@ -307,20 +835,116 @@ int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t src
     state->frameSize = frame_size;
     state->lookahead = lookahead;
     state->preprocState = preprocess;
+    state->compressSilence = vad_enabled;
+    state->firstSpeechFrame = -1;
+    state->lastSpeechFrame = -1;
+    
+    return state;
+}
+
+// called after each frame is encoded. the encoder's VAD counts a frame as silence if its relative quality
+// is below 2 (see nb_celp.c); the same decision picks the frames for DTX, so trimming agrees with it
+static void noteEncodedFrame (TwtwSpeexState *state, long frameN)
+{
+    if ( !state->compressSilence)
+        return;
+    
+    float relativeQuality = 0.0f;
+    speex_encoder_ctl(state->speexEncState, SPEEX_GET_RELATIVE_QUALITY, &relativeQuality);
+    if (relativeQuality < 2.0f) {
+        state->speechRun = 0;
+        return;
+    }
+    if (++state->speechRun < TWTW_SPEEX_MIN_SPEECH_FRAMES)
+        return;
+    
+    if (state->firstSpeechFrame < 0)
+        state->firstSpeechFrame = frameN - (state->speechRun - 1);
+    state->lastSpeechFrame = frameN;
+}
+
+// when compressing silence, drops the packets before and after the speech (except for a margin).
+// the granulepos values of the rest are moved back by the length of the dropped start, so they're still the exact
+// position of each packet's end in the trimmed sound, and the last packet's granulepos is its length.
+// the length of the dropped start is kept in the store, so the encoded PCM can be trimmed to match
+static void trimSilentPackets (TwtwSpeexState *state, TwtwSpeexPacketStore *store)
+{
+    if ( !state->compressSilence || state->firstSpeechFrame < 0 || store->packetCount < 1)
+        return;
+    
+    const int nframes = state->numFrames;
+    int first = MAX(0, (int)(state->firstSpeechFrame / nframes) - TWTW_SPEEX_TRIM_MARGIN_PACKETS);
+    int last = MIN(store->packetCount - 1, (int)(state->lastSpeechFrame / nframes) + TWTW_SPEEX_TRIM_MARGIN_PACKETS);
+    if (first == 0 && last == store->packetCount - 1)
+        return;
+    
+    const int count = last - first + 1;
+    const size_t dataStart = store->packets[first].offset;
+    const size_t dataEnd = store->packets[last].offset + store->packets[last].bytes;
+    const ogg_int64_t shift = (ogg_int64_t)first * nframes * state->frameSize;
+    
+    memmove(store->data, store->data + dataStart, dataEnd - dataStart);
+    store->dataSize = dataEnd - dataStart;
+    memmove(store->packets, store->packets + first, count * sizeof(TwtwSpeexPacket));
+    store->packetCount = count;
+    store->trimmedStart += shift;
+    
+    int i;
+    for (i = 0; i < count; i++) {
+        store->packets[i].offset -= dataStart;
+        store->packets[i].granulepos -= shift;
+        store->packets[i].e_o_s = (i == count - 1) ? 1 : 0;
+    }
+    ///printf("%s: kept packets %i - %i\n", __func__, first, last);
+}
+
+int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t srcPathLen,
+                                               TwtwSpeexStatePtr *outState)
+{
+    g_return_val_if_fail(srcPath, TWTW_PARAMERR);
+    g_return_val_if_fail(outState, TWTW_PARAMERR);
+
+    TwtwPCMImport *imp = NULL;
+    int result = twtw_pcm_import_open_wav_path_utf8 (srcPath, srcPathLen, &imp);
+    if (result != 0)
+        return result;
+
+    TwtwSpeexState *state = createEncodingState ();
+    state->pcmImport = imp;
+    state->pcmInfo.sampleRate = TWTW_PCM_SAMPLERATE;
+    state->pcmInfo.numChannels = 1;
+    state->pcmInfo.dataFormat = TWTW_PCM_SAMPLEBITS;
+    state->fileDataLeft = -1;
 
     *outState = state;
     return 0;
 }
 
-int twtw_speex_init_with_speex_buffer (unsigned char *speexBuf, size_t speexBufSize, TwtwSpeexStatePtr *outState)
+int twtw_speex_init_encoding_from_pcm_buffer (const short *pcmBuf, size_t pcmBufSize, TwtwSpeexStatePtr *outState)
 {
-    g_return_val_if_fail(speexBuf, TWTW_PARAMERR);
+    g_return_val_if_fail(pcmBuf, TWTW_PARAMERR);
     g_return_val_if_fail(outState, TWTW_PARAMERR);
+    
+    TwtwSpeexState *state = createEncodingState ();
+    state->pcmData = (const unsigned char *)pcmBuf;
+    state->pcmDataSize = pcmBufSize;
+    state->pcmDataRead = 0;
+    state->pcmInfo.sampleRate = TWTW_PCM_SAMPLERATE;
+    state->pcmInfo.numChannels = 1;
+    state->pcmInfo.dataFormat = TWTW_PCM_SAMPLEBITS;
+    state->fileDataLeft = pcmBufSize;
+    
+    *outState = state;
+    return 0;
+}
 
+int twtw_speex_init_with_speex_packets (const TwtwSpeexPacketStore *packets, TwtwSpeexStatePtr *outState)
+{
+    g_return_val_if_fail(packets, TWTW_PARAMERR);
+    g_return_val_if_fail(outState, TWTW_PARAMERR);
+    
     TwtwSpeexState *state = g_malloc0(sizeof(TwtwSpeexState));
-    state->speexData = speexBuf;
-    state->speexDataSize = speexBufSize;
-    state->speexDataWritten = 0;
+    state->existingPackets = packets;
     
     // we need to create a speex header for ogg writing
     
@@ -366,46 +990,134 @@ int twtw_speex_write_header_to_oggz(TwtwSpeexStatePtr state, OGGZ *oggz, long se
 }
 
 
-static void writeExistingSpeexDataToOggz(TwtwSpeexStatePtr state, OGGZ *oggz, long serialno)
+static void writePacketsToOggz(const TwtwSpeexPacketStore *store, OGGZ *oggz, long serialno)
+{
+    ogg_packet op;
+    memset(&op, 0, sizeof(op));
+    
+    int i;
+    for (i = 0; i < store->packetCount; i++) {
+        const TwtwSpeexPacket *packet = store->packets + i;
+        
+        op.packet = store->data + packet->offset;
+        op.bytes = packet->bytes;
+        op.b_o_s = 0;
+        op.e_o_s = (packet->e_o_s || i == store->packetCount - 1) ? 1 : 0;
+        op.granulepos = packet->granulepos;
+        op.packetno = -1;  //allow oggz to fill (was: 2 + frameN/nframes)
+        
+        //printf ("  writing packet, granulepos: %d, packetbytes %i\n", (int)op.granulepos, op.bytes);
+        
+        oggz_write_feed(oggz, &op, serialno, OGGZ_FLUSH_AFTER, NULL);
+        
+        while ((oggz_write (oggz, 400)) > 0);
+    }
+}
+
+int twtw_speex_encode_all_data (TwtwSpeexStatePtr state)
 {
+    g_return_val_if_fail(state, TWTW_PARAMERR);
+    
+    // existing data doesn't need encoding
+    if (state->existingPackets || state->isEncoded)
+        return 0;
+
+    short *inputBuf = NULL;
+    char bitsBuf[MAX_FRAME_BYTES];
+    int nbBytes;
+    int nb_samples, nb_encoded;
+    int total_samples = 0;
+    int total_written = 0;
+    int eos = 0;
+    int frameN = -1;
     int nframes = state->numFrames;
     int frameSize = state->frameSize;
-    if (nframes == 0) nframes = TWTW_SPEEX_NUMFRAMES;
-    if (frameSize == 0) frameSize = 160;
+    int lookahead = state->lookahead;
+    ogg_int64_t granulepos;
+    int packetEOS = 0;
     
-    unsigned char *data = state->speexData;
-    int dataSize = state->speexDataSize;
-    int dataWritten = 0;
+    void *encState = state->speexEncState;
+    SpeexBits *bits = &(state->speexBits);
+    SpeexPreprocessState *preprocState = state->preprocState;
     
-    int packetSize = 99;  // FIXME - hardcoded for nframes == 10
-    int frameN = 0;
+    g_return_val_if_fail(encState, -1);
+    g_return_val_if_fail(bits, -1);
     
-    while (dataWritten < dataSize) {
-        ogg_packet op;
-        memset(&op, 0, sizeof(op));
+    state->packets = twtw_speex_packet_store_create ();
 
-        int dataLeft = dataSize - dataWritten;
-        int isEOS = (dataLeft <= packetSize);
-        int framesInPacket = (isEOS) ? ceil((double)dataLeft / frameSize) : nframes;
+    ///printf("%s: starting to read, data left %i, framesize %i, lookahead %i\n", __func__, state->fileDataLeft, frameSize, lookahead);
+    
+    nb_samples = readFrame(state, &inputBuf);
+    
+    if (nb_samples == 0)
+        eos = 1;
+    
+    total_samples += nb_samples;
+    nb_encoded = -lookahead;
+    
+    //printf("  ... data left: %i\n", readSize);
+    
+    // main encoding loop (one frame per iteration)
+    while ( !eos || total_samples > nb_encoded)
+    {
+        frameN++;
         
-        frameN += framesInPacket;
+        if (preprocState)
+            speex_preprocess(preprocState, inputBuf, NULL);
+        
+        speex_encode_int(encState, inputBuf, bits);
+        nb_encoded += frameSize;
+        
+        nb_samples = readFrame(state, &inputBuf);
+        total_samples += nb_samples;
 
-        op.packet = data + dataWritten;
-        op.bytes = (isEOS) ? (dataSize - dataWritten) : packetSize;        
-        op.e_o_s = (isEOS) ? 1 : 0;
-        op.granulepos = (frameN+1)*frameSize;
-        op.packetno = -1;
+        eos = (nb_samples == 0) ? 1 : 0;
+
+        packetEOS = (eos && total_samples <= nb_encoded) ? 1 : 0;
         
-        //printf ("  writing packet from existing data, granulepos: %d, id %d (%d), packetbytes %i\n", (int)op.granulepos, frameN, nframes, op.bytes);
+        ///printf("  frame %i: data left: %i  eos: %i (%i)\n", frameN, state->fileDataLeft, packetEOS, eos);
         
-        oggz_write_feed(oggz, &op, serialno, OGGZ_FLUSH_AFTER, NULL);
-        while ((oggz_write (oggz, 400)) > 0);
+        if ((frameN+1) % nframes == 0) {
+            speex_bits_insert_terminator(bits);
+            nbBytes = speex_bits_write(bits, bitsBuf, MAX_FRAME_BYTES);
+            speex_bits_reset(bits);
+            
+            granulepos = (frameN+1)*frameSize - lookahead;
+            
+            if (granulepos > total_samples)
+                granulepos = total_samples;
+                
+            //printf ("  encoded packet, speex enc granulepos: %d, id %d (%d), packetbytes %i\n", (int)granulepos, frameN, nframes, nbBytes);
+            
+            twtw_speex_packet_store_append(state->packets, (unsigned char *)bitsBuf, nbBytes, granulepos, packetEOS);
+            total_written += nbBytes;
+        }
+    }
+    
+    
+    if ((frameN+1) % nframes != 0) {
+        while ((frameN+1) % nframes != 0)
+        {
+            frameN++;
+            speex_bits_pack(bits, 15, 5);
+        }
+        nbBytes = speex_bits_write(bits, bitsBuf, MAX_FRAME_BYTES);
+        granulepos = (frameN+1)*frameSize - lookahead;
         
-        dataWritten += op.bytes;            
+        if (granulepos > total_samples)
+            granulepos = total_samples;
+        
+        twtw_speex_packet_store_append(state->packets, (unsigned char *)bitsBuf, nbBytes, granulepos, 1);
+        total_written += nbBytes;
+        ///printf("encoded last uneven frame with %i bytes\n", nbBytes);
     }
-    printf("wrote %i bytes of existing speex data\n", dataWritten);
-}
 
+    
+    printf("done with speex enc; total encoded: %i bytes\n", total_written);
+    
+    state->isEncoded = TRUE;
+    return 0;
+}
 
 int twtw_speex_write_all_data_to_oggz_and_finish(TwtwSpeexStatePtr state, OGGZ *oggz, long serialno)
 {
@@ -414,131 +1126,312 @@ int twtw_speex_write_all_data_to_oggz_and_finish(TwtwSpeexStatePtr state, OGGZ *
     g_return_val_if_fail(serialno != -1, TWTW_PARAMERR);
     
     // if there's existing data, we can just write it out wholesale
-    if (state->speexData) {
-        writeExistingSpeexDataToOggz(state, oggz, serialno);
+    if (state->existingPackets) {
+        writePacketsToOggz(state->existingPackets, oggz, serialno);
         memset(state, 0, sizeof(*state));
         g_free(state);
         return 0;
     }
+    
+    // the data may have been encoded already (e.g. on another thread)
+    int result = twtw_speex_encode_all_data (state);
+    
+    if (state->packets)
+        writePacketsToOggz(state->packets, oggz, serialno);
+
+    speex_encoder_destroy(state->speexEncState);
+    speex_bits_destroy( &(state->speexBits) );
+    
+    if (state->preprocState)
+        speex_preprocess_state_destroy(state->preprocState);
+
+    if (state->file)
+        fclose(state->file);
+    twtw_pcm_import_destroy(state->pcmImport);
+    
+    twtw_speex_packet_store_destroy(state->packets);
+    g_free(state->readBuf);
+    
+    memset(state, 0, sizeof(*state));
+    g_free(state);
+    return result;
+}
 
-    short inputBuf[MAX_FRAME_SIZE];
+
+
+#ifdef __APPLE__
+#pragma mark --- background encoder ---
+#endif
+
+// the ring holds a few seconds, so the writer only has to wait if the encoder falls that far behind
+// (or if more than that is written at once, which the audio thread never does). must be a power of two
+#define PCM_RING_SIZE  (1 << 15)
+#define PCM_RING_MASK  (PCM_RING_SIZE - 1)
+
+// how long the encoder sleeps at most when there's no data, in case the writer couldn't signal it
+#define PCM_RING_WAIT_USEC  20000
+
+struct _TwtwSpeexEncoder {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // signaled when data has been written or consumed
+    gboolean finishing;         // protected by the mutex
+    
+    // single writer, single reader. the positions only grow (wrapping around is fine as the size is a power of two);
+    // ring[writePos] onwards belongs to the writer and ring[readPos] up to writePos to the encoder
+    short *ring;   // LSB
+    volatile guint32 writePos;
+    volatile guint32 readPos;
+    
+    // the rest is only accessed by the worker thread until it's been joined.
+    // the encoding follows twtw_speex_write_all_data_to_oggz_and_finish() step by step, so the output is the same
+    TwtwSpeexState *state;
+    short frame[MAX_FRAME_SIZE];
+    int frameFill;
+    int frameN;
+    long totalSamples;
+    long nbEncoded;
+    
+    TwtwSpeexPacketStore *packets;
+};
+
+static void appendEncodedPacket (TwtwSpeexEncoder *enc)
+{
+    TwtwSpeexState *state = enc->state;
+    SpeexBits *bits = &(state->speexBits);
     char bitsBuf[MAX_FRAME_BYTES];
-    int nbBytes;
-    int nb_samples, nb_encoded;
-    int total_samples = 0;
-    int total_written = 0;
-    int eos = 0;
-    int frameN = -1;
-    int nframes = state->numFrames;
-    int frameSize = state->frameSize;
-    int lookahead = state->lookahead;
+    int nbBytes = speex_bits_write(bits, bitsBuf, MAX_FRAME_BYTES);
+    speex_bits_reset(bits);
+    
+    ogg_int64_t granulepos = (ogg_int64_t)(enc->frameN+1) * state->frameSize - state->lookahead;
+    if (granulepos > enc->totalSamples)
+        granulepos = enc->totalSamples;
+    
+    twtw_speex_packet_store_append(enc->packets, (unsigned char *)bitsBuf, nbBytes, granulepos, 0);
+}
+
+static void encodeFrame (TwtwSpeexEncoder *enc)
+{
+    TwtwSpeexState *state = enc->state;
     
-    ogg_packet op;
-    memset(&op, 0, sizeof(op));
+    enc->frameN++;
     
-    void *encState = state->speexEncState;
-    SpeexBits *bits = &(state->speexBits);
-    SpeexPreprocessState *preprocState = state->preprocState;
+    if (state->preprocState)
+        speex_preprocess(state->preprocState, enc->frame, NULL);
     
-    g_return_val_if_fail(encState, -1);
-    g_return_val_if_fail(bits, -1);
+    speex_encode_int(state->speexEncState, enc->frame, &(state->speexBits));
+    noteEncodedFrame (state, enc->frameN);
+    enc->nbEncoded += state->frameSize;
+    enc->frameFill = 0;
     
-    int32_t readSize = state->fileDataLeft;
-    ///printf("%s: starting to read, data left %i, framesize %i, lookahead %i\n", __func__, readSize, frameSize, lookahead);
+    if ((enc->frameN+1) % state->numFrames == 0) {
+        speex_bits_insert_terminator(&(state->speexBits));
+        appendEncodedPacket (enc);
+    }
+}
+
+static void encodeRemainingFrames (TwtwSpeexEncoder *enc)
+{
+    TwtwSpeexState *state = enc->state;
+    const int frameSize = state->frameSize;
     
-    nb_samples = readPCMSamples(state->file, &(state->pcmInfo), frameSize, inputBuf, NULL, &readSize);
+    // the last partial frame and the encoder's lookahead are filled with silence
+    if (enc->frameFill > 0 || enc->totalSamples > enc->nbEncoded) {
+        do {
+            memset(enc->frame + enc->frameFill, 0, (frameSize - enc->frameFill) * sizeof(short));
+            encodeFrame (enc);
+        } while (enc->totalSamples > enc->nbEncoded);
+    }
     
-    if (nb_samples == 0)
-        eos = 1;
+    if ((enc->frameN+1) % state->numFrames != 0) {
+        while ((enc->frameN+1) % state->numFrames != 0) {
+            enc->frameN++;
+            speex_bits_pack(&(state->speexBits), 15, 5);
+        }
+        appendEncodedPacket (enc);
+    }
     
-    total_samples += nb_samples;
-    nb_encoded = -lookahead;
+    if (enc->packets->packetCount > 0)
+        enc->packets->packets[enc->packets->packetCount - 1].e_o_s = 1;
     
-    //printf("  ... data left: %i\n", readSize);
+    trimSilentPackets (state, enc->packets);
+}
+
+static void destroyEncodingState (TwtwSpeexState *state)
+{
+    speex_encoder_destroy(state->speexEncState);
+    speex_bits_destroy( &(state->speexBits) );
+    if (state->preprocState)
+        speex_preprocess_state_destroy(state->preprocState);
+    g_free(state);
+}
+
+// the __sync builtins are full barriers, so the ring contents are visible before the position that covers them
+static guint32 ringPosGet (volatile guint32 *pos)
+{
+#if defined(__GNUC__)
+    return __sync_add_and_fetch(pos, 0);
+#else
+    return *pos;
+#endif
+}
+
+static void ringPosAdd (volatile guint32 *pos, guint32 n)
+{
+#if defined(__GNUC__)
+    __sync_add_and_fetch(pos, n);
+#else
+    *pos += n;
+#endif
+}
+
+static void waitForRingData (TwtwSpeexEncoder *enc)
+{
+#ifndef __WIN32__
+    struct timeval tval = { 0, 0 };
+    gettimeofday(&tval, NULL);
+    long usec = tval.tv_usec + PCM_RING_WAIT_USEC;
+    struct timespec deadline = { tval.tv_sec + usec / 1000000, (usec % 1000000) * 1000 };
+#else
+    struct timespec deadline = { time(NULL) + 1, 0 };
+#endif
+    pthread_cond_timedwait(&(enc->cond), &(enc->mutex), &deadline);
+}
+
+static void *speexEncoderThreadFunc (void *arg)
+{
+    TwtwSpeexEncoder *enc = (TwtwSpeexEncoder *)arg;
+    const int frameSize = enc->state->frameSize;
     
-    // main encoding loop (one frame per iteration)
-    while ( !eos || total_samples > nb_encoded)
-    {
-        frameN++;
+    while (1) {
+        guint32 readPos = ringPosGet(&(enc->readPos));
+        guint32 avail = ringPosGet(&(enc->writePos)) - readPos;
         
-        if (preprocState)
-            speex_preprocess(preprocState, inputBuf, NULL);
-        
-        speex_encode_int(encState, inputBuf, bits);
-        nb_encoded += frameSize;
+        if (avail == 0) {
+            // the writer doesn't block on the mutex, so a signal can be missed; the wait times out for that case
+            pthread_mutex_lock(&(enc->mutex));
+            gboolean finishing = enc->finishing;
+            if ( !finishing && ringPosGet(&(enc->writePos)) == readPos)
+                waitForRingData (enc);
+            pthread_mutex_unlock(&(enc->mutex));
+            
+            // everything written before finishing was set has been encoded
+            if (finishing && ringPosGet(&(enc->writePos)) == readPos)
+                break;
+            continue;
+        }
         
-        nb_samples = readPCMSamples(state->file, &(state->pcmInfo), frameSize, inputBuf, NULL, &readSize);
-        total_samples += nb_samples;
-
-        eos = (nb_samples == 0) ? 1 : 0;
-
-        op.e_o_s = (eos && total_samples <= nb_encoded) ? 1 : 0;
+        // the part up to the end of the ring; the rest is taken on the next round
+        short *in = enc->ring + (readPos & PCM_RING_MASK);
+        int inLeft = MIN(avail, PCM_RING_SIZE - (readPos & PCM_RING_MASK));
+        const int count = inLeft;
         
-        ///printf("  frame %i: data left: %i  eos: %i (%i)\n", frameN, readSize, op.e_o_s, eos);
+        convertPCMByteOrderLE(in, inLeft);
         
-        if ((frameN+1) % nframes == 0) {
-            speex_bits_insert_terminator(bits);
-            nbBytes = speex_bits_write(bits, bitsBuf, MAX_FRAME_BYTES);
-            speex_bits_reset(bits);
-            
-            op.packet = (unsigned char *)bitsBuf;
-            op.bytes = nbBytes;
-            op.b_o_s = 0;
-                            
-            op.granulepos = (frameN+1)*frameSize - lookahead;
+        while (inLeft > 0) {
+            int n = MIN(inLeft, frameSize - enc->frameFill);
+            memcpy(enc->frame + enc->frameFill, in, n * sizeof(short));
+            enc->frameFill += n;
+            enc->totalSamples += n;
+            in += n;
+            inLeft -= n;
             
-            if (op.granulepos > total_samples)
-                op.granulepos = total_samples;
-                
-            //printf ("  writing packet, speex enc granulepos: %d, id %d (%d), packetbytes %i\n", (int)op.granulepos, frameN, nframes, op.bytes);
-            
-            op.packetno = -1;  //allow oggz to fill (was: 2 + frameN/nframes)
-            
-            oggz_write_feed(oggz, &op, serialno, OGGZ_FLUSH_AFTER, NULL);
-            total_written += nbBytes;
-            
-            while ((oggz_write (oggz, 400)) > 0);            
+            if (enc->frameFill == frameSize)
+                encodeFrame (enc);
         }
+        
+        ringPosAdd(&(enc->readPos), count);
+        
+        // a writer may be waiting for space
+        pthread_mutex_lock(&(enc->mutex));
+        pthread_cond_broadcast(&(enc->cond));
+        pthread_mutex_unlock(&(enc->mutex));
     }
     
+    encodeRemainingFrames (enc);
+    return NULL;
+}
+
+TwtwSpeexEncoder *twtw_speex_encoder_create ()
+{
+    TwtwSpeexEncoder *enc = g_malloc0(sizeof(TwtwSpeexEncoder));
+    enc->state = createEncodingState ();
+    enc->frameN = -1;
+    enc->nbEncoded = -(enc->state->lookahead);
+    enc->packets = twtw_speex_packet_store_create ();
+    enc->ring = g_malloc(PCM_RING_SIZE * sizeof(short));
     
-    if ((frameN+1) % nframes != 0) {
-        while ((frameN+1) % nframes != 0)
-        {
-            frameN++;
-            speex_bits_pack(bits, 15, 5);
-        }
-        nbBytes = speex_bits_write(bits, bitsBuf, MAX_FRAME_BYTES);
-        op.packet = (unsigned char *)bitsBuf;
-        op.bytes = nbBytes;
-        op.b_o_s = 0;
-        op.e_o_s = 1;
-        op.granulepos = (frameN+1)*frameSize - lookahead;
-        
-        if (op.granulepos > total_samples)
-            op.granulepos = total_samples;
-        
-        op.packetno = -1;  //2+id/nframes;
+    pthread_mutex_init(&(enc->mutex), NULL);
+    pthread_cond_init(&(enc->cond), NULL);
+    
+    if (0 != pthread_create(&(enc->thread), NULL, speexEncoderThreadFunc, enc)) {
+        printf("** %s: couldn't create thread\n", __func__);
+        pthread_cond_destroy(&(enc->cond));
+        pthread_mutex_destroy(&(enc->mutex));
+        destroyEncodingState (enc->state);
+        twtw_speex_packet_store_destroy (enc->packets);
+        g_free(enc->ring);
+        g_free(enc);
+        return NULL;
+    }
+    return enc;
+}
 
-        oggz_write_feed(oggz, &op, serialno, OGGZ_FLUSH_AFTER, NULL);
-        total_written += nbBytes;
-        ///printf("wrote last uneven frame with %i bytes\n", nbBytes);
+void twtw_speex_encoder_write (TwtwSpeexEncoder *enc, const short *pcm, int frames)
+{
+    g_return_if_fail(enc);
+    if ( !pcm || frames < 1) return;
+    
+    while (frames > 0) {
+        const guint32 writePos = ringPosGet(&(enc->writePos));
+        const guint32 space = PCM_RING_SIZE - (writePos - ringPosGet(&(enc->readPos)));
         
-        while ((oggz_write (oggz, 400)) > 0);
+        if (space == 0) {
+            // the encoder is a whole ring behind, so there's no way around waiting for it
+            pthread_mutex_lock(&(enc->mutex));
+            pthread_cond_broadcast(&(enc->cond));
+            while (ringPosGet(&(enc->writePos)) - ringPosGet(&(enc->readPos)) == PCM_RING_SIZE)
+                pthread_cond_wait(&(enc->cond), &(enc->mutex));
+            pthread_mutex_unlock(&(enc->mutex));
+            continue;
+        }
+        
+        const int n = MIN((guint32)frames, MIN(space, PCM_RING_SIZE - (writePos & PCM_RING_MASK)));
+        memcpy(enc->ring + (writePos & PCM_RING_MASK), pcm, n * sizeof(short));
+        ringPosAdd(&(enc->writePos), n);
+        pcm += n;
+        frames -= n;
+    }
+    
+    // if the encoder holds the mutex, it's awake or about to time out
+    if (0 == pthread_mutex_trylock(&(enc->mutex))) {
+        pthread_cond_signal(&(enc->cond));
+        pthread_mutex_unlock(&(enc->mutex));
     }
+}
+
+int twtw_speex_encoder_finish (TwtwSpeexEncoder *enc, TwtwSpeexPacketStore **outPackets)
+{
+    g_return_val_if_fail(enc, TWTW_PARAMERR);
     
-    printf("done with speex enc; total written: %i bytes\n", total_written);
+    pthread_mutex_lock(&(enc->mutex));
+    enc->finishing = TRUE;
+    pthread_cond_signal(&(enc->cond));
+    pthread_mutex_unlock(&(enc->mutex));
     
-    speex_encoder_destroy(state->speexEncState);
-    speex_bits_destroy( &(state->speexBits) );
+    pthread_join(enc->thread, NULL);
+    pthread_cond_destroy(&(enc->cond));
+    pthread_mutex_destroy(&(enc->mutex));
     
-    if (state->preprocState)
-        speex_preprocess_state_destroy(state->preprocState);
-
-    fclose(state->file);
+    destroyEncodingState (enc->state);
+    g_free(enc->ring);
     
-    memset(state, 0, sizeof(*state));
-    g_free(state);
+    if (outPackets)
+        *outPackets = enc->packets;
+    else
+        twtw_speex_packet_store_destroy (enc->packets);
+    
+    g_free(enc);
     return 0;
 }
 
@@ -587,6 +1480,46 @@ int twtw_speex_init_decoding_to_pcm_path_utf8 (const char *path, size_t pathLen,
     return 0;
 }
 
+int twtw_speex_init_decoding_to_pcm_buffer (TwtwSpeexStatePtr *outState)
+{
+    g_return_val_if_fail(outState, TWTW_PARAMERR);
+
+    SpeexBits bits;
+    speex_bits_init(&bits);
+    
+    TwtwSpeexState *state = g_malloc0(sizeof(TwtwSpeexState));
+    *outState = state;
+    state->decodeToBuffer = TRUE;
+    state->pcmInfo.sampleRate = TWTW_PCM_SAMPLERATE;
+    state->pcmInfo.numChannels = 1;
+    state->pcmInfo.dataFormat = TWTW_PCM_SAMPLEBITS;
+    state->fileDataLeft = -1;
+    
+    state->speexBits = bits;
+    
+    return 0;
+}
+
+int twtw_speex_init_collecting_speex_data (TwtwSpeexStatePtr *outState)
+{
+    g_return_val_if_fail(outState, TWTW_PARAMERR);
+
+    SpeexBits bits;
+    speex_bits_init(&bits);
+    
+    TwtwSpeexState *state = g_malloc0(sizeof(TwtwSpeexState));
+    *outState = state;
+    state->collectOnly = TRUE;
+    state->pcmInfo.sampleRate = TWTW_PCM_SAMPLERATE;
+    state->pcmInfo.numChannels = 1;
+    state->pcmInfo.dataFormat = TWTW_PCM_SAMPLEBITS;
+    state->fileDataLeft = -1;
+    
+    state->speexBits = bits;
+    
+    return 0;
+}
+
 int twtw_identify_speex_header (ogg_packet *op, SpeexHeader *outSpeexHeader)
 {
     g_return_val_if_fail(op, -1);
@@ -635,7 +1568,8 @@ int twtw_speex_read_apply_header (TwtwSpeexStatePtr state, SpeexHeader *header)
     state->packetsRead = 0;
     state->pcmBytesWritten = 0;
     
-    state->speexDataSize = 0;
+    twtw_speex_packet_store_destroy(state->packets);
+    state->packets = twtw_speex_packet_store_create ();
     
     return 0;
 }
@@ -669,7 +1603,8 @@ int twtw_speex_read_data_from_ogg_packet (TwtwSpeexStatePtr state, ogg_packet *o
 {
     g_return_val_if_fail (state, -1);
     g_return_val_if_fail (op, -1);
-    g_return_val_if_fail (state->file, -1);
+    g_return_val_if_fail (state->speexDecState, -1);
+    g_return_val_if_fail (state->file || state->decodeToBuffer || state->collectOnly, -1);
 
     SpeexBits *bits = &(state->speexBits);
     void *decState = state->speexDecState;
@@ -683,17 +1618,30 @@ int twtw_speex_read_data_from_ogg_packet (TwtwSpeexStatePtr state, ogg_packet *o
     
     ///printf("  speex packet %i: read %i bytes\n", state->packetsRead, op->bytes);
     
-    // append the new data to the cache buffer
-    if (op->bytes > 0) {
-        size_t newTotalDataSize = state->speexDataSize + op->bytes;
-        state->speexData = ( !state->speexData) ? g_malloc(newTotalDataSize)
-                                                : g_realloc(state->speexData, newTotalDataSize);
-        
-        memcpy(state->speexData + state->speexDataSize, op->packet, op->bytes);
-        state->speexDataSize = newTotalDataSize;
+    // keep the packet for the cache. a packet that doesn't end an ogg page has no granulepos, so it's inferred
+    ogg_int64_t granulepos = op->granulepos;
+    if (granulepos < 0) {
+        int count = state->packets->packetCount;
+        granulepos = (count > 0) ? state->packets->packets[count - 1].granulepos : -(state->lookahead + state->frameSize);
+        granulepos += nframes * state->frameSize;
     }
-
+    twtw_speex_packet_store_append(state->packets, op->packet, op->bytes, granulepos, eos);
+    
     state->packetsRead++;
+    
+    if (state->collectOnly) {
+        // the data will be decoded later if needed (see twtw_speex_decoder_create).
+        // the size is what the decoder will produce, i.e. the length given by the granulepos
+        const long packetFrames = nframes * state->frameSize;
+        long delay = delayOfPackets (state->packets, packetFrames, state->lookahead + state->frameSize);
+        state->pcmBytesWritten = decodedLengthOfPackets (state->packets, packetFrames, delay) * sizeof(short);
+        
+        if (eos) {
+            speex_decoder_destroy(decState);
+            state->speexDecState = NULL;
+        }
+        return 0;
+    }
         
     long j;
     for (j = 0; j < nframes; j++) {
@@ -710,33 +1658,49 @@ int twtw_speex_read_data_from_ogg_packet (TwtwSpeexStatePtr state, ogg_packet *o
             doAbort = TRUE;
         }
         
-#if !defined(__LITTLE_ENDIAN__) && ( defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__) )
-        // source data is LSB, so flip
-        long i;
-        long bufSize = state->frameSize * 1;  // single channel
-        for (i = 0; i < bufSize; i++) {
-            short v = outputBuf[i];
-            outputBuf[i] = _le_16(v);
-        }
-#endif
+        // output is LSB
+        convertPCMByteOrderLE(outputBuf, state->frameSize);
         
-        fwrite(outputBuf, sizeof(short), state->frameSize, state->file);
-        state->pcmBytesWritten += state->frameSize * sizeof(short);
+        const size_t frameBytes = state->frameSize * sizeof(short);
+        if (state->decodeToBuffer) {
+            if (state->pcmBytesWritten + frameBytes > state->pcmOutCapacity) {
+                state->pcmOutCapacity = MAX(state->pcmOutCapacity * 2, 64 * 1024);
+                state->pcmOut = g_realloc(state->pcmOut, state->pcmOutCapacity);
+            }
+            memcpy(state->pcmOut + state->pcmBytesWritten, outputBuf, frameBytes);
+        } else {
+            fwrite(outputBuf, sizeof(short), state->frameSize, state->file);
+        }
+        state->pcmBytesWritten += frameBytes;
     }
     
     if (doAbort || eos) {
-        closeWAVFile(state->file, state->pcmBytesWritten);
-        state->file = NULL;
-        
+        if (state->file) {
+            closeWAVFile(state->file, state->pcmBytesWritten);
+            state->file = NULL;
+        }
         speex_decoder_destroy(decState);
-        memset(state, 0, sizeof(*state));
+        state->speexDecState = NULL;
     }
     
     return (doAbort) ? -1 : 0;
 }
 
 
-int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outPCMBytes, unsigned char **outSpeexData, size_t *outSpeexDataSize)
+int twtw_speex_read_take_pcm_buffer (TwtwSpeexStatePtr state, short **outPCMBuffer, size_t *outPCMBufferSize)
+{
+    g_return_val_if_fail (state, TWTW_PARAMERR);
+    g_return_val_if_fail (outPCMBuffer && outPCMBufferSize, TWTW_PARAMERR);
+    
+    *outPCMBuffer = (short *)state->pcmOut;
+    *outPCMBufferSize = state->pcmBytesWritten;
+    
+    state->pcmOut = NULL;
+    state->pcmOutCapacity = 0;
+    return 0;
+}
+
+int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outPCMBytes, TwtwSpeexPacketStore **outPackets)
 {
     if (state->file)
         closeWAVFile(state->file, state->pcmBytesWritten);
@@ -744,15 +1708,15 @@ int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outPCMBytes, unsigned
     if (state->speexDecState)
         speex_decoder_destroy(state->speexDecState);
 
-    if (outSpeexData && outSpeexDataSize) {
-        *outSpeexData = state->speexData;
-        *outSpeexDataSize = state->speexDataSize;
-    } else {
-        g_free(state->speexData);
-    }
+    if (outPackets)
+        *outPackets = state->packets;
+    else
+        twtw_speex_packet_store_destroy(state->packets);
 
     speex_bits_destroy( &(state->speexBits) );
     
+    g_free(state->pcmOut);
+    
     if (outPCMBytes)
         *outPCMBytes = state->pcmBytesWritten;
     
@@ -761,3 +1725,228 @@ int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outPCMBytes, unsigned
     g_free(state);
     return 0;
 }
+
+
+
+#ifdef __APPLE__
+#pragma mark --- pull decoder ---
+#endif
+
+struct _TwtwSpeexDecoder {
+    TwtwSpeexPacketStore *packets;
+    int nextPacket;
+    
+    void *speexDecState;
+    SpeexBits speexBits;
+    int numFrames;
+    int frameSize;
+    long delay;     // decoded frames before the start of the sound: the encoder's delay (see delayOfPackets) plus the decoder's lookahead
+    
+    size_t length;
+    size_t position;
+    
+    // decoded frames that are dropped before output: the decoder's delay at the start, or the distance to the seek position
+    long skipFrames;
+    
+    // decoded packet that hasn't been read yet
+    short pcm[MAX_FRAME_SIZE];
+    int pcmAvail;
+    int pcmPos;
+};
+
+// same decoder settings as twtw_speex_read_apply_header() uses
+static void *createDecoderState (int32_t *outFrameSize, int32_t *outLookahead)
+{
+    void *decState = speex_decoder_init(speex_lib_get_mode(TWTW_SPEEX_MODEID));
+    g_return_val_if_fail(decState, NULL);
+    
+    int32_t rate = TWTW_SPEEX_RATE;
+    int32_t enhancerEnabled = 1;
+    speex_decoder_ctl(decState, SPEEX_GET_FRAME_SIZE, outFrameSize);
+    speex_decoder_ctl(decState, SPEEX_GET_LOOKAHEAD, outLookahead);
+    speex_decoder_ctl(decState, SPEEX_SET_SAMPLING_RATE, &rate);
+    speex_decoder_ctl(decState, SPEEX_SET_ENH, &enhancerEnabled);
+    return decState;
+}
+
+TwtwSpeexDecoder *twtw_speex_decoder_create (const TwtwSpeexPacketStore *packets)
+{
+    g_return_val_if_fail(packets, NULL);
+    
+    int32_t frameSize = 0;
+    int32_t lookahead = 0;
+    void *decState = createDecoderState (&frameSize, &lookahead);
+    if ( !decState)
+        return NULL;
+    
+    if (frameSize < 1 || frameSize * TWTW_SPEEX_NUMFRAMES > MAX_FRAME_SIZE) {
+        printf("** %s: unsupported frame size (%i)\n", __func__, frameSize);
+        speex_decoder_destroy(decState);
+        return NULL;
+    }
+    
+    TwtwSpeexDecoder *dec = g_malloc0(sizeof(TwtwSpeexDecoder));
+    dec->speexDecState = decState;
+    dec->numFrames = TWTW_SPEEX_NUMFRAMES;
+    dec->frameSize = frameSize;
+    speex_bits_init(&(dec->speexBits));
+    
+    dec->packets = twtw_speex_packet_store_copy (packets);
+    
+    // the granulepos of the last packet is the exact length; the decoder's output is longer because of the
+    // padding in the last packet, and it's delayed by the encoder and by the decoder's own lookahead (the enhancer),
+    // so both are skipped to line the output up with it
+    const long packetFrames = dec->numFrames * frameSize;
+    const long encoderDelay = delayOfPackets (packets, packetFrames, lookahead + frameSize);
+    dec->delay = encoderDelay + lookahead;
+    dec->length = decodedLengthOfPackets (packets, packetFrames, encoderDelay);
+    dec->skipFrames = dec->delay;
+    
+    return dec;
+}
+
+void twtw_speex_decoder_destroy (TwtwSpeexDecoder *dec)
+{
+    if ( !dec) return;
+    
+    if (dec->speexDecState)
+        speex_decoder_destroy(dec->speexDecState);
+    speex_bits_destroy( &(dec->speexBits) );
+    
+    twtw_speex_packet_store_destroy (dec->packets);
+    g_free(dec);
+}
+
+size_t twtw_speex_decoder_get_length (TwtwSpeexDecoder *dec)
+{
+    g_return_val_if_fail(dec, 0);
+    return dec->length;
+}
+
+size_t twtw_speex_decoder_get_position (TwtwSpeexDecoder *dec)
+{
+    g_return_val_if_fail(dec, 0);
+    return dec->position;
+}
+
+int twtw_speex_decoder_seek (TwtwSpeexDecoder *dec, size_t frame)
+{
+    g_return_val_if_fail(dec, TWTW_PARAMERR);
+    
+    frame = MIN(frame, dec->length);
+    
+    // decoding starts one packet before the one that contains the frame, so the decoder's state has
+    // caught up by the time the frame is reached. the output of packet n starts at n * packetFrames
+    const long packetFrames = dec->numFrames * dec->frameSize;
+    int startPacket = MAX(twtw_speex_packet_store_find_packet (dec->packets, frame) - 1, 0);
+    long skip = (long)frame + dec->delay - startPacket * packetFrames;
+    
+    if (skip < 0) {
+        // granulepos values from an older file didn't match the packets
+        startPacket = ((long)frame + dec->delay) / packetFrames;
+        skip = (long)frame + dec->delay - startPacket * packetFrames;
+    }
+    
+    // SPEEX_RESET_STATE doesn't reset everything, so a new decoder state is used; this way seeking to 0
+    // gives the same output as a new decoder, and seeking also recovers from a corrupted packet
+    int32_t frameSize = 0;
+    int32_t lookahead = 0;
+    if (dec->speexDecState)
+        speex_decoder_destroy(dec->speexDecState);
+    dec->speexDecState = createDecoderState (&frameSize, &lookahead);
+    if ( !dec->speexDecState)
+        return -1;
+    
+    speex_bits_reset( &(dec->speexBits) );
+    
+    dec->nextPacket = startPacket;
+    dec->skipFrames = skip;
+    dec->position = frame;
+    dec->pcmAvail = 0;
+    dec->pcmPos = 0;
+    return 0;
+}
+
+// decodes the next packet into dec->pcm; returns FALSE at end of data
+static gboolean decodeNextPacket (TwtwSpeexDecoder *dec)
+{
+    if ( !dec->speexDecState)
+        return FALSE;
+    
+    if (dec->nextPacket >= dec->packets->packetCount) {
+        // with the decoder's lookahead skipped, the end of the sound can be up to that far past the encoded frames
+        memset(dec->pcm, 0, dec->frameSize * sizeof(short));
+        dec->pcmAvail = dec->frameSize;
+        dec->pcmPos = 0;
+        return TRUE;
+    }
+    
+    SpeexBits *bits = &(dec->speexBits);
+    const TwtwSpeexPacket *packet = dec->packets->packets + dec->nextPacket;
+    int doAbort = FALSE;
+    
+    speex_bits_read_from(bits, (char *)(dec->packets->data + packet->offset), packet->bytes);
+    dec->nextPacket++;
+    
+    long j;
+    for (j = 0; j < dec->numFrames; j++) {
+        short *outputBuf = dec->pcm + j * dec->frameSize;
+        int result = speex_decode_int(dec->speexDecState, bits, outputBuf);
+        
+        if (result == -1) {
+            // a terminator: the rest of the last packet is padding, so the decoder can still be used for seeking
+            memset(outputBuf, 0, (dec->numFrames - j) * dec->frameSize * sizeof(short));
+            break;
+        }
+        if (result != 0) {
+            if (result == -2) {
+                printf("** Speex decoding error: corrupted stream?\n");
+            }
+            doAbort = TRUE;
+        }
+        if (speex_bits_remaining(bits) < 0) {
+            printf("** Speex decoding overflow\n");
+            doAbort = TRUE;
+        }
+        
+        // output is LSB like the PCM format in twtw-audio.h
+        convertPCMByteOrderLE(outputBuf, dec->frameSize);
+    }
+    dec->pcmAvail = dec->numFrames * dec->frameSize;
+    dec->pcmPos = 0;
+    
+    if (doAbort) {
+        // the packet's output is still returned, like when decoding with twtw_speex_read_data_from_ogg_packet()
+        speex_decoder_destroy(dec->speexDecState);
+        dec->speexDecState = NULL;
+    }
+    return TRUE;
+}
+
+int twtw_speex_decoder_read (TwtwSpeexDecoder *dec, short *dst, int frames)
+{
+    g_return_val_if_fail(dec, -1);
+    g_return_val_if_fail(dst || frames < 1, -1);
+    
+    int framesRead = 0;
+    while (framesRead < frames && dec->position < dec->length) {
+        if (dec->pcmPos >= dec->pcmAvail && !decodeNextPacket(dec))
+            break;
+        
+        int avail = dec->pcmAvail - dec->pcmPos;
+        if (dec->skipFrames > 0) {
+            int n = MIN(dec->skipFrames, avail);
+            dec->pcmPos += n;
+            dec->skipFrames -= n;
+            continue;
+        }
+        
+        int n = MIN(frames - framesRead, avail);
+        n = MIN(n, dec->length - dec->position);
+        memcpy(dst + framesRead, dec->pcm + dec->pcmPos, n * sizeof(short));
+        dec->pcmPos += n;
+        dec->position += n;
+        framesRead += n;
+    }
+    return framesRead;
+}
@@ -30,29 +30,107 @@
 #include <speex/speex_header.h>
 
 
-// currently these functions read and write only .WAV files
+// PCM data is read from and written to .WAV files or memory buffers
+// (buffers are always in the format defined in twtw-audio.h)
 
 
 typedef struct _TwtwSpeexState *TwtwSpeexStatePtr;
 
+typedef struct _TwtwSpeexEncoder TwtwSpeexEncoder;
+typedef struct _TwtwSpeexDecoder TwtwSpeexDecoder;
+typedef struct _TwtwSpeexPacketStore TwtwSpeexPacketStore;
+typedef struct _TwtwWaveformPeaks TwtwWaveformPeaks;
+typedef struct _TwtwPCMImport TwtwPCMImport;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// speex packets without ogg framing, with the granulepos of each (the position in PCM frames at the end of the packet).
+// the last packet's granulepos is the exact length of the sound, and a position can be found without decoding anything
+TwtwSpeexPacketStore *twtw_speex_packet_store_create ();
+TwtwSpeexPacketStore *twtw_speex_packet_store_copy (const TwtwSpeexPacketStore *store);
+void twtw_speex_packet_store_destroy (TwtwSpeexPacketStore *store);
+void twtw_speex_packet_store_append (TwtwSpeexPacketStore *store, const unsigned char *data, int bytes, ogg_int64_t granulepos, int eos);
+int twtw_speex_packet_store_get_count (const TwtwSpeexPacketStore *store);
+size_t twtw_speex_packet_store_get_data_size (const TwtwSpeexPacketStore *store);  // total bytes in all packets
+const unsigned char *twtw_speex_packet_store_get_packet (const TwtwSpeexPacketStore *store, int index, int *outBytes, ogg_int64_t *outGranulepos);
+ogg_int64_t twtw_speex_packet_store_get_length (const TwtwSpeexPacketStore *store);  // in PCM frames
+int twtw_speex_packet_store_find_packet (const TwtwSpeexPacketStore *store, ogg_int64_t framePos);  // index of the packet that contains the position, or count if it's past the end
+ogg_int64_t twtw_speex_packet_store_get_trimmed_start (const TwtwSpeexPacketStore *store);  // PCM frames left out before the first packet (see below)
+
+// level overview of a sound for drawing its waveform without decoding it: the minimum and maximum sample of each
+// period of TWTW_WAVEFORM_PEAK_FRAMES (20 ms), scaled to 8 bits. PCM can be appended in any size pieces as it's recorded or decoded.
+// the data is count pairs of (min, max); the last pair covers a partial period if the length isn't a multiple
+#define TWTW_WAVEFORM_PEAK_FRAMES  160
+
+TwtwWaveformPeaks *twtw_waveform_peaks_create ();
+TwtwWaveformPeaks *twtw_waveform_peaks_create_from_data (const signed char *data, size_t count);
+TwtwWaveformPeaks *twtw_waveform_peaks_copy (const TwtwWaveformPeaks *peaks);
+void twtw_waveform_peaks_destroy (TwtwWaveformPeaks *peaks);
+void twtw_waveform_peaks_append_pcm (TwtwWaveformPeaks *peaks, const short *pcm, size_t frames);
+size_t twtw_waveform_peaks_get_count (const TwtwWaveformPeaks *peaks);
+const signed char *twtw_waveform_peaks_get_data (const TwtwWaveformPeaks *peaks);
+
+// reading a WAV file in any of the formats twtw_read_wav_header() accepts (e.g. 44.1 or 48 kHz stereo) as PCM in the format
+// defined in twtw-audio.h: the channels are mixed to mono and the rate is converted with the speex resampler as the file is read.
+// the file is read in blocks, so memory use doesn't depend on the length. the length is known from the header when opening
+int twtw_pcm_import_open_wav_path_utf8 (const char *path, size_t pathLen, TwtwPCMImport **outImport);
+void twtw_pcm_import_destroy (TwtwPCMImport *imp);
+size_t twtw_pcm_import_get_length (TwtwPCMImport *imp);  // in PCM frames after conversion
+int twtw_pcm_import_read (TwtwPCMImport *imp, short *dst, int frames);  // returns number of frames read, 0 at end
+
+// silence compression for narration: pauses are sent with DTX (a few bits per frame), which also makes them faster to decode,
+// and a recording encoded with twtw_speex_encoder_create() leaves out the leading and trailing silence. speech is found with
+// the encoder's VAD (after the preprocessor's denoising), and the sound is trimmed in whole packets (200 ms) with one packet
+// of margin. the packets are timed from the trimmed start, so twtw_speex_packet_store_get_length() gives the shorter length,
+// and twtw_speex_packet_store_get_trimmed_start() tells where it starts in the recorded PCM (the page trims its copy to match).
+// sounds encoded when saving aren't trimmed, since the rest of the page (e.g. the waveform) is written while they're encoded.
+// applies to encoders created after the call
+void twtw_speex_set_silence_compression (int enabled);
+int twtw_speex_silence_compression ();
+
 // writing speex data to ogg
-int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t srcPathLen, TwtwSpeexStatePtr *outState);
-int twtw_speex_init_with_speex_buffer (unsigned char *speexBuf, size_t speexBufSize, TwtwSpeexStatePtr *outState);
+int twtw_speex_init_encoding_from_pcm_path_utf8 (const char *srcPath, size_t srcPathLen, TwtwSpeexStatePtr *outState);  // converted like the above
+int twtw_speex_init_encoding_from_pcm_buffer (const short *pcmBuf, size_t pcmBufSize, TwtwSpeexStatePtr *outState);  // the buffer must stay valid until the data has been written
+int twtw_speex_init_with_speex_packets (const TwtwSpeexPacketStore *packets, TwtwSpeexStatePtr *outState);  // the packets must stay valid until they've been written
 int twtw_speex_write_header_to_oggz (TwtwSpeexStatePtr state, OGGZ *oggz, long serialno);
 int twtw_speex_write_all_data_to_oggz_and_finish (TwtwSpeexStatePtr state, OGGZ *oggz, long serialno);  // destroys the state object
 
+// encodes all of the PCM data into packets that are kept by the state until it's written with the above function
+// (which otherwise does the encoding itself). separate state objects can be encoded on different threads at the same time
+int twtw_speex_encode_all_data (TwtwSpeexStatePtr state);
+
+// incremental encoding on a worker thread, e.g. while a sound is being recorded. PCM data is in the format defined
+// in twtw-audio.h; write copies it into a preallocated ring and returns without allocating or locking, so it can be called
+// from the audio thread. it only waits if the encoder is several seconds behind or more than that is written at once.
+// finish waits for the remaining data to be encoded and destroys the encoder. the returned packets are
+// identical to what encoding the whole sound at once produces
+TwtwSpeexEncoder *twtw_speex_encoder_create ();
+void twtw_speex_encoder_write (TwtwSpeexEncoder *enc, const short *pcm, int frames);
+int twtw_speex_encoder_finish (TwtwSpeexEncoder *enc, TwtwSpeexPacketStore **outPackets);  // the caller must destroy the packets
+
 // ogg packet util
 int twtw_identify_speex_header (ogg_packet *op, SpeexHeader *outSpeexHeader);  // returns 0 if packet is a speex header, and copies to outSpeexHeader
 
 // reading speex data from ogg
 int twtw_speex_init_decoding_to_pcm_path_utf8 (const char *path, size_t pathLen, TwtwSpeexStatePtr *outState);
+int twtw_speex_init_decoding_to_pcm_buffer (TwtwSpeexStatePtr *outState);
+int twtw_speex_init_collecting_speex_data (TwtwSpeexStatePtr *outState);  // nothing is decoded; use twtw_speex_decoder_create() on the collected packets later
 int twtw_speex_read_apply_header (TwtwSpeexStatePtr state, SpeexHeader *speexHeader);
 int twtw_speex_read_data_from_ogg_packet (TwtwSpeexStatePtr state, ogg_packet *op);  // closes the file if packet is EOS
-int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outNumWrittenPCMBytes, unsigned char **outSpeexData, size_t *outSpeexDataSize);
+int twtw_speex_read_take_pcm_buffer (TwtwSpeexStatePtr state, short **outPCMBuffer, size_t *outPCMBufferSize);  // when decoding to a buffer; the caller must g_free the buffer
+int twtw_speex_read_finish (TwtwSpeexStatePtr state, int *outNumWrittenPCMBytes, TwtwSpeexPacketStore **outPackets);
+
+// pull-based decoding of speex packets. the decoder keeps its own copy of the packets. output is in the PCM format
+// defined in twtw-audio.h, lined up with the original sound (the codec delay is skipped) and of the exact original length.
+// seeking resets the decoder and starts decoding a packet before the target, so it takes the same time anywhere in the sound
+TwtwSpeexDecoder *twtw_speex_decoder_create (const TwtwSpeexPacketStore *packets);
+void twtw_speex_decoder_destroy (TwtwSpeexDecoder *dec);
+size_t twtw_speex_decoder_get_length (TwtwSpeexDecoder *dec);  // total number of PCM frames
+size_t twtw_speex_decoder_get_position (TwtwSpeexDecoder *dec);
+int twtw_speex_decoder_seek (TwtwSpeexDecoder *dec, size_t frame);
+int twtw_speex_decoder_read (TwtwSpeexDecoder *dec, short *dst, int frames);  // returns number of frames read, 0 at end
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,128 @@
+/*
+ *  twtw-cpu.c
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "twtw-cpu.h"
+#include <stdio.h>
+
+#if defined(__arm__) && defined(__linux__)
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static void cpuid (unsigned int leaf, unsigned int *eax, unsigned int *ebx, unsigned int *ecx, unsigned int *edx)
+{
+#if defined(__i386__) && defined(__PIC__)
+    // ebx is the PIC register on 32-bit x86, so it must be preserved
+    __asm__ __volatile__ ("movl %%ebx, %%esi  \n"
+                          "cpuid              \n"
+                          "xchgl %%ebx, %%esi \n"
+                            : "=a" (*eax), "=S" (*ebx), "=c" (*ecx), "=d" (*edx)
+                            : "a" (leaf), "c" (0));
+#else
+    __asm__ __volatile__ ("cpuid"
+                            : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                            : "a" (leaf), "c" (0));
+#endif
+}
+
+static gint32 detectCPUFeatures ()
+{
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    gint32 features = 0;
+
+    cpuid (0, &eax, &ebx, &ecx, &edx);
+    if (eax < 1)
+        return 0;
+
+    cpuid (1, &eax, &ebx, &ecx, &edx);
+    if (edx & (1 << 26))  features |= TWTW_CPU_SSE2;
+    if (ecx & (1 << 9))   features |= TWTW_CPU_SSSE3;
+    if (ecx & (1 << 19))  features |= TWTW_CPU_SSE41;
+
+    return features;
+}
+
+#elif defined(__arm__) && defined(__linux__)
+
+#define TWTW_AT_HWCAP       16
+#define TWTW_HWCAP_NEON     (1 << 12)
+
+// NEON is optional on ARMv7 (and the N800/N810's ARMv6 doesn't have it at all),
+// so ask the kernel through the aux vector
+static gint32 detectCPUFeatures ()
+{
+    gint32 features = 0;
+    int fd = open("/proc/self/auxv", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    unsigned long entry[2];
+    while (read(fd, entry, sizeof(entry)) == sizeof(entry)) {
+        if (entry[0] == 0)
+            break;
+        if (entry[0] == TWTW_AT_HWCAP) {
+            if (entry[1] & TWTW_HWCAP_NEON)
+                features |= TWTW_CPU_NEON;
+            break;
+        }
+    }
+    close(fd);
+    return features;
+}
+
+#else
+
+static gint32 detectCPUFeatures ()
+{
+#if defined(__ARM_NEON__)
+    // e.g. iPhone: if the compiler was allowed to target NEON, the device has it
+    return TWTW_CPU_NEON;
+#else
+    return 0;
+#endif
+}
+
+#endif
+
+
+static gint32 g_cpuFeatures = -1;
+static gint32 g_disabledFeatures = 0;
+
+gint32 twtw_cpu_features ()
+{
+    if (g_cpuFeatures == -1) {
+        g_cpuFeatures = detectCPUFeatures ();
+        ///printf("%s: detected features 0x%x\n", __func__, (int)g_cpuFeatures);
+    }
+    return g_cpuFeatures & ~g_disabledFeatures;
+}
+
+void twtw_cpu_set_disabled_features (gint32 features)
+{
+    g_disabledFeatures = features;
+}
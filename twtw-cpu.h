@@ -0,0 +1,56 @@
+/*
+ *  twtw-cpu.h
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TWTW_CPU_H_
+#define _TWTW_CPU_H_
+
+#include "twtw-glib.h"
+
+
+// SIMD code paths are compiled in when the compiler targets the instruction set (e.g. __SSE2__, __ARM_NEON__),
+// and they are used only if the running CPU reports support for it.
+enum {
+    TWTW_CPU_SSE2 =     1 << 0,
+    TWTW_CPU_SSSE3 =    1 << 1,
+    TWTW_CPU_SSE41 =    1 << 2,
+    TWTW_CPU_NEON =     1 << 8
+};
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// detected on first call
+gint32 twtw_cpu_features ();
+
+// features can be masked off for debugging and for comparing against the scalar code paths
+void twtw_cpu_set_disabled_features (gint32 features);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _TWTW_CPU_H_
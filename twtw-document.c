@@ -27,16 +27,30 @@
 #include "twtw-units.h"
 #include "twtw-filesystem.h"
 #include "twtw-audio.h"
+#include "twtw-audio-wavfile.h"
+#include "twtw-byteorder.h"
+#include "twtw-cpu.h"
+#include "twtw-pagerender.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON__)
+ #include <arm_neon.h>
+#endif
 
 // for file i/o
 #include <oggz/oggz.h>
 #include "skeleton.h"
+#include "twtw-audioconv.h"
 
 // deflate is used to compress curve and photo data for the on-disk format
 #include <zlib.h>
@@ -171,6 +185,22 @@ float *twtw_default_color_palette_line_weight_array (gint *outNumEntries)
 #define TWTW_THUMB_DEFAULT_H  40
 
 
+// page photo, shared between pages (defined below)
+typedef struct _TwtwSharedPhoto TwtwSharedPhoto;
+
+static void releaseSharedPhoto (TwtwSharedPhoto *photo);
+
+// one size in the page's preview chain
+typedef struct _TwtwPageThumbLevel {
+    TwtwPageThumb thumb;
+    gboolean isDirty;
+    guint32 lastUsed;
+} TwtwPageThumbLevel;
+
+static void destroyThumbLevel (TwtwPageThumbLevel *level);
+
+#define THUMB_MIP_MAX_COUNT  12
+
 struct _TwtwPage {
     gint refCount;
     
@@ -183,17 +213,35 @@ struct _TwtwPage {
     gdouble soundDuration;
     char *soundTempPath;
     
-    // original speex data if loaded from file
-    unsigned char *speexData;
-    size_t speexDataSize;
+    // the sound is kept in memory if it's not longer than the PCM memory threshold, otherwise only in the temp file.
+    // the temp file is written from memory only when it's needed by code that works on files
+    short *soundPCMData;
+    gboolean soundTempFileIsCurrent;
+    
+    // original speex packets if loaded from file. such a sound is decoded only when the PCM data is asked for;
+    // until then, neither soundPCMData or the temp file exists (see pageSoundIsOnlySpeex)
+    TwtwSpeexPacketStore *speexPackets;
     
-    // background photo
-    TwtwYUVImage *photoImage;
+    // waveform overview of the sound; see twtw_page_get_waveform_peaks()
+    TwtwWaveformPeaks *waveformPeaks;
     
+    // background photo; shared with other pages that have the same photo (see "shared photos" below)
+    TwtwSharedPhoto *photo;
+    guint32 photoSeed;
+
     // thumbnail for preview (paper stack UI)
     TwtwPageThumb thumb;
     gboolean thumbIsDirty;
     
+    // previews at other sizes; see twtw_page_get_thumb_with_size()
+    TwtwPageThumbLevel *thumbLevels[TWTW_THUMB_MAX_LEVELS];
+    gint thumbLevelCount;
+    guint32 thumbLevelClock;
+    
+    // mip chain that the preview sizes are reduced from: level 0 is rendered, each following level is half the previous one
+    TwtwPageThumbLevel *thumbMips[THUMB_MIP_MAX_COUNT];
+    gint thumbMipCount;
+    
     // state during editing
     gpointer editData;
 };
@@ -219,7 +267,7 @@ TwtwPage *twtw_page_create_with_owner (TwtwBook *book)
     newpage->thumb.rgbRowBytes = newpage->thumb.w * ((newpage->thumb.rgbHasAlpha) ? 4 : 3);
     
     newpage->thumb.rgbPixels = g_malloc0(newpage->thumb.rgbRowBytes * newpage->thumb.h);
-    newpage->thumb.maskPixels = g_malloc0((newpage->thumb.w / 8) * newpage->thumb.h);
+    newpage->thumb.maskPixels = g_malloc0(TWTW_THUMB_MASK_ROWBYTES(newpage->thumb.w) * newpage->thumb.h);
     
     newpage->thumbIsDirty = TRUE;
     
@@ -247,6 +295,13 @@ void twtw_page_destroy (TwtwPage *page)
     
         g_free(page->thumb.rgbPixels);
         g_free(page->thumb.maskPixels);
+        
+        while (page->thumbLevelCount > 0) {
+            destroyThumbLevel(page->thumbLevels[--page->thumbLevelCount]);
+        }
+        while (page->thumbMipCount > 0) {
+            destroyThumbLevel(page->thumbMips[--page->thumbMipCount]);
+        }
     
         g_free(page);
     }
@@ -257,12 +312,16 @@ void twtw_page_clear_photo (TwtwPage *page)
 {
     g_return_if_fail (page);    
 
-    if (page->photoImage) {
-        twtw_yuv_image_destroy(page->photoImage);
-        page->photoImage = NULL;
+    // the display photo is found by seed, so it must be purged before the seed is reset
+    twtw_page_purge_display_photo (page);
+    
+    if (page->photo) {
+        releaseSharedPhoto(page->photo);
+        page->photo = NULL;
+        page->photoSeed = 0;
     }
     
-    page->thumbIsDirty = TRUE;
+    twtw_page_invalidate_thumb (page);
 }
 
 void twtw_page_clear_audio (TwtwPage *page)
@@ -272,10 +331,15 @@ void twtw_page_clear_audio (TwtwPage *page)
     page->soundPCMDataSize = 0;
     page->soundDuration = 0.0;
 
-    if (page->speexData) {
-        g_free(page->speexData);
-        page->speexData = NULL;
-    }
+    g_free(page->soundPCMData);
+    page->soundPCMData = NULL;
+    page->soundTempFileIsCurrent = FALSE;
+
+    twtw_speex_packet_store_destroy(page->speexPackets);
+    page->speexPackets = NULL;
+    
+    twtw_waveform_peaks_destroy(page->waveformPeaks);
+    page->waveformPeaks = NULL;
 }
 
 void twtw_page_clear_curves (TwtwPage *page)
@@ -292,7 +356,7 @@ void twtw_page_clear_curves (TwtwPage *page)
     
     page->curveCount = 0;
     
-    page->thumbIsDirty = TRUE;
+    twtw_page_invalidate_thumb (page);
 }
 
 void twtw_page_clear_all_data (TwtwPage *page)
@@ -333,7 +397,7 @@ void twtw_page_add_curve (TwtwPage *page, TwtwCurveList *curve)
     
     page->curves[page->curveCount - 1] = twtw_curvelist_ref (curve);
     
-    page->thumbIsDirty = TRUE;
+    twtw_page_invalidate_thumb (page);
 }
 
 void twtw_page_delete_curve_at_index (TwtwPage *page, gint index)
@@ -355,7 +419,7 @@ void twtw_page_delete_curve_at_index (TwtwPage *page, gint index)
     page->curves = newArr;
     page->curveCount = page->curveCount - 1;
     
-    page->thumbIsDirty = TRUE;
+    twtw_page_invalidate_thumb (page);
 }
 
 TwtwCurveList **twtw_page_copy_all_curves (TwtwPage *page)
@@ -411,62 +475,455 @@ gint twtw_page_get_sound_duration_in_seconds (TwtwPage *page)
     return ceil(page->soundDuration);
 }
 
-// sound playback (the buffer is allocated internally by the page object and should not be modified)
+// --- PCM sound storage ---
+
+static size_t g_pcmMemoryThreshold = TWTW_PCM_DEFAULT_MEMORY_THRESHOLD;
+
+void twtw_set_pcm_memory_threshold (size_t thresholdInBytes)
+{
+    g_pcmMemoryThreshold = thresholdInBytes;
+}
+
+size_t twtw_pcm_memory_threshold ()
+{
+    return g_pcmMemoryThreshold;
+}
+
+void twtw_page_set_associated_pcm_data_size (TwtwPage *page, size_t dataSize)
+{
+    g_return_if_fail (page);
+    
+    page->soundPCMDataSize = dataSize;
+    
+    page->soundDuration = (double)dataSize / (TWTW_PCM_SAMPLERATE * (TWTW_PCM_SAMPLEBITS / 8));
+    ///printf("page %p: pcmdata size %i -> set sound duration to: %f\n", page, (int)dataSize, (double)page->soundDuration);
+}
+
+static gboolean pageSoundIsOnlySpeex (TwtwPage *page)
+{
+    return (page->speexPackets && page->soundPCMDataSize > 0 && !page->soundPCMData && !page->soundTempFileIsCurrent);
+}
+
+// the header is written with placeholder sizes
+static void finishWAVFile (FILE *file, size_t pcmDataSize)
+{
+    int32_t riffSize = _le_32 ((int32_t)pcmDataSize + 36);
+    int32_t dataSize = _le_32 ((int32_t)pcmDataSize);
+    if (0 == fseek(file, 4, SEEK_SET)) {
+        fwrite(&riffSize, 4, 1, file);
+        if (0 == fseek(file, 40, SEEK_SET))
+            fwrite(&dataSize, 4, 1, file);
+    }
+    fclose(file);
+}
+
+static gboolean writePCMToWAVFile (const char *path, const short *pcmData, size_t pcmDataSize)
+{
+    FILE *file = twtw_open_writeb_utf8 (path, strlen(path));
+    if ( !file) {
+        printf("** %s: can't open for writing: %s\n", __func__, path);
+        return FALSE;
+    }
+    
+    twtw_write_wav_header (file, TWTW_PCM_SAMPLERATE, 1, TWTW_PCM_SAMPLEBITS, pcmDataSize);
+    gboolean ok = (fwrite(pcmData, 1, pcmDataSize, file) == pcmDataSize);
+    
+    finishWAVFile (file, pcmDataSize);
+    return ok;
+}
+
+static TwtwWaveformPeaks *createPeaksForPCM (const short *pcmData, size_t pcmDataSize)
+{
+    TwtwWaveformPeaks *peaks = twtw_waveform_peaks_create ();
+    twtw_waveform_peaks_append_pcm (peaks, pcmData, pcmDataSize / sizeof(short));
+    return peaks;
+}
+
+// decodes the page's speex data into the file a chunk at a time, so the whole sound is never in memory.
+// if a file path isn't given, this only computes the waveform peaks; otherwise they're computed too if peaks is non-NULL
+static gboolean writeSpeexToWAVFile (const char *path, const TwtwSpeexPacketStore *speexPackets, TwtwWaveformPeaks *peaks)
+{
+    TwtwSpeexDecoder *dec = twtw_speex_decoder_create (speexPackets);
+    if ( !dec)
+        return FALSE;
+    
+    FILE *file = (path) ? twtw_open_writeb_utf8 (path, strlen(path)) : NULL;
+    if ( !file && path) {
+        printf("** %s: can't open for writing: %s\n", __func__, path);
+        twtw_speex_decoder_destroy (dec);
+        return FALSE;
+    }
+    
+    if (file)
+        twtw_write_wav_header (file, TWTW_PCM_SAMPLERATE, 1, TWTW_PCM_SAMPLEBITS, twtw_speex_decoder_get_length (dec) * sizeof(short));
+    
+    short buf[4096];
+    size_t pcmDataSize = 0;
+    gboolean ok = TRUE;
+    int n;
+    while (ok && (n = twtw_speex_decoder_read (dec, buf, 4096)) > 0) {
+        if (file)
+            ok = (fwrite(buf, sizeof(short), n, file) == (size_t)n);
+        if (peaks)
+            twtw_waveform_peaks_append_pcm (peaks, buf, n);
+        pcmDataSize += n * sizeof(short);
+    }
+    
+    if (file)
+        finishWAVFile (file, pcmDataSize);
+    twtw_speex_decoder_destroy (dec);
+    return ok;
+}
+
+static short *decodeSpeexToPCM (const TwtwSpeexPacketStore *speexPackets, size_t *outPCMDataSize)
+{
+    TwtwSpeexDecoder *dec = twtw_speex_decoder_create (speexPackets);
+    if ( !dec)
+        return NULL;
+    
+    size_t numFrames = twtw_speex_decoder_get_length (dec);
+    short *pcmData = g_malloc(MAX(numFrames, 1) * sizeof(short));
+    
+    *outPCMDataSize = twtw_speex_decoder_read (dec, pcmData, numFrames) * sizeof(short);
+    
+    twtw_speex_decoder_destroy (dec);
+    return pcmData;
+}
+
+// returns NULL if the file isn't a WAV file in the PCM format defined in twtw-audio.h
+static short *readPCMFromWAVFile (const char *path, size_t *outPCMDataSize)
+{
+    FILE *file = twtw_open_readb_utf8 (path, strlen(path));
+    if ( !file)
+        return NULL;
+    
+    short *pcmData = NULL;
+    char riffHeader[12];
+    int rate = 0, numChannels = 0, format = 0;
+    int32_t dataSize = 0;
+    
+    if (fread(riffHeader, 1, 12, file) == 12 && 0 == memcmp(riffHeader, "RIFF", 4)
+            && twtw_read_wav_header (file, &rate, &numChannels, &format, &dataSize) > 0
+            && rate == TWTW_PCM_SAMPLERATE && numChannels == 1 && format == TWTW_PCM_SAMPLEBITS) {
+        
+        // the header's size may not have been updated if recording was interrupted, so also check the file size
+        long dataPos = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long fileDataSize = ftell(file) - dataPos;
+        fseek(file, dataPos, SEEK_SET);
+        
+        size_t pcmDataSize = (dataSize >= 0) ? MIN((long)dataSize, fileDataSize) : fileDataSize;
+        pcmDataSize &= ~(size_t)1;
+        
+        pcmData = g_malloc(MAX(pcmDataSize, 2));
+        pcmDataSize = fread(pcmData, 1, pcmDataSize, file) & ~(size_t)1;
+        *outPCMDataSize = pcmDataSize;
+    }
+    
+    fclose(file);
+    return pcmData;
+}
+
+// takes ownership of pcmData
+static void setPCMSoundData (TwtwPage *page, short *pcmData, size_t pcmDataSize)
+{
+    g_free(page->soundPCMData);
+    page->soundPCMData = pcmData;
+    page->soundTempFileIsCurrent = FALSE;
+    
+    twtw_page_set_associated_pcm_data_size (page, pcmDataSize);
+    
+    twtw_waveform_peaks_destroy (page->waveformPeaks);
+    page->waveformPeaks = createPeaksForPCM (pcmData, pcmDataSize);
+    
+    if (pcmDataSize > g_pcmMemoryThreshold && page->soundTempPath) {
+        // too long to keep in memory; if the file can't be written, the data stays in memory
+        if (writePCMToWAVFile (page->soundTempPath, pcmData, pcmDataSize)) {
+            g_free(page->soundPCMData);
+            page->soundPCMData = NULL;
+            page->soundTempFileIsCurrent = TRUE;
+        }
+    }
+}
+
 gint twtw_page_get_pcm_sound_buffer (TwtwPage *page, short **pcmBuffer, size_t *pcmBufferSize)
 {
     g_return_val_if_fail (page, TWTW_PARAMERR);
     g_return_val_if_fail (pcmBuffer && pcmBufferSize, TWTW_PARAMERR);
     
+    if (pageSoundIsOnlySpeex (page) && page->soundPCMDataSize <= g_pcmMemoryThreshold) {
+        size_t pcmDataSize = 0;
+        short *pcmData = decodeSpeexToPCM (page->speexPackets, &pcmDataSize);
+        if (pcmData) {
+            page->soundPCMData = pcmData;
+            twtw_page_set_associated_pcm_data_size (page, pcmDataSize);
+            
+            if ( !page->waveformPeaks)
+                page->waveformPeaks = createPeaksForPCM (pcmData, pcmDataSize);
+        }
+    }
+    
+    *pcmBuffer = page->soundPCMData;
+    *pcmBufferSize = (page->soundPCMData) ? page->soundPCMDataSize : 0;
     return 0;
 }
 
-void twtw_page_set_associated_pcm_data_size (TwtwPage *page, size_t dataSize)
+void twtw_page_set_pcm_sound_copy (TwtwPage *page, const short *pcmBuffer, size_t pcmBufferSize)
 {
     g_return_if_fail (page);
     
-    page->soundPCMDataSize = dataSize;
+    twtw_page_clear_audio (page);
     
-    page->soundDuration = (double)dataSize / (TWTW_PCM_SAMPLERATE * (TWTW_PCM_SAMPLEBITS / 8));
-    ///printf("page %p: pcmdata size %i -> set sound duration to: %f\n", page, (int)dataSize, (double)page->soundDuration);
+    pcmBufferSize &= ~(size_t)1;
+    if (pcmBuffer && pcmBufferSize > 0) {
+        short *pcmData = g_malloc(pcmBufferSize);
+        memcpy(pcmData, pcmBuffer, pcmBufferSize);
+        
+        setPCMSoundData (page, pcmData, pcmBufferSize);
+    }
 }
 
-void twtw_page_set_cached_speex_data (TwtwPage *page, unsigned char *speexData, size_t speexDataSize)
+void twtw_page_set_pcm_sound_copy_with_speex_packets (TwtwPage *page, const short *pcmBuffer, size_t pcmBufferSize,
+                                                      TwtwSpeexPacketStore *speexPackets)
 {
     g_return_if_fail (page);
     
-    if (page->speexData)
-        g_free(page->speexData);
+    // with silence compression, the encoder may have left out silence at the start and end of the recording.
+    // the page keeps the same part of the PCM, so playback, the waveform and the duration match what gets saved
+    if (pcmBuffer && speexPackets && twtw_speex_packet_store_get_count (speexPackets) > 0) {
+        size_t start = twtw_speex_packet_store_get_trimmed_start (speexPackets);
+        size_t length = twtw_speex_packet_store_get_length (speexPackets);
+        size_t pcmFrames = pcmBufferSize / sizeof(short);
+        
+        start = MIN(start, pcmFrames);
+        pcmBuffer += start;
+        pcmBufferSize = MIN(length, pcmFrames - start) * sizeof(short);
+    }
+    
+    twtw_page_set_pcm_sound_copy (page, pcmBuffer, pcmBufferSize);
+    
+    // the previous speex packets were released when the sound was replaced
+    if (page->soundPCMDataSize > 0 && speexPackets && twtw_speex_packet_store_get_count (speexPackets) > 0) {
+        page->speexPackets = speexPackets;
+    } else
+        twtw_speex_packet_store_destroy (speexPackets);
+}
+
+gint twtw_page_import_wav_sound_utf8 (TwtwPage *page, const char *path, size_t pathLen)
+{
+    g_return_val_if_fail (page, TWTW_PARAMERR);
+    g_return_val_if_fail (path, TWTW_PARAMERR);
+    
+    TwtwPCMImport *imp = NULL;
+    gint result = twtw_pcm_import_open_wav_path_utf8 (path, pathLen, &imp);
+    if (result != 0)
+        return result;
+    
+    size_t length = twtw_pcm_import_get_length (imp);
+    size_t pcmDataSize = 0;
+    
+    if (length * sizeof(short) <= g_pcmMemoryThreshold || !page->soundTempPath) {
+        // converted directly into the buffer that the page keeps
+        short *pcmData = g_malloc(MAX(length, 1) * sizeof(short));
+        pcmDataSize = twtw_pcm_import_read (imp, pcmData, length) * sizeof(short);
+        twtw_pcm_import_destroy (imp);
         
-    page->speexData = speexData;
-    page->speexDataSize = speexDataSize;
+        twtw_page_clear_audio (page);
+        if (pcmDataSize > 0)
+            setPCMSoundData (page, pcmData, pcmDataSize);
+        else
+            g_free(pcmData);
+        return 0;
+    }
+    
+    // too long to keep in memory, so it's converted into the temp file a block at a time
+    FILE *file = twtw_open_writeb_utf8 (page->soundTempPath, strlen(page->soundTempPath));
+    if ( !file) {
+        printf("** %s: can't open for writing: %s\n", __func__, page->soundTempPath);
+        twtw_pcm_import_destroy (imp);
+        return TWTW_FILEERR;
+    }
+    
+    // the temp file may have held the previous sound
+    twtw_page_clear_audio (page);
+    
+    twtw_write_wav_header (file, TWTW_PCM_SAMPLERATE, 1, TWTW_PCM_SAMPLEBITS, length * sizeof(short));
+    
+    TwtwWaveformPeaks *peaks = twtw_waveform_peaks_create ();
+    short buf[4096];
+    gboolean ok = TRUE;
+    int n;
+    while (ok && (n = twtw_pcm_import_read (imp, buf, 4096)) > 0) {
+        ok = (fwrite(buf, sizeof(short), n, file) == (size_t)n);
+        twtw_waveform_peaks_append_pcm (peaks, buf, n);
+        pcmDataSize += n * sizeof(short);
+    }
+    
+    finishWAVFile (file, pcmDataSize);
+    twtw_pcm_import_destroy (imp);
+    
+    if ( !ok) {
+        twtw_waveform_peaks_destroy (peaks);
+        return TWTW_FILEERR;
+    }
+    twtw_page_set_associated_pcm_data_size (page, pcmDataSize);
+    page->soundTempFileIsCurrent = TRUE;
+    page->waveformPeaks = peaks;
+    return 0;
+}
+
+TwtwPCMSound *twtw_page_copy_pcm_sound (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    TwtwPCMSound *sound = g_malloc0(sizeof(TwtwPCMSound));
+    
+    if (page->soundPCMData) {
+        sound->size = page->soundPCMDataSize;
+        sound->pcm = g_malloc(sound->size);
+        memcpy(sound->pcm, page->soundPCMData, sound->size);
+    }
+    else if (pageSoundIsOnlySpeex (page)) {
+        sound->pcm = decodeSpeexToPCM (page->speexPackets, &(sound->size));
+        if ( !sound->pcm)
+            sound->size = 0;
+    }
+    else if (page->soundPCMDataSize > 0 && page->soundTempFileIsCurrent) {
+        sound->pcm = readPCMFromWAVFile (page->soundTempPath, &(sound->size));
+        if ( !sound->pcm)
+            sound->size = 0;
+    }
+    return sound;
+}
+
+void twtw_destroy_pcm_sound (TwtwPCMSound *sound)
+{
+    if ( !sound) return;
+    
+    g_free(sound->pcm);
+    g_free(sound);
+}
+
+gint twtw_page_write_pcm_sound_to_temp_file (TwtwPage *page)
+{
+    g_return_val_if_fail (page, TWTW_PARAMERR);
+    
+    if (page->soundTempFileIsCurrent || ( !page->soundPCMData && !pageSoundIsOnlySpeex (page)))
+        return 0;
+    
+    g_return_val_if_fail (page->soundTempPath, TWTW_FILEERR);
+    
+    TwtwWaveformPeaks *newPeaks = ( !page->soundPCMData && !page->waveformPeaks) ? twtw_waveform_peaks_create () : NULL;
+    
+    gboolean ok = (page->soundPCMData) ? writePCMToWAVFile (page->soundTempPath, page->soundPCMData, page->soundPCMDataSize)
+                                       : writeSpeexToWAVFile (page->soundTempPath, page->speexPackets, newPeaks);
+    if ( !ok) {
+        twtw_waveform_peaks_destroy (newPeaks);
+        return TWTW_FILEERR;
+    }
+    if (newPeaks)
+        page->waveformPeaks = newPeaks;
+    
+    page->soundTempFileIsCurrent = TRUE;
+    return 0;
+}
+
+void twtw_page_set_cached_speex_packets (TwtwPage *page, TwtwSpeexPacketStore *speexPackets)
+{
+    g_return_if_fail (page);
+    
+    twtw_speex_packet_store_destroy (page->speexPackets);
+    
+    page->speexPackets = speexPackets;
+    
+    ///printf("page %p: cached speex packets: %i\n", page, twtw_speex_packet_store_get_count (speexPackets));
+}
+
+TwtwSpeexPacketStore *twtw_page_get_cached_speex_packets (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    return page->speexPackets;
+}
+
+TwtwSpeexDecoder *twtw_page_create_speex_decoder (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
     
-    ///printf("page %p: cached speex data size: %i\n", page, (int)page->speexDataSize);
+    // the original recording is preferred if it's in memory
+    if ( !page->speexPackets || page->soundPCMData || page->soundPCMDataSize < 1)
+        return NULL;
+    
+    return twtw_speex_decoder_create (page->speexPackets);
 }
 
-unsigned char *twtw_page_get_cached_speex_data (TwtwPage *page, size_t *outSpeexDataSize)
+const TwtwWaveformPeaks *twtw_page_get_waveform_peaks (TwtwPage *page)
 {
     g_return_val_if_fail (page, NULL);
     
-    if (outSpeexDataSize) *outSpeexDataSize = page->speexDataSize;
-    return page->speexData;
+    size_t numFrames = page->soundPCMDataSize / sizeof(short);
+    if (numFrames < 1)
+        return NULL;
+    
+    // peaks that were loaded from a file are checked against the sound
+    size_t expectedCount = (numFrames + TWTW_WAVEFORM_PEAK_FRAMES - 1) / TWTW_WAVEFORM_PEAK_FRAMES;
+    if (page->waveformPeaks && twtw_waveform_peaks_get_count (page->waveformPeaks) == expectedCount)
+        return page->waveformPeaks;
+    
+    twtw_waveform_peaks_destroy (page->waveformPeaks);
+    page->waveformPeaks = NULL;
+    
+    if (page->soundPCMData) {
+        page->waveformPeaks = createPeaksForPCM (page->soundPCMData, page->soundPCMDataSize);
+    }
+    else if (pageSoundIsOnlySpeex (page)) {
+        TwtwWaveformPeaks *peaks = twtw_waveform_peaks_create ();
+        if (writeSpeexToWAVFile (NULL, page->speexPackets, peaks))
+            page->waveformPeaks = peaks;
+        else
+            twtw_waveform_peaks_destroy (peaks);
+    }
+    else if (page->soundTempFileIsCurrent) {
+        size_t pcmDataSize = 0;
+        short *pcmData = readPCMFromWAVFile (page->soundTempPath, &pcmDataSize);
+        if (pcmData) {
+            page->waveformPeaks = createPeaksForPCM (pcmData, pcmDataSize);
+            g_free(pcmData);
+        }
+    }
+    return page->waveformPeaks;
 }
 
-// this is called by the UI when the user has finished recording a new clip
+// used by the file reader
+static void setPageWaveformPeaks (TwtwPage *page, TwtwWaveformPeaks *peaks)
+{
+    twtw_waveform_peaks_destroy (page->waveformPeaks);
+    page->waveformPeaks = peaks;
+}
+
+// this is called by the UI when the user has finished recording a new clip into the page's temp file
 void twtw_page_ui_did_record_pcm_with_file_size (TwtwPage *page, gint fileSize)
 {
     g_return_if_fail (page);
     
+    twtw_page_clear_audio (page);
+    
     if (fileSize > 44)
         fileSize -= 44;  // subtract WAV header size (not sure if this is even the correct number, but who cares about a few bytes? :))
         
     twtw_page_set_associated_pcm_data_size(page, fileSize);
-    
-    // clear out cached speex data
-    if (page->speexData) {
-        g_free(page->speexData);
-        page->speexData = NULL;
+    page->soundTempFileIsCurrent = TRUE;
+    
+    // a short recording is loaded into memory so that later playback and saving don't need to go to the file
+    if (fileSize <= g_pcmMemoryThreshold && page->soundTempPath) {
+        size_t pcmDataSize = 0;
+        short *pcmData = readPCMFromWAVFile (page->soundTempPath, &pcmDataSize);
+        if (pcmData) {
+            page->soundPCMData = pcmData;
+            twtw_page_set_associated_pcm_data_size(page, pcmDataSize);
+            page->waveformPeaks = createPeaksForPCM (pcmData, pcmDataSize);
+        }
     }
-    page->speexDataSize = 0;
 }
 
 /*
@@ -485,221 +942,1232 @@ void twtw_page_attach_edit_data (TwtwPage *page, gpointer data)
 {
     g_return_if_fail (page);
     
-    page->editData = data;
+    page->editData = data;
+}
+
+gpointer twtw_page_get_edit_data (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    return page->editData;
+}
+
+
+// only called by the book object
+void twtw_page_set_temp_path_for_pcm_sound (TwtwPage *page, char *path)
+{
+    g_return_if_fail (page);
+    g_return_if_fail (path);
+    
+    g_free(page->soundTempPath);
+    page->soundTempPath = g_strdup(path);
+}
+
+const char *twtw_page_get_temp_path_for_pcm_sound_utf8 (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    return page->soundTempPath;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- shared photos ---
+#endif
+
+/*
+  pages with identical photos share one TwtwSharedPhoto. it's never modified after creation (apart from creating
+  its other form on demand), so setting a photo on a page always means switching to another shared photo, i.e. copy-on-write.
+  
+  a photo has two forms: the serialized data (what's written in the file) and the decoded image. a photo loaded from
+  a file starts with the data and is decoded when first needed; a photo set from pixels starts with the image and is
+  serialized only when it's saved. all live photos are in two tables, one keyed by a hash of the data and one by
+  a hash of the pixels, and a photo is listed in each once it has that form, so pages in any open book find each
+  other's photos either way (e.g. a decoded photo that's set again on undo). a hash match is confirmed by comparing.
+  books can be loaded and released on worker threads, so the tables and reference counts are protected by a mutex.
+  the forms have a lock of their own, so decoding one photo doesn't hold up the others.
+*/
+struct _TwtwSharedPhoto {
+    gint refCount;
+    guint64 dataHash;       // valid when inDataTable
+    guint64 pixelHash;      // valid when inPixelTable
+    gboolean inDataTable;
+    gboolean inPixelTable;
+    
+    // the serialized data, as read from the file or serialized from 'image' when first needed,
+    // and the decoded image, decoded from 'tiles' when first needed or kept from twtw_page_set_yuv_photo_copy().
+    // only accessed through getSharedPhotoTiles() / getSharedPhotoImage(); neither changes once it's been set
+    TwtwTiledYUVImage *tiles;
+    TwtwYUVImage *image;
+    pthread_mutex_t formMutex;
+    
+    TwtwSharedPhoto *nextByData;    // in table buckets
+    TwtwSharedPhoto *nextByPixels;
+};
+
+#define SHARED_PHOTO_BUCKETS  64
+
+static TwtwSharedPhoto *g_sharedPhotosByData[SHARED_PHOTO_BUCKETS];
+static TwtwSharedPhoto *g_sharedPhotosByPixels[SHARED_PHOTO_BUCKETS];
+static pthread_mutex_t g_sharedPhotosMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// 64-bit FNV-1a
+#define HASH_INITIAL  0xcbf29ce484222325ULL
+
+static guint64 hashBytes (guint64 h, const unsigned char *data, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static guint64 hashSerializedData (const unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC)
+{
+    const uint32_t dims[3] = { w, h, dataFourCC };
+    return hashBytes(hashBytes(HASH_INITIAL, (const unsigned char *)dims, sizeof(dims)), data, dataSize);
+}
+
+static guint64 hashPixels (TwtwYUVImage *image)
+{
+    const uint32_t dims[3] = { image->w, image->h, image->pixelFormat };
+    guint64 hash = hashBytes(HASH_INITIAL, (const unsigned char *)dims, sizeof(dims));
+    int y;
+    for (y = 0; y < image->h; y++) {
+        hash = hashBytes(hash, image->buffer + image->rowBytes * y, image->w * 2);
+    }
+    return hash;
+}
+
+static gboolean serializedDataMatches (TwtwTiledYUVImage *tiles, const unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC)
+{
+    size_t otherSize = 0;
+    uint32_t otherFourCC = 0;
+    int otherW = 0, otherH = 0;
+    const unsigned char *otherData = twtw_tiled_yuv_image_get_serialized_data (tiles, &otherSize, &otherFourCC, NULL);
+    twtw_tiled_yuv_image_get_size (tiles, &otherW, &otherH);
+    return (otherSize == dataSize && otherFourCC == dataFourCC && otherW == w && otherH == h && 0 == memcmp(otherData, data, dataSize));
+}
+
+static gboolean pixelsMatch (TwtwYUVImage *a, TwtwYUVImage *b)
+{
+    if (a->w != b->w || a->h != b->h || a->pixelFormat != b->pixelFormat)
+        return FALSE;
+    int y;
+    for (y = 0; y < a->h; y++) {
+        if (0 != memcmp(a->buffer + a->rowBytes * y, b->buffer + b->rowBytes * y, a->w * 2))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// call with the mutex locked
+static void insertSharedPhotoByData (TwtwSharedPhoto *photo, guint64 hash)
+{
+    TwtwSharedPhoto **bucket = &g_sharedPhotosByData[hash % SHARED_PHOTO_BUCKETS];
+    photo->dataHash = hash;
+    photo->inDataTable = TRUE;
+    photo->nextByData = *bucket;
+    *bucket = photo;
+}
+
+static void insertSharedPhotoByPixels (TwtwSharedPhoto *photo, guint64 hash)
+{
+    TwtwSharedPhoto **bucket = &g_sharedPhotosByPixels[hash % SHARED_PHOTO_BUCKETS];
+    photo->pixelHash = hash;
+    photo->inPixelTable = TRUE;
+    photo->nextByPixels = *bucket;
+    *bucket = photo;
+}
+
+static TwtwSharedPhoto *createSharedPhoto ()
+{
+    TwtwSharedPhoto *photo = g_malloc0(sizeof(TwtwSharedPhoto));
+    photo->refCount = 1;
+    pthread_mutex_init(&photo->formMutex, NULL);
+    return photo;
+}
+
+// returns a new reference to a shared photo with the same serialized data, which is created if necessary;
+// NULL if the data is invalid
+static TwtwSharedPhoto *sharedPhotoForSerializedData (unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC, size_t origDataSize)
+{
+    const guint64 hash = hashSerializedData (data, dataSize, w, h, dataFourCC);
+    TwtwSharedPhoto *photo;
+    
+    pthread_mutex_lock(&g_sharedPhotosMutex);
+    for (photo = g_sharedPhotosByData[hash % SHARED_PHOTO_BUCKETS]; photo; photo = photo->nextByData) {
+        if (photo->dataHash == hash && serializedDataMatches (photo->tiles, data, dataSize, w, h, dataFourCC))
+            break;
+    }
+    if (photo) {
+        photo->refCount++;
+    } else {
+        TwtwTiledYUVImage *tiles = twtw_tiled_yuv_image_create_from_serialized (data, dataSize, w, h, dataFourCC, origDataSize);
+        if (tiles) {
+            photo = createSharedPhoto ();
+            photo->tiles = tiles;
+            insertSharedPhotoByData (photo, hash);
+        }
+    }
+    pthread_mutex_unlock(&g_sharedPhotosMutex);
+    return photo;
+}
+
+// returns a new reference to a shared photo with the same pixels; the image is copied if a new photo is created.
+// only the pixels are hashed here, so setting a photo (e.g. from the camera or on undo) doesn't compress it
+static TwtwSharedPhoto *sharedPhotoForImage (TwtwYUVImage *image)
+{
+    g_return_val_if_fail (image && image->buffer, NULL);
+    
+    const guint64 hash = hashPixels (image);
+    TwtwSharedPhoto *photo;
+    
+    pthread_mutex_lock(&g_sharedPhotosMutex);
+    for (photo = g_sharedPhotosByPixels[hash % SHARED_PHOTO_BUCKETS]; photo; photo = photo->nextByPixels) {
+        if (photo->pixelHash == hash && pixelsMatch (photo->image, image))
+            break;
+    }
+    if (photo) {
+        photo->refCount++;
+    } else {
+        photo = createSharedPhoto ();
+        photo->image = twtw_yuv_image_copy (image);
+        insertSharedPhotoByPixels (photo, hash);
+    }
+    pthread_mutex_unlock(&g_sharedPhotosMutex);
+    return photo;
+}
+
+static TwtwSharedPhoto *retainSharedPhoto (TwtwSharedPhoto *photo)
+{
+    pthread_mutex_lock(&g_sharedPhotosMutex);
+    photo->refCount++;
+    pthread_mutex_unlock(&g_sharedPhotosMutex);
+    return photo;
+}
+
+static void releaseSharedPhoto (TwtwSharedPhoto *photo)
+{
+    pthread_mutex_lock(&g_sharedPhotosMutex);
+    gboolean isLast = (--photo->refCount == 0);
+    if (isLast && photo->inDataTable) {
+        TwtwSharedPhoto **link = &g_sharedPhotosByData[photo->dataHash % SHARED_PHOTO_BUCKETS];
+        while (*link != photo)
+            link = &((*link)->nextByData);
+        *link = photo->nextByData;
+    }
+    if (isLast && photo->inPixelTable) {
+        TwtwSharedPhoto **link = &g_sharedPhotosByPixels[photo->pixelHash % SHARED_PHOTO_BUCKETS];
+        while (*link != photo)
+            link = &((*link)->nextByPixels);
+        *link = photo->nextByPixels;
+    }
+    pthread_mutex_unlock(&g_sharedPhotosMutex);
+    
+    if (isLast) {
+        twtw_yuv_image_destroy (photo->image);
+        twtw_tiled_yuv_image_destroy (photo->tiles);
+        pthread_mutex_destroy(&photo->formMutex);
+        g_free(photo);
+    }
+}
+
+// returns the decoded image, or NULL if it's not decoded yet and decodeIfNeeded is FALSE.
+// the image is never modified once it's been set, so the returned pointer stays valid while the photo is retained
+static TwtwYUVImage *getSharedPhotoImage (TwtwSharedPhoto *photo, gboolean decodeIfNeeded)
+{
+    TwtwYUVImage *image;
+    gboolean isNew = FALSE;
+    
+    pthread_mutex_lock(&photo->formMutex);
+    if ( !photo->image && decodeIfNeeded) {
+        photo->image = twtw_tiled_yuv_image_create_decoded (photo->tiles);
+        isNew = (photo->image != NULL);
+    }
+    image = photo->image;
+    pthread_mutex_unlock(&photo->formMutex);
+    
+    if (isNew) {
+        const guint64 hash = hashPixels (image);
+        pthread_mutex_lock(&g_sharedPhotosMutex);
+        insertSharedPhotoByPixels (photo, hash);
+        pthread_mutex_unlock(&g_sharedPhotosMutex);
+    }
+    return image;
+}
+
+// returns the serialized form, which is created if needed (i.e. when a photo that was set from pixels is saved);
+// NULL if it couldn't be serialized. like the image, it stays valid while the photo is retained
+static TwtwTiledYUVImage *getSharedPhotoTiles (TwtwSharedPhoto *photo)
+{
+    TwtwTiledYUVImage *tiles;
+    guint64 hash = 0;
+    gboolean isNew = FALSE;
+    
+    pthread_mutex_lock(&photo->formMutex);
+    if ( !photo->tiles && photo->image) {
+        TwtwYUVImage *image = photo->image;
+        unsigned char *data = NULL;
+        size_t dataSize = 0;
+        uint32_t dataFourCC = 0;
+        twtw_yuv_image_serialize (image, &data, &dataSize, &dataFourCC);
+        if (data) {
+            photo->tiles = twtw_tiled_yuv_image_create_from_serialized (data, dataSize, image->w, image->h, dataFourCC, image->rowBytes * image->h);
+            hash = hashSerializedData (data, dataSize, image->w, image->h, dataFourCC);
+            isNew = (photo->tiles != NULL);
+            g_free(data);
+        }
+    }
+    tiles = photo->tiles;
+    pthread_mutex_unlock(&photo->formMutex);
+    
+    // the same photo loaded from a saved file will now be found
+    if (isNew) {
+        pthread_mutex_lock(&g_sharedPhotosMutex);
+        insertSharedPhotoByData (photo, hash);
+        pthread_mutex_unlock(&g_sharedPhotosMutex);
+    }
+    return tiles;
+}
+
+
+// seeds are unique across all pages, so a seed alone identifies a photo.
+// books can be loaded on worker threads (see twtw-pagerender.c), so the counter is atomic where possible
+static guint32 nextPhotoSeed ()
+{
+    static volatile guint32 s_photoSeed = 0;
+    guint32 seed;
+    do {
+#if defined(__GNUC__)
+        seed = __sync_add_and_fetch(&s_photoSeed, 1);
+#else
+        seed = ++s_photoSeed;
+#endif
+    } while (seed == 0);
+    return seed;
+}
+
+TwtwYUVImage *twtw_page_copy_yuv_photo (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    return (page->photo) ? twtw_yuv_image_copy (getSharedPhotoImage(page->photo, TRUE)) : NULL;
+}
+
+gboolean twtw_page_has_photo (TwtwPage *page)
+{
+    g_return_val_if_fail (page, FALSE);
+    
+    return (page->photo) ? TRUE : FALSE;
+}
+
+// takes ownership of the caller's reference
+static void setPageSharedPhoto (TwtwPage *page, TwtwSharedPhoto *photo)
+{
+    twtw_page_clear_photo (page);
+    
+    page->photo = photo;
+    page->photoSeed = (photo) ? nextPhotoSeed() : 0;
+}
+
+gboolean twtw_page_convert_photo_to_rgb_for_display_scaled (TwtwPage *page, unsigned char *dstBuf, size_t dstRowBytes, gint w, gint h, gboolean hasAlpha)
+{
+    g_return_val_if_fail (page, FALSE);
+    g_return_val_if_fail (dstBuf, FALSE);
+    
+    TwtwSharedPhoto *photo = page->photo;
+    if ( !photo)
+        return FALSE;
+    
+    TwtwYUVImage *image = getSharedPhotoImage (photo, FALSE);
+    
+    if (image && image->buffer) {
+        twtw_yuv_image_convert_to_rgb_for_display_scaled (image, dstBuf, dstRowBytes, w, h, hasAlpha);
+        return TRUE;
+    }
+    else {
+        // a photo without an image was loaded from a file, so this doesn't serialize anything
+        TwtwTiledYUVImage *tiles = getSharedPhotoTiles (photo);
+        if ( !tiles)
+            return FALSE;
+        int photoW = 0, photoH = 0;
+        twtw_tiled_yuv_image_get_size (tiles, &photoW, &photoH);
+        twtw_tiled_yuv_image_convert_rect_to_rgb_for_display_scaled (tiles, 0, 0, photoW, photoH, dstBuf, dstRowBytes, w, h, hasAlpha);
+        return TRUE;
+    }
+}
+
+void twtw_page_set_yuv_photo_copy (TwtwPage *page, TwtwYUVImage *photo)
+{
+    g_return_if_fail (page);
+    
+    setPageSharedPhoto (page, (photo) ? sharedPhotoForImage(photo) : NULL);
+    
+    twtw_page_invalidate_thumb (page);
+}
+
+guint32 twtw_page_get_photo_seed (TwtwPage *page)
+{
+    g_return_val_if_fail (page, 0);
+    
+    return page->photoSeed;
+}
+
+
+// --- display photo cache ---
+
+/*
+  photos converted to RGB at display size, keyed by the page's photo seed (so an entry can't outlive the photo it was made from).
+  this is the canvases' single converted bitmap (seed + size) extended to several entries, so flipping between pages
+  doesn't redo the conversion. entries are kept in LRU order and the least recently used ones are freed
+  when the total size exceeds the budget.
+  the list and the size counter are not locked: the cache is only used by the canvases, so it's UI-thread only.
+*/
+typedef struct _TwtwDisplayPhoto {
+    guint32 photoSeed;
+    gint w;
+    gint h;
+    size_t rowBytes;
+    gboolean hasAlpha;
+    unsigned char *pixels;
+    
+    struct _TwtwDisplayPhoto *lruPrev;  // more recently used
+    struct _TwtwDisplayPhoto *lruNext;  // less recently used
+} TwtwDisplayPhoto;
+
+static TwtwDisplayPhoto *g_displayPhotoMRU = NULL;
+static TwtwDisplayPhoto *g_displayPhotoLRU = NULL;
+static size_t g_displayPhotoCacheSize = 0;
+static size_t g_displayPhotoCacheBudget = TWTW_DISPLAY_PHOTO_DEFAULT_CACHE_BUDGET;
+
+static void unlinkDisplayPhoto (TwtwDisplayPhoto *dp)
+{
+    if (dp->lruPrev)
+        dp->lruPrev->lruNext = dp->lruNext;
+    else
+        g_displayPhotoMRU = dp->lruNext;
+        
+    if (dp->lruNext)
+        dp->lruNext->lruPrev = dp->lruPrev;
+    else
+        g_displayPhotoLRU = dp->lruPrev;
+        
+    dp->lruPrev = NULL;
+    dp->lruNext = NULL;
+}
+
+static void linkDisplayPhotoAsMostRecent (TwtwDisplayPhoto *dp)
+{
+    dp->lruPrev = NULL;
+    dp->lruNext = g_displayPhotoMRU;
+    if (g_displayPhotoMRU)
+        g_displayPhotoMRU->lruPrev = dp;
+    g_displayPhotoMRU = dp;
+    if ( !g_displayPhotoLRU)
+        g_displayPhotoLRU = dp;
+}
+
+static void destroyDisplayPhoto (TwtwDisplayPhoto *dp)
+{
+    unlinkDisplayPhoto (dp);
+    
+    g_displayPhotoCacheSize -= dp->rowBytes * dp->h;
+    g_free(dp->pixels);
+    g_free(dp);
+}
+
+static TwtwDisplayPhoto *findDisplayPhoto (guint32 photoSeed)
+{
+    TwtwDisplayPhoto *dp;
+    for (dp = g_displayPhotoMRU; dp; dp = dp->lruNext) {
+        if (dp->photoSeed == photoSeed)
+            return dp;
+    }
+    return NULL;
+}
+
+// the most recently used photo is always kept, even if it alone exceeds the budget
+static void evictDisplayPhotosOverBudget ()
+{
+    while (g_displayPhotoCacheSize > g_displayPhotoCacheBudget && g_displayPhotoLRU && g_displayPhotoLRU != g_displayPhotoMRU) {
+        ///printf("%s: evicting display photo for seed %u (cache size %i)\n", __func__, g_displayPhotoLRU->photoSeed, (int)g_displayPhotoCacheSize);
+        destroyDisplayPhoto (g_displayPhotoLRU);
+    }
+}
+
+void twtw_page_purge_display_photo (TwtwPage *page)
+{
+    g_return_if_fail (page);
+    
+    TwtwDisplayPhoto *dp = (page->photoSeed) ? findDisplayPhoto (page->photoSeed) : NULL;
+    if (dp)
+        destroyDisplayPhoto (dp);
+}
+
+const unsigned char *twtw_page_get_display_photo (TwtwPage *page, gint w, gint h, gboolean hasAlpha, size_t *outRowBytes)
+{
+    g_return_val_if_fail (page, NULL);
+    g_return_val_if_fail (w > 0 && h > 0, NULL);
+    
+    if ( !twtw_page_has_photo (page))
+        return NULL;
+    
+    TwtwDisplayPhoto *dp = findDisplayPhoto (page->photoSeed);
+    
+    // like a single converted bitmap, an entry is converted again if the canvas size changes
+    if (dp && (dp->w != w || dp->h != h || dp->hasAlpha != hasAlpha)) {
+        destroyDisplayPhoto (dp);
+        dp = NULL;
+    }
+    
+    if ( !dp) {
+        dp = g_malloc0(sizeof(TwtwDisplayPhoto));
+        dp->photoSeed = page->photoSeed;
+        dp->w = w;
+        dp->h = h;
+        dp->hasAlpha = hasAlpha;
+        dp->rowBytes = w * ((hasAlpha) ? 4 : 3);
+        dp->pixels = g_malloc(dp->rowBytes * h);
+        g_displayPhotoCacheSize += dp->rowBytes * h;
+        
+        twtw_page_convert_photo_to_rgb_for_display_scaled (page, dp->pixels, dp->rowBytes, w, h, hasAlpha);
+    } else {
+        unlinkDisplayPhoto (dp);
+    }
+    linkDisplayPhotoAsMostRecent (dp);
+    
+    evictDisplayPhotosOverBudget ();
+    
+    if (outRowBytes) *outRowBytes = dp->rowBytes;
+    return dp->pixels;
+}
+
+void twtw_set_display_photo_cache_budget (size_t budgetInBytes)
+{
+    g_displayPhotoCacheBudget = budgetInBytes;
+    
+    evictDisplayPhotosOverBudget ();
+}
+
+size_t twtw_display_photo_cache_size ()
+{
+    return g_displayPhotoCacheSize;
+}
+
+
+#define THUMB_STACK_TEMPBUF_SIZE  (32*1024)
+
+/*
+  the thumbnail photo is scaled from the strided temp buffer (nearest neighbour), and a gain + pedestal is applied
+  to make the thumbnail stack stand out better against the current page's background.
+  everything except the pixel values depends only on x or y, so it's computed into tables that are cached per thumbnail size.
+  
+  per channel, the original fixed-point expression is:
+        v = FIXD_TO_INT( pedestal + FIXD_MUL(FIXD_FROM_INT(s), gain) )
+  which reduces exactly to:
+        v = ((pedestal >> 8) + s * (gain >> 8)) >> 8
+  so the tables hold pedestal >> 8 per row and gain >> 8 per channel byte.
+*/
+typedef struct _TwtwThumbPostprocTables {
+    int w, h;
+    int tempW, tempH;
+    int pixStride;
+    
+    int *srcRowIndex;       // per row: index of source row in temp buffer
+    int32_t *pedestal;      // per row
+    int *srcXOffset;        // per column: byte offset in source row
+    uint16_t *gainHighlight;  // per destination byte, rows 0-80 (highlight on the left edge)
+    uint16_t *gainDefault;    // per destination byte, rows below that
+    
+    struct _TwtwThumbPostprocTables *next;  // in g_thumbTables
+} TwtwThumbPostprocTables;
+
+#define THUMB_HIGHLIGHT_MAX_Y  80
+
+static TwtwThumbPostprocTables *g_thumbTables = NULL;
+static pthread_mutex_t g_thumbTablesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static TwtwThumbPostprocTables *createThumbTables(int w, int h, int tempW, int tempH, int pixStride)
+{
+    TwtwThumbPostprocTables *tables = g_malloc0(sizeof(TwtwThumbPostprocTables));
+    tables->w = w;
+    tables->h = h;
+    tables->tempW = tempW;
+    tables->tempH = tempH;
+    tables->pixStride = pixStride;
+    tables->srcRowIndex = g_malloc(h * sizeof(int));
+    tables->pedestal = g_malloc(h * sizeof(int32_t));
+    tables->srcXOffset = g_malloc(w * sizeof(int));
+    tables->gainHighlight = g_malloc(w * pixStride * sizeof(uint16_t));
+    tables->gainDefault = g_malloc(w * pixStride * sizeof(uint16_t));
+
+    // there's some non-displayed gunk at the bottom of the image frame, so crop it (hence the 1.15)
+    const TwtwFixedNum xInc = FIXD_QDIV(TWTW_UNITS_FROM_INT(tempW), TWTW_UNITS_FROM_INT(w));
+    const TwtwFixedNum yInc = FIXD_QDIV(TWTW_UNITS_FROM_INT(tempH), TWTW_UNITS_FROM_FLOAT(h * 1.15));
+
+    const TwtwFixedNum def_pedestal = TWTW_UNITS_FROM_INT(55);
+    const TwtwFixedNum def_gain = TWTW_UNITS_FROM_FLOAT(200.0 / 255.0);
+    
+    int x, y, c;
+    for (y = 0; y < h; y++) {
+        int srcY = TWTW_UNITS_TO_INT( FIXD_MUL(yInc, TWTW_UNITS_FROM_INT(y)) );
+        tables->srcRowIndex[y] = MAX(0, MIN(srcY, tempH - 1));
+        
+        TwtwFixedNum pedestal = (y > 15) ? def_pedestal
+                                         : def_pedestal + FIXD_MUL(def_pedestal, TWTW_UNITS_FROM_FLOAT(((float)(15 - y) / 15) * 1.5));
+        tables->pedestal[y] = pedestal >> 8;
+    }
+    
+    for (x = 0; x < w; x++) {
+        int srcX = TWTW_UNITS_TO_INT( FIXD_MUL(xInc, TWTW_UNITS_FROM_INT(x)) );
+        tables->srcXOffset[x] = pixStride * MAX(0, MIN(srcX, tempW - 1));
+        
+        // add a highlight to make the thumbnail stand out better against dark backgrounds
+        TwtwFixedNum gain = (x > 10) ? def_gain
+                                     : FIXD_MUL(def_gain, FIXD_ONE + TWTW_UNITS_FROM_FLOAT(powf((float)(10 - x) / 10, 3.0) * 1.5));
+        
+        for (c = 0; c < pixStride; c++) {
+            // the alpha channel is passed through: gain of 1.0 and no pedestal
+            const gboolean isAlpha = (c == 3);
+            tables->gainHighlight[x*pixStride + c] = (isAlpha) ? 256 : (gain >> 8);
+            tables->gainDefault[x*pixStride + c] = (isAlpha) ? 256 : (def_gain >> 8);
+        }
+    }
+    return tables;
+}
+
+// the tables are shared between threads rendering thumbs; they're never modified once created.
+// one set is kept for each combination of sizes (pages with photos of different sizes use different temp sizes),
+// so switching between them doesn't create new tables. the combinations are few, and the tables are small
+static TwtwThumbPostprocTables *getThumbTables(int w, int h, int tempW, int tempH, int pixStride)
+{
+    TwtwThumbPostprocTables *tables;
+    
+    pthread_mutex_lock(&g_thumbTablesMutex);
+    
+    for (tables = g_thumbTables; tables; tables = tables->next) {
+        if (tables->w == w && tables->h == h && tables->tempW == tempW && tables->tempH == tempH && tables->pixStride == pixStride)
+            break;
+    }
+    if ( !tables) {
+        tables = createThumbTables(w, h, tempW, tempH, pixStride);
+        tables->next = g_thumbTables;
+        g_thumbTables = tables;
+    }
+    
+    pthread_mutex_unlock(&g_thumbTablesMutex);
+    return tables;
+}
+
+// applies v = (pedestal + s * gain) >> 8 in place on a row of bytes; the pedestal is not applied to alpha bytes
+static void applyThumbGainAndPedestal_scalar(unsigned char *row, const uint16_t *gain, const int count,
+                                             const int32_t pedestal, const int pixStride)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        const int32_t ped = (pixStride == 4 && (i & 3) == 3) ? 0 : pedestal;
+        const int32_t v = (ped + row[i] * gain[i]) >> 8;
+        row[i] = (v > 255) ? 255 : ((v < 0) ? 0 : v);
+    }
+}
+
+#if defined(__SSE2__)
+
+// processes 16 bytes per iteration; returns number of bytes processed
+static int applyThumbGainAndPedestal_SSE2(unsigned char *row, const uint16_t *gain, const int count,
+                                          const int32_t pedestal, const int pixStride)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ped = (pixStride == 4) ? _mm_set_epi32(0, pedestal, pedestal, pedestal)
+                                         : _mm_set1_epi32(pedestal);
+    int i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+        __m128i g_lo = _mm_loadu_si128((const __m128i *)(gain + i));
+        __m128i g_hi = _mm_loadu_si128((const __m128i *)(gain + i + 8));
+        
+        // 16x16 -> 32-bit products from the low and high halves
+        __m128i pl_lo = _mm_mullo_epi16(s_lo, g_lo);
+        __m128i ph_lo = _mm_mulhi_epu16(s_lo, g_lo);
+        __m128i pl_hi = _mm_mullo_epi16(s_hi, g_hi);
+        __m128i ph_hi = _mm_mulhi_epu16(s_hi, g_hi);
+        
+        __m128i v0 = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(pl_lo, ph_lo), ped), 8);
+        __m128i v1 = _mm_srli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(pl_lo, ph_lo), ped), 8);
+        __m128i v2 = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(pl_hi, ph_hi), ped), 8);
+        __m128i v3 = _mm_srli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(pl_hi, ph_hi), ped), 8);
+        
+        // saturating packs do the clamp to 0-255
+        __m128i v = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+        _mm_storeu_si128((__m128i *)(row + i), v);
+    }
+    return i;
+}
+
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON__)
+
+// processes 16 bytes per iteration; returns number of bytes processed
+static int applyThumbGainAndPedestal_NEON(unsigned char *row, const uint16_t *gain, const int count,
+                                          const int32_t pedestal, const int pixStride)
+{
+    const int32_t pedArr[4] = { pedestal, pedestal, pedestal, (pixStride == 4) ? 0 : pedestal };
+    const uint32x4_t ped = vreinterpretq_u32_s32(vld1q_s32(pedArr));
+    int i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        uint8x16_t s = vld1q_u8(row + i);
+        uint16x8_t s_lo = vmovl_u8(vget_low_u8(s));
+        uint16x8_t s_hi = vmovl_u8(vget_high_u8(s));
+        uint16x8_t g_lo = vld1q_u16(gain + i);
+        uint16x8_t g_hi = vld1q_u16(gain + i + 8);
+        
+        uint32x4_t v0 = vshrq_n_u32(vmlal_u16(ped, vget_low_u16(s_lo), vget_low_u16(g_lo)), 8);
+        uint32x4_t v1 = vshrq_n_u32(vmlal_u16(ped, vget_high_u16(s_lo), vget_high_u16(g_lo)), 8);
+        uint32x4_t v2 = vshrq_n_u32(vmlal_u16(ped, vget_low_u16(s_hi), vget_low_u16(g_hi)), 8);
+        uint32x4_t v3 = vshrq_n_u32(vmlal_u16(ped, vget_high_u16(s_hi), vget_high_u16(g_hi)), 8);
+        
+        // saturating narrows do the clamp to 0-255
+        uint8x8_t r_lo = vqmovn_u16(vcombine_u16(vqmovn_u32(v0), vqmovn_u32(v1)));
+        uint8x8_t r_hi = vqmovn_u16(vcombine_u16(vqmovn_u32(v2), vqmovn_u32(v3)));
+        vst1q_u8(row + i, vcombine_u8(r_lo, r_hi));
+    }
+    return i;
+}
+
+#endif  // __ARM_NEON__
+
+static void drawThumbPhoto(TwtwPageThumb *thumb, const unsigned char *tempBuffer, const int tempW, const int tempH, const int tempBufRowBytes)
+{
+    const int dstPixStride = (thumb->rgbHasAlpha) ? 4 : 3;
+    const int rowCount = thumb->w * dstPixStride;
+    TwtwThumbPostprocTables *tables = getThumbTables(thumb->w, thumb->h, tempW, tempH, dstPixStride);
+    g_return_if_fail(tables);
+    
+    int (*simdFunc)(unsigned char *, const uint16_t *, const int, const int32_t, const int) = NULL;
+    const gint32 cpuFeatures = twtw_cpu_features ();
+#if defined(__SSE2__)
+    if (cpuFeatures & TWTW_CPU_SSE2)
+        simdFunc = applyThumbGainAndPedestal_SSE2;
+#endif
+#if defined(__ARM_NEON__)
+    if (cpuFeatures & TWTW_CPU_NEON)
+        simdFunc = applyThumbGainAndPedestal_NEON;
+#endif
+    (void)cpuFeatures;
+    
+    int x, y, c;
+    for (y = 0; y < thumb->h; y++) {
+        const unsigned char *src = tempBuffer + tempBufRowBytes * tables->srcRowIndex[y];
+        unsigned char *dst = thumb->rgbPixels + thumb->rgbRowBytes * y;
+        const uint16_t *gain = (y > THUMB_HIGHLIGHT_MAX_Y) ? tables->gainDefault : tables->gainHighlight;
+        const int32_t pedestal = tables->pedestal[y];
+        int n = 0;
+        
+        // gather source pixels, then apply the gain in place
+        for (x = 0; x < thumb->w; x++) {
+            const unsigned char *s = src + tables->srcXOffset[x];
+            for (c = 0; c < dstPixStride; c++)
+                dst[x*dstPixStride + c] = s[c];
+        }
+        
+        if (simdFunc)
+            n = simdFunc(dst, gain, rowCount, pedestal, dstPixStride);
+        
+        applyThumbGainAndPedestal_scalar(dst + n, gain + n, rowCount - n, pedestal, dstPixStride);
+    }
+}
+
+
+// thumbnail curves are drawn as one pixel wide anti-aliased lines (Xiaolin Wu's algorithm in 16.16 fixed point).
+// the canvas is scaled down 5x for the default thumb size, so most curve segments are sub-pixel;
+// those are merged into the polyline until it has moved at least a pixel, and segments outside the thumb are culled.
+// the cost is thus proportional to the number of thumb pixels touched rather than the number of segments.
+
+typedef struct _TwtwThumbPen {
+    TwtwPageThumb *thumb;
+    int pixStride;
+    unsigned char rgba[4];
+} TwtwThumbPen;
+
+// the mask has 8 pixels per byte, leftmost pixel in the least significant bit (i.e. the X bitmap layout)
+#define THUMB_MASK_SET(thumb_, x_, y_) \
+            (thumb_)->maskPixels[TWTW_THUMB_MASK_ROWBYTES((thumb_)->w) * (y_) + ((x_) >> 3)] |= (1 << ((x_) & 7))
+
+static inline void plotThumbPixel(TwtwThumbPen *pen, int x, int y, int coverage)
+{
+    TwtwPageThumb *thumb = pen->thumb;
+    if (coverage <= 0 || x < 0 || x >= thumb->w || y < 0 || y >= thumb->h)
+        return;
+        
+    unsigned char *px = thumb->rgbPixels + thumb->rgbRowBytes*y + pen->pixStride*x;
+    
+    // the pen color is opaque, so the same blend applies to premultiplied RGBA
+    const int a = coverage + (coverage >> 7);  // 0-255 -> 0-256
+    int i;
+    for (i = 0; i < pen->pixStride; i++) {
+        int d = px[i];
+        px[i] = (unsigned char)(d + (((pen->rgba[i] - d) * a) >> 8));
+    }
+    
+    if (coverage >= 128)
+        THUMB_MASK_SET(thumb, x, y);
+}
+
+// coordinates are in thumb pixels, with pixel centers at integer values
+static void drawThumbLineAA(TwtwThumbPen *pen, TwtwFixedNum x0, TwtwFixedNum y0, TwtwFixedNum x1, TwtwFixedNum y1)
+{
+    const gboolean steep = abs(y1 - y0) > abs(x1 - x0);
+    TwtwFixedNum t;
+    if (steep) {
+        t = x0;  x0 = y0;  y0 = t;
+        t = x1;  x1 = y1;  y1 = t;
+    }
+    if (x0 > x1) {
+        t = x0;  x0 = x1;  x1 = t;
+        t = y0;  y0 = y1;  y1 = t;
+    }
+    
+    const TwtwFixedNum dx = x1 - x0;
+    const TwtwFixedNum dy = y1 - y0;
+    const TwtwFixedNum gradient = (dx > 0) ? FIXD_QDIV(dy, dx) : 0;
+    
+    // clip the major axis to the thumb; the minor axis is clipped per pixel
+    const int majorSize = (steep) ? pen->thumb->h : pen->thumb->w;
+    int xStart = FIXD_TO_INT(x0 + FIXD_HALF);
+    int xEnd = FIXD_TO_INT(x1 + FIXD_HALF);
+    if (xStart < 0)  xStart = 0;
+    if (xEnd > majorSize - 1)  xEnd = majorSize - 1;
+    if (xStart > xEnd)
+        return;
+    
+    TwtwFixedNum y = y0 + FIXD_QMUL(gradient, FIXD_FROM_INT(xStart) - x0);
+    int x;
+    for (x = xStart; x <= xEnd; x++) {
+        const int iy = FIXD_TO_INT(y);
+        const int frac = (y >> 8) & 0xff;
+        if (steep) {
+            plotThumbPixel(pen, iy, x, 255 - frac);
+            plotThumbPixel(pen, iy + 1, x, frac);
+        } else {
+            plotThumbPixel(pen, x, iy, 255 - frac);
+            plotThumbPixel(pen, x, iy + 1, frac);
+        }
+        y += gradient;
+    }
+}
+
+static inline gboolean thumbLineIsOutside(TwtwThumbPen *pen, TwtwPoint p0, TwtwPoint p1)
+{
+    const TwtwFixedNum maxX = FIXD_FROM_INT(pen->thumb->w);
+    const TwtwFixedNum maxY = FIXD_FROM_INT(pen->thumb->h);
+    return (p0.x < -FIXD_ONE && p1.x < -FIXD_ONE) || (p0.x > maxX && p1.x > maxX)
+        || (p0.y < -FIXD_ONE && p1.y < -FIXD_ONE) || (p0.y > maxY && p1.y > maxY);
+}
+
+static inline void drawThumbPolylineSegment(TwtwThumbPen *pen, TwtwPoint p0, TwtwPoint p1)
+{
+    if ( !thumbLineIsOutside(pen, p0, p1))
+        drawThumbLineAA(pen, p0.x, p0.y, p1.x, p1.y);
+}
+
+static void drawThumbCurves(TwtwPage *page, TwtwPageThumb *thumb, int dstPixStride)
+{
+    unsigned char *rgbPalette = twtw_default_color_palette_rgb_array (NULL);
+    g_return_if_fail(rgbPalette);
+    
+    TwtwFixedNum canvasScaleMul_x = FIXD_QDIV(TWTW_UNITS_FROM_INT(thumb->w), TWTW_CANONICAL_CANVAS_WIDTH_FIXD);
+    TwtwFixedNum canvasScaleMul_y = FIXD_QDIV(TWTW_UNITS_FROM_INT(thumb->h), TWTW_UNITS_FROM_FLOAT(TWTW_CANONICAL_CANVAS_WIDTH / (16.0 / 9.0)));
+    
+    #if !defined(TWTW_CURVESER_IS_IDENTITY)
+    canvasScaleMul_x = FIXD_QMUL(canvasScaleMul_x, TWTW_CURVESER_SCALE_IN);
+    canvasScaleMul_y = FIXD_QMUL(canvasScaleMul_y, TWTW_CURVESER_SCALE_IN);
+    #endif
+    
+    const int yDispOffset = 40;
+    
+#define MAPPOINT(p_)  TwtwMakePoint( FIXD_MUL((p_).x, canvasScaleMul_x) - FIXD_HALF,  \
+                                     FIXD_MUL((p_).y + yDispOffset, canvasScaleMul_y) - FIXD_HALF )
+
+    TwtwThumbPen pen;
+    pen.thumb = thumb;
+    pen.pixStride = dstPixStride;
+    pen.rgba[3] = 255;
+
+    const int curveCount = twtw_page_get_curves_count (page);
+    int n;
+    for (n = 0; n < curveCount; n++) {
+        TwtwCurveList *curve = twtw_page_get_curve(page, n);
+        const int segCount = twtw_curvelist_get_segment_count (curve);
+        TwtwCurveSegment *segs = twtw_curvelist_get_segment_array (curve);
+        if (segCount < 1 || !segs)
+            continue;
+        
+        const int colorID = twtw_curvelist_get_color_id (curve);
+        const unsigned char *rgbColor = rgbPalette + ((colorID >= 0) ? (colorID*3) : 0);
+        memcpy(pen.rgba, rgbColor, 3);
+        
+        // the polyline is drawn from the last emitted point once it has moved at least a pixel on either axis
+        TwtwPoint emitted = MAPPOINT(segs[0].startPoint);
+        TwtwPoint pending = emitted;
+        gboolean hasPending = FALSE;
+        
+        int i;
+        for (i = 0; i < segCount; i++) {
+            TwtwCurveSegment *seg = segs + i;
+            
+            if (i > 0 && (seg->startPoint.x != segs[i-1].endPoint.x || seg->startPoint.y != segs[i-1].endPoint.y)) {
+                // discontinuous segment: finish the previous run and start over
+                if (hasPending)
+                    drawThumbPolylineSegment(&pen, emitted, pending);
+                emitted = MAPPOINT(seg->startPoint);
+                hasPending = FALSE;
+            }
+            
+            pending = MAPPOINT(seg->endPoint);
+            hasPending = TRUE;
+            
+            if (abs(pending.x - emitted.x) >= FIXD_ONE || abs(pending.y - emitted.y) >= FIXD_ONE) {
+                drawThumbPolylineSegment(&pen, emitted, pending);
+                emitted = pending;
+                hasPending = FALSE;
+            }
+        }
+        
+        // the rest of the curve; a curve that stayed within one pixel is still drawn as a dot
+        if (hasPending)
+            drawThumbPolylineSegment(&pen, emitted, pending);
+    }
+#undef MAPPOINT
+}
+
+
+// private method; reentrant, i.e. thumbs for different pages can be rendered on separate threads
+void twtw_page_render_thumb (TwtwPage *page)
+{
+    TwtwPageThumb *thumb = &(page->thumb);
+    const int dstPixStride = (thumb->rgbHasAlpha) ? 4 : 3;
+
+    if (page->photo) {
+        TwtwYUVImage *photoImage = getSharedPhotoImage (page->photo, FALSE);
+        
+        // the temp buffer is on the stack for the default photo size (160*50 pixels after striding),
+        // so thumbs for different pages can be rendered concurrently
+        unsigned char stackTempBuffer[THUMB_STACK_TEMPBUF_SIZE];
+        unsigned char *tempBuffer = stackTempBuffer;
+        
+        const int xStride = 2;
+        const int yStride = 4;
+        // a photo that hasn't been decoded is converted straight to the size that a default size photo has after striding,
+        // so only one row of its tiles is decoded at a time
+        const int tempW = ((photoImage) ? photoImage->w : TWTW_CAM_IMAGEWIDTH) / xStride;
+        const int tempH = ((photoImage) ? photoImage->h : TWTW_CAM_IMAGEHEIGHT) / yStride;
+        const int tempBufRowBytes = tempW * dstPixStride;
+        
+        if (tempBufRowBytes * tempH > sizeof(stackTempBuffer)) {
+            tempBuffer = g_malloc(tempBufRowBytes * tempH);
+            ///printf("malloced thumb photo temp buffer for size %i * %i\n", tempW, tempH);
+        }
+    
+        if (photoImage) {
+            twtw_yuv_image_convert_to_rgb_for_display (photoImage,
+                                                       tempBuffer,
+                                                       tempBufRowBytes,
+                                                       thumb->rgbHasAlpha,
+                                                       xStride,
+                                                       yStride);
+        } else {
+            twtw_page_convert_photo_to_rgb_for_display_scaled (page, tempBuffer, tempBufRowBytes, tempW, tempH, thumb->rgbHasAlpha);
+        }
+                                                   
+        // scaling, and some color correction to make the thumbnail stack stand out better against the current page's background
+        drawThumbPhoto(thumb, tempBuffer, tempW, tempH, tempBufRowBytes);
+        
+        // set mask to full opacity since we have a background photo
+        memset(thumb->maskPixels, 0xff, TWTW_THUMB_MASK_ROWBYTES(thumb->w) * thumb->h);
+        
+        if (tempBuffer != stackTempBuffer)
+            g_free(tempBuffer);
+    }
+    else {
+        memset(thumb->rgbPixels, 0, thumb->rgbRowBytes * thumb->h);
+        memset(thumb->maskPixels, 0, TWTW_THUMB_MASK_ROWBYTES(thumb->w) * thumb->h);
+    }
+    
+    if (twtw_page_get_curves_count (page) > 0) {
+        drawThumbCurves(page, thumb, dstPixStride);
+    }
+}
+
+TwtwPageThumb *twtw_page_get_thumb (TwtwPage *page)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    if (page->thumbIsDirty) {
+        twtw_page_render_thumb (page);
+        page->thumbIsDirty = FALSE;
+    }
+    return &(page->thumb);
+}
+
+TwtwPageThumb *twtw_page_peek_thumb (TwtwPage *page, gboolean *outIsDirty)
+{
+    g_return_val_if_fail (page, NULL);
+    
+    if (outIsDirty) *outIsDirty = page->thumbIsDirty;
+    return &(page->thumb);
+}
+
+void twtw_page_invalidate_thumb (TwtwPage *page)
+{
+    g_return_if_fail (page);
+    
+    page->thumbIsDirty = TRUE;
+    
+    gint i;
+    for (i = 0; i < page->thumbLevelCount; i++) {
+        page->thumbLevels[i]->isDirty = TRUE;
+    }
+    for (i = 0; i < page->thumbMipCount; i++) {
+        page->thumbMips[i]->isDirty = TRUE;
+    }
+}
+
+
+/*
+  previews at arbitrary sizes.
+  the page keeps a mip chain: the base level is drawn by the headless page renderer (twtw-pagerender.h) at 16:9
+  with a power-of-two width, and each smaller mip is a 2*2 reduction of the one above it.
+  a requested size is box-filtered from the smallest mip that covers it on both axes, so any set of sizes
+  costs one render plus cheap reductions. the base is rendered again only if the page changes
+  or a size larger than the base is asked for.
+  the page renderer fills the background, so every level is fully opaque and its mask is all set.
+*/
+
+#define THUMB_LEVEL_MAX_SIZE  4096
+#define THUMB_MIP_MIN_BASE_W  256
+#define THUMB_MIP_MIN_W       16
+
+static TwtwPageThumbLevel *createThumbLevel (gint w, gint h)
+{
+    TwtwPageThumbLevel *level = g_malloc0(sizeof(TwtwPageThumbLevel));
+    TwtwPageThumb *thumb = &(level->thumb);
+    
+    thumb->w = w;
+    thumb->h = h;
+#ifdef __APPLE__
+    thumb->rgbHasAlpha = TRUE;
+#else
+    thumb->rgbHasAlpha = FALSE;
+#endif
+    thumb->rgbRowBytes = thumb->w * ((thumb->rgbHasAlpha) ? 4 : 3);
+    
+    thumb->rgbPixels = g_malloc0(thumb->rgbRowBytes * thumb->h);
+    thumb->maskPixels = g_malloc(TWTW_THUMB_MASK_ROWBYTES(thumb->w) * thumb->h);
+    memset(thumb->maskPixels, 0xff, TWTW_THUMB_MASK_ROWBYTES(thumb->w) * thumb->h);
+    
+    level->isDirty = TRUE;
+    return level;
 }
 
-gpointer twtw_page_get_edit_data (TwtwPage *page)
+static void destroyThumbLevel (TwtwPageThumbLevel *level)
 {
-    g_return_val_if_fail (page, NULL);
+    if ( !level) return;
     
-    return page->editData;
+    g_free(level->thumb.rgbPixels);
+    g_free(level->thumb.maskPixels);
+    g_free(level);
 }
 
-
-// only called by the book object
-void twtw_page_set_temp_path_for_pcm_sound (TwtwPage *page, char *path)
+// averages each box of source pixels into one destination pixel (for a 2x reduction, the usual 2*2 mip filter).
+// a box is at least one source pixel, so a destination larger than the source is stretched. if the source has no alpha, destination alpha is 255
+static void boxFilterReduce (const unsigned char *src, const int srcW, const int srcH, const size_t srcRowBytes, const int srcPixStride,
+                             unsigned char *dst, const int dstW, const int dstH, const size_t dstRowBytes, const int dstPixStride)
 {
-    g_return_if_fail (page);
-    g_return_if_fail (path);
+    const int channelCount = MIN(srcPixStride, dstPixStride);
+    uint32_t *colSums = g_malloc(srcW * channelCount * sizeof(uint32_t));
+    int dx, dy, sx, sy, c;
     
-    g_free(page->soundTempPath);
-    page->soundTempPath = g_strdup(path);
+    for (dy = 0; dy < dstH; dy++) {
+        const int sy0 = MIN((dy * srcH) / dstH, srcH - 1);
+        const int sy1 = MAX(((dy + 1) * srcH) / dstH, sy0 + 1);
+        
+        // sum the box's source rows for each column, then each destination pixel sums its span of columns
+        memset(colSums, 0, srcW * channelCount * sizeof(uint32_t));
+        for (sy = sy0; sy < sy1; sy++) {
+            const unsigned char *s = src + srcRowBytes * sy;
+            uint32_t *sum = colSums;
+            for (sx = 0; sx < srcW; sx++) {
+                for (c = 0; c < channelCount; c++)
+                    sum[c] += s[c];
+                s += srcPixStride;
+                sum += channelCount;
+            }
+        }
+        
+        unsigned char *d = dst + dstRowBytes * dy;
+        for (dx = 0; dx < dstW; dx++) {
+            const int sx0 = MIN((dx * srcW) / dstW, srcW - 1);
+            const int sx1 = MAX(((dx + 1) * srcW) / dstW, sx0 + 1);
+            const uint32_t count = (sx1 - sx0) * (sy1 - sy0);
+            
+            for (c = 0; c < channelCount; c++) {
+                uint32_t v = 0;
+                for (sx = sx0; sx < sx1; sx++)
+                    v += colSums[sx * channelCount + c];
+                d[c] = (v + count / 2) / count;
+            }
+            if (dstPixStride > channelCount)
+                d[3] = 255;
+            
+            d += dstPixStride;
+        }
+    }
+    g_free(colSums);
 }
 
-const char *twtw_page_get_temp_path_for_pcm_sound_utf8 (TwtwPage *page)
+static void reduceThumbLevel (const TwtwPageThumbLevel *srcLevel, TwtwPageThumbLevel *level)
 {
-    g_return_val_if_fail (page, NULL);
+    const TwtwPageThumb *src = &(srcLevel->thumb);
+    TwtwPageThumb *thumb = &(level->thumb);
     
-    return page->soundTempPath;
+    boxFilterReduce(src->rgbPixels, src->w, src->h, src->rgbRowBytes, (src->rgbHasAlpha) ? 4 : 3,
+                    thumb->rgbPixels, thumb->w, thumb->h, thumb->rgbRowBytes, (thumb->rgbHasAlpha) ? 4 : 3);
 }
 
-
-TwtwYUVImage *twtw_page_get_yuv_photo (TwtwPage *page)
+static void renderThumbMipBase (TwtwPage *page, TwtwPageThumbLevel *base)
 {
-    g_return_val_if_fail (page, NULL);
+    TwtwPageThumb *thumb = &(base->thumb);
     
-    return page->photoImage;
+    TwtwPageRenderer *renderer = twtw_page_renderer_create (thumb->w);
+    g_return_if_fail (renderer);
+    
+    size_t srcRowBytes = 0;
+    const unsigned char *rgb = twtw_page_renderer_draw_page (renderer, page, &srcRowBytes);
+    
+    // same size, so this only converts the renderer's 24-bit RGB into the thumb's pixel format
+    boxFilterReduce(rgb, thumb->w, thumb->h, srcRowBytes, 3,
+                    thumb->rgbPixels, thumb->w, thumb->h, thumb->rgbRowBytes, (thumb->rgbHasAlpha) ? 4 : 3);
+    
+    twtw_page_renderer_destroy (renderer);
 }
 
-void twtw_page_set_yuv_photo_copy (TwtwPage *page, TwtwYUVImage *photo)
+// (re)creates the mip chain if its base doesn't cover the given size on both axes.
+// the base is at most THUMB_LEVEL_MAX_SIZE wide, so a level that's taller than 16:9 at that width is stretched from it
+static void ensureThumbMipsCover (TwtwPage *page, gint w, gint h)
 {
-    g_return_if_fail (page);
+    // the renderer's height is derived from the width, so make it wide enough to cover the height too
+    const gint needW = MIN(MAX(w, (h * 16 + 8) / 9), THUMB_LEVEL_MAX_SIZE);
+    
+    if (page->thumbMipCount > 0 && page->thumbMips[0]->thumb.w >= needW)
+        return;
     
-    if (page->photoImage) {
-        twtw_yuv_image_destroy (page->photoImage);
-        page->photoImage = NULL;
+    gint baseW = THUMB_MIP_MIN_BASE_W;
+    while (baseW < needW)
+        baseW *= 2;
+    
+    while (page->thumbMipCount > 0) {
+        destroyThumbLevel(page->thumbMips[--page->thumbMipCount]);
     }
+    
+    gint mipW = baseW;
+    gint mipH = MAX(1, (baseW * 9 + 8) / 16);  // as in twtw_page_renderer_create()
+    while (page->thumbMipCount < THUMB_MIP_MAX_COUNT) {
+        page->thumbMips[page->thumbMipCount++] = createThumbLevel (mipW, mipH);
         
-    if (photo) {
-        page->photoImage = twtw_yuv_image_copy (photo);
+        if (mipW / 2 < THUMB_MIP_MIN_W)
+            break;
+        mipW /= 2;
+        mipH = MAX(1, mipH / 2);
     }
-    
-    page->thumbIsDirty = TRUE;
 }
 
-// private method
-void twtw_page_render_thumb (TwtwPage *page)
+static void updateThumbMip (TwtwPage *page, gint index)
 {
-    TwtwPageThumb *thumb = &(page->thumb);
-    const int dstPixStride = (thumb->rgbHasAlpha) ? 4 : 3;
-
-    if (page->photoImage) {
-        // static temp buffer so we don't have to malloc every time -- potentially un-threadsafe
-        static unsigned char *s_tempBuffer = NULL;
-        static int s_tempBufW = 0;
-        static int s_tempBufH = 0;
-        
-        const int xStride = 2;
-        const int yStride = 4;
-        const int tempW = page->photoImage->w / xStride;
-        const int tempH = page->photoImage->h / yStride;
-        const int tempBufRowBytes = tempW * dstPixStride;
-        
-        if ( !s_tempBuffer || s_tempBufW != tempW || s_tempBufH != tempH) {
-            g_free(s_tempBuffer);
-            s_tempBuffer = g_malloc(tempBufRowBytes * tempH);
-            s_tempBufW = tempW;
-            s_tempBufH = tempH;
-            ///printf("malloced thumb photo temp buffer for size %i * %i\n", tempW, tempH);
-        }
+    TwtwPageThumbLevel *mip = page->thumbMips[index];
+    if ( !mip->isDirty)
+        return;
     
-        twtw_yuv_image_convert_to_rgb_for_display (page->photoImage,
-                                                   s_tempBuffer,
-                                                   tempBufRowBytes,
-                                                   thumb->rgbHasAlpha,
-                                                   xStride,
-                                                   yStride);
-                                                   
-        // scaling, and some color correction to make the thumbnail stack stand out better against the current page's background
-        const TwtwFixedNum xInc = FIXD_QDIV(TWTW_UNITS_FROM_INT(tempW), TWTW_UNITS_FROM_INT(thumb->w));
-        const TwtwFixedNum yInc = FIXD_QDIV(TWTW_UNITS_FROM_INT(tempH), TWTW_UNITS_FROM_FLOAT(thumb->h * 1.15));
-        // there's some non-displayed gunk at the bottom of the image frame, so crop it ^^
-
-        const TwtwFixedNum def_pedestal = TWTW_UNITS_FROM_INT(55);
-        const TwtwFixedNum def_gain = TWTW_UNITS_FROM_FLOAT(200.0 / 255.0);
-        
-        unsigned int x, y;
-        for (y = 0; y < thumb->h; y++) {
-            unsigned char *src = s_tempBuffer + tempBufRowBytes * TWTW_UNITS_TO_INT( FIXD_MUL(yInc, TWTW_UNITS_FROM_INT(y)) );
-            unsigned char *dst = thumb->rgbPixels + thumb->rgbRowBytes * y;
-
-            for (x = 0; x < thumb->w; x++) {
-                unsigned char *s = src + dstPixStride * TWTW_UNITS_TO_INT( FIXD_MUL(xInc, TWTW_UNITS_FROM_INT(x)) );
-                
-                // add a highlight to make the thumbnail stand out better against dark backgrounds
-                TwtwFixedNum gain = (y > 80 || x > 10) ? def_gain
-                                                      : FIXD_MUL(def_gain, FIXD_ONE + TWTW_UNITS_FROM_FLOAT(powf((float)(10 - x) / 10, 3.0) * 1.5));
-                
-                TwtwFixedNum pedestal = (y > 15) ? def_pedestal
-                                                 : def_pedestal + FIXD_MUL(def_pedestal, TWTW_UNITS_FROM_FLOAT(((float)(15 - y) / 15) * 1.5));
-                
-                int v0 = TWTW_UNITS_TO_INT( pedestal + FIXD_MUL(TWTW_UNITS_FROM_INT(s[0]), gain) );
-                int v1 = TWTW_UNITS_TO_INT( pedestal + FIXD_MUL(TWTW_UNITS_FROM_INT(s[1]), gain) );
-                int v2 = TWTW_UNITS_TO_INT( pedestal + FIXD_MUL(TWTW_UNITS_FROM_INT(s[2]), gain) );
-                dst[0] = MAX(0, MIN(v0, 255));
-                dst[1] = MAX(0, MIN(v1, 255));
-                dst[2] = MAX(0, MIN(v2, 255));
-                if (dstPixStride == 4)
-                    dst[3] = s[3];
-                dst += dstPixStride;
-            }
-        }
-        // set mask to full opacity since we have a background photo
-        memset(thumb->maskPixels, 0xff, (thumb->w / 8) * thumb->h);
-    }
-    else {
-        memset(thumb->rgbPixels, 0, thumb->rgbRowBytes * thumb->h);
-        memset(thumb->maskPixels, 0, (thumb->w / 8) * thumb->h);
+    if (index == 0) {
+        renderThumbMipBase (page, mip);
+    } else {
+        updateThumbMip (page, index - 1);
+        reduceThumbLevel (page->thumbMips[index - 1], mip);
     }
-    
-    int curveCount = twtw_page_get_curves_count (page);
-    if (curveCount > 0) {
-        unsigned char *rgbPalette = twtw_default_color_palette_rgb_array (NULL);
-        g_return_if_fail(rgbPalette);
-        
-        TwtwFixedNum canvasScaleMul_x = FIXD_QDIV(TWTW_UNITS_FROM_INT(thumb->w), TWTW_CANONICAL_CANVAS_WIDTH_FIXD);
-        TwtwFixedNum canvasScaleMul_y = FIXD_QDIV(TWTW_UNITS_FROM_INT(thumb->h), TWTW_UNITS_FROM_FLOAT(TWTW_CANONICAL_CANVAS_WIDTH / (16.0 / 9.0)));
-        
-        #if !defined(TWTW_CURVESER_IS_IDENTITY)
-        canvasScaleMul_x = FIXD_QMUL(canvasScaleMul_x, TWTW_CURVESER_SCALE_IN);
-        canvasScaleMul_y = FIXD_QMUL(canvasScaleMul_y, TWTW_CURVESER_SCALE_IN);
-        #endif
-        
-        const int yDispOffset = 40;
-        
-        ///printf("%s: canvas scale is %.4f (thumb w %i)\n", __func__, TWTW_UNITS_TO_FLOAT(canvasScaleMul), thumb->w);
-
-        int n;
-        for (n = 0; n < curveCount; n++) {
-            TwtwCurveList *curve = twtw_page_get_curve(page, n);
-            // for each curve, just draw pixels at point vertices
-
-            int segCount = twtw_curvelist_get_segment_count (curve);
-            TwtwCurveSegment *segs = twtw_curvelist_get_segment_array (curve);            
-            
-            const int colorID = twtw_curvelist_get_color_id (curve);
-            unsigned char *rgbColor = rgbPalette + ((colorID >= 0) ? (colorID*3) : 0);
-            
-            int i;
-            for (i = 0; i < segCount; i++) {
-                TwtwCurveSegment *seg = segs + i;
-                TwtwPoint startPoint = seg->startPoint;
-                TwtwPoint endPoint = seg->endPoint;
-                
-                startPoint.y += yDispOffset;
-                endPoint.y += yDispOffset;
-                
-                TwtwPoint midPoint = TwtwMakePoint((startPoint.x + endPoint.x) >> 1, (startPoint.y + endPoint.y) >> 1);
-                
-                int p0_x = TWTW_UNITS_TO_INT( FIXD_MUL(startPoint.x, canvasScaleMul_x) );
-                int p0_y = TWTW_UNITS_TO_INT( FIXD_MUL(startPoint.y, canvasScaleMul_y) );
+    mip->isDirty = FALSE;
+}
 
-                int p1_x = TWTW_UNITS_TO_INT( FIXD_MUL(midPoint.x, canvasScaleMul_x) );
-                int p1_y = TWTW_UNITS_TO_INT( FIXD_MUL(midPoint.y, canvasScaleMul_y) );
+static void updateThumbLevel (TwtwPage *page, TwtwPageThumbLevel *level)
+{
+    if ( !level->isDirty)
+        return;
+    
+    TwtwPageThumb *thumb = &(level->thumb);
+    ensureThumbMipsCover (page, thumb->w, thumb->h);
+    
+    // smallest mip that still covers the level; the base does unless the level is taller than the largest base
+    gint mipIndex = 0;
+    while (mipIndex + 1 < page->thumbMipCount
+                && page->thumbMips[mipIndex + 1]->thumb.w >= thumb->w && page->thumbMips[mipIndex + 1]->thumb.h >= thumb->h)
+        mipIndex++;
+    
+    updateThumbMip (page, mipIndex);
+    reduceThumbLevel (page->thumbMips[mipIndex], level);
+    
+    level->isDirty = FALSE;
+}
 
-#define WRITEPX(dst_, src_)  \
-        (dst_)[0] = src_[0];  (dst_)[1] = src_[1];  (dst_)[2] = (src_)[2];  \
-        if (dstPixStride == 4)  (dst_)[3] = 255;
+// the palettes and the photo gamma LUT are built lazily on first use; this makes sure it happens only once
+// even if previews are first requested from several threads at the same time
+static pthread_once_t g_thumbTablesOnce = PTHREAD_ONCE_INIT;
 
-                if (p0_x >= 0 && p0_x < thumb->w && p0_y >= 0 && p0_y < thumb->h) {
-                    unsigned char *px = thumb->rgbPixels + thumb->rgbRowBytes*p0_y + dstPixStride*p0_x;
-                    WRITEPX(px, rgbColor);
-                    
-                    if (p0_x < thumb->w-1) {
-                        WRITEPX(px+dstPixStride, rgbColor);
-                    }
-                }
-                
-                if (p1_x >= 0 && p1_x < thumb->w && p1_y >= 0 && p1_y < thumb->h) {
-                    unsigned char *px = thumb->rgbPixels + thumb->rgbRowBytes*p1_y + dstPixStride*p1_x;
-                    WRITEPX(px, rgbColor);
-                    
-                    if (p0_x < thumb->w-1) {
-                        WRITEPX(px+dstPixStride, rgbColor);
-                    }
-                }
-#undef WRITEPX
-            }
-        }
-    }
+static void primeSharedTablesForThumbs ()
+{
+    twtw_default_color_palette_rgb_array (NULL);
+    twtw_default_color_palette_line_weight_array (NULL);
+    twtw_photo_init_shared_tables ();
 }
 
-TwtwPageThumb *twtw_page_get_thumb (TwtwPage *page)
+TwtwPageThumb *twtw_page_get_thumb_with_size (TwtwPage *page, gint w, gint h)
 {
     g_return_val_if_fail (page, NULL);
+    g_return_val_if_fail (w > 0 && h > 0 && w <= THUMB_LEVEL_MAX_SIZE && h <= THUMB_LEVEL_MAX_SIZE, NULL);
     
-    if (page->thumbIsDirty) {
-        twtw_page_render_thumb (page);
-        page->thumbIsDirty = FALSE;
+    pthread_once(&g_thumbTablesOnce, primeSharedTablesForThumbs);
+    
+    TwtwPageThumbLevel *level = NULL;
+    gint i;
+    for (i = 0; i < page->thumbLevelCount; i++) {
+        if (page->thumbLevels[i]->thumb.w == w && page->thumbLevels[i]->thumb.h == h) {
+            level = page->thumbLevels[i];
+            break;
+        }
     }
-    return &(page->thumb);
-}
-
-void twtw_page_invalidate_thumb (TwtwPage *page)
-{
-    g_return_if_fail (page);
     
-    page->thumbIsDirty = TRUE;
+    if ( !level) {
+        if (page->thumbLevelCount >= TWTW_THUMB_MAX_LEVELS) {
+            gint lruIndex = 0;
+            for (i = 1; i < page->thumbLevelCount; i++) {
+                if (page->thumbLevels[i]->lastUsed < page->thumbLevels[lruIndex]->lastUsed)
+                    lruIndex = i;
+            }
+            ///printf("%s: evicting thumb level %i * %i\n", __func__, page->thumbLevels[lruIndex]->thumb.w, page->thumbLevels[lruIndex]->thumb.h);
+            destroyThumbLevel (page->thumbLevels[lruIndex]);
+            page->thumbLevels[lruIndex] = page->thumbLevels[--page->thumbLevelCount];
+        }
+        level = createThumbLevel (w, h);
+        page->thumbLevels[page->thumbLevelCount++] = level;
+    }
+    
+    level->lastUsed = ++page->thumbLevelClock;
+    
+    updateThumbLevel (page, level);
+    return &(level->thumb);
 }
 
 
@@ -859,7 +2327,7 @@ gboolean twtw_book_page_has_content (TwtwBook *book, gint index)
         return TRUE;
     else if (twtw_page_get_sound_duration_in_seconds (page) > 0)
         return TRUE;
-    else if (twtw_page_get_yuv_photo (page))
+    else if (twtw_page_has_photo (page))
         return TRUE;
     else
         return FALSE;
@@ -892,6 +2360,138 @@ gint twtw_book_get_total_sound_duration (TwtwBook *book)
     return sum;
 }
 
+
+// --- parallel thumbnail rendering ---
+
+#define MAX_THUMB_THREADS  8
+
+typedef struct {
+    TwtwBook *book;
+    gint *dirtyIndexes;
+    gint dirtyCount;
+    
+    TwtwThumbReadyFunc readyFunc;
+    void *cbData;
+    gint reportedCount;         // only accessed by the calling thread
+    
+    pthread_mutex_t mutex;      // protects the fields below
+    gint nextDirtyIndex;
+    gint *doneIndexes;          // page indexes in the order their thumbs were finished
+    gint doneCount;
+} TwtwThumbRegenJob;
+
+// returns FALSE when there are no more thumbs to render
+static gboolean renderNextDirtyThumb (TwtwThumbRegenJob *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    const gint n = job->nextDirtyIndex++;
+    pthread_mutex_unlock(&job->mutex);
+    
+    if (n >= job->dirtyCount)
+        return FALSE;
+    
+    const gint pageIndex = job->dirtyIndexes[n];
+    TwtwPage *page = job->book->pages[pageIndex];
+    
+    twtw_page_render_thumb (page);
+    page->thumbIsDirty = FALSE;
+    
+    pthread_mutex_lock(&job->mutex);
+    job->doneIndexes[job->doneCount++] = pageIndex;
+    pthread_mutex_unlock(&job->mutex);
+    return TRUE;
+}
+
+static void *thumbRegenThreadFunc (void *userData)
+{
+    TwtwThumbRegenJob *job = (TwtwThumbRegenJob *)userData;
+    
+    while (renderNextDirtyThumb (job))
+        ;
+    return NULL;
+}
+
+// called on the calling thread only, so the callback can touch the UI
+static void reportFinishedThumbs (TwtwThumbRegenJob *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    const gint doneCount = job->doneCount;
+    pthread_mutex_unlock(&job->mutex);
+    
+    // entries below doneCount are no longer written
+    for ( ; job->reportedCount < doneCount; job->reportedCount++) {
+        if (job->readyFunc)
+            job->readyFunc (job->book, job->doneIndexes[job->reportedCount], job->cbData);
+    }
+}
+
+gint twtw_book_regen_dirty_thumbs (TwtwBook *book, gint threadCount, TwtwThumbReadyFunc readyFunc, void *cbData)
+{
+    g_return_val_if_fail (book, 0);
+    
+    gint dirtyCount = 0;
+    gint i;
+    for (i = 0; i < book->pageCount; i++) {
+        if (book->pages[i]->thumbIsDirty)
+            dirtyCount++;
+    }
+    if (dirtyCount < 1)
+        return 0;
+        
+    gint *dirtyIndexes = g_malloc(dirtyCount * sizeof(gint));
+    gint n = 0;
+    for (i = 0; i < book->pageCount; i++) {
+        if (book->pages[i]->thumbIsDirty)
+            dirtyIndexes[n++] = i;
+    }
+    
+    if (threadCount <= 0) {
+        long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cpuCount > 0) ? (gint)cpuCount : 1;
+    }
+    threadCount = MAX(1, MIN(MIN(threadCount, MAX_THUMB_THREADS), dirtyCount));
+    
+    TwtwThumbRegenJob job;
+    memset(&job, 0, sizeof(job));
+    job.book = book;
+    job.dirtyIndexes = dirtyIndexes;
+    job.dirtyCount = dirtyCount;
+    job.readyFunc = readyFunc;
+    job.cbData = cbData;
+    job.doneIndexes = g_malloc(dirtyCount * sizeof(gint));
+    pthread_mutex_init(&job.mutex, NULL);
+    
+    // lazily built tables must exist before the workers start
+    twtw_default_color_palette_rgb_array (NULL);
+    twtw_photo_init_shared_tables ();
+    
+    pthread_t threads[MAX_THUMB_THREADS];
+    gint threadsStarted = 0;
+    for (i = 1; i < threadCount; i++) {
+        if (0 != pthread_create(&threads[threadsStarted], NULL, thumbRegenThreadFunc, &job)) {
+            printf("** %s: could not create worker thread %i\n", __func__, i);
+            break;
+        }
+        threadsStarted++;
+    }
+    
+    // the calling thread works too, and reports the thumbs that are done (its own and the workers') between renders
+    while (renderNextDirtyThumb (&job))
+        reportFinishedThumbs (&job);
+    
+    for (i = 0; i < threadsStarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    reportFinishedThumbs (&job);
+    
+    pthread_mutex_destroy(&job.mutex);
+    g_free(job.doneIndexes);
+    g_free(dirtyIndexes);
+    
+    return dirtyCount;
+}
+
+
 const char *twtw_book_get_author (TwtwBook *book)
 {
     g_return_val_if_fail (book, NULL);
@@ -1056,8 +2656,6 @@ void twtw_remove_active_document_notif_callback (TwtwDocumentNotificationCallbac
 #endif
 
 #include "twtw-ogg.h"
-#include "twtw-byteorder.h"
-#include "twtw-audioconv.h"
 
 
 // a stream of type TWTW_STREAM_PICTURE can contain both curve data and photo data.
@@ -1066,6 +2664,21 @@ void twtw_remove_active_document_notif_callback (TwtwDocumentNotificationCallbac
 #define TWTW_HEADERSIZE_twCu   16
 #define TWTW_HEADERSIZE_twPh   38
 
+// after the curves, the stream can have the waveform overview of the page's sound ("twWv"):
+// le32 data size + le32 frames per peak + le32 metadata size, then the min/max pairs as signed bytes.
+// older readers stop after the curves, so they don't see it
+#define TWTW_HEADERSIZE_twWv   16
+
+// the twPh header's metadata can contain a photo ID ("twPi" + le32 flags + le64 ID).
+// a photo that appears on several pages has the same ID on each, so it's only loaded once. from document version 1.1,
+// the photo's data is only written on the first page that has it: the later pages have entries with the reference flag
+// and no data. a document is only written as 1.1 when it has such entries, so other documents stay readable as before
+// (readers before 1.1 don't check the version, and they show no photo on pages with a reference)
+#define TWTW_METADATASIZE_twPi  16
+#define TWTW_PHOTOID_IS_REFERENCE  1
+
+#define TWTW_DOC_VERSION_MINOR_PHOTO_REFS  1
+
 
 // ------ reading ------
 
@@ -1097,6 +2710,13 @@ typedef struct {
     TwtwDocumentBonePacket docBone;
     gboolean docIsValid;
     
+    gint32 readFlags;
+    
+    // photos with an ID read so far, for resolving references from later pages
+    gint photoIDCount;
+    guint64 *photoIDs;
+    TwtwSharedPhoto **photosForIDs;
+    
     TwtwBook *newBook;
 } TwtwOggFileInfo;
 
@@ -1225,8 +2845,19 @@ static int oggzCbReadPacket_findEOS(OGGZ *oggz, ogg_packet *op, long serialno, v
         return 0;
 }
 
-static int readPictureFromOggPacketIntoBook(TwtwBook *book, int pageIndex, ogg_packet *op, TwtwPictureHeadPacket *picHead)
+static TwtwSharedPhoto *findPhotoWithID(TwtwOggFileInfo *fileInfo, guint64 photoID)
+{
+    gint i;
+    for (i = 0; i < fileInfo->photoIDCount; i++) {
+        if (fileInfo->photoIDs[i] == photoID)
+            return fileInfo->photosForIDs[i];
+    }
+    return NULL;
+}
+
+static int readPictureFromOggPacketIntoBook(TwtwOggFileInfo *fileInfo, int pageIndex, ogg_packet *op, TwtwPictureHeadPacket *picHead)
 {
+    TwtwBook *book = fileInfo->newBook;
     g_assert(book);
     g_assert(op);
     TwtwPage *page = twtw_book_get_page (book, pageIndex);
@@ -1263,19 +2894,54 @@ static int readPictureFromOggPacketIntoBook(TwtwBook *book, int pageIndex, ogg_p
             dstRect[2] = _le_16_s (*((uint16_t *)(data+30)));
             dstRect[3] = _le_16_s (*((uint16_t *)(data+32)));
             
-            // metadata size; currently unused.
             uint32_t metadataSizeInBytes = _le_32 (*((uint32_t *)(data+34)));
+            g_return_val_if_fail(metadataSizeInBytes < op->bytes, OGGZ_STOP_ERR);  // sanity check
+            
+            gboolean hasPhotoID = FALSE;
+            uint32_t photoIDFlags = 0;
+            guint64 photoID = 0;
+            if (metadataSizeInBytes >= TWTW_METADATASIZE_twPi && 0 == memcmp(data+TWTW_HEADERSIZE_twPh, "twPi", 4)) {
+                unsigned char *md = data + TWTW_HEADERSIZE_twPh;
+                hasPhotoID = TRUE;
+                photoIDFlags = _le_32 (*((uint32_t *)(md+4)));
+                photoID = (guint64)_le_32 (*((uint32_t *)(md+8))) | ((guint64)_le_32 (*((uint32_t *)(md+12))) << 32);
+            }
             
             data += TWTW_HEADERSIZE_twPh + metadataSizeInBytes;
             
             g_return_val_if_fail(photoSerializedSize < op->bytes, OGGZ_STOP_ERR);  // sanity check
             
-            TwtwYUVImage *yuvImage = twtw_yuv_image_create_from_serialized (data, photoSerializedSize, photoWidth, photoHeight, compressedPixelFormat, photoDataOriginalSize);
+            const gboolean isReference = (hasPhotoID && (photoIDFlags & TWTW_PHOTOID_IS_REFERENCE));
+            const gboolean allowsReferences = (fileInfo->docHead.version_major > 1 || fileInfo->docHead.version_minor >= TWTW_DOC_VERSION_MINOR_PHOTO_REFS);
+            TwtwSharedPhoto *photoWithID = (hasPhotoID) ? findPhotoWithID (fileInfo, photoID) : NULL;
             
-            if (yuvImage) {
-                twtw_page_set_yuv_photo_copy (page, yuvImage);
+            if (isReference && !allowsReferences) {
+                printf("** stream for page index %i: photo %i is a reference, which document version %i.%i doesn't have\n", pageIndex, i,
+                                        (int)fileInfo->docHead.version_major, (int)fileInfo->docHead.version_minor);
+            }
+            else if (photoWithID) {
+                setPageSharedPhoto (page, retainSharedPhoto(photoWithID));
+            }
+            else if (isReference) {
+                printf("** stream for page index %i: photo %i refers to unknown photo ID\n", pageIndex, i);
+            }
+            else {
+                // the photo is decoded on demand (one row of tiles at a time for display).
+                // if an identical photo is already in memory (e.g. in another open book), that one is used
+                TwtwSharedPhoto *photo = sharedPhotoForSerializedData (data, photoSerializedSize, photoWidth, photoHeight, compressedPixelFormat, photoDataOriginalSize);
+                
+                if (photo) {
+                    setPageSharedPhoto (page, photo);
+                    
+                    if (hasPhotoID) {
+                        fileInfo->photoIDCount++;
+                        fileInfo->photoIDs = g_realloc(fileInfo->photoIDs, fileInfo->photoIDCount * sizeof(guint64));
+                        fileInfo->photosForIDs = g_realloc(fileInfo->photosForIDs, fileInfo->photoIDCount * sizeof(TwtwSharedPhoto *));
+                        fileInfo->photoIDs[fileInfo->photoIDCount - 1] = photoID;
+                        fileInfo->photosForIDs[fileInfo->photoIDCount - 1] = retainSharedPhoto(photo);
+                    }
+                }
             }
-            twtw_yuv_image_destroy (yuvImage);
             
             data += photoSerializedSize;
             /*
@@ -1344,6 +3010,22 @@ static int readPictureFromOggPacketIntoBook(TwtwBook *book, int pageIndex, ogg_p
             twtw_page_add_curve (page, curvelist);
     }
     
+    unsigned char *dataEnd = (unsigned char *)op->packet + op->bytes;
+    if (data + TWTW_HEADERSIZE_twWv <= dataEnd && 0 == memcmp(data, "twWv", 4)) {
+        uint32_t peakDataSize = _le_32 (*((uint32_t *)(data+4)));
+        uint32_t peakFrames = _le_32 (*((uint32_t *)(data+8)));
+        uint32_t metadataSizeInBytes = _le_32 (*((uint32_t *)(data+12)));
+        
+        data += TWTW_HEADERSIZE_twWv;
+        
+        // peaks with a different period are ignored; they're recomputed from the sound when needed
+        if (metadataSizeInBytes <= dataEnd - data && peakDataSize <= dataEnd - data - metadataSizeInBytes
+                && peakFrames == TWTW_WAVEFORM_PEAK_FRAMES) {
+            data += metadataSizeInBytes;
+            setPageWaveformPeaks (page, twtw_waveform_peaks_create_from_data ((const signed char *)data, peakDataSize / 2));
+        }
+    }
+    
     return 0;
 }
 
@@ -1356,15 +3038,10 @@ static int readSpeexFromOggPacketIntoBook(TwtwBook *book, int pageIndex, ogg_pac
     g_return_val_if_fail (page, OGGZ_STOP_ERR);
     
     if (*pSpeexState == NULL) {
-        // the file hasn't been opened yet
-        const char *path = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
-        g_return_val_if_fail (path, OGGZ_STOP_ERR);
-        
-        printf("%s: page %i: initing decode to path '%s'\n", __func__, pageIndex, path);
-
-        twtw_speex_init_decoding_to_pcm_path_utf8 (path, strlen(path), pSpeexState);
+        // the speex data is only collected here; the page decodes it when the sound is first needed
+        twtw_speex_init_collecting_speex_data (pSpeexState);
         if (*pSpeexState == NULL) {
-            printf("** failed to init speex decoding (path %s)\n", path);
+            printf("** failed to init speex decoding (page %i)\n", pageIndex);
             return OGGZ_STOP_ERR;
         }
         twtw_speex_read_apply_header (*pSpeexState, speexHead);
@@ -1385,13 +3062,16 @@ static int oggzCbReadPacket_readIntoBook(OGGZ *oggz, ogg_packet *op, long serial
     g_assert(fileInfo);
     g_return_val_if_fail(fileInfo->newBook, OGGZ_STOP_ERR);
     
-    if (op->e_o_s) return 0;
-
+    // the other streams end with an empty EOS packet, but the last speex packet has data
+    if (op->e_o_s && op->bytes < 1) return 0;
+    
     ///printf("%s: %i, packet %i, bytes %i, eos %i\n", __func__, (int)serialno, (int)op->packetno, (int)op->bytes, (int)op->e_o_s);
         
+    // the bone stores serials as unsigned 32-bit while oggz gives them as a signed long,
+    // so compare as 32-bit (otherwise streams with a negative serial are missed where long is 64 bits)
     long i, j;
     for (i = 0; i < fileInfo->docHead.num_pages_in_document; i++) {
-        if (serialno == fileInfo->docBone.pic_stream_serials[i]) {
+        if ((ogg_uint32_t)serialno == fileInfo->docBone.pic_stream_serials[i]) {
             // this is a picture stream; find the pertinent picture header
             ///printf("got picture stream with serial %ld\n", serialno);
             TwtwPictureHeadPacket *picHead = NULL;
@@ -1402,9 +3082,12 @@ static int oggzCbReadPacket_readIntoBook(OGGZ *oggz, ogg_packet *op, long serial
             if ( !picHead) {
                 printf("** %s: couldn't find picHead for this stream (%i, index in doc %i)\n", __func__, (int)serialno, i);
             } else
-                return readPictureFromOggPacketIntoBook(fileInfo->newBook, i, op, picHead);
+                return readPictureFromOggPacketIntoBook(fileInfo, i, op, picHead);
         }
-        else if (serialno == fileInfo->docBone.speex_stream_serials[i]) {
+        else if ((ogg_uint32_t)serialno == fileInfo->docBone.speex_stream_serials[i]) {
+            if (fileInfo->readFlags & TWTW_BOOKREAD_SKIP_AUDIO)
+                return 0;
+        
             // this is a speex stream; find the pertinent picture header
             ///printf("got speex stream with serial %ld\n", serialno);
             SpeexHeader *speexHead = NULL;
@@ -1427,6 +3110,11 @@ static int oggzCbReadPacket_readIntoBook(OGGZ *oggz, ogg_packet *op, long serial
 }
 
 gint twtw_book_create_from_path_utf8 (const char *path, size_t pathLen, TwtwBook **outBook)
+{
+    return twtw_book_create_from_path_utf8_with_flags (path, pathLen, 0, outBook);
+}
+
+gint twtw_book_create_from_path_utf8_with_flags (const char *path, size_t pathLen, gint32 readFlags, TwtwBook **outBook)
 {
     g_return_val_if_fail (path && pathLen > 0, TWTW_PARAMERR);
     g_return_val_if_fail (outBook, TWTW_PARAMERR);
@@ -1445,6 +3133,7 @@ gint twtw_book_create_from_path_utf8 (const char *path, size_t pathLen, TwtwBook
     
     gint retval = 0;
     TwtwOggFileInfo *fileInfo = g_malloc0(sizeof(TwtwOggFileInfo));
+    fileInfo->readFlags = readFlags;
     
     oggz_set_read_callback(oggz, -1, (OggzReadPacket)oggzCbReadPacket_countStreamBOS, fileInfo);
 
@@ -1520,25 +3209,33 @@ bail:
         if (info->speexHead) {
             g_free(info->speexHead);
         
-            // if we decoded something, let the book know about it
-            int pcmBytesDecoded = 0;
-            unsigned char *speexData = NULL;
-            size_t speexDataSize = 0;
+            // if we read something, let the book know about it
+            int pcmDataSize = 0;
+            TwtwSpeexPacketStore *speexPackets = NULL;
             if (info->speexState) {
-                twtw_speex_read_finish (info->speexState, &pcmBytesDecoded, &speexData, &speexDataSize);
+                twtw_speex_read_finish (info->speexState, &pcmDataSize, &speexPackets);
             }
             
             // find page associated with this stream
             int i;
             for (i = 0; i < fileInfo->docHead.num_pages_in_document; i++) {
-                if (info->serialno == fileInfo->docBone.speex_stream_serials[i]) {
+                if ((ogg_uint32_t)info->serialno == fileInfo->docBone.speex_stream_serials[i]) {
                     TwtwPage *page = twtw_book_get_page (fileInfo->newBook, i);
                     
-                    twtw_page_set_associated_pcm_data_size (page, pcmBytesDecoded);
-                    
-                    twtw_page_set_cached_speex_data (page, speexData, speexDataSize);
+                    if (speexPackets && pcmDataSize > 0) {
+                        // the waveform was read with the picture stream
+                        TwtwWaveformPeaks *peaks = page->waveformPeaks;
+                        page->waveformPeaks = NULL;
+                        
+                        twtw_page_clear_audio (page);
+                        twtw_page_set_associated_pcm_data_size (page, pcmDataSize);
+                        twtw_page_set_cached_speex_packets (page, speexPackets);
+                        page->waveformPeaks = peaks;
+                        speexPackets = NULL;
+                    }
                 }
             }
+            twtw_speex_packet_store_destroy (speexPackets);
         }        
         memset(info, 0, sizeof(*info));
     }
@@ -1586,6 +3283,12 @@ bail:
 
     _ogg_free(fileInfo->docBone.metadata_fields);
     g_free(fileInfo->streamInfos);
+    
+    for (j = 0; j < fileInfo->photoIDCount; j++) {
+        releaseSharedPhoto(fileInfo->photosForIDs[j]);
+    }
+    g_free(fileInfo->photoIDs);
+    g_free(fileInfo->photosForIDs);
         
     // done with fileInfo
     g_free(fileInfo);
@@ -1669,6 +3372,37 @@ static void appendMetadataKeyValuePairToBuffer(char **mdStr, size_t *mdSize, con
 }
 
 
+// --- parallel speex encoding for saving ---
+
+#define MAX_SPEEX_ENCODE_THREADS  8
+
+typedef struct {
+    TwtwSpeexStatePtr *states;  // NULL entries are skipped
+    gint stateCount;
+    
+    pthread_mutex_t mutex;      // protects the field below
+    gint nextIndex;
+} TwtwSpeexEncodeJob;
+
+static void *speexEncodeThreadFunc (void *userData)
+{
+    TwtwSpeexEncodeJob *job = (TwtwSpeexEncodeJob *)userData;
+    
+    while (1) {
+        pthread_mutex_lock(&job->mutex);
+        const gint n = job->nextIndex++;
+        pthread_mutex_unlock(&job->mutex);
+        
+        if (n >= job->stateCount)
+            break;
+        
+        if (job->states[n])
+            twtw_speex_encode_all_data (job->states[n]);
+    }
+    return NULL;
+}
+
+
 gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t pathLen)
 {
     g_return_val_if_fail (book, TWTW_PARAMERR);
@@ -1716,10 +3450,23 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
     writePacketNowAndCleanupPacketBuffer(oggz, &op, skeletonSerialno);
     
     {
+        // photos that appear on several pages are written once, which needs version 1.1 (see TWTW_PHOTOID_IS_REFERENCE)
+        gboolean hasRepeatedPhotos = FALSE;
+        gint j;
+        for (i = 0; i < 20 && !hasRepeatedPhotos; i++) {
+            TwtwSharedPhoto *photo = twtw_book_get_page (book, i)->photo;
+            for (j = 0; j < i && photo; j++) {
+                if (twtw_book_get_page (book, j)->photo == photo) {
+                    hasRepeatedPhotos = TRUE;
+                    break;
+                }
+            }
+        }
+        
         TwtwDocumentHeadPacket docHead;
         memset(&docHead, 0, sizeof(docHead));
         docHead.version_major = 1;
-        docHead.version_minor = 0;
+        docHead.version_minor = (hasRepeatedPhotos) ? TWTW_DOC_VERSION_MINOR_PHOTO_REFS : 0;
         docHead.num_pages_in_document = 20;
         docHead.granules_per_page = 1000;
     
@@ -1737,7 +3484,7 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
         picHead.sound_duration_in_secs = twtw_page_get_sound_duration_in_seconds (page);
         picHead.num_curves = twtw_page_get_curves_count(page);
         picHead.num_points = -1;  // twtw_page_get_total_point_count(page);
-        picHead.num_photos = (twtw_page_get_yuv_photo(page)) ? 1 : 0;
+        picHead.num_photos = (twtw_page_has_photo(page)) ? 1 : 0;
         //picHead.fg_color_rgba_be = 0;
         //picHead.bg_color_rgba_be = 0xffffffff;
 
@@ -1753,16 +3500,20 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
         
         if (duration > 0) {
             TwtwSpeexStatePtr twtwSpeexState = NULL;
-            size_t existingBufSize = 0;
-            unsigned char *existingBuf = twtw_page_get_cached_speex_data (page, &existingBufSize);
+            TwtwSpeexPacketStore *existingPackets = twtw_page_get_cached_speex_packets (page);
             
-            if (existingBuf) {
-                // there's an existing Speex buffer available
-                if (0 == twtw_speex_init_with_speex_buffer (existingBuf, existingBufSize, &twtwSpeexState)) {
+            if (existingPackets) {
+                // there are existing Speex packets available
+                if (0 == twtw_speex_init_with_speex_packets (existingPackets, &twtwSpeexState)) {
+                    useStream = TRUE;
+                }
+            } else if (page->soundPCMData) {
+                // do PCM->Speex encoding from memory (the page's buffer stays valid until the write is finished)
+                if (0 == twtw_speex_init_encoding_from_pcm_buffer (page->soundPCMData, page->soundPCMDataSize, &twtwSpeexState)) {
                     useStream = TRUE;
                 }
             } else {
-                // do PCM->Speex encoding
+                // the sound is too long to be kept in memory, so encode from the temp file
                 const char *audioPath = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
                 if (0 == twtw_speex_init_encoding_from_pcm_path_utf8 (audioPath, strlen(audioPath), &twtwSpeexState)) {
                     useStream = TRUE;
@@ -1771,7 +3522,7 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             if (useStream) {
                 int result = twtw_speex_write_header_to_oggz (twtwSpeexState, oggz, speexSerials[i]);
                 speexStates[i] = twtwSpeexState;
-                printf("  page %i: writing speex header to serial %i (existing buffer: %p)\n", i, speexSerials[i], existingBuf);
+                printf("  page %i: writing speex header to serial %i (existing packets: %p)\n", i, speexSerials[i], existingPackets);
             }
 
         }
@@ -1779,6 +3530,34 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             speexSerials[i] = -1;
     }
     
+    // the sounds are encoded into packet lists on worker threads while the other streams are written below;
+    // the packets are muxed in step 6
+    TwtwSpeexEncodeJob encodeJob;
+    memset(&encodeJob, 0, sizeof(encodeJob));
+    encodeJob.states = speexStates;
+    encodeJob.stateCount = 20;
+    pthread_mutex_init(&encodeJob.mutex, NULL);
+    
+    pthread_t encodeThreads[MAX_SPEEX_ENCODE_THREADS];
+    gint encodeThreadsStarted = 0;
+    {
+        gint encodeCount = 0;
+        for (i = 0; i < 20; i++) {
+            if (speexStates[i]) encodeCount++;
+        }
+        // the calling thread encodes too once it gets to step 6, so it takes one of the CPUs
+        long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        gint threadCount = MIN(MIN((cpuCount > 1) ? (gint)cpuCount - 1 : 0, MAX_SPEEX_ENCODE_THREADS), encodeCount);
+        
+        for (i = 0; i < threadCount; i++) {
+            if (0 != pthread_create(&encodeThreads[encodeThreadsStarted], NULL, speexEncodeThreadFunc, &encodeJob)) {
+                printf("** %s: could not create encoder thread %i\n", __func__, (int)i);
+                break;
+            }
+            encodeThreadsStarted++;
+        }
+    }
+    
     /*
     const char *audioPath = "/testrec-8k.wav";
     TwtwSpeexStatePtr twtwSpeexState = NULL;
@@ -1902,6 +3681,11 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
 
 
     // --- 5. data streams for pictures ---
+    // a photo shared by several pages is written with the same ID on each of them
+    TwtwSharedPhoto *writtenPhotos[20];
+    guint64 writtenPhotoIDs[20];
+    gint writtenPhotoCount = 0;
+    
     for (i = 0; i < 20; i++) {
         long serialno = pictureSerials[i];
         TwtwPage *page = twtw_book_get_page (book, i);
@@ -1911,9 +3695,43 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
         size_t pagePictureDataSize = 0;
         
         // - write background photo -
-        TwtwYUVImage *photo = twtw_page_get_yuv_photo (page);
-        if (photo && photo->buffer) {
-            const size_t photoDataSize = photo->rowBytes * photo->h;
+        // a photo that was loaded is written out without recompressing; one that was set from pixels is serialized now
+        TwtwSharedPhoto *sharedPhoto = page->photo;
+        TwtwTiledYUVImage *photoTiles = (sharedPhoto) ? getSharedPhotoTiles (sharedPhoto) : NULL;
+        if (photoTiles) {
+            guint64 photoID = 0;
+            gboolean isWritten = FALSE;
+            for (j = 0; j < writtenPhotoCount; j++) {
+                if (writtenPhotos[j] == sharedPhoto) {
+                    photoID = writtenPhotoIDs[j];
+                    isWritten = TRUE;
+                    break;
+                }
+            }
+            if ( !isWritten) {
+                // the content hash makes a good ID, it just needs to be unique within the file
+                photoID = sharedPhoto->dataHash;
+                for (j = 0; j < writtenPhotoCount; j++) {
+                    if (writtenPhotoIDs[j] == photoID) {
+                        photoID++;
+                        j = -1;
+                    }
+                }
+                writtenPhotos[writtenPhotoCount] = sharedPhoto;
+                writtenPhotoIDs[writtenPhotoCount] = photoID;
+                writtenPhotoCount++;
+            }
+        
+            TwtwYUVImage photoInfo;
+            memset(&photoInfo, 0, sizeof(photoInfo));
+            size_t photoDataSize;
+            
+            twtw_tiled_yuv_image_get_size (photoTiles, &photoInfo.w, &photoInfo.h);
+            photoInfo.rowBytes = photoInfo.w * 2;
+            photoInfo.pixelFormat = TWTW_CAM_FOURCC;
+            twtw_tiled_yuv_image_get_serialized_data (photoTiles, NULL, NULL, &photoDataSize);
+            if (photoDataSize == 0)
+                photoDataSize = photoInfo.rowBytes * photoInfo.h;
             
             /*
             // deflate photo image data
@@ -1925,13 +3743,15 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             printf("deflated YUV photo: orig data size %i -> %i  (%i * %i px)\n", photoDataSize, deflatedSize, photo->w, photo->h);
             */
             
+            // a photo that's already been written on an earlier page is written as a reference without data
             size_t serializedPhotoSize = 0;
-            unsigned char *serializedPhotoData = NULL;
             uint32_t serPhotoFourCC = 0;
-            twtw_yuv_image_serialize (photo, &serializedPhotoData, &serializedPhotoSize, &serPhotoFourCC);
+            const unsigned char *serializedPhotoData = twtw_tiled_yuv_image_get_serialized_data (photoTiles, &serializedPhotoSize, &serPhotoFourCC, NULL);
+            if (isWritten)
+                serializedPhotoSize = 0;
             
                                     
-            const int photoHeaderSize = TWTW_HEADERSIZE_twPh;
+            const int photoHeaderSize = TWTW_HEADERSIZE_twPh + TWTW_METADATASIZE_twPi;
             pagePictureDataSize += serializedPhotoSize + photoHeaderSize;  
         
             pagePictureData = ( !pagePictureData) ? g_malloc(pagePictureDataSize)
@@ -1942,10 +3762,10 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             *((uint32_t *)(thisData+4)) = _le_32 ((uint32_t)serializedPhotoSize);
             *((uint32_t *)(thisData+8)) = _le_32 ((uint32_t)photoDataSize);
 
-            *((uint16_t *)(thisData+12)) = _le_16 ((uint16_t)photo->w);
-            *((uint16_t *)(thisData+14)) = _le_16 ((uint16_t)photo->h);
-            *((uint16_t *)(thisData+16)) = _le_16 ((uint16_t)photo->rowBytes);
-            *((uint32_t *)(thisData+18)) = photo->pixelFormat;  // original image fourCC (already little-endian by definition)
+            *((uint16_t *)(thisData+12)) = _le_16 ((uint16_t)photoInfo.w);
+            *((uint16_t *)(thisData+14)) = _le_16 ((uint16_t)photoInfo.h);
+            *((uint16_t *)(thisData+16)) = _le_16 ((uint16_t)photoInfo.rowBytes);
+            *((uint32_t *)(thisData+18)) = photoInfo.pixelFormat;  // original image fourCC (already little-endian by definition)
             *((uint32_t *)(thisData+22)) = serPhotoFourCC;      // compressed image fourCC
             
             // image dst rectangle; currently unused by the editor, but it's stored in the file format
@@ -1957,12 +3777,17 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             *((int16_t *)(thisData+30)) = _le_16_s (dstRect[2]);
             *((int16_t *)(thisData+32)) = _le_16_s (dstRect[3]);
             
-            // metadata size in bytes (for expansion; currently unused)
-            *((uint32_t *)(thisData+34)) = _le_32 (0);
+            // metadata size in bytes, and the photo ID
+            *((uint32_t *)(thisData+34)) = _le_32 (TWTW_METADATASIZE_twPi);
             
-            memcpy(thisData+photoHeaderSize, serializedPhotoData, serializedPhotoSize);
+            unsigned char *md = thisData + TWTW_HEADERSIZE_twPh;
+            memcpy(md, "twPi", 4);
+            *((uint32_t *)(md+4)) = _le_32 ((isWritten) ? TWTW_PHOTOID_IS_REFERENCE : 0);
+            *((uint32_t *)(md+8)) = _le_32 ((uint32_t)photoID);
+            *((uint32_t *)(md+12)) = _le_32 ((uint32_t)(photoID >> 32));
             
-            g_free(serializedPhotoData);
+            if (serializedPhotoSize > 0)
+                memcpy(thisData+photoHeaderSize, serializedPhotoData, serializedPhotoSize);
         }
         
         // - write curves -
@@ -2025,6 +3850,26 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
             g_free(serData);
         }
         
+        // - write waveform overview -
+        const TwtwWaveformPeaks *peaks = twtw_page_get_waveform_peaks (page);
+        size_t peakDataSize = (peaks) ? twtw_waveform_peaks_get_count (peaks) * 2 : 0;
+        
+        if (peakDataSize > 0) {
+            const int peaksHeaderSize = TWTW_HEADERSIZE_twWv;
+            pagePictureDataSize += peakDataSize + peaksHeaderSize;
+            
+            pagePictureData = ( !pagePictureData) ? g_malloc(pagePictureDataSize)
+                                                  : g_realloc(pagePictureData, pagePictureDataSize);
+            
+            unsigned char *thisData = pagePictureData + pagePictureDataSize - peakDataSize - peaksHeaderSize;
+            memcpy(thisData, "twWv", 4);
+            *((uint32_t *)(thisData+4)) = _le_32 ((uint32_t)peakDataSize);
+            *((uint32_t *)(thisData+8)) = _le_32 ((uint32_t)TWTW_WAVEFORM_PEAK_FRAMES);
+            *((uint32_t *)(thisData+12)) = _le_32 (0);  // metadata size; currently unused
+            
+            memcpy(thisData+peaksHeaderSize, twtw_waveform_peaks_get_data (peaks), peakDataSize);
+        }
+        
         // write data packet for picture stream
         if (pagePictureDataSize > 0 && pagePictureData) {
             memset(&op, 0, sizeof(op));
@@ -2052,6 +3897,15 @@ gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t path
 
     
     // --- 6. data streams for speex ---
+    
+    // the calling thread helps with whatever is left to encode (or does all of it if no threads could be started)
+    speexEncodeThreadFunc (&encodeJob);
+    
+    for (i = 0; i < encodeThreadsStarted; i++) {
+        pthread_join(encodeThreads[i], NULL);
+    }
+    pthread_mutex_destroy(&encodeJob.mutex);
+    
     for (i = 0; i <  20; i++) {
         if (speexStates[i]) {
             int result = twtw_speex_write_all_data_to_oggz_and_finish (speexStates[i], oggz, speexSerials[i]);
@@ -34,6 +34,11 @@
 typedef struct _TwtwPage TwtwPage;
 typedef struct _TwtwBook TwtwBook;
 
+// speex types from twtw-audioconv.h
+struct _TwtwSpeexDecoder;
+struct _TwtwSpeexPacketStore;
+struct _TwtwWaveformPeaks;
+
 
 // error values returned by those page/book sound and file util methods that return a gint error number
 enum {
@@ -53,6 +58,22 @@ enum {
 
 typedef void (*TwtwDocumentNotificationCallback) (gint notifID, void *userData);
 
+// called by twtw_book_regen_dirty_thumbs() when a page's thumbnail has been rendered.
+// always called on the thread that called twtw_book_regen_dirty_thumbs(), so it can update the UI directly
+typedef void (*TwtwThumbReadyFunc) (TwtwBook *book, gint pageIndex, void *cbData);
+
+// flags for twtw_book_create_from_path_utf8_with_flags()
+enum {
+    TWTW_BOOKREAD_SKIP_AUDIO = 1 << 0    // speex streams are not decoded (useful when only the pictures are needed, e.g. for rendering previews)
+};
+
+
+// enough for the current page and both neighbours at the Maemo canvas size (800*450 RGB)
+#define TWTW_DISPLAY_PHOTO_DEFAULT_CACHE_BUDGET  (4 * 1024 * 1024)
+
+// about 65 seconds of PCM sound, so normal recordings (20 secs) are always kept in memory
+#define TWTW_PCM_DEFAULT_MEMORY_THRESHOLD  (1024 * 1024)
+
 
 // page thumbnail
 typedef struct _TwtwPageThumb {
@@ -61,9 +82,14 @@ typedef struct _TwtwPageThumb {
     gint rgbRowBytes;
     gboolean rgbHasAlpha;       // on some platforms like OS X (Quartz), 24-bit pixels are not directly supported, so it makes sense to include alpha
     unsigned char *rgbPixels;   // 8-bit RGB or RGBA pixel data
-    unsigned char *maskPixels;  // 1-bit mask pixel data
+    unsigned char *maskPixels;  // 1-bit mask pixel data, TWTW_THUMB_MASK_ROWBYTES(w) bytes per row with the leftmost pixel in the lowest bit
 } TwtwPageThumb;
 
+#define TWTW_THUMB_MASK_ROWBYTES(w_)  (((w_) + 7) / 8)
+
+// number of sizes kept per page by twtw_page_get_thumb_with_size()
+#define TWTW_THUMB_MAX_LEVELS  6
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -86,6 +112,15 @@ void twtw_set_active_document_page_index (gint index);
 void twtw_add_active_document_notif_callback (TwtwDocumentNotificationCallback callback, void *data);
 void twtw_remove_active_document_notif_callback (TwtwDocumentNotificationCallback callback);
 
+// memory used by the pages' display photos (see twtw_page_get_display_photo)
+void twtw_set_display_photo_cache_budget (size_t budgetInBytes);
+size_t twtw_display_photo_cache_size ();
+
+// pages' PCM sounds up to this size are kept in memory; longer sounds are only stored in the page's temp file.
+// the new value applies to sounds set after the call
+void twtw_set_pcm_memory_threshold (size_t thresholdInBytes);
+size_t twtw_pcm_memory_threshold ();
+
 
 // ---- book object ----
 
@@ -99,6 +134,7 @@ gint32 twtw_book_regen_serialno (TwtwBook *book);
 
 // file i/o
 gint twtw_book_create_from_path_utf8 (const char *path, size_t pathLen, TwtwBook **outBook);
+gint twtw_book_create_from_path_utf8_with_flags (const char *path, size_t pathLen, gint32 readFlags, TwtwBook **outBook);
 gint twtw_book_write_to_path_utf8 (TwtwBook *book, const char *path, size_t pathLen);
 
 gint twtw_book_create_from_data (const char *data, size_t dataLen, TwtwBook **outBook);
@@ -114,6 +150,13 @@ gboolean twtw_book_page_has_content (TwtwBook *book, gint index);
 gint twtw_book_get_index_of_last_page_with_content (TwtwBook *book);
 gint twtw_book_get_total_sound_duration (TwtwBook *book);
 
+// renders the thumbnails of all pages that need it, in parallel.
+// if threadCount is <= 0, one thread per online CPU is used. returns when all thumbs are done;
+// readyFunc is called on the calling thread as thumbs finish, including the ones rendered by workers;
+// returns the number of thumbs rendered.
+// the book must not be modified while this is running
+gint twtw_book_regen_dirty_thumbs (TwtwBook *book, gint threadCount, TwtwThumbReadyFunc readyFunc, void *cbData);
+
 // metadata
 const char *twtw_book_get_author (TwtwBook *book);
 void twtw_book_set_author (TwtwBook *book, const char *str);
@@ -146,20 +189,82 @@ void twtw_page_replace_curves_copy (TwtwPage *page, gint count, TwtwCurveList **
 gint twtw_page_get_sound_duration_in_seconds (TwtwPage *page);
 
 // sound playback. the buffer is allocated internally by the page object and should not be modified.
-// pcm sound data's sample rate and other properties are fixed (defined in twtw-audio.h)
+// pcm sound data's sample rate and other properties are fixed (defined in twtw-audio.h).
+// if the sound is too long to be kept in memory (see twtw_set_pcm_memory_threshold), the returned buffer is NULL
+// and the sound must be played from the temp file.
+// a sound loaded from a file is decoded on the first call, so prefer twtw_page_create_speex_decoder() for playback
 gint twtw_page_get_pcm_sound_buffer (TwtwPage *page, short **pcmBuffer, size_t *pcmBufferSize);
 
-// to associate a recorded sound with this page
+// for streaming playback of a sound loaded from a file: returns a decoder over the page's original speex data
+// (see twtw-audioconv.h; the caller must destroy it), or NULL if the sound isn't available in that form
+// or the uncompressed sound is in memory.
+// the decoder has its own copy of the data, so the page can be modified while it's in use
+struct _TwtwSpeexDecoder *twtw_page_create_speex_decoder (TwtwPage *page);
+
+// min/max levels of the sound for drawing a waveform (see twtw-audioconv.h), or NULL if the page has no sound.
+// they're computed when the sound is recorded or decoded and saved in the file, so this normally doesn't need to decode;
+// for a file from an older version, the sound is decoded once on the first call
+const struct _TwtwWaveformPeaks *twtw_page_get_waveform_peaks (TwtwPage *page);
+
+// replaces the page's sound, e.g. with a recording made into memory
+void twtw_page_set_pcm_sound_copy (TwtwPage *page, const short *pcmBuffer, size_t pcmBufferSize);
+
+// the same with the sound already encoded (see twtw_speex_encoder_create), so saving the book just writes the existing packets.
+// if the encoder trimmed silence from the packets (see twtw_speex_set_silence_compression), the PCM is trimmed the same way.
+// the page takes ownership of speexPackets
+void twtw_page_set_pcm_sound_copy_with_speex_packets (TwtwPage *page, const short *pcmBuffer, size_t pcmBufferSize,
+                                                      struct _TwtwSpeexPacketStore *speexPackets);
+
+// replaces the page's sound with a WAV file, e.g. narration recorded elsewhere at 44.1 kHz stereo. it's converted
+// to the format in twtw-audio.h as it's read (see twtw_pcm_import_open_wav_path_utf8); a sound too long to keep
+// in memory is converted straight into the temp file
+gint twtw_page_import_wav_sound_utf8 (TwtwPage *page, const char *path, size_t pathLen);
+
+// to associate a recorded sound with this page through a file (call twtw_page_ui_did_record_pcm_with_file_size() when done).
+// a sound that's kept in memory isn't written into this file until twtw_page_write_pcm_sound_to_temp_file() is called
 const char *twtw_page_get_temp_path_for_pcm_sound_utf8 (TwtwPage *page);
-
-// photo
-TwtwYUVImage *twtw_page_get_yuv_photo (TwtwPage *page);
+gint twtw_page_write_pcm_sound_to_temp_file (TwtwPage *page);
+
+// photo. a photo loaded from a file is kept compressed and decoded on the first call to twtw_page_copy_yuv_photo(),
+// so use twtw_page_has_photo() when the pixels aren't needed.
+// pages with identical photos (also in different books) share one image, so the pixels are only handed out as a copy
+// owned by the caller; to change a page's photo, modify the copy and pass it to twtw_page_set_yuv_photo_copy().
+// setting a photo only copies the pixels; it's compressed when the book is saved
+TwtwYUVImage *twtw_page_copy_yuv_photo (TwtwPage *page);
 void twtw_page_set_yuv_photo_copy (TwtwPage *page, TwtwYUVImage *photo);
+gboolean twtw_page_has_photo (TwtwPage *page);
+
+// converts the photo at the given size without decoding all of it up front (see twtw_tiled_yuv_image_convert_rect_to_rgb_for_display_scaled).
+// doesn't modify the page, so it can be called from any thread as long as the photo isn't being replaced. returns FALSE if there's no photo
+gboolean twtw_page_convert_photo_to_rgb_for_display_scaled (TwtwPage *page, unsigned char *dstBuf, size_t dstRowBytes, gint w, gint h, gboolean hasAlpha);
+
+// changes whenever the photo is replaced; 0 if the page has no photo.
+// this can be used as the key for caching a converted display bitmap of the photo
+guint32 twtw_page_get_photo_seed (TwtwPage *page);
+
+// photo converted to RGB (or RGBA if hasAlpha) at display size. the buffer is owned by the display photo cache, which keys it
+// by the page's photo seed; it's kept until the photo changes or it's evicted (least recently used photos go first).
+// the returned pointer is valid until the next call to this function for any page; returns NULL if the page has no photo.
+// the cache is not threadsafe, so this should only be called from the UI thread
+const unsigned char *twtw_page_get_display_photo (TwtwPage *page, gint w, gint h, gboolean hasAlpha, size_t *outRowBytes);
+void twtw_page_purge_display_photo (TwtwPage *page);
 
 // thumbnail
 TwtwPageThumb *twtw_page_get_thumb (TwtwPage *page);
 void twtw_page_invalidate_thumb (TwtwPage *page);
 
+// returns the thumbnail as it was last rendered (blank if never), without rendering it.
+// lets the UI draw without waiting for thumbs and leave the dirty ones to twtw_book_regen_dirty_thumbs
+TwtwPageThumb *twtw_page_peek_thumb (TwtwPage *page, gboolean *outIsDirty);
+
+// preview of the whole page (photo and curves, without the paper stack styling of twtw_page_get_thumb) at an arbitrary size.
+// the page renders itself once into the base of a mip chain (each smaller mip is a 2*2 reduction of the previous one),
+// and each requested size is box-filtered from the smallest mip that covers it. the page caches up to TWTW_THUMB_MAX_LEVELS
+// requested sizes; they are refreshed on demand after twtw_page_invalidate_thumb.
+// the returned thumb is owned by the page and stays valid until its size is evicted (least recently used goes first).
+// this can be used from a worker thread as long as no other thread is accessing the same page
+TwtwPageThumb *twtw_page_get_thumb_with_size (TwtwPage *page, gint w, gint h);
+
 // state during editing
 void twtw_page_attach_edit_data (TwtwPage *page, gpointer data);
 gpointer twtw_page_get_edit_data (TwtwPage *page);
@@ -174,6 +279,17 @@ typedef struct _TwtwCurveListArray {
 void twtw_destroy_curvelist_array (TwtwCurveListArray *array);
 
 
+// a copy of a page's sound (this datatype is needed for undo of recording and "clear audio").
+// if the page has no sound, size is 0 and pcm is NULL
+typedef struct _TwtwPCMSound {
+    size_t size;
+    short *pcm;
+} TwtwPCMSound;
+
+TwtwPCMSound *twtw_page_copy_pcm_sound (TwtwPage *page);
+void twtw_destroy_pcm_sound (TwtwPCMSound *sound);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -271,10 +271,6 @@ void twtw_undo_push_action (TwtwAction *action)
 }
 
 
-// private function for notifying page about new audio recording
-extern void twtw_page_ui_did_record_pcm_with_file_size (TwtwPage *page, gint fileSize);
-
-
 static const TwtwAction nullTwtwAction = { 0, 0, NULL,  NULL, NULL };
 
 
@@ -317,17 +313,12 @@ gboolean twtw_undo_pop_and_perform ()
         }
             
         case TWTW_ACTION_SET_PCM_SOUND: {
-            char *pcmPath = (char *)action.data;
-            if ( !pcmPath) {
-                printf("**** undo action 'set pcm sound' requires an associated path object\n");
+            TwtwPCMSound *sound = (TwtwPCMSound *)action.data;
+            if ( !sound) {
+                printf("**** undo action 'set pcm sound' requires a pcmsound object\n");
             } else {
-                const char *pagePath = twtw_page_get_temp_path_for_pcm_sound_utf8 (page);
-                
-                if (twtw_filesys_copy_file (pcmPath, strlen(pcmPath), pagePath, strlen(pagePath), TRUE)) {
-                    // notify the page that its sound file has been replaced
-                    twtw_page_ui_did_record_pcm_with_file_size (page, twtw_filesys_get_file_size_utf8 (pagePath, strlen(pagePath), NULL));
-                    notifType = TWTW_NOTIF_DOCUMENT_PAGE_MODIFIED;
-                }
+                twtw_page_set_pcm_sound_copy (page, sound->pcm, sound->size);
+                notifType = TWTW_NOTIF_DOCUMENT_PAGE_MODIFIED;
             }
             break;
         }
@@ -64,7 +64,7 @@ typedef enum {
 typedef void (*TwtwActionDestructorFuncPtr)(void *);
 
 // destructorFunc gets called when the action is removed from the undo stack.
-// it must free 'data' (and in the case of e.g. PCM sound files, it should also remove the temp file).
+// it must free 'data' (e.g. twtw_destroy_pcm_sound for a TWTW_ACTION_SET_PCM_SOUND action's TwtwPCMSound).
 // if destructorFunc is NULL, data will be destroyed with g_free().
 typedef struct _TwtwAction {
     gint type;
@@ -34,6 +34,7 @@
 
 struct _TwtwCacheSurface {
     CGContextRef cgContext;
+    gboolean isDrawing;  // between begin_drawing and end_drawing
 
     gint w;
     gint h;    
@@ -42,7 +43,7 @@ struct _TwtwCacheSurface {
 };
 
 
-static TwtwCacheSurface g_mainCanvas = { NULL, 0, 0, 0, NULL };
+static TwtwCacheSurface g_mainCanvas = { NULL, FALSE, 0, 0, 0, NULL };
 
 
 static void recreateCGBitmapContext(TwtwCacheSurface *surf, int w, int h)
@@ -119,6 +120,17 @@ void twtw_cache_surface_destroy(TwtwCacheSurface *surf)
     g_free(surf);
 }
 
+void twtw_cache_surface_swap_contents (TwtwCacheSurface *surf1, TwtwCacheSurface *surf2)
+{
+    g_return_if_fail(surf1);
+    g_return_if_fail(surf2);
+    g_return_if_fail( !surf1->isDrawing && !surf2->isDrawing);
+    
+    TwtwCacheSurface temp = *surf1;
+    *surf1 = *surf2;
+    *surf2 = temp;
+}
+
 
 gint twtw_cache_surface_get_width (TwtwCacheSurface *surf)
 {
@@ -153,13 +165,18 @@ void *twtw_cache_surface_begin_drawing (TwtwCacheSurface *surf)
 {
     g_return_val_if_fail(surf, NULL);
     g_return_val_if_fail(surf->cgContext, NULL);    
+    g_return_val_if_fail( !surf->isDrawing, NULL);
     
+    surf->isDrawing = TRUE;
     return surf->cgContext;
 }
 
 void twtw_cache_surface_end_drawing (TwtwCacheSurface *surf)
 {
     g_return_if_fail(surf);
+    g_return_if_fail(surf->isDrawing);
+    
+    surf->isDrawing = FALSE;
 }
 
 void *twtw_cache_surface_get_sourceable (TwtwCacheSurface *surf)
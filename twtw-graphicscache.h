@@ -47,6 +47,10 @@ TwtwCacheSurface *twtw_cache_surface_create_similar (TwtwCacheSurface *surf, gin
 
 void twtw_cache_surface_destroy(TwtwCacheSurface *surf);
 
+// exchanges the contents (and sizes) of two surfaces; used to swap in a surface that was rendered in advance.
+// neither surface can be in the middle of drawing
+void twtw_cache_surface_swap_contents (TwtwCacheSurface *surf1, TwtwCacheSurface *surf2);
+
 
 gint twtw_cache_surface_get_width (TwtwCacheSurface *surf);
 gint twtw_cache_surface_get_height (TwtwCacheSurface *surf);
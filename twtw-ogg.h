@@ -58,7 +58,7 @@ The recommended file extension is .oggtw (.ogx == "Ogg for applications" is also
 
 typedef struct {
     ogg_uint16_t version_major;             // twtw version number (currently 1)
-    ogg_uint16_t version_minor;             // twtw version minor (currently 0)
+    ogg_uint16_t version_minor;             // twtw version minor (0, or 1 if photos shared between pages are written once)
     ogg_uint32_t num_pages_in_document;     // actual number of slides in this document (up to 20)
     ogg_uint32_t granules_per_page;         // length of a slide in granulepos count (allows for slide packets to be located by granulepos)
 } TwtwDocumentHeadPacket;
@@ -0,0 +1,559 @@
+/*
+ *  twtw-pagerender.c
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "twtw-pagerender.h"
+#include "twtw-curves.h"
+#include "twtw-photo.h"
+#include "twtw-filesystem.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+// PNG writing uses zlib's compress2() and crc32(), as zlib is already required for the document format
+#include <zlib.h>
+
+
+// same defaults as the canvas implementations
+#define DEFAULT_SEG_WEIGHT  0.7f
+#define MAX_SEG_STEPS       16
+
+#define MAX_BATCH_THREADS   64
+
+
+struct _TwtwPageRenderer {
+    gint w;
+    gint h;
+    size_t rowBytes;
+    unsigned char *rgbBuf;
+};
+
+
+TwtwPageRenderer *twtw_page_renderer_create (gint w)
+{
+    g_return_val_if_fail (w > 0 && w <= 8192, NULL);
+
+    TwtwPageRenderer *renderer = g_malloc0(sizeof(TwtwPageRenderer));
+
+    renderer->w = w;
+    renderer->h = MAX(1, (w * 9 + 8) / 16);
+    renderer->rowBytes = renderer->w * 3;
+    renderer->rgbBuf = g_malloc(renderer->rowBytes * renderer->h);
+
+    return renderer;
+}
+
+void twtw_page_renderer_destroy (TwtwPageRenderer *renderer)
+{
+    if ( !renderer) return;
+
+    g_free(renderer->rgbBuf);
+    g_free(renderer);
+}
+
+gint twtw_page_renderer_get_width (TwtwPageRenderer *renderer)
+{
+    g_return_val_if_fail (renderer, 0);
+    return renderer->w;
+}
+
+gint twtw_page_renderer_get_height (TwtwPageRenderer *renderer)
+{
+    g_return_val_if_fail (renderer, 0);
+    return renderer->h;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- photo ---
+#endif
+
+static gboolean drawPhoto (TwtwPageRenderer *renderer, TwtwPage *page)
+{
+    return twtw_page_convert_photo_to_rgb_for_display_scaled (page, renderer->rgbBuf, renderer->rowBytes, renderer->w, renderer->h, FALSE);
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- curves ---
+#endif
+
+// draws an antialiased line with round caps; radius is interpolated from r0 to r1 along the line
+static void drawCapsule (TwtwPageRenderer *renderer, float x0, float y0, float r0, float x1, float y1, float r1, const unsigned char *rgb)
+{
+    const float maxR = MAX(r0, r1) + 1.0f;
+    const int minX = MAX(0,              (int)floorf(MIN(x0, x1) - maxR));
+    const int maxX = MIN(renderer->w - 1, (int)ceilf(MAX(x0, x1) + maxR));
+    const int minY = MAX(0,              (int)floorf(MIN(y0, y1) - maxR));
+    const int maxY = MIN(renderer->h - 1, (int)ceilf(MAX(y0, y1) + maxR));
+
+    if (minX > maxX || minY > maxY)
+        return;
+
+    const float dx = x1 - x0;
+    const float dy = y1 - y0;
+    const float len2 = dx*dx + dy*dy;
+    const float invLen2 = (len2 > 0.000001f) ? (1.0f / len2) : 0.0f;
+
+    int x, y;
+    for (y = minY; y <= maxY; y++) {
+        const float fy = (float)y + 0.5f - y0;
+        unsigned char *dst = renderer->rgbBuf + renderer->rowBytes * y + minX * 3;
+
+        for (x = minX; x <= maxX; x++, dst += 3) {
+            const float fx = (float)x + 0.5f - x0;
+
+            float t = (fx*dx + fy*dy) * invLen2;
+            t = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+
+            const float ex = fx - t*dx;
+            const float ey = fy - t*dy;
+            const float r = r0 + t*(r1 - r0);
+
+            float cov = r + 0.5f - sqrtf(ex*ex + ey*ey);
+            if (cov <= 0.0f)
+                continue;
+            if (cov > 1.0f)
+                cov = 1.0f;
+            if (r < 0.5f)
+                cov *= r * 2.0f;  // hairlines are faded rather than drawn thinner than a pixel
+
+            const int a = (int)(cov * 256.0f);
+            dst[0] = (unsigned char)(dst[0] + (((rgb[0] - dst[0]) * a) >> 8));
+            dst[1] = (unsigned char)(dst[1] + (((rgb[1] - dst[1]) * a) >> 8));
+            dst[2] = (unsigned char)(dst[2] + (((rgb[2] - dst[2]) * a) >> 8));
+        }
+    }
+}
+
+static void drawCurve (TwtwPageRenderer *renderer, TwtwCurveList *curve, const float scale)
+{
+    const int segCount = twtw_curvelist_get_segment_count (curve);
+    TwtwCurveSegment *segs = twtw_curvelist_get_segment_array (curve);
+
+    if (segCount < 1 || !segs)
+        return;
+
+    unsigned char *rgbPalette = twtw_default_color_palette_rgb_array (NULL);
+    float *paletteLineWeights = twtw_default_color_palette_line_weight_array (NULL);
+    g_return_if_fail(rgbPalette);
+    g_return_if_fail(paletteLineWeights);
+
+    int colorID = twtw_curvelist_get_color_id (curve);
+    if (colorID < 0 || colorID >= 20) colorID = twtw_default_color_index ();
+
+    const unsigned char *rgb = rgbPalette + colorID*3;
+    const float lineWMul = ((paletteLineWeights[colorID] > 0.0f) ? paletteLineWeights[colorID] : 1.0f) * scale * 0.5f;
+
+    int i;
+    for (i = 0; i < segCount; i++) {
+        TwtwCurveSegment *seg = segs + i;
+
+        float startW = TWTW_UNITS_TO_FLOAT(seg->startWeight);
+        float endW = TWTW_UNITS_TO_FLOAT(seg->endWeight);
+        if (startW < 0.0001f) startW = DEFAULT_SEG_WEIGHT;
+        if (endW < 0.0001f) endW = DEFAULT_SEG_WEIGHT;
+
+        float prevX = TWTW_UNITS_TO_FLOAT(seg->startPoint.x) * scale;
+        float prevY = TWTW_UNITS_TO_FLOAT(seg->startPoint.y) * scale;
+        float prevR = startW * lineWMul;
+
+        if (seg->segmentType == TWTW_SEG_CATMULLROM &&
+                !twtw_is_invalid_point(seg->controlPoint1) &&
+                !twtw_is_invalid_point(seg->controlPoint2)) {
+
+            TwtwUnit segLen = twtw_point_distance (seg->startPoint, seg->endPoint);
+
+            if (segLen > TWTW_UNITS_FROM_INT(1)) {
+                const gint steps = MIN(MAX_SEG_STEPS, TWTW_UNITS_TO_INT(segLen) * 2);
+                TwtwPoint twarr[MAX_SEG_STEPS];
+
+                twtw_calc_catmullrom_curve (seg, steps, twarr);
+
+                int j;
+                for (j = 0; j < steps; j++) {
+                    const float u = (float)(j+1) / (float)steps;
+                    const float x = TWTW_UNITS_TO_FLOAT(twarr[j].x) * scale;
+                    const float y = TWTW_UNITS_TO_FLOAT(twarr[j].y) * scale;
+                    const float r = (startW + u*(endW - startW)) * lineWMul;
+
+                    drawCapsule (renderer, prevX, prevY, prevR, x, y, r, rgb);
+                    prevX = x;
+                    prevY = y;
+                    prevR = r;
+                }
+            }
+        }
+
+        drawCapsule (renderer, prevX, prevY, prevR,
+                               TWTW_UNITS_TO_FLOAT(seg->endPoint.x) * scale,
+                               TWTW_UNITS_TO_FLOAT(seg->endPoint.y) * scale,
+                               endW * lineWMul,
+                               rgb);
+    }
+}
+
+
+unsigned char *twtw_page_renderer_draw_page (TwtwPageRenderer *renderer, TwtwPage *page, size_t *outRowBytes)
+{
+    g_return_val_if_fail (renderer, NULL);
+    g_return_val_if_fail (page, NULL);
+
+    if ( !drawPhoto (renderer, page)) {
+        // same as the canvas background
+        memset(renderer->rgbBuf, 0xff, renderer->rowBytes * renderer->h);
+    }
+
+    // curves are stored in device coordinates (see TWTW_CURVESER_SCALE_IN in twtw-curves.h)
+    const float scale = (float)renderer->w / ((float)TWTW_CANONICAL_CANVAS_WIDTH * TWTW_UNITS_TO_FLOAT(TWTW_CURVESER_SCALE_IN));
+
+    const gint curveCount = twtw_page_get_curves_count (page);
+    gint i;
+    for (i = 0; i < curveCount; i++) {
+        drawCurve (renderer, twtw_page_get_curve (page, i), scale);
+    }
+
+    if (outRowBytes) *outRowBytes = renderer->rowBytes;
+    return renderer->rgbBuf;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- image files ---
+#endif
+
+static void writeBE32 (unsigned char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static gboolean writePNGChunk (FILE *file, const char *type, const unsigned char *data, size_t dataSize)
+{
+    unsigned char buf[8];
+    writeBE32 (buf, (uint32_t)dataSize);
+    memcpy(buf + 4, type, 4);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, buf + 4, 4);
+    if (dataSize > 0)
+        crc = crc32(crc, data, dataSize);
+
+    if (fwrite(buf, 8, 1, file) != 1)
+        return FALSE;
+    if (dataSize > 0 && fwrite(data, dataSize, 1, file) != 1)
+        return FALSE;
+
+    writeBE32 (buf, (uint32_t)crc);
+    return (fwrite(buf, 4, 1, file) == 1) ? TRUE : FALSE;
+}
+
+static gboolean writePNG (FILE *file, const unsigned char *rgb, gint w, gint h, size_t rowBytes)
+{
+    static const unsigned char pngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+
+    // each row is prefixed with a filter type byte; "Sub" filtering compresses photos a bit better than "None"
+    const size_t filteredRowBytes = 1 + w * 3;
+    const size_t filteredSize = filteredRowBytes * h;
+    unsigned char *filtered = g_malloc(filteredSize);
+    gint x, y;
+    for (y = 0; y < h; y++) {
+        const unsigned char *src = rgb + rowBytes * y;
+        unsigned char *dst = filtered + filteredRowBytes * y;
+        *dst++ = 1;
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        for (x = 3; x < w * 3; x++) {
+            dst[x] = (unsigned char)(src[x] - src[x - 3]);
+        }
+    }
+
+    uLongf compressedSize = compressBound(filteredSize);
+    unsigned char *compressed = g_malloc(compressedSize);
+    gboolean ok = (Z_OK == compress2(compressed, &compressedSize, filtered, filteredSize, 6)) ? TRUE : FALSE;
+    g_free(filtered);
+
+    if (ok) {
+        unsigned char ihdr[13];
+        writeBE32 (ihdr, w);
+        writeBE32 (ihdr + 4, h);
+        ihdr[8] = 8;   // bit depth
+        ihdr[9] = 2;   // color type: truecolor
+        ihdr[10] = 0;  // compression
+        ihdr[11] = 0;  // filter method
+        ihdr[12] = 0;  // no interlace
+
+        ok = (fwrite(pngSignature, 8, 1, file) == 1)
+              && writePNGChunk (file, "IHDR", ihdr, 13)
+              && writePNGChunk (file, "IDAT", compressed, compressedSize)
+              && writePNGChunk (file, "IEND", NULL, 0);
+    }
+
+    g_free(compressed);
+    return ok;
+}
+
+static gboolean writePPM (FILE *file, const unsigned char *rgb, gint w, gint h, size_t rowBytes)
+{
+    fprintf(file, "P6\n%d %d\n255\n", w, h);
+
+    gint y;
+    for (y = 0; y < h; y++) {
+        if (fwrite(rgb + rowBytes * y, w * 3, 1, file) != 1)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+gint twtw_page_renderer_write_image_utf8 (TwtwPageRenderer *renderer, const char *path, size_t pathLen, gint fileFormat)
+{
+    g_return_val_if_fail (renderer, TWTW_PARAMERR);
+    g_return_val_if_fail (path && pathLen > 0, TWTW_PARAMERR);
+    g_return_val_if_fail (fileFormat == TWTW_IMAGEFILE_PPM || fileFormat == TWTW_IMAGEFILE_PNG, TWTW_PARAMERR);
+
+    FILE *file = twtw_open_writeb_utf8 (path, pathLen);
+    if ( !file) {
+        printf("** %s: could not open file for writing: %s\n", __func__, path);
+        return TWTW_FILEERR;
+    }
+
+    gboolean ok;
+    if (fileFormat == TWTW_IMAGEFILE_PNG)
+        ok = writePNG (file, renderer->rgbBuf, renderer->w, renderer->h, renderer->rowBytes);
+    else
+        ok = writePPM (file, renderer->rgbBuf, renderer->w, renderer->h, renderer->rowBytes);
+
+    if (0 != fclose(file))
+        ok = FALSE;
+
+    return (ok) ? 0 : TWTW_FILEERR;
+}
+
+
+#ifdef __APPLE__
+#pragma mark --- batch rendering ---
+#endif
+
+typedef struct {
+    const char **bookPaths;
+    gint bookCount;
+    const char *outDirPath;
+    gint targetWidth;
+    gint fileFormat;
+
+    TwtwBatchRenderProgressFunc progressFunc;
+    void *cbData;
+
+    pthread_mutex_t mutex;      // protects the fields below
+    gint nextBookIndex;
+    gint booksDone;
+    TwtwBatchRenderStats stats;
+} TwtwBatchRenderJob;
+
+
+static double currentTimeInSeconds ()
+{
+    struct timeval tval = { 0, 0 };
+    gettimeofday(&tval, NULL);
+    return (double)tval.tv_sec + (double)tval.tv_usec * 0.000001;
+}
+
+// returns a newly allocated path "<outdir>/<book name without extension>_p<index>.<ext>"
+static char *createOutputPathForPage (const char *outDirPath, const char *bookPath, gint pageIndex, gint fileFormat)
+{
+    const char *name = strrchr(bookPath, '/');
+    name = (name) ? name + 1 : bookPath;
+
+    size_t nameLen = strlen(name);
+    const char *ext = strrchr(name, '.');
+    if (ext && ext != name)
+        nameLen = ext - name;
+
+    const char *fileExt = (fileFormat == TWTW_IMAGEFILE_PNG) ? "png" : "ppm";
+    char *fileName = g_malloc(nameLen + 16);
+    memcpy(fileName, name, nameLen);
+    sprintf(fileName + nameLen, "_p%02d.%s", (int)pageIndex, fileExt);
+
+    char *path = twtw_filesys_append_path_component (outDirPath, fileName);
+    g_free(fileName);
+    return path;
+}
+
+static gint renderBook (TwtwBatchRenderJob *job, TwtwPageRenderer *renderer, const char *bookPath,
+                        gint *outPagesRendered, double *outLoadSecs, double *outRenderSecs, double *outWriteSecs)
+{
+    double t0 = currentTimeInSeconds ();
+
+    TwtwBook *book = NULL;
+    gint result = twtw_book_create_from_path_utf8_with_flags (bookPath, strlen(bookPath), TWTW_BOOKREAD_SKIP_AUDIO, &book);
+
+    double t1 = currentTimeInSeconds ();
+    *outLoadSecs += t1 - t0;
+
+    if (result != 0 || !book) {
+        printf("** %s: failed to load book '%s' (error %i)\n", __func__, bookPath, result);
+        twtw_book_destroy (book);
+        return (result != 0) ? result : TWTW_INVALIDFORMATERR;
+    }
+
+    const gint pageCount = twtw_book_get_page_count (book);
+    gint i;
+    for (i = 0; i < pageCount; i++) {
+        if ( !twtw_book_page_has_content (book, i))
+            continue;
+
+        t0 = currentTimeInSeconds ();
+
+        twtw_page_renderer_draw_page (renderer, twtw_book_get_page (book, i), NULL);
+
+        t1 = currentTimeInSeconds ();
+        *outRenderSecs += t1 - t0;
+
+        char *outPath = createOutputPathForPage (job->outDirPath, bookPath, i, job->fileFormat);
+        result = twtw_page_renderer_write_image_utf8 (renderer, outPath, strlen(outPath), job->fileFormat);
+        g_free(outPath);
+
+        *outWriteSecs += currentTimeInSeconds () - t1;
+
+        if (result != 0)
+            break;
+        (*outPagesRendered)++;
+    }
+
+    twtw_book_destroy (book);
+    return result;
+}
+
+static void *batchRenderThreadFunc (void *userData)
+{
+    TwtwBatchRenderJob *job = (TwtwBatchRenderJob *)userData;
+
+    // each worker has its own renderer, so all scratch memory is per-thread
+    TwtwPageRenderer *renderer = twtw_page_renderer_create (job->targetWidth);
+
+    while (1) {
+        pthread_mutex_lock(&job->mutex);
+        const gint bookIndex = job->nextBookIndex++;
+        pthread_mutex_unlock(&job->mutex);
+
+        if (bookIndex >= job->bookCount)
+            break;
+
+        const char *bookPath = job->bookPaths[bookIndex];
+        gint pagesRendered = 0;
+        double loadSecs = 0.0, renderSecs = 0.0, writeSecs = 0.0;
+
+        gint result = renderBook (job, renderer, bookPath, &pagesRendered, &loadSecs, &renderSecs, &writeSecs);
+
+        pthread_mutex_lock(&job->mutex);
+        job->booksDone++;
+        job->stats.pagesRendered += pagesRendered;
+        job->stats.loadSecs += loadSecs;
+        job->stats.renderSecs += renderSecs;
+        job->stats.writeSecs += writeSecs;
+        if (result != 0)
+            job->stats.booksFailed++;
+
+        if (job->progressFunc)
+            job->progressFunc (job->booksDone, job->bookCount, bookPath, result, pagesRendered, job->cbData);
+        pthread_mutex_unlock(&job->mutex);
+    }
+
+    twtw_page_renderer_destroy (renderer);
+    return NULL;
+}
+
+gint twtw_batch_render_books_utf8 (const char **bookPaths, gint bookCount,
+                                   const char *outDirPath,
+                                   gint targetWidth,
+                                   gint fileFormat,
+                                   gint threadCount,
+                                   TwtwBatchRenderProgressFunc progressFunc, void *cbData,
+                                   TwtwBatchRenderStats *outStats)
+{
+    g_return_val_if_fail (bookPaths, TWTW_PARAMERR);
+    g_return_val_if_fail (outDirPath, TWTW_PARAMERR);
+    g_return_val_if_fail (targetWidth > 0 && targetWidth <= 8192, TWTW_PARAMERR);
+    g_return_val_if_fail (fileFormat == TWTW_IMAGEFILE_PPM || fileFormat == TWTW_IMAGEFILE_PNG, TWTW_PARAMERR);
+
+    if (threadCount <= 0) {
+        long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cpuCount > 0) ? (gint)cpuCount : 1;
+    }
+    threadCount = MIN(threadCount, MAX_BATCH_THREADS);
+    threadCount = MAX(1, MIN(threadCount, bookCount));
+
+    const double startTime = currentTimeInSeconds ();
+
+    TwtwBatchRenderJob job;
+    memset(&job, 0, sizeof(job));
+    job.bookPaths = bookPaths;
+    job.bookCount = MAX(0, bookCount);
+    job.outDirPath = outDirPath;
+    job.targetWidth = targetWidth;
+    job.fileFormat = fileFormat;
+    job.progressFunc = progressFunc;
+    job.cbData = cbData;
+    job.stats.booksTotal = job.bookCount;
+    job.stats.threadCount = threadCount;
+    pthread_mutex_init(&job.mutex, NULL);
+
+    // the color palettes and the photo gamma LUT are built lazily on first use;
+    // make sure that happens here rather than concurrently in the workers
+    twtw_default_color_palette_rgb_array (NULL);
+    twtw_default_color_palette_line_weight_array (NULL);
+    twtw_photo_init_shared_tables ();
+
+    pthread_t threads[MAX_BATCH_THREADS];
+    gint threadsStarted = 0;
+    gint i;
+    for (i = 1; i < threadCount; i++) {
+        if (0 != pthread_create(&threads[threadsStarted], NULL, batchRenderThreadFunc, &job)) {
+            printf("** %s: could not create worker thread %i\n", __func__, i);
+            break;
+        }
+        threadsStarted++;
+    }
+
+    // the calling thread works too
+    batchRenderThreadFunc (&job);
+
+    for (i = 0; i < threadsStarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.mutex);
+
+    job.stats.threadCount = threadsStarted + 1;
+    job.stats.wallSecs = currentTimeInSeconds () - startTime;
+
+    if (outStats) *outStats = job.stats;
+    return job.stats.booksFailed;
+}
@@ -0,0 +1,110 @@
+/*
+ *  twtw-pagerender.h
+ *  TwentyTwenty
+ *
+ *  Created by Pauli Ojala on 19.10.2026.
+ *  Copyright 2026 Pauli Olavi Ojala. All rights reserved.
+ *
+ */
+/*
+    This file is part of TwentyTwenty.
+
+    TwentyTwenty is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TwentyTwenty is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TwentyTwenty.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+    headless page rendering.
+
+    the platform canvases draw pages using Cairo / Quartz into a TwtwCacheSurface, which is tied to the UI thread.
+    this renderer draws the same content (background photo + curves) into a plain 24-bit RGB buffer
+    using only the core library, so it can be used from worker threads and command-line tools.
+*/
+
+#ifndef _TWTW_PAGERENDER_H_
+#define _TWTW_PAGERENDER_H_
+
+#include "twtw-glib.h"
+#include "twtw-document.h"
+
+
+// file formats for rendered images
+enum {
+    TWTW_IMAGEFILE_PPM = 0,     // binary 'P6' netpbm
+    TWTW_IMAGEFILE_PNG          // 24-bit RGB, compressed with zlib
+};
+
+
+typedef struct _TwtwPageRenderer TwtwPageRenderer;
+
+
+// statistics collected by the batch renderer.
+// the load/render/write times are summed over all worker threads, so they can exceed the wall time
+typedef struct _TwtwBatchRenderStats {
+    gint booksTotal;
+    gint booksFailed;
+    gint pagesRendered;
+    gint threadCount;
+
+    double loadSecs;
+    double renderSecs;
+    double writeSecs;
+    double wallSecs;
+} TwtwBatchRenderStats;
+
+// called after each book is finished (result is 0 on success, or a TWTW_*ERR value).
+// calls are made from the worker threads, but they are serialized so the callback doesn't need to be reentrant
+typedef void (*TwtwBatchRenderProgressFunc) (gint booksDone, gint booksTotal, const char *bookPath, gint result, gint pagesRendered, void *cbData);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// --- renderer object ---
+
+// a renderer owns the output buffer and scratch memory for rendering pages at a given size.
+// it can be used from any thread, but only by one thread at a time.
+// the height is derived from the width using the canvas aspect ratio (16:9).
+TwtwPageRenderer *twtw_page_renderer_create (gint w);
+void twtw_page_renderer_destroy (TwtwPageRenderer *renderer);
+
+gint twtw_page_renderer_get_width (TwtwPageRenderer *renderer);
+gint twtw_page_renderer_get_height (TwtwPageRenderer *renderer);
+
+// renders the page into the renderer's buffer; returned buffer is owned by the renderer and contains 24-bit RGB pixels
+unsigned char *twtw_page_renderer_draw_page (TwtwPageRenderer *renderer, TwtwPage *page, size_t *outRowBytes);
+
+// writes the most recently rendered page
+gint twtw_page_renderer_write_image_utf8 (TwtwPageRenderer *renderer, const char *path, size_t pathLen, gint fileFormat);
+
+
+// --- batch rendering ---
+
+// loads each book and writes its pages with content into outDirPath as "<bookname>_p<index>.ppm/png".
+// books are loaded on demand by the worker threads (without decoding audio) and released as soon as they are rendered.
+// if threadCount is <= 0, one thread per online CPU is used.
+// returns the number of books that failed to load or write, or TWTW_PARAMERR.
+gint twtw_batch_render_books_utf8 (const char **bookPaths, gint bookCount,
+                                   const char *outDirPath,
+                                   gint targetWidth,
+                                   gint fileFormat,
+                                   gint threadCount,
+                                   TwtwBatchRenderProgressFunc progressFunc, void *cbData,
+                                   TwtwBatchRenderStats *outStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _TWTW_PAGERENDER_H_
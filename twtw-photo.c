@@ -25,9 +25,20 @@
 
 #include "twtw-photo.h"
 #include "twtw-curves.h"
+#include "twtw-cpu.h"
+#include "twtw-byteorder.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <zlib.h>
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON__)
+ #include <arm_neon.h>
+#endif
 
 
 #if defined(__STDC_VERSION__) && (__STDC_VERSION__ == 199901L)
@@ -39,10 +50,6 @@
 #endif
 
 
-extern gboolean twtw_deflate(unsigned char *srcBuf, size_t srcLen,
-                      unsigned char *dstBuf, size_t dstLen,
-                           size_t *outCompressedLen);
-                           
 extern gboolean twtw_inflate(unsigned char *srcBuf, size_t srcLen,
                       unsigned char *dstBuf, size_t dstLen,
                            size_t *outDecompressedLen);
@@ -133,340 +140,1448 @@ static unsigned char *getGammaLUTForBGPhoto()
 }
 
 
-static inline float yFromRGB_rec601_f(const float r, const float g, const float b) {
-    return  16.0f + ( 65.481f * r + 128.553f * g +  24.966f * b);  }
+// --- RGB import ---
 
-static inline float cbFromRGB_rec601_f(const float r, const float g, const float b) {
-    return  128.0f + (-37.797f * r + -74.203f * g +   112.0f * b);  }
+/*
+    Rec.601 RGB -> YCbCr in 17.15 fixed point (the coefficients are the usual ones divided by 255).
+    the chroma coefficients sum to zero, so greys get exactly 128.
+    both pixels of a UYVY macropixel contribute to its chroma: the coefficients are applied to the sum of the two pixels
+    and the result is shifted one bit further.
+    these fit in 16 bits, so the SIMD paths can use 16x16->32 multiplies and produce the same output as the scalar code.
+*/
+#define RGB2YUV_SHIFT   15
 
-static inline float crFromRGB_rec601_f(const float r, const float g, const float b) {
-    return  128.0f + (  112.0f * r + -93.786f * g + -18.214f * b);  }
+enum {
+    K_Y_R = 8414,   K_Y_G = 16519,   K_Y_B = 3208,
+    K_CB_R = -4857, K_CB_G = -9535,  K_CB_B = 14392,
+    K_CR_R = 14392, K_CR_G = -12052, K_CR_B = -2340
+};
 
-    
-TwtwYUVImage *twtw_yuv_image_create_from_rgb_with_default_size (unsigned char *srcBuf, const size_t srcRowBytes, const gboolean srcHasAlpha)
+#define RGB2YUV_Y_BIAS  ((16 << RGB2YUV_SHIFT) + (1 << (RGB2YUV_SHIFT - 1)))
+#define RGB2YUV_C_BIAS  ((128 << (RGB2YUV_SHIFT + 1)) + (1 << RGB2YUV_SHIFT))
+
+static inline unsigned int lumaFromRGB (const int r, const int g, const int b) {
+    return (K_Y_R * r + K_Y_G * g + K_Y_B * b + RGB2YUV_Y_BIAS) >> RGB2YUV_SHIFT;  }
+
+// arguments are sums of two pixels
+static inline unsigned int cbFromRGBPair (const int r2, const int g2, const int b2) {
+    return (K_CB_R * r2 + K_CB_G * g2 + K_CB_B * b2 + RGB2YUV_C_BIAS) >> (RGB2YUV_SHIFT + 1);  }
+
+static inline unsigned int crFromRGBPair (const int r2, const int g2, const int b2) {
+    return (K_CR_R * r2 + K_CR_G * g2 + K_CR_B * b2 + RGB2YUV_C_BIAS) >> (RGB2YUV_SHIFT + 1);  }
+
+
+// converts numMacropixels * 2 RGB or RGBX pixels to UYVY, starting at macropixel 'start'
+static void convertRGBRowToUYVY_scalar (const unsigned char * RESTRICT src, const int srcStride,
+                                        unsigned char * RESTRICT dst, const int start, const int numMacropixels)
+{
+    int n;
+    src += start * 2 * srcStride;
+    dst += start * 4;
+    for (n = start; n < numMacropixels; n++) {
+        const int r0 = src[0], g0 = src[1], b0 = src[2];
+        const int r1 = src[srcStride], g1 = src[srcStride + 1], b1 = src[srcStride + 2];
+        
+        dst[0] = cbFromRGBPair(r0 + r1, g0 + g1, b0 + b1);
+        dst[1] = lumaFromRGB(r0, g0, b0);
+        dst[2] = crFromRGBPair(r0 + r1, g0 + g1, b0 + b1);
+        dst[3] = lumaFromRGB(r1, g1, b1);
+        src += srcStride * 2;
+        dst += 4;
+    }
+}
+
+#if defined(__SSE2__)
+
+// 32-bit pixels only; converts 8 pixels (4 UYVY macropixels) per iteration and returns the number of macropixels converted
+static int convertRGBXRowToUYVY_SSE2 (const unsigned char *src, unsigned char *dst, const int numMacropixels)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i kYRG = _mm_set_epi16(K_Y_G, K_Y_R, K_Y_G, K_Y_R, K_Y_G, K_Y_R, K_Y_G, K_Y_R);
+    const __m128i kYB = _mm_set_epi16(0, K_Y_B, 0, K_Y_B, 0, K_Y_B, 0, K_Y_B);
+    const __m128i kCbRG = _mm_set_epi16(K_CB_G, K_CB_R, K_CB_G, K_CB_R, K_CB_G, K_CB_R, K_CB_G, K_CB_R);
+    const __m128i kCbB = _mm_set_epi16(0, K_CB_B, 0, K_CB_B, 0, K_CB_B, 0, K_CB_B);
+    const __m128i kCrRG = _mm_set_epi16(K_CR_G, K_CR_R, K_CR_G, K_CR_R, K_CR_G, K_CR_R, K_CR_G, K_CR_R);
+    const __m128i kCrB = _mm_set_epi16(0, K_CR_B, 0, K_CR_B, 0, K_CR_B, 0, K_CR_B);
+    const __m128i yBias = _mm_set1_epi32(RGB2YUV_Y_BIAS);
+    const __m128i cBias = _mm_set1_epi32(RGB2YUV_C_BIAS);
+    const __m128i ones = _mm_set1_epi16(1);
+    int n;
+    for (n = 0; n + 4 <= numMacropixels; n += 4) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(src + n*8));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(src + n*8 + 16));
+        
+        // channels of 8 pixels as 16-bit values
+        const __m128i r = _mm_packs_epi32(_mm_and_si128(a, byteMask), _mm_and_si128(b, byteMask));
+        const __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), byteMask), _mm_and_si128(_mm_srli_epi32(b, 8), byteMask));
+        const __m128i bl = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), byteMask), _mm_and_si128(_mm_srli_epi32(b, 16), byteMask));
+        
+        // luma: { r, g } pairs and { b, 0 } pairs through madd
+        __m128i rgLo = _mm_unpacklo_epi16(r, g);
+        __m128i rgHi = _mm_unpackhi_epi16(r, g);
+        __m128i yLo = _mm_add_epi32(_mm_madd_epi16(rgLo, kYRG), _mm_madd_epi16(_mm_unpacklo_epi16(bl, _mm_setzero_si128()), kYB));
+        __m128i yHi = _mm_add_epi32(_mm_madd_epi16(rgHi, kYRG), _mm_madd_epi16(_mm_unpackhi_epi16(bl, _mm_setzero_si128()), kYB));
+        yLo = _mm_srai_epi32(_mm_add_epi32(yLo, yBias), RGB2YUV_SHIFT);
+        yHi = _mm_srai_epi32(_mm_add_epi32(yHi, yBias), RGB2YUV_SHIFT);
+        // as 32-bit lanes, this is { Y0 | Y1 << 16 } for each macropixel
+        const __m128i ys = _mm_packs_epi32(yLo, yHi);
+        
+        // chroma: sums of each pixel pair in 32-bit lanes
+        const __m128i r2 = _mm_madd_epi16(r, ones);
+        const __m128i g2 = _mm_madd_epi16(g, ones);
+        const __m128i b2 = _mm_madd_epi16(bl, ones);
+        const __m128i rg2 = _mm_or_si128(r2, _mm_slli_epi32(g2, 16));
+        __m128i cb = _mm_add_epi32(_mm_madd_epi16(rg2, kCbRG), _mm_madd_epi16(b2, kCbB));
+        __m128i cr = _mm_add_epi32(_mm_madd_epi16(rg2, kCrRG), _mm_madd_epi16(b2, kCrB));
+        cb = _mm_srai_epi32(_mm_add_epi32(cb, cBias), RGB2YUV_SHIFT + 1);
+        cr = _mm_srai_epi32(_mm_add_epi32(cr, cBias), RGB2YUV_SHIFT + 1);
+        
+        // { Cb, Y0, Cr, Y1 } byte order; all values are within 0-255
+        const __m128i uyvy = _mm_or_si128(_mm_or_si128(cb, _mm_slli_epi32(cr, 16)), _mm_slli_epi32(ys, 8));
+        _mm_storeu_si128((__m128i *)(dst + n*4), uyvy);
+    }
+    return n;
+}
+
+// adds numBytes bytes to 32-bit accumulators; returns the number of bytes done
+static int accumulateRow_SSE2 (const unsigned char *src, uint32_t *acc, const int numBytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int n;
+    for (n = 0; n + 16 <= numBytes; n += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + n));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *a = (__m128i *)(acc + n);
+        _mm_storeu_si128(a + 0, _mm_add_epi32(_mm_loadu_si128(a + 0), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+    return n;
+}
+
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON__)
+
+static inline uint8x8_t neonLumaFromRGB (const uint8x8_t r, const uint8x8_t g, const uint8x8_t b)
+{
+    const int16x8_t r16 = vreinterpretq_s16_u16(vmovl_u8(r));
+    const int16x8_t g16 = vreinterpretq_s16_u16(vmovl_u8(g));
+    const int16x8_t b16 = vreinterpretq_s16_u16(vmovl_u8(b));
+    const int32x4_t bias = vdupq_n_s32(RGB2YUV_Y_BIAS);
+    int32x4_t lo = vmlal_n_s16(bias, vget_low_s16(r16), K_Y_R);
+    int32x4_t hi = vmlal_n_s16(bias, vget_high_s16(r16), K_Y_R);
+    lo = vmlal_n_s16(lo, vget_low_s16(g16), K_Y_G);
+    hi = vmlal_n_s16(hi, vget_high_s16(g16), K_Y_G);
+    lo = vmlal_n_s16(lo, vget_low_s16(b16), K_Y_B);
+    hi = vmlal_n_s16(hi, vget_high_s16(b16), K_Y_B);
+    return vmovn_u16(vcombine_u16(vqshrun_n_s32(lo, RGB2YUV_SHIFT), vqshrun_n_s32(hi, RGB2YUV_SHIFT)));
+}
+
+// arguments are sums of pixel pairs
+static inline uint8x8_t neonChromaFromRGBPairs (const uint16x8_t r2, const uint16x8_t g2, const uint16x8_t b2,
+                                                const int16_t kR, const int16_t kG, const int16_t kB)
+{
+    const int16x8_t r16 = vreinterpretq_s16_u16(r2);
+    const int16x8_t g16 = vreinterpretq_s16_u16(g2);
+    const int16x8_t b16 = vreinterpretq_s16_u16(b2);
+    const int32x4_t bias = vdupq_n_s32(RGB2YUV_C_BIAS);
+    int32x4_t lo = vmlal_n_s16(bias, vget_low_s16(r16), kR);
+    int32x4_t hi = vmlal_n_s16(bias, vget_high_s16(r16), kR);
+    lo = vmlal_n_s16(lo, vget_low_s16(g16), kG);
+    hi = vmlal_n_s16(hi, vget_high_s16(g16), kG);
+    lo = vmlal_n_s16(lo, vget_low_s16(b16), kB);
+    hi = vmlal_n_s16(hi, vget_high_s16(b16), kB);
+    return vmovn_u16(vcombine_u16(vqshrun_n_s32(lo, RGB2YUV_SHIFT + 1), vqshrun_n_s32(hi, RGB2YUV_SHIFT + 1)));
+}
+
+// 32-bit pixels only; converts 16 pixels (8 UYVY macropixels) per iteration and returns the number of macropixels converted
+static int convertRGBXRowToUYVY_NEON (const unsigned char *src, unsigned char *dst, const int numMacropixels)
+{
+    int n;
+    for (n = 0; n + 8 <= numMacropixels; n += 8) {
+        // deinterleaves into R, G, B, X
+        const uint8x16x4_t px = vld4q_u8(src + n*8);
+        
+        const uint8x8_t yLo = neonLumaFromRGB(vget_low_u8(px.val[0]), vget_low_u8(px.val[1]), vget_low_u8(px.val[2]));
+        const uint8x8_t yHi = neonLumaFromRGB(vget_high_u8(px.val[0]), vget_high_u8(px.val[1]), vget_high_u8(px.val[2]));
+        const uint8x8x2_t ys = vuzp_u8(yLo, yHi);  // even and odd pixels
+        
+        const uint16x8_t r2 = vpaddlq_u8(px.val[0]);
+        const uint16x8_t g2 = vpaddlq_u8(px.val[1]);
+        const uint16x8_t b2 = vpaddlq_u8(px.val[2]);
+        
+        uint8x8x4_t uyvy;
+        uyvy.val[0] = neonChromaFromRGBPairs(r2, g2, b2, K_CB_R, K_CB_G, K_CB_B);
+        uyvy.val[1] = ys.val[0];
+        uyvy.val[2] = neonChromaFromRGBPairs(r2, g2, b2, K_CR_R, K_CR_G, K_CR_B);
+        uyvy.val[3] = ys.val[1];
+        vst4_u8(dst + n*4, uyvy);
+    }
+    return n;
+}
+
+static int accumulateRow_NEON (const unsigned char *src, uint32_t *acc, const int numBytes)
+{
+    int n;
+    for (n = 0; n + 16 <= numBytes; n += 16) {
+        const uint8x16_t v = vld1q_u8(src + n);
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        const uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(acc + n,      vaddw_u16(vld1q_u32(acc + n),      vget_low_u16(lo)));
+        vst1q_u32(acc + n + 4,  vaddw_u16(vld1q_u32(acc + n + 4),  vget_high_u16(lo)));
+        vst1q_u32(acc + n + 8,  vaddw_u16(vld1q_u32(acc + n + 8),  vget_low_u16(hi)));
+        vst1q_u32(acc + n + 12, vaddw_u16(vld1q_u32(acc + n + 12), vget_high_u16(hi)));
+    }
+    return n;
+}
+
+#endif  // __ARM_NEON__
+
+
+TwtwYUVImage *twtw_yuv_image_create_from_rgb (const unsigned char *srcBuf, const size_t srcRowBytes, const gboolean srcHasAlpha,
+                                              const gint srcW, const gint srcH,
+                                              const gint dstW, const gint dstH,
+                                              const gboolean areaAverage)
 {
     g_return_val_if_fail(srcBuf, NULL);
+    g_return_val_if_fail(srcW > 0 && srcH > 0, NULL);
+    g_return_val_if_fail(dstW >= 2 && dstH > 0 && (dstW & 1) == 0, NULL);
     
-    const int w = TWTW_CAM_IMAGEWIDTH;
-    const int h = TWTW_CAM_IMAGEHEIGHT;
+    const int srcStride = (srcHasAlpha) ? 4 : 3;
+    g_return_val_if_fail(srcRowBytes >= srcW * srcStride, NULL);
     
-    g_return_val_if_fail(srcRowBytes >= w * 3, NULL);
+    // crop the source to the destination aspect ratio, centered
+    int cropX = 0, cropY = 0, cropW = srcW, cropH = srcH;
+    if ((int64_t)srcW * dstH > (int64_t)srcH * dstW) {
+        cropW = MAX(1, (int)(((int64_t)srcH * dstW + dstH / 2) / dstH));
+        cropX = (srcW - cropW) / 2;
+    } else {
+        cropH = MAX(1, (int)(((int64_t)srcW * dstH + dstW / 2) / dstW));
+        cropY = (srcH - cropH) / 2;
+    }
+    const gboolean isScaled = (cropW != dstW || cropH != dstH);
+    
+    int (*simdConvertFunc)(const unsigned char *, unsigned char *, const int) = NULL;
+    int (*simdAccumFunc)(const unsigned char *, uint32_t *, const int) = NULL;
+    const gint32 cpuFeatures = twtw_cpu_features ();
+#if defined(__SSE2__)
+    if (cpuFeatures & TWTW_CPU_SSE2) {
+        simdConvertFunc = convertRGBXRowToUYVY_SSE2;
+        simdAccumFunc = accumulateRow_SSE2;
+    }
+#endif
+#if defined(__ARM_NEON__)
+    if (cpuFeatures & TWTW_CPU_NEON) {
+        simdConvertFunc = convertRGBXRowToUYVY_NEON;
+        simdAccumFunc = accumulateRow_NEON;
+    }
+#endif
+    (void)cpuFeatures;
     
     TwtwYUVImage *img = g_malloc0(sizeof(TwtwYUVImage));
-    img->w = w;
-    img->h = h;
-    img->rowBytes = w * 2;
+    img->w = dstW;
+    img->h = dstH;
+    img->rowBytes = dstW * 2;
     img->pixelFormat = TWTW_CAM_FOURCC;
     img->buffer = g_malloc(img->rowBytes * img->h);
     
-    // this is called rarely, so I think we can afford to do this slow float-based conversion here
-    
-    int srcStride = (srcHasAlpha) ? 4 : 3;
-    
-    int i, j;
-    const float toFloatMult = (1.0f / 255.0f);
+    // when scaling, each destination row is first gathered into a row of 32-bit pixels.
+    // for area averaging, the source rows covered by the destination row are summed at full width, then the columns are summed
+    unsigned char *rgbRow = NULL;
+    uint32_t *accRow = NULL;
+    int *colStart = NULL;
+    if (isScaled) {
+        rgbRow = g_malloc(dstW * 4);
+        colStart = g_malloc((dstW + 1) * sizeof(int));
+        int x;
+        for (x = 0; x <= dstW; x++)
+            colStart[x] = (int)(((int64_t)x * cropW) / dstW);
+        if (areaAverage)
+            accRow = g_malloc(cropW * srcStride * sizeof(uint32_t));
+    }
     
-    for (i = 0; i < h; i++) {
-        unsigned char *src = (unsigned char *)(srcBuf + srcRowBytes * i);
-        unsigned int *dst = (unsigned int *)(img->buffer + img->rowBytes * i);
-        for (j = w/2; j; j--) {
-            register unsigned int iy1, iy2, iCb, iCr;
-            register float y1, y2, Cb, Cr;
-            register float r1, r2, g1, g2, b1, b2;
-            
-            r1 = src[0] * toFloatMult;
-            g1 = src[1] * toFloatMult;
-            b1 = src[2] * toFloatMult;
-            src += srcStride;
-
-            y1 = yFromRGB_rec601_f(r1, g1, b1);
-            Cb = cbFromRGB_rec601_f(r1, g1, b1);
-            Cr = crFromRGB_rec601_f(r1, g1, b1);
-
-            r2 = src[0] * toFloatMult;
-            g2 = src[1] * toFloatMult;
-            b2 = src[2] * toFloatMult;
-            src += srcStride;
-                        
-            y2 = yFromRGB_rec601_f(r2, g2, b2);
-            
-            iy1 = ((unsigned int)y1) & 0xff;
-            iy2 = ((unsigned int)y2) & 0xff;
-            iCb = ((unsigned int)Cb) & 0xff;
-            iCr = ((unsigned int)Cr) & 0xff;
+    int x, y, c;
+    for (y = 0; y < dstH; y++) {
+        unsigned char *dst = img->buffer + img->rowBytes * y;
+        const unsigned char *rowPixels;
+        int rowStride;
+        
+        if ( !isScaled) {
+            rowPixels = srcBuf + srcRowBytes * (cropY + y) + cropX * srcStride;
+            rowStride = srcStride;
+        }
+        else {
+            const int y0 = (int)(((int64_t)y * cropH) / dstH);
+            const int y1 = MAX(y0 + 1, (int)(((int64_t)(y + 1) * cropH) / dstH));
             
-#if !defined(WORDS_BIGENDIAN)
-            dst[0] = (iCb << 0) | (iy1 << 8) | (iCr << 16) | (iy2 << 24);
-#else
-            dst[0] = (iCb << 24) | (iy1 << 16) | (iCr << 8) | (iy2 << 0);
-#endif            
-            dst++;
+            if ( !areaAverage) {
+                // nearest: the source pixel at the center of the destination pixel's area
+                const int sy = (int)(((int64_t)(2*y + 1) * cropH) / (2*dstH));
+                const unsigned char *src = srcBuf + srcRowBytes * (cropY + sy) + cropX * srcStride;
+                for (x = 0; x < dstW; x++) {
+                    const int sx = (int)(((int64_t)(2*x + 1) * cropW) / (2*dstW));
+                    rgbRow[x*4 + 0] = src[sx*srcStride + 0];
+                    rgbRow[x*4 + 1] = src[sx*srcStride + 1];
+                    rgbRow[x*4 + 2] = src[sx*srcStride + 2];
+                }
+            }
+            else {
+                const int accCount = cropW * srcStride;
+                int sy;
+                memset(accRow, 0, accCount * sizeof(uint32_t));
+                for (sy = y0; sy < y1; sy++) {
+                    const unsigned char *src = srcBuf + srcRowBytes * (cropY + sy) + cropX * srcStride;
+                    const int done = (simdAccumFunc) ? simdAccumFunc(src, accRow, accCount) : 0;
+                    for (c = done; c < accCount; c++)
+                        accRow[c] += src[c];
+                }
+                for (x = 0; x < dstW; x++) {
+                    const int x0 = colStart[x];
+                    const int x1 = MAX(x0 + 1, colStart[x + 1]);
+                    const uint32_t area = (x1 - x0) * (y1 - y0);
+                    uint32_t sum[3] = { 0, 0, 0 };
+                    int sx;
+                    for (sx = x0; sx < x1; sx++) {
+                        sum[0] += accRow[sx*srcStride + 0];
+                        sum[1] += accRow[sx*srcStride + 1];
+                        sum[2] += accRow[sx*srcStride + 2];
+                    }
+                    for (c = 0; c < 3; c++)
+                        rgbRow[x*4 + c] = (unsigned char)((sum[c] + area / 2) / area);
+                }
+            }
+            rowPixels = rgbRow;
+            rowStride = 4;
         }
+        
+        const int done = (simdConvertFunc && rowStride == 4) ? simdConvertFunc(rowPixels, dst, dstW / 2) : 0;
+        convertRGBRowToUYVY_scalar(rowPixels, rowStride, dst, done, dstW / 2);
     }
+    
+    g_free(rgbRow);
+    g_free(accRow);
+    g_free(colStart);
     return img;
 }
 
+TwtwYUVImage *twtw_yuv_image_create_from_rgb_with_default_size (unsigned char *srcBuf, const size_t srcRowBytes, const gboolean srcHasAlpha)
+{
+    return twtw_yuv_image_create_from_rgb (srcBuf, srcRowBytes, srcHasAlpha,
+                                           TWTW_CAM_IMAGEWIDTH, TWTW_CAM_IMAGEHEIGHT,
+                                           TWTW_CAM_IMAGEWIDTH, TWTW_CAM_IMAGEHEIGHT, FALSE);
+}
 
-void twtw_yuv_image_convert_to_rgb_for_display (TwtwYUVImage *yuvImage, unsigned char *dstBuf, const size_t dstRowBytes,
-                                                const gboolean includeAlpha,
-                                                const gint srcXStride,
-                                                const gint srcYStride)
+
+// --- SIMD conversion ---
+
+/*
+    the scalar conversion below works in 16.16 fixed point using FIXD_MUL, which drops the low 8 bits of both operands.
+    all the inputs are integers, so each output channel reduces exactly to:
+    
+        v = clamp((kY * (Y-16) + kCr * (Cr-128) + kCb * (Cb-128)) >> 16, 0, 255)
+        
+    the coefficients are divisible by a few powers of two, and after dividing they fit in 16 bits.
+    the SIMD paths use these coefficients with 16x16->32 multiplies, so they produce the same output as the scalar path, bit for bit.
+*/
+typedef struct {
+    int16_t r_y, r_cr;
+    int16_t g_y, g_cr, g_cb;
+    int16_t b_y, b_cb;
+    int r_shift, g_shift, b_shift;
+} TwtwYUVToRGBCoeffs;
+
+static int countTrailingZeros32(int32_t v)
 {
-    g_return_if_fail(yuvImage);
-    g_return_if_fail(yuvImage->buffer);
-    g_return_if_fail(dstBuf);
+    int n = 0;
+    if (v == 0) return 32;
+    while ((v & 1) == 0 && n < 16) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+// returns the shift to apply to the three coefficients, or -1 if they can't be represented in 16 bits
+static int reduceCoeffsTo16Bit(int32_t *c0, int32_t *c1, int32_t *c2)
+{
+    int s = MIN(countTrailingZeros32(*c0), MIN(countTrailingZeros32(*c1), countTrailingZeros32(*c2)));
+    s = MIN(s, 16);
+    *c0 >>= s;
+    *c1 >>= s;
+    *c2 >>= s;
+    if (abs(*c0) > 32767 || abs(*c1) > 32767 || abs(*c2) > 32767)
+        return -1;
+    return 16 - s;
+}
+
+static gboolean getYUVToRGBCoeffs(TwtwFixedNum fx_chromaMul, TwtwFixedNum fx_lumaMul,
+                                  TwtwFixedNum fx_crMul_r, TwtwFixedNum fx_crMul_g, TwtwFixedNum fx_cbMul_g, TwtwFixedNum fx_cbMul_b,
+                                  TwtwYUVToRGBCoeffs *k)
+{
+    // these are the products that FIXD_MUL computes in the scalar loop
+    const int32_t chromaMul = fx_chromaMul >> 8;
+    int32_t yMul = (fx_lumaMul >> 8) << 8;
+    int32_t rCr = (fx_crMul_r >> 8) * chromaMul;
+    int32_t gCr = -(fx_crMul_g >> 8) * chromaMul;
+    int32_t gCb = -(fx_cbMul_g >> 8) * chromaMul;
+    int32_t bCb = (fx_cbMul_b >> 8) * chromaMul;
+    int32_t zero = 0;
+    int32_t y;
+
+    y = yMul;
+    k->r_shift = reduceCoeffsTo16Bit(&y, &rCr, &zero);
+    k->r_y = y;
+    k->r_cr = rCr;
+    
+    y = yMul;
+    k->g_shift = reduceCoeffsTo16Bit(&y, &gCr, &gCb);
+    k->g_y = y;
+    k->g_cr = gCr;
+    k->g_cb = gCb;
+    
+    y = yMul;
+    zero = 0;
+    k->b_shift = reduceCoeffsTo16Bit(&y, &bCb, &zero);
+    k->b_y = y;
+    k->b_cb = bCb;
+    
+    return (k->r_shift >= 0 && k->g_shift >= 0 && k->b_shift >= 0) ? TRUE : FALSE;
+}
+
+// the tone curve LUT doesn't vectorize, so it's applied while interleaving the planar results
+static inline void storeRGBThroughLUT(unsigned char * RESTRICT dst, const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                                      const int count, const gboolean includeAlpha, const unsigned char *lut)
+{
+    int i;
+    if (includeAlpha) {
+        for (i = 0; i < count; i++) {
+            dst[0] = lut[r[i]];
+            dst[1] = lut[g[i]];
+            dst[2] = lut[b[i]];
+            dst[3] = 255;
+            dst += 4;
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            dst[0] = lut[r[i]];
+            dst[1] = lut[g[i]];
+            dst[2] = lut[b[i]];
+            dst += 3;
+        }
+    }
+}
 
-    const unsigned int w = yuvImage->w;
-    const unsigned int h = yuvImage->h;
-    const size_t srcRowBytes = yuvImage->rowBytes;
-    unsigned char *srcBuf = yuvImage->buffer;
 
+#if defined(__SSE2__)
+
+// converts 8 pixels (4 UYVY macropixels) per iteration; returns number of macropixels converted
+static unsigned int convertUYVYRowToRGB_SSE2(const unsigned char *src, unsigned char *dst, const unsigned int numMacropixels,
+                                             const gboolean includeAlpha, const unsigned char *lut, const TwtwYUVToRGBCoeffs *k)
+{
     const unsigned int dstStride = (includeAlpha) ? 4 : 3;
+    const __m128i lowByteMask = _mm_set1_epi16(0x00ff);
+    const __m128i yBias = _mm_set1_epi16(16);
+    const __m128i cBias = _mm_set1_epi16(128);
+    const __m128i zero = _mm_setzero_si128();
+    
+    const __m128i kR = _mm_set_epi16(k->r_cr, k->r_y, k->r_cr, k->r_y, k->r_cr, k->r_y, k->r_cr, k->r_y);
+    const __m128i kG = _mm_set_epi16(k->g_cr, k->g_y, k->g_cr, k->g_y, k->g_cr, k->g_y, k->g_cr, k->g_y);
+    const __m128i kGCb = _mm_set_epi16(0, k->g_cb, 0, k->g_cb, 0, k->g_cb, 0, k->g_cb);
+    const __m128i kB = _mm_set_epi16(k->b_cb, k->b_y, k->b_cb, k->b_y, k->b_cb, k->b_y, k->b_cb, k->b_y);
+    const __m128i rShift = _mm_cvtsi32_si128(k->r_shift);
+    const __m128i gShift = _mm_cvtsi32_si128(k->g_shift);
+    const __m128i bShift = _mm_cvtsi32_si128(k->b_shift);
+    
+    unsigned char rBuf[16], gBuf[16], bBuf[16];
+    unsigned int n;
+    for (n = 0; n + 4 <= numMacropixels; n += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + n*4));
+        
+        // { Cb, Y0, Cr, Y1 } byte order
+        __m128i ys = _mm_sub_epi16(_mm_srli_epi16(v, 8), yBias);
+        __m128i cs = _mm_sub_epi16(_mm_and_si128(v, lowByteMask), cBias);
+        __m128i cbs = _mm_shufflehi_epi16(_mm_shufflelo_epi16(cs, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+        __m128i crs = _mm_shufflehi_epi16(_mm_shufflelo_epi16(cs, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+        
+        __m128i ycr_lo = _mm_unpacklo_epi16(ys, crs);
+        __m128i ycr_hi = _mm_unpackhi_epi16(ys, crs);
+        __m128i ycb_lo = _mm_unpacklo_epi16(ys, cbs);
+        __m128i ycb_hi = _mm_unpackhi_epi16(ys, cbs);
+        __m128i cb_lo = _mm_unpacklo_epi16(cbs, zero);
+        __m128i cb_hi = _mm_unpackhi_epi16(cbs, zero);
+        
+        __m128i r_lo = _mm_sra_epi32(_mm_madd_epi16(ycr_lo, kR), rShift);
+        __m128i r_hi = _mm_sra_epi32(_mm_madd_epi16(ycr_hi, kR), rShift);
+        __m128i g_lo = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(ycr_lo, kG), _mm_madd_epi16(cb_lo, kGCb)), gShift);
+        __m128i g_hi = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(ycr_hi, kG), _mm_madd_epi16(cb_hi, kGCb)), gShift);
+        __m128i b_lo = _mm_sra_epi32(_mm_madd_epi16(ycb_lo, kB), bShift);
+        __m128i b_hi = _mm_sra_epi32(_mm_madd_epi16(ycb_hi, kB), bShift);
+        
+        // saturating packs do the clamp to 0-255
+        __m128i r8 = _mm_packus_epi16(_mm_packs_epi32(r_lo, r_hi), zero);
+        __m128i g8 = _mm_packus_epi16(_mm_packs_epi32(g_lo, g_hi), zero);
+        __m128i b8 = _mm_packus_epi16(_mm_packs_epi32(b_lo, b_hi), zero);
+        _mm_storeu_si128((__m128i *)rBuf, r8);
+        _mm_storeu_si128((__m128i *)gBuf, g8);
+        _mm_storeu_si128((__m128i *)bBuf, b8);
+        
+        storeRGBThroughLUT(dst, rBuf, gBuf, bBuf, 8, includeAlpha, lut);
+        dst += 8 * dstStride;
+    }
+    return n;
+}
 
-    //printf("%s: dstrb %i, srcrb %i, stride %i\n", __func__, dstRowBytes, srcRowBytes, stride);
+#endif  // __SSE2__
+
+
+#if defined(__ARM_NEON__)
+
+static inline uint8x8_t neonChannel(int16x8_t ys, int16x8_t c1s, int16x8_t c2s,
+                                    const int16_t kY, const int16_t kC1, const int16_t kC2, const int32x4_t shift)
+{
+    int32x4_t lo = vmull_n_s16(vget_low_s16(ys), kY);
+    int32x4_t hi = vmull_n_s16(vget_high_s16(ys), kY);
+    lo = vmlal_n_s16(lo, vget_low_s16(c1s), kC1);
+    hi = vmlal_n_s16(hi, vget_high_s16(c1s), kC1);
+    if (kC2 != 0) {
+        lo = vmlal_n_s16(lo, vget_low_s16(c2s), kC2);
+        hi = vmlal_n_s16(hi, vget_high_s16(c2s), kC2);
+    }
+    // shift is negative, so vshl is an arithmetic right shift; the saturating narrows do the clamp to 0-255
+    lo = vshlq_s32(lo, shift);
+    hi = vshlq_s32(hi, shift);
+    return vqmovn_u16(vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+}
+
+// converts 16 pixels (8 UYVY macropixels) per iteration; returns number of macropixels converted
+static unsigned int convertUYVYRowToRGB_NEON(const unsigned char *src, unsigned char *dst, const unsigned int numMacropixels,
+                                             const gboolean includeAlpha, const unsigned char *lut, const TwtwYUVToRGBCoeffs *k)
+{
+    const unsigned int dstStride = (includeAlpha) ? 4 : 3;
+    const int32x4_t rShift = vdupq_n_s32(-k->r_shift);
+    const int32x4_t gShift = vdupq_n_s32(-k->g_shift);
+    const int32x4_t bShift = vdupq_n_s32(-k->b_shift);
+    const uint8x8_t yBias = vdup_n_u8(16);
+    const uint8x8_t cBias = vdup_n_u8(128);
     
+    unsigned char rBuf[16], gBuf[16], bBuf[16];
+    unsigned int n;
+    for (n = 0; n + 8 <= numMacropixels; n += 8) {
+        // deinterleaves { Cb, Y0, Cr, Y1 } into separate vectors; even and odd pixels share the chroma
+        uint8x8x4_t v = vld4_u8(src + n*4);
+        
+        int16x8_t cbs = vreinterpretq_s16_u16(vsubl_u8(v.val[0], cBias));
+        int16x8_t crs = vreinterpretq_s16_u16(vsubl_u8(v.val[2], cBias));
+        int16x8_t y0s = vreinterpretq_s16_u16(vsubl_u8(v.val[1], yBias));
+        int16x8_t y1s = vreinterpretq_s16_u16(vsubl_u8(v.val[3], yBias));
+        
+        uint8x8x2_t r = vzip_u8(neonChannel(y0s, crs, cbs, k->r_y, k->r_cr, 0, rShift),
+                                neonChannel(y1s, crs, cbs, k->r_y, k->r_cr, 0, rShift));
+        uint8x8x2_t g = vzip_u8(neonChannel(y0s, crs, cbs, k->g_y, k->g_cr, k->g_cb, gShift),
+                                neonChannel(y1s, crs, cbs, k->g_y, k->g_cr, k->g_cb, gShift));
+        uint8x8x2_t b = vzip_u8(neonChannel(y0s, cbs, crs, k->b_y, k->b_cb, 0, bShift),
+                                neonChannel(y1s, cbs, crs, k->b_y, k->b_cb, 0, bShift));
+        vst1q_u8(rBuf, vcombine_u8(r.val[0], r.val[1]));
+        vst1q_u8(gBuf, vcombine_u8(g.val[0], g.val[1]));
+        vst1q_u8(bBuf, vcombine_u8(b.val[0], b.val[1]));
+        
+        storeRGBThroughLUT(dst, rBuf, gBuf, bBuf, 16, includeAlpha, lut);
+        dst += 16 * dstStride;
+    }
+    return n;
+}
+
+#endif  // __ARM_NEON__
+
+
+void twtw_photo_init_shared_tables ()
+{
+    getGammaLUTForBGPhoto();
+    twtw_cpu_features ();
+}
+
+
+// state shared by the display conversion functions
+typedef struct {
     // tweak down the color saturation.
     // this is applied to make the heavily chroma-compressed images
     // look better as the background for the vector graphics.
-    const TwtwFixedNum fx_photoChromaMul = FIXD_FROM_FLOAT(0.6);
+    TwtwFixedNum fx_photoChromaMul;
+    
+    // constants for YUV conversion
+    TwtwFixedNum fx_lumaMul;
+    TwtwFixedNum fx_crMul_r;
+    TwtwFixedNum fx_crMul_g;
+    TwtwFixedNum fx_cbMul_g;
+    TwtwFixedNum fx_cbMul_b;
 
     // an s-shaped tone curve is applied to make N800-taken images look a bit better
-    const unsigned char *outLUT = getGammaLUTForBGPhoto();
-    g_return_if_fail(outLUT);
-            
-    // constants for YUV conversion
-    const TwtwFixedNum fx_lumaMul = FIXD_FROM_FLOAT(1.164);
-    const TwtwFixedNum fx_crMul_r = FIXD_FROM_FLOAT(1.596);
-    const TwtwFixedNum fx_crMul_g = FIXD_FROM_FLOAT(0.813);
-    const TwtwFixedNum fx_cbMul_g = FIXD_FROM_FLOAT(0.391);
-    const TwtwFixedNum fx_cbMul_b = FIXD_FROM_FLOAT(2.018);
+    const unsigned char *outLUT;
     
-    const unsigned int xStride = (srcXStride > 0) ? srcXStride : 1;
-    const unsigned int yStride = (srcYStride > 0) ? srcYStride : 1;
+    // SIMD row converter for the unstrided case, or NULL
+    unsigned int (*simdRowFunc)(const unsigned char *, unsigned char *, const unsigned int, const gboolean, const unsigned char *, const TwtwYUVToRGBCoeffs *);
+    TwtwYUVToRGBCoeffs simdCoeffs;
+} TwtwYUVDisplayConversion;
 
-    const unsigned int srcNumPixels =  (xStride == 1) ? (w / 2) : w;  // if stride==1 (i.e. no pixels are skipped), we process two source pixels at a time
+static gboolean initDisplayConversion(TwtwYUVDisplayConversion *conv, const gboolean allowSIMD)
+{
+    memset(conv, 0, sizeof(*conv));
+    
+    conv->fx_photoChromaMul = FIXD_FROM_FLOAT(0.6);
+
+    conv->fx_lumaMul = FIXD_FROM_FLOAT(1.164);
+    conv->fx_crMul_r = FIXD_FROM_FLOAT(1.596);
+    conv->fx_crMul_g = FIXD_FROM_FLOAT(0.813);
+    conv->fx_cbMul_g = FIXD_FROM_FLOAT(0.391);
+    conv->fx_cbMul_b = FIXD_FROM_FLOAT(2.018);
+
+    conv->outLUT = getGammaLUTForBGPhoto();
+    if ( !conv->outLUT)
+        return FALSE;
+    
+    if (allowSIMD && getYUVToRGBCoeffs(conv->fx_photoChromaMul, conv->fx_lumaMul,
+                                       conv->fx_crMul_r, conv->fx_crMul_g, conv->fx_cbMul_g, conv->fx_cbMul_b,
+                                       &conv->simdCoeffs)) {
+        const gint32 cpuFeatures = twtw_cpu_features ();
+#if defined(__SSE2__)
+        if (cpuFeatures & TWTW_CPU_SSE2)
+            conv->simdRowFunc = convertUYVYRowToRGB_SSE2;
+#endif
+#if defined(__ARM_NEON__)
+        if (cpuFeatures & TWTW_CPU_NEON)
+            conv->simdRowFunc = convertUYVYRowToRGB_NEON;
+#endif
+        (void)cpuFeatures;
+    }
+    return TRUE;
+}
+
+// converts one row of numMacropixels UYVY macropixels.
+// if xStride==1, both pixels of each macropixel are converted;
+// otherwise only the first luma sample of every (xStride/2)'th macropixel is used
+static void convertUYVYRowForDisplay(const TwtwYUVDisplayConversion *conv,
+                                     const unsigned int * RESTRICT src, unsigned char * RESTRICT dst,
+                                     const unsigned int numMacropixels,
+                                     const unsigned int xStride,
+                                     const gboolean includeAlpha)
+{
+    const unsigned int dstStride = (includeAlpha) ? 4 : 3;
     const unsigned int srcRealStride = (xStride == 1) ? 1 : (xStride / 2);
+    const unsigned char *outLUT = conv->outLUT;
+    const TwtwFixedNum fx_photoChromaMul = conv->fx_photoChromaMul;
+    const TwtwFixedNum fx_lumaMul = conv->fx_lumaMul;
+    const TwtwFixedNum fx_crMul_r = conv->fx_crMul_r;
+    const TwtwFixedNum fx_crMul_g = conv->fx_crMul_g;
+    const TwtwFixedNum fx_cbMul_g = conv->fx_cbMul_g;
+    const TwtwFixedNum fx_cbMul_b = conv->fx_cbMul_b;
+    unsigned int n = 0;
     
-    unsigned int y;
-    for (y = 0; y < h; y += yStride) {
-        unsigned int * RESTRICT src = (unsigned int *)(srcBuf + srcRowBytes*y);
-        unsigned char * RESTRICT dst = (unsigned char *)(dstBuf + dstRowBytes*(y / yStride));
-        unsigned int n;
-        for (n = 0; n < srcNumPixels; n += srcRealStride) {
-            int r0, g0, b0, r1, g1, b1;
-            unsigned int v = src[n];
-            // pixel format used by twtw is UYVY (i.e. byte order is { Cb, Y0, Cr, Y1 })
+    if (xStride == 1 && conv->simdRowFunc) {
+        // the SIMD function does as much of the row as it can; the remainder is done by the scalar loop
+        n = conv->simdRowFunc((const unsigned char *)src, dst, numMacropixels, includeAlpha, outLUT, &conv->simdCoeffs);
+        dst += n * 2 * dstStride;
+    }
+        
+    for ( ; n < numMacropixels; n += srcRealStride) {
+        int r0, g0, b0, r1, g1, b1;
+        unsigned int v = src[n];
+        // pixel format used by twtw is UYVY (i.e. byte order is { Cb, Y0, Cr, Y1 })
 #if !defined(WORDS_BIGENDIAN)
-            int cb = (v) & 0xff;
-            int y0 = (v >> 8) & 0xff;
-            int cr = (v >> 16) & 0xff;
-            int y1 = (v >> 24) & 0xff;
+        int cb = (v) & 0xff;
+        int y0 = (v >> 8) & 0xff;
+        int cr = (v >> 16) & 0xff;
+        int y1 = (v >> 24) & 0xff;
 #else
-            int y1 = (v) & 0xff;
-            int cr = (v >> 8) & 0xff;
-            int y0 = (v >> 16) & 0xff;
-            int cb = (v >> 24) & 0xff;
+        int y1 = (v) & 0xff;
+        int cr = (v >> 8) & 0xff;
+        int y0 = (v >> 16) & 0xff;
+        int cb = (v >> 24) & 0xff;
 #endif
-            /*
-            R = 1.164(Y-16) + 1.596(Cr-128)
-            G = 1.164(Y-16) - 0.813(Cr-128) - 0.391(Cb-128)
-            B = 1.164(Y-16) + 2.018(Cb-128)
-            */
-            cr = FIXD_FROM_INT(cr - 128);
-            cb = FIXD_FROM_INT(cb - 128);
-            y0 = FIXD_FROM_INT(y0 - 16);
-            y1 = FIXD_FROM_INT(y1 - 16);
-            
-            cr = FIXD_MUL(cr, fx_photoChromaMul);
-            cb = FIXD_MUL(cb, fx_photoChromaMul);
+        /*
+        R = 1.164(Y-16) + 1.596(Cr-128)
+        G = 1.164(Y-16) - 0.813(Cr-128) - 0.391(Cb-128)
+        B = 1.164(Y-16) + 2.018(Cb-128)
+        */
+        cr = FIXD_FROM_INT(cr - 128);
+        cb = FIXD_FROM_INT(cb - 128);
+        y0 = FIXD_FROM_INT(y0 - 16);
+        y1 = FIXD_FROM_INT(y1 - 16);
+        
+        cr = FIXD_MUL(cr, fx_photoChromaMul);
+        cb = FIXD_MUL(cb, fx_photoChromaMul);
    
-            int scaled_cr_r = FIXD_MUL(fx_crMul_r, cr);
-            int scaled_cr_g = FIXD_MUL(fx_crMul_g, cr);
-            int scaled_cb_g = FIXD_MUL(fx_cbMul_g, cb);
-            int scaled_cb_b = FIXD_MUL(fx_cbMul_b, cb);
-            int scaled_y0 = FIXD_MUL(fx_lumaMul, y0);
-            
-            r0 = scaled_y0 + scaled_cr_r;
-            g0 = scaled_y0 - scaled_cr_g - scaled_cb_g;
-            b0 = scaled_y0 + scaled_cb_b;
-            dst[0] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(r0) ) ];
-            dst[1] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(g0) ) ];
-            dst[2] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(b0) ) ];
+        int scaled_cr_r = FIXD_MUL(fx_crMul_r, cr);
+        int scaled_cr_g = FIXD_MUL(fx_crMul_g, cr);
+        int scaled_cb_g = FIXD_MUL(fx_cbMul_g, cb);
+        int scaled_cb_b = FIXD_MUL(fx_cbMul_b, cb);
+        int scaled_y0 = FIXD_MUL(fx_lumaMul, y0);
+        
+        r0 = scaled_y0 + scaled_cr_r;
+        g0 = scaled_y0 - scaled_cr_g - scaled_cb_g;
+        b0 = scaled_y0 + scaled_cb_b;
+        dst[0] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(r0) ) ];
+        dst[1] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(g0) ) ];
+        dst[2] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(b0) ) ];
+        
+        if (includeAlpha) {
+            dst[3] = 255;
+        }
+        dst += dstStride;
+
+        if (xStride == 1) {
+            int scaled_y1 = FIXD_MUL(fx_lumaMul, y1);
             
+            r1 = scaled_y1 + scaled_cr_r;
+            g1 = scaled_y1 - scaled_cr_g - scaled_cb_g;
+            b1 = scaled_y1 + scaled_cb_b;
+            dst[0] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(r1) ) ];
+            dst[1] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(g1) ) ];
+            dst[2] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(b1) ) ];
+
             if (includeAlpha) {
                 dst[3] = 255;
             }
             dst += dstStride;
+        }
+    }
+}
 
-            if (xStride == 1) {
-                int scaled_y1 = FIXD_MUL(fx_lumaMul, y1);
-            
-                r1 = scaled_y1 + scaled_cr_r;
-                g1 = scaled_y1 - scaled_cr_g - scaled_cb_g;
-                b1 = scaled_y1 + scaled_cb_b;
-                dst[0] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(r1) ) ];
-                dst[1] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(g1) ) ];
-                dst[2] = outLUT[ FIXD_TO_INT( FIXD_CLAMP_255(b1) ) ];
-
-                if (includeAlpha) {
-                    dst[3] = 255;
+
+void twtw_yuv_image_convert_to_rgb_for_display (TwtwYUVImage *yuvImage, unsigned char *dstBuf, const size_t dstRowBytes,
+                                                const gboolean includeAlpha,
+                                                const gint srcXStride,
+                                                const gint srcYStride)
+{
+    g_return_if_fail(yuvImage);
+    g_return_if_fail(yuvImage->buffer);
+    g_return_if_fail(dstBuf);
+
+    const unsigned int h = yuvImage->h;
+    const size_t srcRowBytes = yuvImage->rowBytes;
+    unsigned char *srcBuf = yuvImage->buffer;
+
+    //printf("%s: dstrb %i, srcrb %i, stride %i\n", __func__, dstRowBytes, srcRowBytes, stride);
+    
+    const unsigned int xStride = (srcXStride > 0) ? srcXStride : 1;
+    const unsigned int yStride = (srcYStride > 0) ? srcYStride : 1;
+
+    // the source row has w/2 UYVY macropixels
+    const unsigned int srcNumPixels =  yuvImage->w / 2;
+    
+    TwtwYUVDisplayConversion conv;
+    g_return_if_fail(initDisplayConversion(&conv, TRUE));
+    
+    unsigned int y;
+    for (y = 0; y < h; y += yStride) {
+        convertUYVYRowForDisplay(&conv,
+                                 (const unsigned int *)(srcBuf + srcRowBytes*y),
+                                 dstBuf + dstRowBytes*(y / yStride),
+                                 srcNumPixels, xStride, includeAlpha);
+    }
+}
+
+
+// scratch rows for scaled conversion are on the stack up to this size
+#define SCALE_STACK_SCRATCH_SIZE  (32*1024)
+
+// bilinear horizontal scaling of a 24-bit RGB row; coordinates are 16.16 fixed point.
+// the result is kept at 8.8 precision so that the vertical pass rounds only once
+static void scaleRGBRowHorizontal(const unsigned char * RESTRICT src, const int srcW,
+                                  uint16_t * RESTRICT dst, const int dstW,
+                                  const int32_t xInc)
+{
+    const int32_t maxSX = (srcW - 1) << 16;
+    int32_t sx = xInc / 2 - 0x8000;
+    int x, n;
+    for (x = 0; x < dstW; x++) {
+        const int32_t cx = (sx < 0) ? 0 : ((sx > maxSX) ? maxSX : sx);
+        const int ix = cx >> 16;
+        const int fx = (cx >> 8) & 0xff;
+        const int ix1 = (ix < srcW - 1) ? 3 : 0;
+        const unsigned char *s = src + ix * 3;
+
+        for (n = 0; n < 3; n++) {
+            dst[n] = (uint16_t)((s[n] << 8) + (s[n + ix1] - s[n]) * fx);
+        }
+        dst += 3;
+        sx += xInc;
+    }
+}
+
+// scaled conversion reads its source through this, so the rows can come from a plain image or be decoded tile by tile.
+// rows are requested in increasing order; each row is srcW pixels of UYVY
+typedef const unsigned char *(*TwtwYUVRowSourceFunc) (void *ctx, const int y);
+
+static void convertRowSourceToRGBScaled (TwtwYUVRowSourceFunc rowFunc, void *rowCtx, const int srcW, const int srcH,
+                                         unsigned char *dstBuf, const size_t dstRowBytes,
+                                         const gint dstW, const gint dstH,
+                                         const gboolean includeAlpha)
+{
+    TwtwYUVDisplayConversion conv;
+    g_return_if_fail(initDisplayConversion(&conv, TRUE));
+
+    // scratch: one converted source row + two horizontally scaled rows (source rows iy and iy+1).
+    // this is small enough to be on the stack for any reasonable display size
+    const size_t srcRowSize = srcW * 3;
+    const size_t scaledRowSize = dstW * 3 * sizeof(uint16_t);
+    const size_t scratchSize = srcRowSize + 2*scaledRowSize;
+    uint16_t stackScratch[SCALE_STACK_SCRATCH_SIZE / sizeof(uint16_t)];
+    unsigned char *scratch = (scratchSize <= sizeof(stackScratch)) ? (unsigned char *)stackScratch : g_malloc(scratchSize);
+    
+    uint16_t *scaledRows[2] = { (uint16_t *)scratch, (uint16_t *)(scratch + scaledRowSize) };
+    int scaledRowY[2] = { -1, -1 };
+    unsigned char *srcRow = scratch + 2*scaledRowSize;
+    
+    const int32_t xInc = (int32_t)(((int64_t)srcW << 16) / dstW);
+    const int32_t yInc = (int32_t)(((int64_t)srcH << 16) / dstH);
+    const int32_t maxSY = (srcH - 1) << 16;
+
+    int32_t sy = yInc / 2 - 0x8000;
+    int x, y, n, i;
+    for (y = 0; y < dstH; y++) {
+        const int32_t cy = (sy < 0) ? 0 : ((sy > maxSY) ? maxSY : sy);
+        const int iy = cy >> 16;
+        const int fy = (cy >> 8) & 0xff;
+        const int rowIndices[2] = { iy, (iy < srcH - 1) ? (iy + 1) : iy };
+        
+        // source row iy is always kept in slot (iy & 1), so when moving down by one row, the previous lower row is reused
+        for (i = 0; i < 2; i++) {
+            const int ry = rowIndices[i];
+            const int slot = ry & 1;
+            if (scaledRowY[slot] != ry) {
+                convertUYVYRowForDisplay(&conv, (const unsigned int *)rowFunc(rowCtx, ry), srcRow,
+                                         srcW / 2, 1, FALSE);
+                scaleRGBRowHorizontal(srcRow, srcW, scaledRows[slot], dstW, xInc);
+                scaledRowY[slot] = ry;
+            }
+        }
+        
+        const uint16_t *top = scaledRows[rowIndices[0] & 1];
+        const uint16_t *bot = scaledRows[rowIndices[1] & 1];
+        unsigned char *d = dstBuf + dstRowBytes * y;
+        
+        if ( !includeAlpha) {
+            for (n = 0; n < dstW*3; n++) {
+                const int t = top[n];
+                d[n] = (unsigned char)(((t << 8) + (bot[n] - t) * fy + 0x8000) >> 16);
+            }
+        } else {
+            for (x = 0; x < dstW; x++) {
+                for (n = 0; n < 3; n++) {
+                    const int t = top[n];
+                    d[n] = (unsigned char)(((t << 8) + (bot[n] - t) * fy + 0x8000) >> 16);
                 }
-                dst += dstStride;
+                d[3] = 255;
+                top += 3;
+                bot += 3;
+                d += 4;
             }
         }
+        sy += yInc;
     }
+    
+    if (scratch != (unsigned char *)stackScratch)
+        g_free(scratch);
+}
+
+static const unsigned char *getYUVImageRow (void *ctx, const int y)
+{
+    TwtwYUVImage *image = (TwtwYUVImage *)ctx;
+    return image->buffer + image->rowBytes * y;
+}
+
+void twtw_yuv_image_convert_to_rgb_for_display_scaled (TwtwYUVImage *yuvImage, unsigned char *dstBuf, const size_t dstRowBytes,
+                                                       const gint dstW, const gint dstH,
+                                                       const gboolean includeAlpha)
+{
+    g_return_if_fail(yuvImage);
+    g_return_if_fail(yuvImage->buffer);
+    g_return_if_fail(dstBuf);
+    g_return_if_fail(dstW > 0 && dstH > 0);
+    g_return_if_fail(yuvImage->w >= 2 && yuvImage->h >= 1);
+
+    convertRowSourceToRGBScaled(getYUVImageRow, yuvImage, yuvImage->w & ~1, yuvImage->h,
+                                dstBuf, dstRowBytes, dstW, dstH, includeAlpha);
 }
 
 
 // --- disk format ---
 
-void twtw_yuv_image_serialize (TwtwYUVImage *image, unsigned char **outData, size_t *outDataSize, uint32_t *outDataFourCC)
+// same as twtw_deflate() in twtw-document.c
+#define PHOTO_DEFLATE_LEVEL  7
+
+
+/*
+  'twYd' planes are stored row by row: one byte for the predictor used on the row, followed by one residual byte
+  per sample (the difference from the prediction, modulo 256). as in PNG, the samples left of the first column
+  and above the first row are taken to be zero.
+  
+  the encoder picks the predictor that gives the smallest sum of absolute residuals for each row.
+  JPEG-LS's median edge detector compresses about as well on camera photos, but each sample depends on
+  the previous one through several operations, so it decodes much slower than these.
+  
+  both directions are streamed through zlib a row at a time, so neither side needs the whole planar image in memory:
+  the luma plane is written while the UYVY rows are walked, and only the (quarter-size) chroma planes are kept until the end.
+*/
+enum {
+    PLANE_PRED_NONE = 0,
+    PLANE_PRED_LEFT,        // a
+    PLANE_PRED_UP,          // b
+    PLANE_PRED_AVERAGE,     // (a + b) / 2
+    PLANE_PRED_GRADIENT,    // a + b - c
+    PLANE_PRED_COUNT
+};
+
+// a = left, b = above, c = above-left
+static inline unsigned int predictSample (const int pred, const unsigned int a, const unsigned int b, const unsigned int c)
 {
-    g_return_if_fail(image);
-    g_return_if_fail(outData);
-    g_return_if_fail(outDataSize);
+    switch (pred) {
+        case PLANE_PRED_LEFT:       return a;
+        case PLANE_PRED_UP:         return b;
+        case PLANE_PRED_AVERAGE:    return (a + b) >> 1;
+        case PLANE_PRED_GRADIENT:   return a + b - c;
+        default:                    return 0;
+    }
+}
+
+// average and gradient need about twice the time of the left predictor to decode, so they're used only when they're 1/16 better
+#define SLOW_PREDICTOR_PENALTY_DIV  16
+
+// writes the predictor byte and w residuals to dst
+static void encodeRowDPCM (const unsigned char *row, const unsigned char *up, const int w, unsigned char *dst)
+{
+    int x, pred;
+    int bestPred = PLANE_PRED_NONE;
+    unsigned int bestSum = UINT_MAX;
     
+    for (pred = 0; pred < PLANE_PRED_COUNT; pred++) {
+        unsigned int sum = 0;
+        for (x = 0; x < w; x++) {
+            const unsigned int a = (x > 0) ? row[x-1] : 0;
+            const unsigned int c = (x > 0) ? up[x-1] : 0;
+            const int r = (signed char)(row[x] - predictSample(pred, a, up[x], c));
+            sum += abs(r);
+        }
+        // the predictors are in order of decoding cost; a slower one must be clearly better to be picked
+        if (pred >= PLANE_PRED_AVERAGE)
+            sum += sum / SLOW_PREDICTOR_PENALTY_DIV;
+        
+        if (sum < bestSum) {
+            bestSum = sum;
+            bestPred = pred;
+        }
+    }
+    
+    *dst++ = bestPred;
+    for (x = 0; x < w; x++) {
+        const unsigned int a = (x > 0) ? row[x-1] : 0;
+        const unsigned int c = (x > 0) ? up[x-1] : 0;
+        dst[x] = (unsigned char)(row[x] - predictSample(bestPred, a, up[x], c));
+    }
+}
+
+// reconstructs the quantized samples in place from the row's w residuals; returns FALSE for an invalid predictor
+static gboolean decodeRowDPCM (const int pred, unsigned char * RESTRICT row, const unsigned char * RESTRICT up, const int w)
+{
+    unsigned int a, c;
+    int x;
+    
+    // separate loops so that each is a short dependency chain (or none at all for the up predictor)
+    switch (pred) {
+        case PLANE_PRED_NONE:
+            break;
+        case PLANE_PRED_LEFT:
+            a = 0;
+            for (x = 0; x < w; x++) {
+                a = (a + row[x]) & 0xff;
+                row[x] = a;
+            }
+            break;
+        case PLANE_PRED_UP:
+            for (x = 0; x < w; x++)
+                row[x] += up[x];
+            break;
+        case PLANE_PRED_AVERAGE:
+            a = 0;
+            for (x = 0; x < w; x++) {
+                a = (row[x] + ((a + up[x]) >> 1)) & 0xff;
+                row[x] = a;
+            }
+            break;
+        case PLANE_PRED_GRADIENT:
+            a = 0;
+            c = 0;
+            for (x = 0; x < w; x++) {
+                const unsigned int b = up[x];
+                a = (row[x] + a + b - c) & 0xff;
+                row[x] = a;
+                c = b;
+            }
+            break;
+        default:
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+// splitting UYVY rows into quantized planes.
+// luma is truncated to 6 bits; chroma is averaged over two rows and rounded to 5 bits.
+// the SIMD versions do a multiple of 16 pixels (8 macropixels) and return the count; the rest is done by the scalar code
+
+typedef int (*TwtwLumaRowFunc) (const unsigned char *src, unsigned char *dst, const int w);
+typedef int (*TwtwChromaRowFunc) (const unsigned char *src1, const unsigned char *src2, unsigned char *dstCb, unsigned char *dstCr, const int cw);
+
+static void splitLumaRow_scalar (const unsigned char *src, unsigned char *dst, const int start, const int w)
+{
+    int x;
+    for (x = start; x < w; x++) {
+        // the lowest bits of a mobile camera's luma are practically just noise, and most mobile device LCDs
+        // don't display more than 18-bit (6-bpc) color anyway
+        dst[x] = src[x*2 + 1] >> 2;
+    }
+}
+
+static void splitChromaRow_scalar (const unsigned char *src1, const unsigned char *src2, unsigned char *dstCb, unsigned char *dstCr,
+                                   const int start, const int cw)
+{
+    int x;
+    for (x = start; x < cw; x++) {
+        const unsigned int cb = (src1[x*4] + src2[x*4]) >> 1;
+        const unsigned int cr = (src1[x*4 + 2] + src2[x*4 + 2]) >> 1;
+        dstCb[x] = MIN(31, (cb + 4) >> 3);
+        dstCr[x] = MIN(31, (cr + 4) >> 3);
+    }
+}
+
+#if defined(__SSE2__)
+
+static int splitLumaRow_SSE2 (const unsigned char *src, unsigned char *dst, const int w)
+{
+    int n;
+    for (n = 0; n + 16 <= w; n += 16) {
+        // { Cb, Y0, Cr, Y1 } byte order, so the luma is the high byte of each 16-bit lane
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(src + n*2));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + n*2 + 16));
+        v0 = _mm_srli_epi16(v0, 8 + 2);
+        v1 = _mm_srli_epi16(v1, 8 + 2);
+        _mm_storeu_si128((__m128i *)(dst + n), _mm_packus_epi16(v0, v1));
+    }
+    return n;
+}
+
+static int splitChromaRow_SSE2 (const unsigned char *src1, const unsigned char *src2, unsigned char *dstCb, unsigned char *dstCr, const int cw)
+{
+    const __m128i lowByteMask = _mm_set1_epi16(0x00ff);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i rounding = _mm_set1_epi8(4);
+    int n;
+    for (n = 0; n + 8 <= cw; n += 8) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(src1 + n*4));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(src1 + n*4 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(src2 + n*4));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(src2 + n*4 + 16));
+        
+        // pavgb rounds up, so subtract the lost low bit to get (a + b) >> 1.
+        // the saturating add of the rounding term then does the clamp to 31 after the shift
+        __m128i c0 = _mm_sub_epi8(_mm_avg_epu8(a0, b0), _mm_and_si128(_mm_xor_si128(a0, b0), ones));
+        __m128i c1 = _mm_sub_epi8(_mm_avg_epu8(a1, b1), _mm_and_si128(_mm_xor_si128(a1, b1), ones));
+        c0 = _mm_adds_epu8(c0, rounding);
+        c1 = _mm_adds_epu8(c1, rounding);
+        
+        // drop the luma bytes: { Cb, Cr } pairs for 8 macropixels, then separate Cb and Cr
+        __m128i c = _mm_packus_epi16(_mm_and_si128(c0, lowByteMask), _mm_and_si128(c1, lowByteMask));
+        __m128i cb = _mm_srli_epi16(_mm_and_si128(c, lowByteMask), 3);
+        __m128i cr = _mm_srli_epi16(c, 8 + 3);
+        __m128i cbcr = _mm_packus_epi16(cb, cr);
+        
+        _mm_storel_epi64((__m128i *)(dstCb + n), cbcr);
+        _mm_storel_epi64((__m128i *)(dstCr + n), _mm_srli_si128(cbcr, 8));
+    }
+    return n;
+}
+
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON__)
+
+static int splitLumaRow_NEON (const unsigned char *src, unsigned char *dst, const int w)
+{
+    int n;
+    for (n = 0; n + 16 <= w; n += 16) {
+        // deinterleaves into chroma (val[0]) and luma (val[1])
+        uint8x16x2_t v = vld2q_u8(src + n*2);
+        vst1q_u8(dst + n, vshrq_n_u8(v.val[1], 2));
+    }
+    return n;
+}
+
+static int splitChromaRow_NEON (const unsigned char *src1, const unsigned char *src2, unsigned char *dstCb, unsigned char *dstCr, const int cw)
+{
+    const uint8x8_t rounding = vdup_n_u8(4);
+    int n;
+    for (n = 0; n + 8 <= cw; n += 8) {
+        uint8x8x4_t a = vld4_u8(src1 + n*4);
+        uint8x8x4_t b = vld4_u8(src2 + n*4);
+        
+        // the halving add truncates like (a + b) >> 1; the saturating add does the clamp to 31 after the shift
+        uint8x8_t cb = vshr_n_u8(vqadd_u8(vhadd_u8(a.val[0], b.val[0]), rounding), 3);
+        uint8x8_t cr = vshr_n_u8(vqadd_u8(vhadd_u8(a.val[2], b.val[2]), rounding), 3);
+        vst1_u8(dstCb + n, cb);
+        vst1_u8(dstCr + n, cr);
+    }
+    return n;
+}
+
+#endif  // __ARM_NEON__
+
+
+static gboolean deflateRow (z_stream *zs, unsigned char *data, const size_t dataSize)
+{
+    zs->next_in = data;
+    zs->avail_in = dataSize;
+    // the output buffer is sized with deflateBound(), so this never runs out of space
+    return (Z_OK == deflate(zs, Z_NO_FLUSH) && zs->avail_in == 0);
+}
+
+static gboolean serializeDPCM (TwtwYUVImage *image, unsigned char **outData, size_t *outDataSize)
+{
     const int yw = image->w;
     const int yh = image->h;
-    
     const int cw = yw / 2;
     const int ch = yh / 2;
+    const size_t planarDataSize = (yh * (yw + 1)) + 2 * (ch * (cw + 1));
+    
+    TwtwLumaRowFunc lumaRowFunc = NULL;
+    TwtwChromaRowFunc chromaRowFunc = NULL;
+    const gint32 cpuFeatures = twtw_cpu_features ();
+#if defined(__SSE2__)
+    if (cpuFeatures & TWTW_CPU_SSE2) {
+        lumaRowFunc = splitLumaRow_SSE2;
+        chromaRowFunc = splitChromaRow_SSE2;
+    }
+#endif
+#if defined(__ARM_NEON__)
+    if (cpuFeatures & TWTW_CPU_NEON) {
+        lumaRowFunc = splitLumaRow_NEON;
+        chromaRowFunc = splitChromaRow_NEON;
+    }
+#endif
+    
+    // scratch: two quantized luma rows (current and above), a row of zeros for predicting the first row,
+    // the row being deflated, and the quantized chroma planes
+    unsigned char *scratch = g_malloc0(yw * 3 + (yw + 1) + 2 * (cw * ch));
+    unsigned char *lumaRow = scratch;
+    unsigned char *lumaRowAbove = lumaRow + yw;
+    unsigned char *zeroRow = lumaRowAbove + yw;
+    unsigned char *codedRow = zeroRow + yw;
+    unsigned char *cbPlane = codedRow + (yw + 1);
+    unsigned char *crPlane = cbPlane + (cw * ch);
+    
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (Z_OK != deflateInit(&zs, PHOTO_DEFLATE_LEVEL)) {
+        printf("*** %s: deflateInit failed\n", __func__);
+        g_free(scratch);
+        return FALSE;
+    }
+    const size_t defDataAvailSize = deflateBound(&zs, planarDataSize);
+    unsigned char *defData = g_malloc(defDataAvailSize);
+    zs.next_out = defData;
+    zs.avail_out = defDataAvailSize;
+    
+    gboolean ok = TRUE;
+    int y;
+    
+    // luma rows go straight to deflate; each pair of rows also produces a row of chroma
+    for (y = 0; y < yh && ok; y++) {
+        const unsigned char *src = image->buffer + image->rowBytes*y;
+        const int lumaDone = (lumaRowFunc) ? lumaRowFunc(src, lumaRow, yw) : 0;
+        splitLumaRow_scalar(src, lumaRow, lumaDone, yw);
+        
+        encodeRowDPCM(lumaRow, (y > 0) ? lumaRowAbove : zeroRow, yw, codedRow);
+        ok = deflateRow(&zs, codedRow, yw + 1);
+        
+        unsigned char *t = lumaRowAbove;
+        lumaRowAbove = lumaRow;
+        lumaRow = t;
+        
+        if ((y & 1) == 1 && (y >> 1) < ch) {
+            const unsigned char *srcAbove = src - image->rowBytes;
+            unsigned char *cbRow = cbPlane + cw*(y >> 1);
+            unsigned char *crRow = crPlane + cw*(y >> 1);
+            const int chromaDone = (chromaRowFunc) ? chromaRowFunc(srcAbove, src, cbRow, crRow, cw) : 0;
+            splitChromaRow_scalar(srcAbove, src, cbRow, crRow, chromaDone, cw);
+        }
+    }
+    
+    for (y = 0; y < ch && ok; y++) {
+        encodeRowDPCM(cbPlane + cw*y, (y > 0) ? cbPlane + cw*(y-1) : zeroRow, cw, codedRow);
+        ok = deflateRow(&zs, codedRow, cw + 1);
+    }
+    for (y = 0; y < ch && ok; y++) {
+        encodeRowDPCM(crPlane + cw*y, (y > 0) ? crPlane + cw*(y-1) : zeroRow, cw, codedRow);
+        ok = deflateRow(&zs, codedRow, cw + 1);
+    }
+    
+    ok = ok && (Z_STREAM_END == deflate(&zs, Z_FINISH));
+    const size_t deflatedSize = zs.total_out;
+    deflateEnd(&zs);
+    g_free(scratch);
+    
+    if ( !ok) {
+        printf("*** %s: deflate failed\n", __func__);
+        g_free(defData);
+        return FALSE;
+    }
+    
+    ///printf("deflated planar image: orig data size %i --> compressed %i (%.3f)\n", (int)planarDataSize, (int)deflatedSize, (double)deflatedSize / planarDataSize);
+    
+    *outData = defData;
+    *outDataSize = deflatedSize;
+    return TRUE;
+}
 
-    // chroma data will be truncated
-    const int chromaBits = 5;
-    const int cTruncRowBytes = (chromaBits * cw) / 8;
-    const int cTruncSize = cTruncRowBytes * ch;
 
-    // contains the final plane data
-    size_t planarBufDataSize = (yw * yh) + cTruncSize + cTruncSize;
-    unsigned char *planarBuf = g_malloc(planarBufDataSize);
+/*
+  'twYt' is used for photos larger than the default size. the image is split into tiles that are each compressed
+  as an independent 'twYd' stream, so a view of the photo (or a thumbnail) can be produced by decoding one row of tiles at a time,
+  and parts outside the view don't need to be decoded at all.
+  
+  layout, all little-endian:
+      uint16 tile width, uint16 tile height, uint16 columns, uint16 rows
+      uint32 compressed size of each tile, row by row
+      the compressed tiles in the same order
+      
+  tiles on the right and bottom edges are smaller when the image size isn't a multiple of the tile size.
+*/
+#define TILED_HEADER_SIZE   8
 
-    // separate image into planes
-    unsigned char *yPlane = planarBuf;
-    unsigned char *cbPlane = g_malloc(cw * ch);
-    unsigned char *crPlane = g_malloc(cw * ch);
+// picks the tile size along one axis; a 'twYd' stream must be at least 2 pixels in each direction,
+// so the tile size is adjusted (keeping it even) if the last tile would be a single pixel
+static int tileSizeForExtent (const int extent)
+{
+    int tileSize = TWTW_PHOTO_TILE_SIZE;
+    while (tileSize < extent && (extent % tileSize) == 1)
+        tileSize += 2;
+    return MIN(tileSize, extent);
+}
+
+static gboolean serializeTiled (TwtwYUVImage *image, unsigned char **outData, size_t *outDataSize)
+{
+    const int tileW = tileSizeForExtent(image->w);
+    const int tileH = tileSizeForExtent(image->h);
+    const int cols = (image->w + tileW - 1) / tileW;
+    const int rows = (image->h + tileH - 1) / tileH;
+    const int tileCount = cols * rows;
+    g_return_val_if_fail(cols <= 0xffff && rows <= 0xffff, FALSE);
     
-    // luma plane
-    unsigned int x, y;
-    for (y = 0; y < image->h; y++) {
-        unsigned char * RESTRICT src = image->buffer + image->rowBytes*y;
-        unsigned char * RESTRICT dst = yPlane + yw*y;
-        for (x = 0; x < image->w; x++) {
-            // truncate 2 bits from luma for substantially better compression when data is deflated.
-            // this seems heavy-handed, but most mobile device LCDs don't display more than 18-bit (6-bpc) color,
-            // and in fact images taken on an N800 or mobile phone seem to be so gritty in general that the lowest bits
-            // are practically just noise.
-            // some kind of smoothing algorithm would be nice when displaying these images on a desktop computer, however...
-            unsigned char luma = (src[1] & 0xfc);
-            *dst++ = luma;
-            src += 2;
-        }
+    unsigned char **tileData = g_malloc0(tileCount * sizeof(unsigned char *));
+    size_t *tileSizes = g_malloc0(tileCount * sizeof(size_t));
+    size_t totalSize = TILED_HEADER_SIZE + 4 * tileCount;
+    gboolean ok = TRUE;
+    int i;
+    
+    for (i = 0; i < tileCount && ok; i++) {
+        const int x0 = tileW * (i % cols);
+        const int y0 = tileH * (i / cols);
+        
+        // the tile is a view into the image's buffer
+        TwtwYUVImage tile = *image;
+        tile.w = MIN(tileW, image->w - x0);
+        tile.h = MIN(tileH, image->h - y0);
+        tile.buffer = image->buffer + image->rowBytes*y0 + x0*2;
+        
+        ok = serializeDPCM(&tile, &tileData[i], &tileSizes[i]);
+        totalSize += tileSizes[i];
     }
-    // chroma planes
-    for (y = 0; y < ch; y++) {
-        unsigned char * RESTRICT src1 = image->buffer + image->rowBytes*(y*2);
-        unsigned char * RESTRICT src2 = image->buffer + image->rowBytes*(y*2 + 1);
-        unsigned char * RESTRICT dst_cb = cbPlane + cw*y;
-        unsigned char * RESTRICT dst_cr = crPlane + cw*y;
-        for (x = 0; x < cw; x++) {
-            unsigned int cb1 = src1[0];
-            unsigned int cr1 = src1[2];
-            src1 += 4;
-            unsigned int cb2 = src2[0];
-            unsigned int cr2 = src2[2];
-            src2 += 4;
-            
-            // blend chroma samples from two rows
-            unsigned int cb = (cb1 + cb2) >> 1;
-            unsigned int cr = (cr1 + cr2) >> 1;
-            
-            *dst_cb++ = (cb & 0xff);
-            *dst_cr++ = (cr & 0xff);
+    
+    if (ok) {
+        unsigned char *data = g_malloc(totalSize);
+        unsigned char *d = data + TILED_HEADER_SIZE + 4 * tileCount;
+        *((uint16_t *)(data+0)) = _le_16 ((uint16_t)tileW);
+        *((uint16_t *)(data+2)) = _le_16 ((uint16_t)tileH);
+        *((uint16_t *)(data+4)) = _le_16 ((uint16_t)cols);
+        *((uint16_t *)(data+6)) = _le_16 ((uint16_t)rows);
+        for (i = 0; i < tileCount; i++) {
+            *((uint32_t *)(data + TILED_HEADER_SIZE + 4*i)) = _le_32 ((uint32_t)tileSizes[i]);
+            memcpy(d, tileData[i], tileSizes[i]);
+            d += tileSizes[i];
         }
+        *outData = data;
+        *outDataSize = totalSize;
     }
+    
+    for (i = 0; i < tileCount; i++)
+        g_free(tileData[i]);
+    g_free(tileData);
+    g_free(tileSizes);
+    return ok;
+}
 
-    // truncate chroma data
-    {
-    unsigned char * RESTRICT cbTruncBuf = planarBuf + (yw * yh);
-    unsigned char * RESTRICT crTruncBuf = cbTruncBuf + cTruncSize;
+void twtw_yuv_image_serialize (TwtwYUVImage *image, unsigned char **outData, size_t *outDataSize, uint32_t *outDataFourCC)
+{
+    g_return_if_fail(image);
+    g_return_if_fail(outData);
+    g_return_if_fail(outDataSize);
+    g_return_if_fail(image->w >= 2 && image->h >= 2);
     
-    unsigned int ns = 0, nd = 0;
-    while (nd < cTruncSize) {
-        // this code did 4-bit truncation (2 values -> 1 byte)
-        /*
-        const unsigned int cOffset = 7;
-        unsigned int cb1 = cOffset + cbPlane[ns];   // add an offset to prevent e.g. a value of 127 rounding wrong way
-        unsigned int cb2 = cOffset + cbPlane[ns+1];        
-        unsigned int cr1 = cOffset + crPlane[ns];
-        unsigned int cr2 = cOffset + crPlane[ns+1];
-        ns += 2;
-        
-        unsigned int cbPack = (cb1 & 0xf0) | (cb2 >> 4);
-        unsigned int crPack = (cr1 & 0xf0) | (cr2 >> 4);
-        
-        cbTruncBuf[nd] = (cbPack & 0xff);
-        crTruncBuf[nd] = (crPack & 0xff);
-        nd++;
-        
-        //if (nd < cTruncRowBytes)  printf("%i: cb %x (%u, %u) / cb %x (%u, %u)\n", nd, cbTrunc, cb1, cb2, crTrunc, cr1, cr2);
-        */
-        // this code does 5-bit truncation (8 values -> 5 bytes)
-        const unsigned int cOffset = 4;
-        #define TRUNC(c_)  (((c_) >> 3) & 0x1f)
-        
-        unsigned int cb1 = cOffset + cbPlane[ns];
-        unsigned int cb2 = cOffset + cbPlane[ns+1];
-        unsigned int cb3 = cOffset + cbPlane[ns+2];
-        unsigned int cb4 = cOffset + cbPlane[ns+3];
-        unsigned int cb5 = cOffset + cbPlane[ns+4];
-        unsigned int cb6 = cOffset + cbPlane[ns+5];
-        unsigned int cb7 = cOffset + cbPlane[ns+6];
-        unsigned int cb8 = cOffset + cbPlane[ns+7];
-        
-        unsigned int cr1 = cOffset + crPlane[ns];
-        unsigned int cr2 = cOffset + crPlane[ns+1];
-        unsigned int cr3 = cOffset + crPlane[ns+2];
-        unsigned int cr4 = cOffset + crPlane[ns+3];
-        unsigned int cr5 = cOffset + crPlane[ns+4];
-        unsigned int cr6 = cOffset + crPlane[ns+5];
-        unsigned int cr7 = cOffset + crPlane[ns+6];
-        unsigned int cr8 = cOffset + crPlane[ns+7];
-        ns += 8;
-        
-        cbTruncBuf[nd+0] = (TRUNC(cb1) << 3) | (TRUNC(cb2) >> 2);
-        cbTruncBuf[nd+1] = (TRUNC(cb2) << 6) | (TRUNC(cb3) << 1) | (TRUNC(cb4) >> 4);
-        cbTruncBuf[nd+2] = (TRUNC(cb4) << 4) | (TRUNC(cb5) >> 1);
-        cbTruncBuf[nd+3] = (TRUNC(cb5) << 7) | (TRUNC(cb6) << 2) | (TRUNC(cb7) >> 3);
-        cbTruncBuf[nd+4] = (TRUNC(cb7) << 5) | (TRUNC(cb8));
-
-        crTruncBuf[nd+0] = (TRUNC(cr1) << 3) | (TRUNC(cr2) >> 2);
-        crTruncBuf[nd+1] = (TRUNC(cr2) << 6) | (TRUNC(cr3) << 1) | (TRUNC(cr4) >> 4);
-        crTruncBuf[nd+2] = (TRUNC(cr4) << 4) | (TRUNC(cr5) >> 1);
-        crTruncBuf[nd+3] = (TRUNC(cr5) << 7) | (TRUNC(cr6) << 2) | (TRUNC(cr7) >> 3);
-        crTruncBuf[nd+4] = (TRUNC(cr7) << 5) | (TRUNC(cr8));
-        nd += 5;
-        #undef TRUNC
-    }
-    }
-    
-    size_t defDataAvailSize = planarBufDataSize + 512;
-    unsigned char *defData = g_malloc(defDataAvailSize);
-    size_t deflatedSize = 0;
-    twtw_deflate(planarBuf, planarBufDataSize,  defData, defDataAvailSize,  &deflatedSize);
+    *outData = NULL;
+    *outDataSize = 0;
+    
+    // photos of the default size are small enough to be decoded in one piece
+    const gboolean useTiles = (image->w > TWTW_CAM_IMAGEWIDTH || image->h > TWTW_CAM_IMAGEHEIGHT);
+    gboolean ok;
+    
+    if (useTiles)
+        ok = serializeTiled(image, outData, outDataSize);
+    else
+        ok = serializeDPCM(image, outData, outDataSize);
+    
+    if (ok && outDataFourCC)
+        *outDataFourCC = (useTiles) ? TWTW_CAM_COMPRESSED_TILED_FOURCC : TWTW_CAM_COMPRESSED_DPCM_FOURCC;
+}
 
-    printf("deflated planar image: orig data size %i --> compressed %i (%.3f)\n", planarBufDataSize, deflatedSize, (double)deflatedSize / planarBufDataSize);
 
+// inflated data is read through a small buffer: asking zlib for one row at a time
+// would keep it out of its fast path (which needs 258 bytes of output space) for much of each row
+#define PHOTO_INFLATE_CHUNK_SIZE  8192
 
-    *outData = defData;
-    *outDataSize = deflatedSize;
+typedef struct _TwtwPhotoInflater {
+    z_stream zs;
+    unsigned char *pos;
+    size_t avail;
+    gboolean atEnd;
+    unsigned char buf[PHOTO_INFLATE_CHUNK_SIZE];
+} TwtwPhotoInflater;
 
-    if (outDataFourCC)
-        *outDataFourCC = TWTW_CAM_COMPRESSED_FOURCC;
+static gboolean inflateRow (TwtwPhotoInflater *inf, unsigned char *dst, size_t dstSize)
+{
+    while (dstSize > 0) {
+        if (inf->avail == 0) {
+            if (inf->atEnd)
+                return FALSE;
+            inf->zs.next_out = inf->buf;
+            inf->zs.avail_out = PHOTO_INFLATE_CHUNK_SIZE;
+            int zret = inflate(&inf->zs, Z_NO_FLUSH);
+            if (zret == Z_STREAM_END)
+                inf->atEnd = TRUE;
+            else if (zret != Z_OK)
+                return FALSE;
+            inf->pos = inf->buf;
+            inf->avail = PHOTO_INFLATE_CHUNK_SIZE - inf->zs.avail_out;
+        }
+        const size_t n = MIN(dstSize, inf->avail);
+        memcpy(dst, inf->pos, n);
+        inf->pos += n;
+        inf->avail -= n;
+        dst += n;
+        dstSize -= n;
+    }
+    return TRUE;
+}
 
-    // clean up temp buffers
-    g_free(cbPlane);
-    g_free(crPlane);
-    g_free(planarBuf);
+// decodes 'twYd' straight into the UYVY image: luma rows are placed as they are inflated,
+// and the chroma is filled in once both chroma planes have been read
+static TwtwYUVImage *createYUVImageFromDPCMStream (unsigned char *deflatedData, size_t deflatedDataSize, int w, int h)
+{
+    g_return_val_if_fail (w >= 2 && h >= 2, NULL);
+    
+    const int yw = w;
+    const int yh = h;
+    const int cw = yw / 2;
+    const int ch = yh / 2;
+    
+    // scratch: two luma rows (each with the predictor byte), a row of zeros, and the chroma planes (also with predictor bytes)
+    unsigned char *scratch = g_malloc0(2 * (yw + 1) + yw + 2 * (ch * (cw + 1)));
+    unsigned char *lumaRow = scratch;
+    unsigned char *lumaRowAbove = lumaRow + (yw + 1);
+    unsigned char *zeroRow = lumaRowAbove + (yw + 1);
+    unsigned char *cbPlane = zeroRow + yw;
+    unsigned char *crPlane = cbPlane + (ch * (cw + 1));
+    
+    TwtwPhotoInflater *inf = g_malloc0(sizeof(TwtwPhotoInflater));
+    inf->zs.next_in = deflatedData;
+    inf->zs.avail_in = deflatedDataSize;
+    if (Z_OK != inflateInit(&inf->zs)) {
+        g_free(inf);
+        g_free(scratch);
+        return NULL;
+    }
+    
+    const size_t uyvyRowBytes = w * 2;
+    unsigned char *uyvyBuf = g_malloc(uyvyRowBytes * h);
+    gboolean ok = TRUE;
+    int x, y;
+    
+    for (y = 0; y < yh && ok; y++) {
+        ok = inflateRow(inf, lumaRow, yw + 1)
+          && decodeRowDPCM(lumaRow[0], lumaRow + 1, (y > 0) ? lumaRowAbove + 1 : zeroRow, yw);
+        
+        const unsigned char * RESTRICT src = lumaRow + 1;
+        unsigned char * RESTRICT dst = uyvyBuf + uyvyRowBytes*y;
+        for (x = 0; x < yw; x++) {
+            dst[x*2 + 1] = src[x] << 2;
+        }
+        
+        unsigned char *t = lumaRowAbove;
+        lumaRowAbove = lumaRow;
+        lumaRow = t;
+    }
+    
+    for (y = 0; y < ch && ok; y++) {
+        unsigned char *row = cbPlane + (cw + 1)*y;
+        ok = inflateRow(inf, row, cw + 1)
+          && decodeRowDPCM(row[0], row + 1, (y > 0) ? row - (cw + 1) + 1 : zeroRow, cw);
+    }
+    for (y = 0; y < ch && ok; y++) {
+        unsigned char *row = crPlane + (cw + 1)*y;
+        ok = inflateRow(inf, row, cw + 1)
+          && decodeRowDPCM(row[0], row + 1, (y > 0) ? row - (cw + 1) + 1 : zeroRow, cw);
+    }
+    inflateEnd(&inf->zs);
+    g_free(inf);
+    
+    if ( !ok) {
+        printf("*** %s: corrupt photo data (%i * %i px)\n", __func__, w, h);
+        g_free(uyvyBuf);
+        g_free(scratch);
+        return NULL;
+    }
+    
+    for (y = 0; y < yh; y++) {
+        // the chroma rows were averaged in pairs, so interpolate for the odd rows in between
+        const int cy = MIN(y >> 1, ch - 1);
+        const unsigned char * RESTRICT src_cb = cbPlane + (cw + 1)*cy + 1;
+        const unsigned char * RESTRICT src_cr = crPlane + (cw + 1)*cy + 1;
+        unsigned char * RESTRICT dst = uyvyBuf + uyvyRowBytes*y;
+        
+        if ((y & 1) == 1 && cy < ch - 1) {
+            const unsigned char * RESTRICT src_cb_next = src_cb + (cw + 1);
+            const unsigned char * RESTRICT src_cr_next = src_cr + (cw + 1);
+            for (x = 0; x < cw; x++) {
+                dst[x*4 + 0] = ((src_cb[x] << 3) + (src_cb_next[x] << 3)) >> 1;
+                dst[x*4 + 2] = ((src_cr[x] << 3) + (src_cr_next[x] << 3)) >> 1;
+            }
+        } else {
+            for (x = 0; x < cw; x++) {
+                dst[x*4 + 0] = src_cb[x] << 3;
+                dst[x*4 + 2] = src_cr[x] << 3;
+            }
+        }
+    }
+    g_free(scratch);
+    
+    TwtwYUVImage *image = g_malloc0(sizeof(TwtwYUVImage));
+    image->w = w;
+    image->h = h;
+    image->pixelFormat = TWTW_CAM_FOURCC;
+    image->rowBytes = uyvyRowBytes;
+    image->buffer = uyvyBuf;
+    return image;
 }
 
 
@@ -484,6 +1599,16 @@ TwtwYUVImage *twtw_yuv_image_create_from_serialized (unsigned char *deflatedData
     if ( !deflatedData || deflatedDataSize < 1) return NULL;
     if (w < 1 || h < 1) return NULL;
     
+    if (dataFourCC == TWTW_CAM_COMPRESSED_DPCM_FOURCC)
+        return createYUVImageFromDPCMStream(deflatedData, deflatedDataSize, w, h);
+    
+    if (dataFourCC == TWTW_CAM_COMPRESSED_TILED_FOURCC) {
+        TwtwTiledYUVImage *tiled = twtw_tiled_yuv_image_create_from_serialized (deflatedData, deflatedDataSize, w, h, dataFourCC, origDataSize);
+        TwtwYUVImage *image = (tiled) ? twtw_tiled_yuv_image_create_decoded (tiled) : NULL;
+        twtw_tiled_yuv_image_destroy (tiled);
+        return image;
+    }
+    
     if (dataFourCC != TWTW_CAM_COMPRESSED_FOURCC && dataFourCC != TWTW_CAM_COMPRESSED_4BITCHROMA_FOURCC && dataFourCC != TWTW_CAM_COMPRESSED_8BITCHROMA_FOURCC) {
         char s[5] = "____";
         memcpy(s, (char *)(&dataFourCC), 4);
@@ -719,3 +1844,279 @@ TwtwYUVImage *twtw_yuv_image_create_from_serialized (unsigned char *deflatedData
 }
 
 
+
+
+// --- tiled images ---
+
+struct _TwtwTiledYUVImage {
+    int w;
+    int h;
+    
+    uint32_t dataFourCC;
+    unsigned char *data;
+    size_t dataSize;
+    size_t origDataSize;
+    
+    int tileW;
+    int tileH;
+    int cols;
+    int rows;
+    
+    // offset of each tile's compressed data within 'data'; tileOffsets[cols*rows] is the end of the last tile
+    size_t *tileOffsets;
+};
+
+TwtwTiledYUVImage *twtw_tiled_yuv_image_create_from_serialized (unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC, size_t origDataSize)
+{
+    if ( !data || dataSize < 1) return NULL;
+    if (w < 2 || h < 2) return NULL;
+    
+    int tileW = w, tileH = h, cols = 1, rows = 1;
+    size_t tablePos = 0;
+    
+    if (dataFourCC == TWTW_CAM_COMPRESSED_TILED_FOURCC) {
+        if (dataSize < TILED_HEADER_SIZE) return NULL;
+        tileW = _le_16 (*((uint16_t *)(data+0)));
+        tileH = _le_16 (*((uint16_t *)(data+2)));
+        cols =  _le_16 (*((uint16_t *)(data+4)));
+        rows =  _le_16 (*((uint16_t *)(data+6)));
+        
+        if (tileW < 2 || tileH < 2 || cols != (w + tileW - 1) / tileW || rows != (h + tileH - 1) / tileH
+                    || (w - tileW * (cols - 1)) < 2 || (h - tileH * (rows - 1)) < 2
+                    || dataSize < TILED_HEADER_SIZE + 4 * (size_t)(cols * rows)) {
+            printf("*** %s: invalid tile layout (%i * %i px, tiles %i * %i px, %i * %i)\n", __func__, w, h, tileW, tileH, cols, rows);
+            return NULL;
+        }
+        tablePos = TILED_HEADER_SIZE;
+    }
+    else if (dataFourCC != TWTW_CAM_COMPRESSED_DPCM_FOURCC && dataFourCC != TWTW_CAM_COMPRESSED_FOURCC
+                && dataFourCC != TWTW_CAM_COMPRESSED_4BITCHROMA_FOURCC && dataFourCC != TWTW_CAM_COMPRESSED_8BITCHROMA_FOURCC) {
+        char s[5] = "____";
+        memcpy(s, (char *)(&dataFourCC), 4);
+        printf("*** %s: unsupported fourCC: '%s'\n", __func__, s);
+        return NULL;
+    }
+    
+    const int tileCount = cols * rows;
+    size_t *tileOffsets = g_malloc((tileCount + 1) * sizeof(size_t));
+    int i;
+    
+    if (tablePos == 0) {
+        tileOffsets[0] = 0;
+        tileOffsets[1] = dataSize;
+    } else {
+        // each size is checked against the space left before it's added, so a corrupt table can't wrap the offset around
+        size_t pos = tablePos + 4 * tileCount;
+        for (i = 0; i < tileCount; i++) {
+            const size_t tileSize = _le_32 (*((uint32_t *)(data + tablePos + 4*i)));
+            if (tileSize > dataSize - pos) {
+                printf("*** %s: tile %i extends past end of data (%u bytes at %i / %i)\n", __func__, i, (unsigned int)tileSize, (int)pos, (int)dataSize);
+                g_free(tileOffsets);
+                return NULL;
+            }
+            tileOffsets[i] = pos;
+            pos += tileSize;
+        }
+        tileOffsets[tileCount] = pos;
+    }
+    
+    TwtwTiledYUVImage *image = g_malloc0(sizeof(TwtwTiledYUVImage));
+    image->w = w;
+    image->h = h;
+    image->dataFourCC = dataFourCC;
+    image->data = g_malloc(dataSize);
+    memcpy(image->data, data, dataSize);
+    image->dataSize = dataSize;
+    image->origDataSize = origDataSize;
+    image->tileW = tileW;
+    image->tileH = tileH;
+    image->cols = cols;
+    image->rows = rows;
+    image->tileOffsets = tileOffsets;
+    return image;
+}
+
+void twtw_tiled_yuv_image_destroy (TwtwTiledYUVImage *image)
+{
+    if ( !image) return;
+    
+    g_free(image->data);
+    g_free(image->tileOffsets);
+    g_free(image);
+}
+
+void twtw_tiled_yuv_image_get_size (TwtwTiledYUVImage *image, int *outW, int *outH)
+{
+    g_return_if_fail (image);
+    
+    if (outW) *outW = image->w;
+    if (outH) *outH = image->h;
+}
+
+const unsigned char *twtw_tiled_yuv_image_get_serialized_data (TwtwTiledYUVImage *image, size_t *outDataSize, uint32_t *outDataFourCC, size_t *outOrigDataSize)
+{
+    g_return_val_if_fail (image, NULL);
+    
+    if (outDataSize) *outDataSize = image->dataSize;
+    if (outDataFourCC) *outDataFourCC = image->dataFourCC;
+    if (outOrigDataSize) *outOrigDataSize = image->origDataSize;
+    return image->data;
+}
+
+// returns a new image for the tile, or NULL if the data is corrupt
+static TwtwYUVImage *decodeTile (TwtwTiledYUVImage *image, const int col, const int row)
+{
+    const int index = row * image->cols + col;
+    unsigned char *tileData = image->data + image->tileOffsets[index];
+    const size_t tileDataSize = image->tileOffsets[index + 1] - image->tileOffsets[index];
+    
+    if (image->dataFourCC != TWTW_CAM_COMPRESSED_TILED_FOURCC)
+        return twtw_yuv_image_create_from_serialized (tileData, tileDataSize, image->w, image->h, image->dataFourCC, image->origDataSize);
+    
+    const int tileW = MIN(image->tileW, image->w - image->tileW * col);
+    const int tileH = MIN(image->tileH, image->h - image->tileH * row);
+    return createYUVImageFromDPCMStream(tileData, tileDataSize, tileW, tileH);
+}
+
+// corrupt tiles are shown as mid-grey
+static void fillUYVYGrey (unsigned char *dst, const int w)
+{
+    memset(dst, 128, w * 2);
+}
+
+TwtwYUVImage *twtw_tiled_yuv_image_create_decoded (TwtwTiledYUVImage *image)
+{
+    g_return_val_if_fail (image, NULL);
+    
+    if (image->dataFourCC != TWTW_CAM_COMPRESSED_TILED_FOURCC)
+        return decodeTile(image, 0, 0);
+    
+    const size_t rowBytes = image->w * 2;
+    unsigned char *buf = g_malloc(rowBytes * image->h);
+    int col, row, y;
+    
+    for (row = 0; row < image->rows; row++) {
+        for (col = 0; col < image->cols; col++) {
+            const int x0 = image->tileW * col;
+            const int y0 = image->tileH * row;
+            const int tileW = MIN(image->tileW, image->w - x0);
+            const int tileH = MIN(image->tileH, image->h - y0);
+            TwtwYUVImage *tile = decodeTile(image, col, row);
+            
+            for (y = 0; y < tileH; y++) {
+                unsigned char *dst = buf + rowBytes*(y0 + y) + x0*2;
+                if (tile)
+                    memcpy(dst, tile->buffer + tile->rowBytes*y, tileW*2);
+                else
+                    fillUYVYGrey(dst, tileW);
+            }
+            twtw_yuv_image_destroy(tile);
+        }
+    }
+    
+    TwtwYUVImage *decoded = g_malloc0(sizeof(TwtwYUVImage));
+    decoded->w = image->w;
+    decoded->h = image->h;
+    decoded->pixelFormat = TWTW_CAM_FOURCC;
+    decoded->rowBytes = rowBytes;
+    decoded->buffer = buf;
+    return decoded;
+}
+
+
+// row source for scaled conversion: keeps the tiles of the current tile row that intersect the source area
+typedef struct {
+    TwtwTiledYUVImage *image;
+    int srcX;
+    int srcY;
+    int srcW;
+    int col0;
+    int col1;
+    int tileRow;
+    TwtwYUVImage **tiles;
+    unsigned char *rowBuf;
+} TwtwTileRowSource;
+
+static void releaseTileRow (TwtwTileRowSource *src)
+{
+    int i;
+    for (i = 0; i <= src->col1 - src->col0; i++) {
+        twtw_yuv_image_destroy(src->tiles[i]);
+        src->tiles[i] = NULL;
+    }
+    src->tileRow = -1;
+}
+
+static const unsigned char *getTiledImageRow (void *ctx, const int y)
+{
+    TwtwTileRowSource *src = (TwtwTileRowSource *)ctx;
+    TwtwTiledYUVImage *image = src->image;
+    const int iy = src->srcY + y;
+    const int tileRow = iy / image->tileH;
+    const int ty = iy - tileRow * image->tileH;
+    int col;
+    
+    if (tileRow != src->tileRow) {
+        releaseTileRow(src);
+        for (col = src->col0; col <= src->col1; col++)
+            src->tiles[col - src->col0] = decodeTile(image, col, tileRow);
+        src->tileRow = tileRow;
+    }
+    
+    // when the area is within a single column of tiles, the row can be read straight from the tile
+    if (src->col0 == src->col1 && src->tiles[0]) {
+        TwtwYUVImage *tile = src->tiles[0];
+        return tile->buffer + tile->rowBytes*ty + (src->srcX - src->col0 * image->tileW)*2;
+    }
+    
+    for (col = src->col0; col <= src->col1; col++) {
+        TwtwYUVImage *tile = src->tiles[col - src->col0];
+        const int tileX = col * image->tileW;
+        const int x0 = MAX(tileX, src->srcX);
+        const int x1 = MIN(tileX + image->tileW, src->srcX + src->srcW);
+        unsigned char *dst = src->rowBuf + (x0 - src->srcX)*2;
+        
+        if (tile)
+            memcpy(dst, tile->buffer + tile->rowBytes*ty + (x0 - tileX)*2, (x1 - x0)*2);
+        else
+            fillUYVYGrey(dst, x1 - x0);
+    }
+    return src->rowBuf;
+}
+
+void twtw_tiled_yuv_image_convert_rect_to_rgb_for_display_scaled (TwtwTiledYUVImage *image,
+                                                                  int srcX, int srcY, int srcW, int srcH,
+                                                                  unsigned char *dstBuf, const size_t dstRowBytes,
+                                                                  const gint dstW, const gint dstH,
+                                                                  const gboolean includeAlpha)
+{
+    g_return_if_fail(image);
+    g_return_if_fail(dstBuf);
+    g_return_if_fail(dstW > 0 && dstH > 0);
+    
+    // tiles start at even pixels, and the area must start at a macropixel boundary too
+    srcX = MAX(0, srcX) & ~1;
+    srcY = MAX(0, srcY);
+    srcW = MIN(srcW, image->w - srcX) & ~1;
+    srcH = MIN(srcH, image->h - srcY);
+    g_return_if_fail(srcW >= 2 && srcH >= 1);
+    
+    TwtwTileRowSource src;
+    memset(&src, 0, sizeof(src));
+    src.image = image;
+    src.srcX = srcX;
+    src.srcY = srcY;
+    src.srcW = srcW;
+    src.col0 = srcX / image->tileW;
+    src.col1 = (srcX + srcW - 1) / image->tileW;
+    src.tileRow = -1;
+    src.tiles = g_malloc0((src.col1 - src.col0 + 1) * sizeof(TwtwYUVImage *));
+    src.rowBuf = g_malloc(srcW * 2);
+    
+    convertRowSourceToRGBScaled(getTiledImageRow, &src, srcW, srcH,
+                                dstBuf, dstRowBytes, dstW, dstH, includeAlpha);
+    
+    releaseTileRow(&src);
+    g_free(src.tiles);
+    g_free(src.rowBuf);
+}
@@ -86,6 +86,24 @@ typedef struct _TwtwYUVImage {
 #define TWTW_CAM_COMPRESSED_FOURCC_STR      "twYb"
 #define TWTW_CAM_COMPRESSED_FOURCC          MAKE_FOURCC_LE('t', 'w', 'Y', 'b')
 
+// 'twYd' has the same planes and precision as 'twYb' (6-bit luma, 5-bit chroma), but samples are stored one per byte
+// as residuals from a per-row predictor (as in PNG), which makes them compress much better. this is the format currently written.
+#define TWTW_CAM_COMPRESSED_DPCM_FOURCC_STR      "twYd"
+#define TWTW_CAM_COMPRESSED_DPCM_FOURCC          MAKE_FOURCC_LE('t', 'w', 'Y', 'd')
+
+// 'twYt' is used for photos larger than TWTW_CAM_IMAGEWIDTH * TWTW_CAM_IMAGEHEIGHT.
+// the image is split into tiles that are compressed separately as 'twYd', so they can be decoded independently
+#define TWTW_CAM_COMPRESSED_TILED_FOURCC_STR     "twYt"
+#define TWTW_CAM_COMPRESSED_TILED_FOURCC         MAKE_FOURCC_LE('t', 'w', 'Y', 't')
+
+#define TWTW_PHOTO_TILE_SIZE    256
+
+
+// a photo kept in its serialized form and decoded in tiles as needed (see above for the 'twYt' format).
+// other formats are handled as a single tile that covers the whole image.
+// the object is immutable, so it can be used from several threads at once
+typedef struct _TwtwTiledYUVImage TwtwTiledYUVImage;
+
 
 
 #ifdef __cplusplus
@@ -94,6 +112,10 @@ extern "C" {
 
 void twtw_yuv_image_destroy (TwtwYUVImage *image);
 
+// the display conversion uses lookup tables that are built on first use.
+// call this before converting photos on several threads at once
+void twtw_photo_init_shared_tables ();
+
 TwtwYUVImage *twtw_yuv_image_copy (TwtwYUVImage *image);
 
 // when dstHasAlpha is specified, writes 255 as last element in 32-bit pixel; otherwise writes 24-bit pixels.
@@ -103,14 +125,53 @@ void twtw_yuv_image_convert_to_rgb_for_display (TwtwYUVImage *yuvImage, unsigned
                                                 const gint srcXStride,
                                                 const gint srcYStride);
 
-// for converting RGB / RGBA data (this is not used by the Maemo version, which acquires YUV images directly from the camera)
+// converts and scales the image to an arbitrary size with bilinear filtering in a single pass (no intermediate bitmap is allocated).
+// the output is identical to what the above function produces at native size
+void twtw_yuv_image_convert_to_rgb_for_display_scaled (TwtwYUVImage *yuvImage, unsigned char *dstBuf, const size_t dstRowBytes,
+                                                       const gint dstW, const gint dstH,
+                                                       const gboolean dstHasAlpha);
+
+// for converting RGB / RGBA data (this is not used by the Maemo version, which acquires YUV images directly from the camera).
+// the source can be any size: it's cropped to the destination aspect ratio (centered) and scaled in the same pass.
+// with areaAverage, each destination pixel is the average of the source pixels it covers, which is the right thing
+// for downscaling large camera images; otherwise the nearest source pixel is used. dstW must be even
+TwtwYUVImage *twtw_yuv_image_create_from_rgb (const unsigned char *srcBuf, const size_t srcRowBytes, const gboolean srcHasAlpha,
+                                              const gint srcW, const gint srcH,
+                                              const gint dstW, const gint dstH,
+                                              const gboolean areaAverage);
+
+// source must be TWTW_CAM_IMAGEWIDTH * TWTW_CAM_IMAGEHEIGHT
 TwtwYUVImage *twtw_yuv_image_create_from_rgb_with_default_size (unsigned char *srcBuf, const size_t srcRowBytes, const gboolean srcHasAlpha);
 
-// on-disk format for photos
+// on-disk format for photos.
+// serializing writes 'twYd' and streams the planes through zlib, so only the quarter-size chroma planes are buffered;
+// all the formats listed above can be read
 void twtw_yuv_image_serialize (TwtwYUVImage *image, unsigned char **outData, size_t *outDataSize, uint32_t *outDataFourCC);
 
 TwtwYUVImage *twtw_yuv_image_create_from_serialized (unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC, size_t origDataSize);
 
+// --- tiled images ---
+
+// the data is copied; returns NULL if the format is unknown or the tile table is invalid
+TwtwTiledYUVImage *twtw_tiled_yuv_image_create_from_serialized (unsigned char *data, size_t dataSize, int w, int h, uint32_t dataFourCC, size_t origDataSize);
+void twtw_tiled_yuv_image_destroy (TwtwTiledYUVImage *image);
+
+void twtw_tiled_yuv_image_get_size (TwtwTiledYUVImage *image, int *outW, int *outH);
+
+// returns the data the image was created from, so it can be written out again without recompressing. owned by the image
+const unsigned char *twtw_tiled_yuv_image_get_serialized_data (TwtwTiledYUVImage *image, size_t *outDataSize, uint32_t *outDataFourCC, size_t *outOrigDataSize);
+
+// decodes all tiles into a new image
+TwtwYUVImage *twtw_tiled_yuv_image_create_decoded (TwtwTiledYUVImage *image);
+
+// converts the given source area into the destination size with the same filtering as twtw_yuv_image_convert_to_rgb_for_display_scaled().
+// only the tiles that intersect the area are decoded, and only one row of tiles is kept in memory at a time
+void twtw_tiled_yuv_image_convert_rect_to_rgb_for_display_scaled (TwtwTiledYUVImage *image,
+                                                                  int srcX, int srcY, int srcW, int srcH,
+                                                                  unsigned char *dstBuf, const size_t dstRowBytes,
+                                                                  const gint dstW, const gint dstH,
+                                                                  const gboolean dstHasAlpha);
+
 #ifdef __cplusplus
 }
 #endif